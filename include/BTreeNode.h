@@ -29,6 +29,8 @@ public:
 
     BlockID get_id() const { return this->id; }
 
+    uint32_t key_size(const KeyValue *key) const;
+
 protected:
     SlottedPage *block;
     HeapFile &file;
@@ -83,8 +85,14 @@ public:
 
     BTreeNode *find(const KeyValue *key, uint depth) const;
 
+    BlockID find_id(const KeyValue *key) const;
+
     Insertion insert(const KeyValue *boundary, BlockID block_id);
 
+    bool has_room(uint32_t boundary_size) const;
+
+    uint32_t largest_key() const;
+
     virtual void save();
 
     void set_first(BlockID first) { this->first = first; }
@@ -106,6 +114,12 @@ public:
     Handle find_eq(const KeyValue *key) const;  // throws if not found
     Insertion insert(const KeyValue *key, Handle handle);
 
+    void del(const KeyValue *key, Handle handle);
+
+    bool has_room(const KeyValue *key) const;
+
+    uint32_t largest_key() const;
+
     virtual void save();
 
 protected:
@@ -0,0 +1,70 @@
+/**
+ * @file Batch.h - Runs SQL script files without anyone at the keyboard.
+ * Batch
+ *
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * @class Batch - runs SQL scripts, each in a session of its own on a thread of its own, and times them
+ *
+ * A script has what would be typed at the REPL, a statement (or transaction control, "set" option,
+ * and so on) to a line. A statement can go on over several lines as long as it has a parenthesis or
+ * quote still open. Blank lines and lines starting with "--" are skipped.
+ *
+ * Statements aren't echoed and their rows aren't printed. Instead each statement gets a line with
+ * where it is in its script, how long it took (wall clock and CPU), and the last line of what the REPL
+ * would have printed (its row count, say, or its error). After all the scripts are done, there is a
+ * summary for each script and for the whole run.
+ *
+ * The scripts' sessions run their statements in parallel like the server's do (see Session), so
+ * scripts can load different tables at once or contend for the same ones.
+ */
+class Batch {
+public:
+    /**
+     * @param paths  the scripts
+     * @param out    where to write the timings
+     */
+    Batch(const std::vector<std::string> &paths, std::ostream &out);
+
+    virtual ~Batch() {}
+
+    Batch(const Batch &other) = delete;
+
+    Batch &operator=(const Batch &other) = delete;
+
+    bool run();
+
+protected:
+    /**
+     * What happened when one script ran.
+     */
+    struct Script {
+        std::string path;
+        bool opened;
+        uint64_t statements;
+        uint64_t errors;
+        double wall_s;
+        double cpu_s;
+        double slowest_ms;
+        uint32_t slowest_line;
+    };
+
+    std::vector<Script> scripts;
+    std::ostream &out;
+    std::mutex out_mutex;  // the scripts' threads take turns writing their lines
+
+    void run_script(Script &script);
+
+    void report(const Script &script, uint32_t line, double wall_ms, double cpu_ms, const std::string &result);
+
+    static bool is_complete(const std::string &text);
+};
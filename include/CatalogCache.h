@@ -0,0 +1,128 @@
+/**
+ * @file CatalogCache.h - Read-mostly cache of the relations and indices instantiated so far.
+ * CatalogCache<K, T>
+ *
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include "Rcu.h"
+
+/**
+ * @class CatalogCache - map from names to objects we have instantiated for them, which it owns
+ *
+ * Lookups take no locks, so any number of threads can resolve names at once. The map they look in is
+ * never changed once published: a writer (one at a time) copies it, changes the copy, and swaps the
+ * copy in through an atomic pointer. The old map, and any object taken out of the cache, is retired
+ * and deleted once no lookup can still be using it (see Rcu). Holding on to an object after the
+ * lookup is up to the caller, as before: it is good until it is removed from the cache.
+ */
+template<typename K, typename T>
+class CatalogCache {
+public:
+    typedef std::map<K, T *> Map;
+
+    CatalogCache() : current(new Map()), writer() {}
+
+    virtual ~CatalogCache() {
+        delete this->current.load();  // at exit; whatever is still cached lives as long as the program
+    }
+
+    CatalogCache(const CatalogCache &other) = delete;
+
+    CatalogCache &operator=(const CatalogCache &other) = delete;
+
+    /**
+     * Look up an object.
+     * @param key  name to look for
+     * @return     the object, or nullptr if there isn't one
+     */
+    T *find(const K &key) const {
+        Rcu::ReadSection section;
+        const Map *map = this->current.load();
+        auto hit = map->find(key);
+        return hit == map->end() ? nullptr : hit->second;
+    }
+
+    /**
+     * Add an object, unless another thread has added one for the same name first.
+     * @param key    its name
+     * @param value  the object (the cache owns it from here on)
+     * @return       the cached object, which is value unless somebody else got there first (in which
+     *               case value is deleted)
+     */
+    T *insert(const K &key, T *value) {
+        std::lock_guard<std::mutex> lock(this->writer);
+        const Map *old = this->current.load();
+        auto hit = old->find(key);
+        if (hit != old->end()) {
+            if (hit->second != value)
+                delete value;
+            return hit->second;
+        }
+        Map *copy = new Map(*old);
+        (*copy)[key] = value;
+        publish(copy, old);
+        return value;
+    }
+
+    /**
+     * Put an object in the cache whether or not there is one for that name already. The one it
+     * replaces is left alone (this is for objects that belong to somebody else, like the schema tables).
+     * @param key    its name
+     * @param value  the object
+     */
+    void replace(const K &key, T *value) {
+        std::lock_guard<std::mutex> lock(this->writer);
+        const Map *old = this->current.load();
+        Map *copy = new Map(*old);
+        (*copy)[key] = value;
+        publish(copy, old);
+    }
+
+    /**
+     * Remove an object (if it is there) and delete it once nobody can be looking it up.
+     * @param key  its name
+     */
+    void erase(const K &key) {
+        erase_if([&key](const K &k) { return k == key; });
+    }
+
+    /**
+     * Remove every object whose name passes a test, deleting them once nobody can be looking them up.
+     * @param doomed  test for the names to remove
+     */
+    template<typename Pred>
+    void erase_if(Pred doomed) {
+        std::lock_guard<std::mutex> lock(this->writer);
+        const Map *old = this->current.load();
+        Map *copy = new Map();
+        Map *gone = new Map();
+        for (auto &entry: *old)
+            (doomed(entry.first) ? gone : copy)->insert(entry);
+        if (gone->empty()) {
+            delete copy;
+            delete gone;
+            return;
+        }
+        publish(copy, old);
+        Rcu::retire([gone]() {
+            for (auto &entry: *gone)
+                delete entry.second;
+            delete gone;
+        });
+    }
+
+protected:
+    std::atomic<const Map *> current;
+    std::mutex writer;  // one writer at a time
+
+    // swap in the new map and retire the old one (writer must be locked)
+    void publish(Map *copy, const Map *old) {
+        this->current.store(copy);
+        Rcu::retire([old]() { delete old; });
+    }
+};
@@ -0,0 +1,141 @@
+/**
+ * @file DirectFile.h - Direct I/O alternative to HeapFile.
+ * DirectFile: HeapFile
+ * DirectFileScan: HeapFileScan
+ *
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include <list>
+#include <unordered_map>
+#include "HeapFile.h"
+
+
+/**
+ * @class DirectFile - DbFile kept in a flat file read and written with O_DIRECT
+ *
+ * Same interface as HeapFile (so HeapTable can use either one), but the blocks live in a plain file
+ * (<name>.direct in the database environment directory) that is opened with O_DIRECT, so reads and
+ * writes go straight between the disk and our own buffers without a second copy in the operating
+ * system's page cache. Block n is at byte offset n * block_size; block 0 is a file header holding a
+ * magic number and the block size.
+ *
+ * The file keeps its own cache of up to cache_blocks recently used blocks, each in a buffer aligned
+ * to ALIGNMENT bytes (as O_DIRECT requires). The SlottedPages handed out by get() wrap the cached
+ * buffers, so (unlike those of HeapFile) a block is only good until a few more blocks have been read.
+ * put() just marks the cached block dirty; dirty blocks are written to the file when they are
+ * evicted from the cache or when the file is flushed (see HeapFile). A block's checksum is checked
+ * (per verify_mode) when it is read from the file, not when it is found in the cache.
+ *
+ * Blocks must be at least ALIGNMENT bytes. If the file system does not support O_DIRECT
+ * (e.g., tmpfs), the file is opened without it and the operating system caches it as usual.
+ */
+class DirectFile : public HeapFile {
+public:
+    /**
+     * Alignment of our buffers and smallest block size we can use
+     */
+    static const uint32_t ALIGNMENT = 4096;
+
+    /**
+     * How many blocks each open file keeps in its cache.
+     */
+    static uint32_t cache_blocks;
+
+    DirectFile(std::string name, uint32_t block_size = DbBlock::BLOCK_SZ);
+
+    virtual ~DirectFile();
+
+    DirectFile(const DirectFile &other) = delete;
+
+    DirectFile(DirectFile &&temp) = delete;
+
+    DirectFile &operator=(const DirectFile &other) = delete;
+
+    DirectFile &operator=(DirectFile &&temp) = delete;
+
+    virtual void create(void);
+
+    virtual void drop(void);
+
+    virtual void open(void);
+
+    virtual void close(void);
+
+    virtual SlottedPage *get_new(void);
+
+    virtual SlottedPage *get(BlockID block_id);
+
+    virtual void put(DbBlock *block);
+
+    virtual HeapFileScan *scan();
+
+    virtual void flush();
+
+protected:
+    static const uint32_t MAGIC = 0x44495245;  // "DIRE"
+    static const uint32_t MIN_CACHE_BLOCKS = 4;  // callers may hold on to a couple of blocks at a time
+
+    /**
+     * A cached block: its buffer and where it is in the least-recently-used list
+     */
+    struct Frame {
+        char *data;
+        std::list<BlockID>::iterator use;
+    };
+
+    std::string path;
+    int fd;
+    std::list<BlockID> lru;  // cached block ids, most recently used first
+    std::unordered_map<BlockID, Frame> cache;
+    std::set<BlockID> written;  // cached blocks that are newer than the file
+
+    virtual void discard();
+
+    virtual void open_fd(int flags);
+
+    virtual char *cached(BlockID block_id);
+
+    virtual char *install(BlockID block_id);
+
+    virtual void uncache(BlockID block_id);
+
+    virtual void read_blocks(BlockID block_id, uint32_t count, char *buffer);
+
+    virtual void write_block(BlockID block_id, const char *buffer);
+
+    static char *allocate(uint64_t size);
+
+    friend class DirectFileScan;
+};
+
+
+/**
+ * @class DirectFileScan - walk through all the blocks of a DirectFile in order
+ *
+ * Reads runs of RUN_BLOCKS blocks at a time with one request each into its own buffer, leaving the
+ * file's cache alone (blocks that are already cached are copied from there instead, since they are
+ * at least as new). The blocks handed out by next() are only good until the next call to next().
+ */
+class DirectFileScan : public HeapFileScan {
+public:
+    /**
+     * Most blocks read with one request
+     */
+    static const uint32_t RUN_BLOCKS = 64;
+
+    DirectFileScan(DirectFile &file);
+
+    virtual ~DirectFileScan();
+
+    virtual SlottedPage *next();
+
+protected:
+    DirectFile &direct_file;
+    BlockID block_id;  // last block handed out
+    BlockID first;     // first block in run
+    uint32_t count;    // number of blocks in run
+    uint32_t size;     // number of blocks run has room for
+    char *run;
+};
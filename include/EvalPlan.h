@@ -6,10 +6,27 @@
  */
 #pragma once
 
+#include <string>
 #include "storage_engine.h"
+#include "RowSink.h"
 
 
 typedef std::pair<DbRelation *, Handles *> EvalPipeline;
+typedef std::map<Identifier, size_t> EvalParameters;  // column name -> number of the parameter it is compared with
+typedef std::function<void(DbRelation &, Handle)> EvalVisitor;  // called with each row a pipeline selects
+
+/**
+ * What an operator of an EvalPlan did while it was analyzed (see EvalPlan::analyze). Each is the
+ * operator's own share, not counting the operators under it.
+ */
+struct EvalStats {
+    uint64_t rows;         // handed to the operator above (or, at the top, to the sink)
+    uint64_t time_ns;      // spent doing its own work
+    uint64_t blocks_read;  // from Berkeley DB or the disk (see PerfCounters)
+    uint64_t block_hits;   // found in memory
+    size_t memory;         // most bytes it held at once (handles it collected, the row it was projecting)
+    bool ran;              // did it run at all (or was it folded into the operator above)?
+};
 
 class EvalPlan {
 public:
@@ -19,7 +36,7 @@ public:
 
     EvalPlan(PlanType type, EvalPlan *relation);  // use for ProjectAll, e.g., EvalPlan(EvalPlan::ProjectAll, table);
     EvalPlan(ColumnNames *projection, EvalPlan *relation); // use for Project
-    EvalPlan(ValueDict *conjunction, EvalPlan *relation);  // use for Select
+    EvalPlan(ValueDict *conjunction, EvalPlan *relation, EvalParameters *parameters = nullptr);  // use for Select
     EvalPlan(DbRelation &table);  // use for TableScan
     EvalPlan(const EvalPlan *other);  // use for copying
     virtual ~EvalPlan();
@@ -32,11 +49,41 @@ public:
 
     EvalPipeline pipeline();
 
+    // Evaluate the plan a row at a time: evaluate hands each row's values to the sink as soon as it is
+    // found, pipeline hands over each row's handle
+    void evaluate(RowSink &sink);
+
+    void pipeline(const EvalVisitor &visit);
+
+    // A copy with the parameters of its selections filled in (for prepared statements)
+    EvalPlan *bind(const std::vector<Value> &arguments) const;
+
+    // EXPLAIN: how many rows each operator is expected to produce (worked out once, by estimate, while
+    // the statement's transaction is still going), and the plan as text, an operator to a line; with
+    // analyze, each operator (whatever its type) counts what it does as it runs
+    void estimate();
+
+    void analyze();
+
+    std::string explain() const;
+
 protected:
+    class Charge;
+
 
     PlanType type;
     EvalPlan *relation;  // for everything except TableScan
     ColumnNames *projection;  // for Project
     ValueDict *select_conjunction;  // for Select
+    EvalParameters *select_parameters;  // for Select: the columns whose values in select_conjunction come from arguments
     DbRelation &table;  // for TableScan
+    bool analyzing;  // counting into stats?
+    EvalStats stats;
+    uint64_t estimated;  // rows expected (see estimate), or NOT_ESTIMATED
+
+    static const uint64_t NOT_ESTIMATED = UINT64_MAX;
+
+    EvalStats total() const;
+
+    void explain(std::string &text, int depth, bool folded) const;
 };
\ No newline at end of file
@@ -7,9 +7,14 @@
  */
 #pragma once
 
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
 #include "db_cxx.h"
 #include "SlottedPage.h"
 
+class HeapFileScan;
 
 /**
  * @class HeapFile - heap file implementation of DbFile
@@ -18,12 +23,34 @@
         database blocks for each Berkeley DB record in the RecNo file. In this way we are using Berkeley DB
         for buffer management and file management.
         Uses SlottedPage for storing records within blocks.
+        The block size is fixed when the file is created (it is the RecNo record length); opening
+        an existing file picks up whatever size it was created with.
+        Every block written gets a checksum, which is checked when the block is read back according
+        to verify_mode.
+        Blocks written with put() (and new blocks from get_new()) are kept in memory as dirty blocks
+        and written back to Berkeley DB together by flush(), so repeated writes of the same block only
+        cost one Berkeley DB put. Dirty blocks belong to the thread that wrote them (and so to its
+        transaction): nobody else sees them, and flushing writes back only the thread's own. Files are
+        flushed at the end of each statement (see flush_all), before a scan, when closed, and whenever
+        a thread has more than write_back blocks of a file dirty. A block handed out by
+        get() or get_new() is the caller's own copy, good for as long as the caller keeps it, whatever
+        happens to the file meanwhile (flushes included); changes to it only reach the file through put().
+        All reads and writes are done in the current transaction, _DB_TXN (see Transaction). Files are
+        opened multiversion, so a snapshot transaction reads the blocks as they were when it started.
+        An existing file's handle is opened in a transaction of its own, so it stays good whatever
+        happens to the transaction that needed it. A file created in a transaction (and only visible
+        there until it commits) is opened in that transaction instead; if it is aborted, the handle goes
+        with it (see aborted).
+        Any number of threads may read a file at once (the Berkeley DB handle is free-threaded), but
+        only one transaction at a time may write to it (see HeapTable), since blocks are added at the
+        end: a block added by one transaction reads as empty to the others until they can see it.
+        The latch is only for opening and closing the file, and for verified.
  */
 class HeapFile : public DbFile {
 public:
-    HeapFile(std::string name);
+    HeapFile(std::string name, uint32_t block_size = DbBlock::BLOCK_SZ);
 
-    virtual ~HeapFile() {}
+    virtual ~HeapFile();
 
     HeapFile(const HeapFile &other) = delete;
 
@@ -49,21 +76,139 @@ public:
 
     virtual BlockIDs *block_ids() const;
 
+    virtual HeapFileScan *scan();
+
+    virtual void flush();
+
+    static void flush_all();
+
+    static void discard_all();
+
+    static void committed(DbTxn *txn, DbTxn *parent);
+
+    static void aborted(DbTxn *txn, DbTxn *parent);
+
+    /**
+     * How many times this thread has written to a Berkeley DB file (put a block, added one, or dropped
+     * a file), so a statement can tell whether it has changed anything.
+     * @return  the count so far
+     */
+    static uint64_t changes() { return changed; }
+
     /**
      * Get the id of the current final block in the heap file.
      * @return block id of last block
      */
     virtual uint32_t get_last_block_id() { return last; }
 
+    /**
+     * Get the size of the blocks in this file.
+     * @return block size in bytes
+     */
+    virtual uint32_t get_block_size() const { return block_size; }
+
+    /**
+     * Check that a requested block size is one we can use.
+     * @param block_size  candidate block size in bytes
+     * @return            true if it is a power of two between DbBlock::MIN_BLOCK_SZ and DbBlock::MAX_BLOCK_SZ
+     */
+    static bool is_valid_block_size(uint32_t block_size);
+
+    /**
+     * When to check a block's checksum as it is read:
+     *   VERIFY_NEVER   don't check
+     *   VERIFY_ALWAYS  check on every read
+     *   VERIFY_ONCE    check the first time each block is read after the file is opened
+     */
+    enum VerifyMode {
+        VERIFY_NEVER, VERIFY_ALWAYS, VERIFY_ONCE
+    };
+    static VerifyMode verify_mode;
+
+    /**
+     * How many dirty blocks a file may hold before they are all written back (0 to write every block
+     * through as it is put).
+     */
+    static uint32_t write_back;
+
 protected:
+    typedef std::map<BlockID, char *> Blocks;  // in block order
+
+    static thread_local std::map<HeapFile *, Blocks> dirty;  // this thread's blocks written since the last flush
+    static thread_local std::set<HeapFile *> dirty_files;    // files this thread may have blocks to write back to
+    static std::set<HeapFile *> open_files;   // Berkeley DB files that are open
+    static std::map<std::string, DbTxn *> new_files;  // created by transactions not committed yet, by file name
+    static std::mutex registry_mutex;         // guards open_files and new_files
+    static thread_local uint64_t changed;     // see changes
+
     std::string dbfilename;
-    uint32_t last;
-    bool closed;
-    Db db;
+    uint32_t block_size;
+    std::atomic<uint32_t> last;
+    std::atomic<bool> closed;
+    Db *db;  // open Berkeley DB handle (nullptr while closed)
+    std::atomic<DbTxn *> opened_in;   // uncommitted transaction the handle was opened in (nullptr if opened on its own)
+    std::atomic<DbTxn *> written_in;  // uncommitted transaction that has written to the file, if any
+    std::vector<bool> verified;  // blocks known to be intact since the file was opened (for VERIFY_ONCE)
+    std::recursive_mutex latch;  // one thread at a time in open, close, and verified
 
     virtual void db_open(uint flags = 0);
 
     virtual uint32_t get_block_count();
+
+    virtual void verify(SlottedPage *page);
+
+    void mark_verified(BlockID block_id);
+
+    void mark_dirty();
+
+    void mark_clean();
+
+    void unregister();
+
+    virtual void discard();
+
+    friend class HeapFileScan;
+};
+
+
+/**
+ * @class HeapFileScan - walk through all the blocks of a HeapFile in order
+ *
+ * Uses a Berkeley DB cursor with bulk retrieval (DB_MULTIPLE_KEY), so each trip into Berkeley DB
+ * brings back as many blocks as fit in the scan's buffer instead of looking up one block at a time.
+ * The blocks handed out by next() point into that buffer, so they are only good until the next call
+ * to next(), and changes to them are not written back.
+ */
+class HeapFileScan {
+public:
+    /**
+     * Minimum size of the bulk retrieval buffer (it is bigger if needed to hold several blocks).
+     */
+    static const uint32_t BULK_SZ = 1024 * 1024;
+
+    HeapFileScan(HeapFile &file);
+
+    virtual ~HeapFileScan();
+
+    HeapFileScan(const HeapFileScan &other) = delete;
+
+    HeapFileScan(HeapFileScan &&temp) = delete;
+
+    HeapFileScan &operator=(const HeapFileScan &other) = delete;
+
+    HeapFileScan &operator=(HeapFileScan &&temp) = delete;
+
+    virtual SlottedPage *next();
+
+protected:
+    HeapFile &file;
+    Dbc *cursor;
+    char *buffer;
+    Dbt bulk;
+    DbMultipleRecnoDataIterator *batch;
+    bool done;
+
+    virtual void start();
 };
 
 
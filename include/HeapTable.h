@@ -7,19 +7,40 @@
  */
 #pragma once
 
+#include <atomic>
 #include "storage_engine.h"
 #include "SlottedPage.h"
 #include "HeapFile.h"
+#include "MmapFile.h"
+#include "DirectFile.h"
 
 /**
  * @class HeapTable - Heap storage engine (implementation of DbRelation)
+ *
+ * Each table picks its block size when it is created (see HeapFile), and where its blocks are kept:
+ * in a Berkeley DB file ("heap", see HeapFile), in a memory-mapped flat file ("mmap", see MmapFile), or in a
+ * flat file read and written with direct I/O ("direct", see DirectFile).
+ *
+ * Rows are updated in place when they still fit in their block. Otherwise the row is moved to
+ * another block and a small forwarding stub is left behind, so the row's Handle never changes.
+ *
+ * TEXT values longer than a quarter of a block are stored out-of-line in a chain of overflow pages
+ * kept in a second file (<table_name>.overflow, kept the same way as the table's blocks). The row
+ * itself just holds a small reference to the chain, which is only followed when a projection asks
+ * for that column. A chain that is no longer referred to (its row was deleted, or its value updated)
+ * goes on the overflow file's free list, which is kept in the file's first block, and its pages are
+ * used again for later chains.
+ *
+ * Any number of transactions may read a Berkeley DB table at once, but only one at a time changes it
+ * (see lock_to_write), and memory-mapped and direct tables are used by one transaction at a time.
  */
 
 class HeapTable : public DbRelation {
 public:
-    HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes);
+    HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes,
+              uint32_t block_size = DbBlock::BLOCK_SZ, const std::string &storage = "heap");
 
-    virtual ~HeapTable() {}
+    virtual ~HeapTable();
 
     HeapTable(const HeapTable &other) = delete;
 
@@ -51,26 +72,138 @@ public:
 
     virtual Handles* select(Handles *current_selection, const ValueDict* where);
 
+    virtual void select(const ValueDict *where, const HandleVisitor &visit);
+
+    virtual uint64_t estimate_rows();
+
     virtual ValueDict *project(Handle handle);
 
     virtual ValueDict *project(Handle handle, const ColumnNames *column_names);
 
     using DbRelation::project;
 
+    /**
+     * Get the block size this table was created with.
+     * @return block size in bytes
+     */
+    virtual uint32_t get_block_size() const { return file->get_block_size(); }
+
+    /**
+     * Only Berkeley DB files take part in transactions; memory-mapped and direct-I/O files are
+     * changed in place.
+     * @return true if the table is stored in Berkeley DB
+     */
+    virtual bool is_transactional() const { return storage == "heap"; }
+
+    /**
+     * Check that a requested storage kind is one we have.
+     * @param storage  candidate storage kind
+     * @return         true if it is "heap", "mmap", or "direct"
+     */
+    static bool is_valid_storage(const std::string &storage) {
+        return storage == "heap" || storage == "mmap" || storage == "direct";
+    }
+
+    /**
+     * TEXT values longer than this many bytes are moved out of the row into overflow pages
+     */
+    virtual uint overflow_threshold() const { return get_block_size() / 4; }
+
+    /**
+     * How many times a table has been written to, created, or dropped, for caches of what was read from
+     * it (see ResultCache). Versions are never reset, so a table dropped and created again carries on
+     * from where it left off.
+     * @param table_name  the table
+     * @return            its version
+     */
+    static std::atomic<uint64_t> &version(const Identifier &table_name);
+
 protected:
-    HeapFile file;
+    /**
+     * Length prefix that marks a TEXT value as a reference to an overflow chain
+     */
+    static const u_int16_t OVERFLOW_MARKER = UINT16_MAX;
+
+    /**
+     * Bytes of a TEXT value stored in each overflow page (leaves room for page headers and the chain pointer)
+     */
+    virtual uint overflow_chunk() const { return get_block_size() - 64; }
+
+    HeapFile *file;
+    HeapFile *overflow;  // same kind of file as the table's
+    std::string storage;  // see is_valid_storage
+    std::atomic<uint64_t> &writes;  // version(table_name)
+
+    virtual void lock_to_read();
+
+    virtual void lock_to_write();
 
     virtual ValueDict *validate(const ValueDict *row) const;
 
     virtual Handle append(const ValueDict *row);
 
-    virtual Dbt *marshal(const ValueDict *row) const;
+    virtual Handle append(const Dbt *data, uint32_t flags = 0);
+
+    // first page of each overflow chain a row refers to, by column
+    typedef std::map<Identifier, BlockID> OverflowChains;
+
+    virtual Dbt *marshal(const ValueDict *row, const OverflowChains *keep = nullptr);
+
+    virtual ValueDict *unmarshal(Dbt *data, const ColumnNames *column_names = nullptr);
+
+    /**
+     * The block of the overflow file that holds the head of its free list (HeapFile::create makes it,
+     * and chains never use it)
+     */
+    static const BlockID OVERFLOW_FREE_LIST = 1;
+
+    virtual void open_overflow();
+
+    virtual BlockID put_overflow(const std::string &text);
+
+    virtual std::string get_overflow(BlockID block_id, uint32_t length);
 
-    virtual ValueDict *unmarshal(Dbt *data) const;
+    virtual void free_overflow(BlockID block_id);
+
+    virtual OverflowChains overflow_chains(const Dbt *data) const;
+
+    virtual OverflowChains overflow_chains(Handle handle);
+
+    virtual SlottedPage *new_overflow_page();
+
+    virtual BlockID get_overflow_free_list();
+
+    virtual void set_overflow_free_list(BlockID head);
 
     virtual bool selected(Handle handle, const ValueDict *where);
+
+    virtual bool selected(Dbt *data, const ValueDict *where);
+
+    static Dbt *marshal_handle(Handle handle);
+
+    static Handle unmarshal_handle(const Dbt *data);
+
+    friend class OverflowWritten;
+
+    friend bool test_heap_storage();
+
+    friend bool benchmark_bulk_scan();
+
+bool benchmark_write_back();
 };
 
 bool test_heap_storage();
 
+bool benchmark_block_size();
+
+bool benchmark_mmap();
+
+bool benchmark_direct();
+
+bool benchmark_bulk_scan();
+
+bool benchmark_write_back();
+
+bool benchmark_storage();
+
 
@@ -0,0 +1,151 @@
+/**
+ * @file LockManager.h - Table, page, record, and index key locks held by transactions.
+ * LockManager
+ * DeadlockError
+ *
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include "storage_engine.h"
+
+/**
+ * @class DeadlockError - the lock asked for would have closed a cycle of transactions waiting for each other
+ */
+class DeadlockError : public DbRelationError {
+public:
+    explicit DeadlockError(std::string s) : DbRelationError(s) {}
+};
+
+/**
+ * @class LockManager - locks taken by the transaction in progress and held until it ends
+ *
+ * Locks are hierarchical: a table contains pages, which contain records. Locking a record (or page)
+ * first takes an intent lock on what contains it (IS to read, IX to write), so a transaction that
+ * wants the whole table only has to look at the table's lock to see whether anyone is working inside
+ * it. A lock on something already covered by a lock on its container (a record in a table locked S or
+ * X, say) isn't taken at all. Index entries are locked by a hash of their key, under the index.
+ *
+ * Locks belong to the transaction (see Transaction::lock_owner) and are all released when it commits
+ * or rolls back. Outside of any transaction (building the schema tables, the tests), nothing is locked.
+ *
+ * The lock table is split into STRIPES, each with its own mutex, so transactions locking different
+ * things rarely contend. A lock that can't be granted waits, first come first served, except that a
+ * transaction upgrading a lock it already holds goes ahead of new requests. Before waiting, the
+ * requester records who it is waiting for in the waits-for graph; if that closes a cycle, it gives up
+ * its request and throws DeadlockError instead, and its transaction has to be rolled back. While it
+ * waits, other sessions get to run (see Transaction::before_wait).
+ *
+ * How often, and for how long, transactions had to wait is counted per table and index (see
+ * wait_stats), so hot spots show up in "show locks".
+ */
+class LockManager {
+public:
+    /**
+     * Lock modes, from weakest to strongest.
+     */
+    enum Mode {
+        IS,     // intend to read things inside
+        IX,     // intend to change things inside
+        S,      // read
+        SIX,    // read all of it and change things inside
+        X       // change
+    };
+
+    /**
+     * Waiting done for the locks on one table or index.
+     */
+    struct WaitStats {
+        uint64_t waits;        // requests that had to wait
+        uint64_t wait_us;      // total time spent waiting
+        uint64_t max_wait_us;  // longest wait
+        uint64_t deadlocks;    // requests refused because they would have deadlocked
+    };
+
+    /**
+     * Number of lock requests so far (including those already covered by a lock the transaction held).
+     */
+    static std::atomic<uint64_t> requests;
+
+    static void lock_table(const Identifier &table_name, Mode mode);
+
+    static void lock_page(const Identifier &table_name, BlockID block_id, Mode mode);
+
+    static void lock_record(const Identifier &table_name, Handle handle, Mode mode);
+
+    static void lock_key(const Identifier &index_name, uint64_t key_hash, Mode mode);
+
+    static bool holds_table(const Identifier &table_name, Mode mode);
+
+    static void release_all(uint64_t owner);
+
+    static std::map<Identifier, WaitStats> wait_stats();
+
+protected:
+    static const uint32_t STRIPES = 64;
+
+    enum Level {
+        TABLE,
+        PAGE,
+        RECORD,
+        KEY
+    };
+
+    /**
+     * What is locked: a table or index by name, and something inside it by number(s).
+     */
+    struct LockId {
+        Identifier object;
+        Level level;
+        uint64_t first;
+        uint64_t second;
+
+        bool operator==(const LockId &other) const {
+            return this->level == other.level && this->first == other.first && this->second == other.second &&
+                   this->object == other.object;
+        }
+
+        size_t hash() const;
+    };
+
+    struct LockIdHash {
+        size_t operator()(const LockId &id) const { return id.hash(); }
+    };
+
+    struct Request;
+    struct Stripe;
+    struct Holdings;
+
+    static const bool compatible[5][5];
+    static const Mode supremum[5][5];
+    static Stripe stripes[STRIPES];      // the lock table
+    static Holdings holdings[STRIPES];   // what each transaction holds
+
+    static void lock(uint64_t owner, const LockId &id, Mode mode);
+
+    static bool holds(uint64_t owner, const LockId &id, Mode mode);
+
+    static bool held(uint64_t owner, const LockId &id, Mode &mode);
+
+    static std::vector<uint64_t> blocking(const std::list<Request> &queue, std::list<Request>::const_iterator request);
+
+    static bool closes_cycle(uint64_t owner, const std::vector<uint64_t> &blockers);
+
+    static void stop_waiting(uint64_t owner);
+
+    static Mode intent(Mode mode) { return mode == IS || mode == S ? IS : IX; }
+
+    static void count_wait(const Identifier &object, uint64_t wait_us, bool deadlock);
+
+    static uint64_t elapsed_us(std::chrono::steady_clock::time_point start);
+
+    friend bool test_lock_manager();
+};
+
+bool test_lock_manager();
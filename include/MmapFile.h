@@ -0,0 +1,94 @@
+/**
+ * @file MmapFile.h - Memory-mapped alternative to HeapFile.
+ * MmapFile: HeapFile
+ * MmapFileScan: HeapFileScan
+ *
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include "HeapFile.h"
+
+
+/**
+ * @class MmapFile - DbFile kept in a flat file that is mapped into memory
+ *
+ * Same interface as HeapFile (so HeapTable can use either one), but the blocks live in a plain file
+ * (<name>.mmap in the database environment directory) instead of a Berkeley DB RecNo file. Block n
+ * is at byte offset n * block_size; block 0 is a file header holding a magic number and the block
+ * size. The whole file is mapped with mmap and the SlottedPages handed out by get() wrap the mapped
+ * memory directly, so reading a block copies nothing and changes to a block are changes to the file.
+ * put() just refreshes the block's checksum.
+ *
+ * Address space for MAX_FILE_SZ bytes is mapped when the file is opened, so the mapping never
+ * moves as the file grows (and blocks already handed out stay valid).
+ */
+class MmapFile : public HeapFile {
+public:
+    /**
+     * Largest file we can hold (this much address space is mapped for each open file).
+     */
+    static const uint64_t MAX_FILE_SZ = 1ULL << 36;
+
+    MmapFile(std::string name, uint32_t block_size = DbBlock::BLOCK_SZ);
+
+    virtual ~MmapFile();
+
+    MmapFile(const MmapFile &other) = delete;
+
+    MmapFile(MmapFile &&temp) = delete;
+
+    MmapFile &operator=(const MmapFile &other) = delete;
+
+    MmapFile &operator=(MmapFile &&temp) = delete;
+
+    virtual void create(void);
+
+    virtual void drop(void);
+
+    virtual void open(void);
+
+    virtual void close(void);
+
+    virtual SlottedPage *get_new(void);
+
+    virtual SlottedPage *get(BlockID block_id);
+
+    virtual void put(DbBlock *block);
+
+    virtual HeapFileScan *scan();
+
+protected:
+    static const uint32_t MAGIC = 0x4D4D4150;  // "MMAP"
+
+    std::string path;
+    int fd;
+    char *map;
+
+    virtual void map_file();
+
+    virtual void verify(SlottedPage *page);
+
+    char *address(BlockID block_id) const { return this->map + (uint64_t) block_id * this->block_size; }
+
+    friend class MmapFileScan;
+};
+
+
+/**
+ * @class MmapFileScan - walk through all the blocks of an MmapFile in order
+ *
+ * Tells the kernel the mapping is being read sequentially while the scan is going on.
+ */
+class MmapFileScan : public HeapFileScan {
+public:
+    MmapFileScan(MmapFile &file);
+
+    virtual ~MmapFileScan();
+
+    virtual SlottedPage *next();
+
+protected:
+    MmapFile &mmap_file;
+    BlockID block_id;
+};
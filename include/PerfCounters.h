@@ -0,0 +1,111 @@
+/**
+ * @file PerfCounters.h - Counts of what the storage layer does.
+ * PerfCounter
+ * PerfCounters
+ *
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @class PerfCounter - one count, only ever changed by the thread it belongs to
+ *
+ * Other threads may read it while it is being counted (see PerfCounters::total), so it is atomic, but
+ * since there is just the one writer, counting is a plain load and store, with no locked instruction.
+ */
+class PerfCounter {
+public:
+    PerfCounter(uint64_t n = 0) : n(n) {}
+
+    PerfCounter(const PerfCounter &other) : n(other.get()) {}
+
+    PerfCounter &operator=(const PerfCounter &other) {
+        this->n.store(other.get(), std::memory_order_relaxed);
+        return *this;
+    }
+
+    operator uint64_t() const { return get(); }
+
+    uint64_t get() const { return this->n.load(std::memory_order_relaxed); }
+
+    void operator++(int) { *this += 1; }
+
+    PerfCounter &operator+=(uint64_t delta) {
+        this->n.store(get() + delta, std::memory_order_relaxed);
+        return *this;
+    }
+
+private:
+    std::atomic<uint64_t> n;
+};
+
+/**
+ * @class PerfCounters - how many times the storage layer has done things, counted by each thread for
+ * itself, so that counting is just an increment (no locks, no shared cache lines)
+ *
+ * Take a copy of this thread's counters before and after something to see what it did (see
+ * EvalPlan's EXPLAIN ANALYZE numbers), or add up every thread's, including the ones that have
+ * finished, for the whole engine (SHOW STATUS). The totals can also be written out every so often
+ * (see set_dump_interval).
+ */
+struct PerfCounters {
+    PerfCounter blocks_read;       // blocks that had to come from Berkeley DB or the disk
+    PerfCounter block_hits;        // blocks found already in memory, among the ones a file keeps
+    PerfCounter heap_gets;         // HeapFile::get calls (and its subclasses')
+    PerfCounter heap_puts;         // HeapFile::put calls
+    PerfCounter blocks_allocated;  // HeapFile::get_new calls
+    PerfCounter page_compactions;  // SlottedPage moving its records together to reclaim the holes
+    PerfCounter btree_splits;      // B-tree nodes (leaf or interior) split in two
+    PerfCounter node_loads;        // B-tree nodes read in
+    PerfCounter rows_marshaled;    // HeapTable rows turned into records
+    PerfCounter rows_unmarshaled;  // and back
+    PerfCounter catalog_lookups;   // tables and indices looked up by name
+
+    PerfCounters &operator+=(const PerfCounters &other);
+
+    std::vector<std::pair<std::string, uint64_t>> list() const;
+
+    static PerfCounters &mine();
+
+    static PerfCounters total();
+
+    static void set_dump_interval(uint32_t seconds, std::ostream *out);
+
+private:
+    class Registered;
+
+    static thread_local Registered counters;
+    static std::mutex registry_mutex;
+    static std::set<const PerfCounters *> live;  // every thread's that is still running
+    static PerfCounters retired;                  // sum of the ones that have finished
+};
+
+/**
+ * @class PerfCounters::Registered - a thread's counters, on the list for total while the thread lasts
+ */
+class PerfCounters::Registered : public PerfCounters {
+public:
+    Registered();
+
+    ~Registered();
+
+    Registered(const Registered &other) = delete;
+
+    Registered &operator=(const Registered &other) = delete;
+};
+
+/**
+ * This thread's counters.
+ */
+inline PerfCounters &PerfCounters::mine() {
+    return counters;
+}
@@ -0,0 +1,142 @@
+/**
+ * @file PlanCache.h - Statements parsed (and planned) once and run many times.
+ * StatementPlan
+ * PreparedStatement
+ * PlanCache
+ *
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "SQLParser.h"
+#include "EvalPlan.h"
+
+/**
+ * @class StatementPlan - what SQLExec works out for an insert, update, delete, or select before it
+ * runs it: the table, the indices it has to keep up, the columns it returns, and the optimized
+ * evaluation plan (with the statement's parameters still to be bound)
+ */
+class StatementPlan {
+public:
+    explicit StatementPlan(uint64_t catalog_version) : table(nullptr), column_names(nullptr),
+                                                       column_attributes(nullptr), plan(nullptr),
+                                                       catalog_version(catalog_version) {}
+
+    virtual ~StatementPlan() {
+        delete this->column_names;
+        delete this->column_attributes;
+        delete this->plan;
+    }
+
+    StatementPlan(const StatementPlan &other) = delete;
+
+    StatementPlan &operator=(const StatementPlan &other) = delete;
+
+    DbRelation *table;
+    std::vector<DbIndex *> indices;  // the ones the statement changes
+    ColumnNames *column_names;  // for select
+    ColumnAttributes *column_attributes;  // for select
+    EvalPlan *plan;  // for select, update, and delete
+    uint64_t catalog_version;  // good as long as the catalog is still at this version (see SQLExec::catalog_changed)
+};
+
+
+/**
+ * @class PreparedStatement - one SQL statement, parsed, with "?" for each of its parameters
+ *
+ * The parameters are numbered in the order they appear. The first time the statement runs, SQLExec
+ * keeps its plan here, so running it again skips the parse, the catalog lookups, and the
+ * optimization. The plan is made again if the catalog has changed since.
+ */
+class PreparedStatement {
+public:
+    /**
+     * @param text  the statement
+     * @throws SQLExecError if it isn't valid SQL, or is more than one statement
+     */
+    explicit PreparedStatement(const std::string &text);
+
+    virtual ~PreparedStatement();
+
+    PreparedStatement(const PreparedStatement &other) = delete;
+
+    PreparedStatement &operator=(const PreparedStatement &other) = delete;
+
+    const hsql::SQLStatement *get_statement() const { return this->statement; }
+
+    const std::string &get_text() const { return this->text; }
+
+    size_t parameter_count() const { return this->placeholders.size(); }
+
+    size_t parameter_number(const hsql::Expr *placeholder) const;
+
+    std::string echo(const std::vector<Value> &arguments) const;
+
+protected:
+    std::string text;
+    hsql::SQLParserResult *parse;
+    const hsql::SQLStatement *statement;
+    std::vector<const hsql::Expr *> placeholders;  // in order
+    std::vector<std::string> echo_pieces;  // the statement as we understood it, split at the placeholders
+    std::shared_ptr<StatementPlan> plan;  // only touched by SQLExec, while running the statement
+
+    void find_placeholders(const hsql::Expr *expr);
+
+    friend class SQLExec;
+};
+
+typedef std::shared_ptr<PreparedStatement> PreparedStatementPtr;
+
+
+/**
+ * @class PlanCache - the most recently used prepared statements, by text
+ *
+ * Every select, insert, update, and delete the REPL (or a server session) runs goes through here: the
+ * literals of a statement are taken out and replaced with "?", so "select * from foo where id = 7" and
+ * "... where id = 8" share one parse and one plan, each run with its own arguments. Other statements
+ * (CREATE, DROP, SHOW, BEGIN, ...) have no plan worth keeping and are left to the parser. Statements
+ * named with PREPARE are kept here by their text as written. Text that can't be prepared (it isn't
+ * valid SQL, or is more than one statement) is kept, too, along with why, so it is only parsed once.
+ * The least recently used entries are dropped when there are too many; a session still running a
+ * statement keeps it until it's done.
+ */
+class PlanCache {
+public:
+    static const size_t DEFAULT_CAPACITY = 256;
+
+    static PreparedStatementPtr get(const std::string &text);
+
+    static bool plans(const std::string &line);
+
+    static bool normalize(const std::string &line, std::string &text, std::vector<Value> &arguments);
+
+    static void set_capacity(size_t capacity);
+
+    static size_t get_capacity();
+
+protected:
+    /**
+     * A statement, or why it couldn't be prepared
+     */
+    struct Entry {
+        std::string text;
+        PreparedStatementPtr prepared;  // nullptr if it couldn't be
+        std::string error;
+    };
+    typedef std::list<Entry> Entries;
+
+    static std::mutex mutex;
+    static size_t capacity;
+    static Entries entries;  // most recently used first
+    static std::unordered_map<std::string, Entries::iterator> by_text;
+
+    static void trim();
+};
+
+bool test_plan_cache();
@@ -0,0 +1,44 @@
+/**
+ * @file Rcu.h - Read-copy-update: lock-free readers of data that is replaced rather than changed.
+ * Rcu
+ *
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include <functional>
+
+/**
+ * @class Rcu - deciding when something readers may still be looking at can be deleted
+ *
+ * Readers look at shared data inside a Rcu::ReadSection, without taking any locks. A writer never
+ * changes what readers can see: it publishes a new copy (through an atomic pointer) and retires the
+ * old one, which is deleted once every read section that might have seen it has ended.
+ *
+ * This is epoch-based: each retirement starts a new epoch, and each thread announces the epoch in
+ * which its current read section started (in a slot of its own, so readers don't contend with each
+ * other). Something retired in an epoch is deleted when no thread is still reading from that epoch
+ * or an earlier one.
+ */
+class Rcu {
+public:
+    /**
+     * A read section, for as long as this object lives. Read sections may be nested.
+     */
+    class ReadSection {
+    public:
+        ReadSection();
+
+        ~ReadSection();
+
+        ReadSection(const ReadSection &other) = delete;
+
+        ReadSection &operator=(const ReadSection &other) = delete;
+    };
+
+    static void retire(std::function<void()> reclaim);
+
+    static void reclaim();
+};
+
+bool test_rcu();
@@ -0,0 +1,95 @@
+/**
+ * @file ResultCache.h - Results of recent SELECTs, kept until their table changes.
+ * ResultCache
+ *
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "storage_engine.h"
+
+class QueryResult;
+
+/**
+ * @class ResultCache - what SELECTs returned, by statement and arguments, so that asking again before
+ * the table changes skips the scan
+ *
+ * Only statements outside of an explicit transaction use the cache (one inside a transaction has to
+ * see its own snapshot). Each result is kept with the version its table had when it was read (see
+ * HeapTable::version) and is good until the version moves on: any insert, update, or delete does that,
+ * as does dropping and creating the table again. The version moves on before a change is made, so one
+ * that is rolled back leaves nothing wrong in the cache (nor can it get in: see insert). Rolling back a
+ * change to the catalog makes all the cached results stale, to be on the safe side.
+ *
+ * Results are kept in least recently used order and the oldest are dropped once the cache holds more
+ * than its capacity in bytes (as best we can tell). The capacity starts at 0, which turns the cache
+ * off; see SQLExec::set.
+ */
+class ResultCache {
+public:
+    /**
+     * Counts, for SHOW RESULT CACHE
+     */
+    struct Stats {
+        size_t capacity;
+        size_t bytes;
+        size_t entries;
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t stale;      // misses because the table had changed
+        uint64_t evictions;  // dropped to make room
+    };
+
+    static bool enabled();
+
+    static std::string key(const std::string &text, const std::vector<Value> &arguments);
+
+    static uint64_t get_epoch();
+
+    static QueryResult *find(const std::string &key);
+
+    static void insert(const std::string &key, const Identifier &table_name, uint64_t version, uint64_t epoch,
+                       const QueryResult &result);
+
+    static void invalidate_all();
+
+    static void set_capacity(size_t bytes);
+
+    static size_t get_capacity();
+
+    static Stats stats();
+
+protected:
+    struct Entry {
+        std::string key;
+        Identifier table_name;
+        uint64_t version;  // of the table when the result was read
+        uint64_t epoch;    // see invalidate_all
+        QueryResult *result;
+        size_t bytes;
+    };
+    typedef std::list<Entry> Entries;
+
+    static std::mutex mutex;
+    static size_t capacity;
+    static size_t bytes;
+    static uint64_t epoch;
+    static Entries entries;  // most recently used first
+    static std::unordered_map<std::string, Entries::iterator> by_key;
+    static uint64_t hits, misses, stale, evictions;
+
+    static QueryResult *copy(const QueryResult &result);
+
+    static size_t size_of(const std::string &key, const QueryResult &result);
+
+    static void erase(Entries::iterator entry);
+
+    static void trim();
+};
+
+bool test_result_cache();
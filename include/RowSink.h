@@ -0,0 +1,212 @@
+/**
+ * @file RowSink.h - Where the rows of a query go as they are produced.
+ * RowSink
+ * TextRowSink
+ * BufferedRowSink
+ * CsvRowSink
+ * TsvRowSink
+ * BinaryRowSink
+ * RowCollector
+ *
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "storage_engine.h"
+
+/**
+ * @class RowSink - takes the rows of a query one at a time, as the plan comes up with them
+ *
+ * A select hands its rows to a sink instead of collecting them all before anything is shown, so the
+ * first row comes out as soon as it is found and a big result never has to fit in memory.
+ */
+class RowSink {
+public:
+    virtual ~RowSink() {}
+
+    /**
+     * The rows are about to start.
+     * @param column_names       the columns of each row, in order
+     * @param column_attributes  their types
+     */
+    virtual void begin(const ColumnNames &column_names, const ColumnAttributes &column_attributes) = 0;
+
+    /**
+     * One row. It is only lent to the sink: whatever it wants to keep, it copies.
+     * @param row  the row's values, by column name
+     */
+    virtual void row(const ValueDict &row) = 0;
+
+    /**
+     * That's all the rows.
+     */
+    virtual void end() {}
+
+    static bool is_valid_format(const std::string &format);
+
+    static RowSink *make(const std::string &format, std::ostream &out);
+};
+
+
+/**
+ * @class TextRowSink - prints the rows the way the REPL always has: the column names, a rule, then
+ * a line per row
+ */
+class TextRowSink : public RowSink {
+public:
+    explicit TextRowSink(std::ostream &out) : out(out), column_names() {}
+
+    virtual void begin(const ColumnNames &column_names, const ColumnAttributes &column_attributes);
+
+    virtual void row(const ValueDict &row);
+
+protected:
+    std::ostream &out;
+    ColumnNames column_names;
+};
+
+
+/**
+ * @class BufferedRowSink - base for the machine-readable formats: they are written into a big buffer,
+ * numbers with std::to_chars rather than through the stream, and the buffer is written out whole
+ * when it fills (and at the end)
+ */
+class BufferedRowSink : public RowSink {
+public:
+    static const size_t BUFFER_SIZE = 1024 * 1024;
+
+    explicit BufferedRowSink(std::ostream &out);
+
+    virtual ~BufferedRowSink() {}
+
+    virtual void begin(const ColumnNames &column_names, const ColumnAttributes &column_attributes);
+
+    virtual void end();
+
+protected:
+    std::ostream &out;
+    ColumnNames column_names;
+    std::vector<char> buffer;
+    size_t used;
+
+    void flush();
+
+    void put(char c) {
+        if (this->used == this->buffer.size())
+            flush();
+        this->buffer[this->used++] = c;
+    }
+
+    void put(const char *data, size_t n);
+
+    void put(const std::string &s) { put(s.data(), s.size()); }
+
+    void put_int(int32_t n);
+
+    void put_uint32(uint32_t n);
+};
+
+
+/**
+ * @class CsvRowSink - comma-separated values (RFC 4180, but with plain newlines): a line of column
+ * names, then a line per row, with text quoted if it has a comma, quote, or line break in it
+ */
+class CsvRowSink : public BufferedRowSink {
+public:
+    explicit CsvRowSink(std::ostream &out) : BufferedRowSink(out) {}
+
+    virtual void begin(const ColumnNames &column_names, const ColumnAttributes &column_attributes);
+
+    virtual void row(const ValueDict &row);
+
+protected:
+    void put_text(const std::string &s);
+};
+
+
+/**
+ * @class TsvRowSink - tab-separated values: a line of column names, then a line per row, with tabs,
+ * line breaks, and backslashes in text written as \t, \n, \r, and \\
+ */
+class TsvRowSink : public BufferedRowSink {
+public:
+    explicit TsvRowSink(std::ostream &out) : BufferedRowSink(out) {}
+
+    virtual void begin(const ColumnNames &column_names, const ColumnAttributes &column_attributes);
+
+    virtual void row(const ValueDict &row);
+
+protected:
+    void put_text(const std::string &s);
+};
+
+
+/**
+ * @class BinaryRowSink - length-prefixed rows, for programs to read without any parsing
+ *
+ * All numbers are little-endian. First comes the number of columns (4 bytes), then for each column
+ * the length of its name (4 bytes), the name, and its type (1 byte: 0 for INT, 1 for TEXT, 2 for
+ * BOOLEAN). Each row is the length of the rest of the row (4 bytes), then each value in column order:
+ * an INT in 4 bytes, TEXT as its length (4 bytes) and its bytes, a BOOLEAN in 1 byte. After the last
+ * row comes a length of 0xFFFFFFFF.
+ */
+class BinaryRowSink : public BufferedRowSink {
+public:
+    explicit BinaryRowSink(std::ostream &out) : BufferedRowSink(out) {}
+
+    virtual void begin(const ColumnNames &column_names, const ColumnAttributes &column_attributes);
+
+    virtual void row(const ValueDict &row);
+
+    virtual void end();
+
+protected:
+    std::vector<const Value *> values;  // of the row being written
+};
+
+
+/**
+ * @class RowCollector - keeps copies of the rows (and counts them), optionally passing them on to
+ * another sink as well
+ *
+ * Keeping can be limited to about so many bytes, past which the collector gives up on keeping them
+ * but goes on counting and passing them on: the result cache uses this to keep what a query streams
+ * out, if it's small enough to cache.
+ */
+class RowCollector : public RowSink {
+public:
+    explicit RowCollector(RowSink *next = nullptr, size_t limit = SIZE_MAX);
+
+    virtual ~RowCollector();
+
+    RowCollector(const RowCollector &other) = delete;
+
+    RowCollector &operator=(const RowCollector &other) = delete;
+
+    virtual void begin(const ColumnNames &column_names, const ColumnAttributes &column_attributes);
+
+    virtual void row(const ValueDict &row);
+
+    virtual void end();
+
+    size_t count() const { return this->rows_seen; }
+
+    ValueDicts *release();
+
+    static size_t size_of(const ValueDict &row);
+
+protected:
+    RowSink *next;
+    size_t limit;
+    size_t bytes;
+    size_t rows_seen;
+    ValueDicts *rows;  // nullptr once there are too many to keep
+
+    void discard();
+};
+
+bool benchmark_output();
@@ -5,12 +5,21 @@
  */
 #pragma once
 
+#include <atomic>
 #include <exception>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 #include "SQLParser.h"
 #include "EvalPlan.h"
+#include "PlanCache.h"
+#include "RowSink.h"
+#include "StatementStats.h"
 #include "schema_tables.h"
 
+struct PerfCounters;
+
 /**
  * @class SQLExecError - exception for SQLExec methods
  */
@@ -59,16 +68,163 @@ protected:
 class SQLExec {
 public:
     /**
-     * Execute the given SQL statement.
+     * Execute the given SQL statement. The blocks it changed are written back when it is done.
      * @param statement   the Hyrise AST of the SQL statement to execute
+     * @param sink        where a select's rows go as they are found (if nullptr, they are returned in
+     *                    the query result instead)
      * @returns           the query result (freed by caller)
      */
-    static QueryResult *execute(const hsql::SQLStatement *statement);
+    static QueryResult *execute(const hsql::SQLStatement *statement, RowSink *sink = nullptr);
+
+    /**
+     * Execute a prepared statement. Its plan is kept with it, to be used again next time unless the
+     * catalog has changed since.
+     * @param prepared   the statement (see PlanCache)
+     * @param arguments  values for its parameters, in order
+     * @param sink       as for the other execute
+     * @returns          the query result (freed by caller)
+     */
+    static QueryResult *execute(PreparedStatement &prepared, const std::vector<Value> &arguments,
+                                RowSink *sink = nullptr);
+
+    /**
+     * Explain how a SELECT would be run (our parser has no EXPLAIN, so the REPL hands the statement to us
+     * directly): the evaluation plan, an operator to a line, with the rows each is expected to produce.
+     * With analyze, the statement is run (its rows are counted, then thrown away), and each operator
+     * also reports the rows it produced, the time it took, the blocks it read and found in memory, and
+     * the memory it held (see EvalPlan::explain).
+     * @param statement  the statement
+     * @param analyze    run it, too?
+     * @returns          the query result (freed by caller)
+     * @throws           SQLExecError if it isn't a SELECT, or as for execute
+     */
+    static QueryResult *explain(const hsql::SQLStatement *statement, bool analyze);
+
+    /**
+     * Transaction control (our parser has no statements for these, so the REPL hands them to us directly).
+     *   begin     start a transaction: the statements that follow are kept or undone together
+     *   commit    keep everything done since begin
+     *   rollback  undo everything done since begin
+     * @returns       the query result (freed by caller)
+     * @throws        SQLExecError if there is (for begin) or isn't (for commit and rollback) a transaction in progress
+     */
+    static QueryResult *begin();
+
+    static QueryResult *commit();
+
+    static QueryResult *rollback();
+
+    /**
+     * Change an option (our parser has no SET statement, so the REPL hands these to us directly).
+     * These belong to the session (see Session):
+     *   block_size <bytes>   block size for tables and indices created from now on
+     *   storage <heap|mmap|direct>  where the blocks of tables created from now on are kept
+     *   isolation snapshot|serializable  how transactions started from now on see each other's changes
+     *   output <text|csv|tsv|binary>  how SELECT results are written (see RowSink)
+     * The rest apply to everyone using the database (see is_global_option):
+     *   direct_cache <blocks>  how many blocks each open direct-storage table keeps cached
+     *   commit_delay <microseconds>  how long a commit waits for others to share its sync of the log
+     *   trickle <percent>  how much of the cache the cleaner thread keeps written out (0 for none)
+     *   write_back <blocks>  how many changed blocks a file holds before writing them back (0 to write through)
+     *   verify_checksums <never|always|once>   when to check block checksums as blocks are read
+     *   plan_cache <statements>  how many parsed and planned statements to keep (0 for none)
+     *   result_cache <bytes>  how much memory to keep SELECT results in (0, the default, for none)
+     *   status_interval <seconds>  how often to write the performance counters to the error output (0 for never)
+     *   slow_query_ms <milliseconds|off>  how long a statement takes before it goes in the slow query log
+     * @param option  name of the option
+     * @param value   new value for the option
+     * @returns       the query result (freed by caller)
+     * @throws        SQLExecError if the option or value is not acceptable
+     */
+    static QueryResult *set(const std::string &option, const std::string &value);
+
+    /**
+     * Does an option apply to everyone using the database, rather than just the session setting it?
+     * @param option  name of the option
+     * @returns       true if it is one of the options for everyone (see set)
+     */
+    static bool is_global_option(const std::string &option);
+
+    /**
+     * Show lock waits by table and index (our parser only knows SHOW TABLES, COLUMNS, and INDEX, so the REPL
+     * hands "show locks" to us directly).
+     * @returns       the query result (freed by caller)
+     */
+    static QueryResult *show_locks();
+
+    /**
+     * Show the result cache's size and hit rate ("show result cache", which our parser doesn't know either).
+     * @returns       the query result (freed by caller)
+     */
+    static QueryResult *show_result_cache();
+
+    /**
+     * Show the storage layer's counters, added up over every thread ("show status").
+     * @returns       the query result (freed by caller)
+     */
+    static QueryResult *show_status();
+
+    /**
+     * Show the latency percentiles of each kind of statement ("show latency").
+     * @returns       the query result (freed by caller)
+     */
+    static QueryResult *show_latency();
 
 protected:
     // the one place in the system that holds the _tables and _indices tables
     static Tables *tables;
     static Indices *indices;
+    static std::once_flag schema_opened;
+
+    // session options (put in place for each turn; see Session)
+    static thread_local uint32_t block_size;
+    static thread_local std::string storage;
+    static thread_local std::string output;
+    static void undo_statement(bool changes_catalog);
+
+    static void rollback_transaction();
+
+    static void forget_relations();
+
+    // plans kept with prepared statements are good until the catalog changes
+    static std::atomic<uint64_t> catalog_version;
+
+    static void catalog_changed();
+
+    // the prepared statement this thread is executing, if any, and its arguments
+    static thread_local PreparedStatement *prepared;
+    static thread_local const std::vector<Value> *arguments;
+
+    static std::shared_ptr<StatementPlan> cached_plan();
+
+    // the plan of the statement this thread is executing, as explain shows it, if it has one and there
+    // is a slow query log to write it to
+    static thread_local std::string explained;
+
+    static EvalPlan *bind_plan(const StatementPlan &plan);
+
+    static void log_slow(const hsql::SQLStatement *statement, const PerfCounters &before, uint64_t us);
+
+    // what explain asked for, for the statement this thread is executing
+    enum Explain {
+        NO_EXPLAIN, EXPLAIN, EXPLAIN_ANALYZE
+    };
+    static thread_local Explain explaining;
+
+    static QueryResult *explain_select(const StatementPlan &plan);
+
+    static void keep_plan(const std::shared_ptr<StatementPlan> &plan);
+
+    static bool literal(const hsql::Expr *expr, Value &value);
+
+    static size_t parameter_number(const hsql::Expr *placeholder);
+
+    static const std::vector<Value> &get_arguments();
+
+    static void get_where_conjunction(const hsql::Expr *where, ValueDict *conjunction, EvalParameters *parameters);
+
+    static EvalPlan *where_plan(const hsql::Expr *where, EvalPlan *plan);
+
     // recursive decent into the AST
     static QueryResult *create(const hsql::CreateStatement *statement);
 
@@ -94,7 +250,12 @@ protected:
 
     static QueryResult *del(const hsql::DeleteStatement *statement);
 
-    static QueryResult *select(const hsql::SelectStatement *statement);
+    static QueryResult *update(const hsql::UpdateStatement *statement);
+
+    static void check_unique(const std::vector<DbIndex *> &indices, DbRelation &table, const Handles &handles,
+                             const ValueDict &new_values);
+
+    static QueryResult *select(const hsql::SelectStatement *statement, RowSink *sink);
     
     /**
      * Pull out column name and attributes from AST's column definition clause
@@ -104,6 +265,8 @@ protected:
      */
     static void
     column_definition(const hsql::ColumnDefinition *col, Identifier &column_name, ColumnAttribute &column_attribute);
+
+    friend class Session;  // keeps each session's options
 };
 
 
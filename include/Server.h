@@ -0,0 +1,111 @@
+/**
+ * @file Server.h - Serves many clients at once over a Unix domain socket or loopback TCP.
+ * Server
+ *
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/**
+ * @class Server - sql5300 for any number of clients sharing one database environment
+ *
+ * Each connection is a Session. Clients send lines, just as they would type them into the REPL, and
+ * get back what the REPL would print, followed by a line with a single "." on it (a line of the
+ * response that starts with "." gets another one put in front). "quit", or closing the connection,
+ * ends the session and rolls back its transaction if it has one.
+ *
+ * One thread (the one in run) does all the connection handling, with non-blocking sockets and epoll:
+ * it accepts connections, reads whatever has arrived, and writes whatever responses the sockets would
+ * not take right away. Complete lines are queued on their connections, and a connection with lines
+ * waiting is handed to the worker pool. Responses go out as they are written, a chunk at a time; a
+ * worker whose client is more than MAX_BACKLOG behind waits for it, stepping aside as it would for a lock,
+ * and cuts the client off if it hasn't caught up within CLIENT_TIMEOUT. A worker runs one line for a session and then puts
+ * the connection at the back of the line if it has more, so busy sessions don't keep the others waiting.
+ *
+ * The pool has a fixed number of workers, except that a worker whose session is waiting for a lock
+ * (or the log, or its client) is made up for with an extra one for the duration, so that the sessions they are
+ * waiting for always get to run.
+ */
+class Server {
+public:
+    /**
+     * @param address  path of a Unix domain socket, or a port number for TCP on the loopback interface
+     * @param workers  size of the worker pool
+     * @throws std::runtime_error if the address can't be listened on
+     */
+    Server(const std::string &address, uint32_t workers);
+
+    virtual ~Server();
+
+    Server(const Server &other) = delete;
+
+    Server &operator=(const Server &other) = delete;
+
+    void run();
+
+    static void stop();
+
+protected:
+    struct Connection;
+    typedef std::shared_ptr<Connection> ConnectionPtr;
+
+    class Response;
+
+    static const size_t READ_SIZE = 64 * 1024;
+    static const size_t CHUNK_SIZE = 64 * 1024;     // a response is handed to its connection this much at a time
+    static const size_t MAX_BACKLOG = 1024 * 1024;  // how much of a response a client can fall behind by
+    static const uint32_t CLIENT_TIMEOUT = 10;      // seconds a client that far behind has to catch up
+    static Server *instance;  // the one running (for the wait hooks and stop)
+
+    std::string address;
+    int listener;
+    int epoll;
+    int wake[2];  // pipe for waking up the event loop
+    std::unordered_map<int, ConnectionPtr> connections;
+
+    // the worker pool
+    std::mutex pool_mutex;
+    std::condition_variable work;     // a connection is ready, or we're stopping
+    std::condition_variable idle;     // a worker exited
+    std::deque<ConnectionPtr> ready;  // connections with lines to run
+    std::deque<int> finished;         // connections whose sessions have ended
+    uint32_t size;                    // workers we want
+    uint32_t workers;                 // workers there are
+    uint32_t waiting;                 // workers waiting for a lock or the log
+    bool stopping;
+
+    void accept_all();
+
+    void receive(const ConnectionPtr &connection);
+
+    void send(const ConnectionPtr &connection);
+
+    void close_finished();
+
+    void schedule(const ConnectionPtr &connection);
+
+    void add_worker();
+
+    void worker();
+
+    void respond(const ConnectionPtr &connection, const std::string &line);
+
+    void finish(const ConnectionPtr &connection);
+
+    void watch(int fd, bool writing);
+
+    void poke();
+
+    static void before_wait();
+
+    static void after_wait();
+
+    static int listen_on(const std::string &address);
+};
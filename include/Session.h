@@ -0,0 +1,126 @@
+/**
+ * @file Session.h - One user's conversation with the database.
+ * Session
+ *
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include <map>
+#include <ostream>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+#include "Transaction.h"
+#include "PlanCache.h"
+
+/**
+ * @class Session - what one user has going: their transaction and their "set" options
+ *
+ * A session runs the lines its user types, just as the REPL always has: transaction control, "set"
+ * options (only the session's own ones, unless it is an admin session, as the REPL's and the batch
+ * scripts' are), "show locks" (and "show result cache", "show status", and "show latency"), and SQL
+ * statements (which are echoed before their results). It also keeps the user's prepared statements:
+ *   prepare <name> as <statement>    with a "?" for each parameter
+ *   execute <name> [(<literal>, ...)]  one literal per parameter
+ *   deallocate <name>
+ * and explains how SELECTs are run:
+ *   explain [analyze] <select statement>
+ * Other SQL statements are run through the PlanCache too, so repeating one (even with different
+ * literals) skips the parse and the planning.
+ *
+ * Each statement runs in a turn of its session's, on whatever thread the session has at the time. A
+ * session's transaction and options are put in place (in that thread's Transaction and SQLExec) when
+ * its turn starts and put away when it ends. The turns of all sessions share the engine, so their
+ * statements run in parallel: each thread keeps the blocks it changes to itself until they are
+ * written back (see HeapFile), the caches are safe to share, and what one statement may not see of
+ * another's is kept from it by the locks they take (see HeapTable, and SQLExec::execute for the
+ * catalog). Only setting an option that applies to everyone takes the engine to itself, waiting for
+ * the statements running meanwhile to finish. Parsing and echoing are done outside of the turn. The
+ * rows a select finds are printed during the turn, as they are found (see RowSink), so none of them
+ * have to be held for later.
+ *
+ * A statement that has to wait for something another session may have to do first (a lock it holds,
+ * a sync of the log that others can join) steps aside, so that a turn waiting for the engine to
+ * itself doesn't wait for it too, and it takes another turn once the wait is over (see
+ * Transaction::before_wait).
+ */
+class Session {
+public:
+    Session();
+
+    virtual ~Session();
+
+    Session(const Session &other) = delete;
+
+    Session &operator=(const Session &other) = delete;
+
+    bool execute(const std::string &line, std::ostream &out);
+
+    void close(std::ostream &out);
+
+    void set_echo(bool echo) { this->echo = echo; }
+
+    void set_admin(bool admin) { this->admin = admin; }
+
+    static void step_aside();
+
+    static void step_back();
+
+protected:
+    // the session's transaction (see Transaction)
+    DbTxn *transaction;
+    DbTxn *statement;
+    uint32_t flags;
+    uint64_t owner;
+
+    bool echo;  // print each statement (as our parser understood it) before its results?
+    bool admin;  // may the user change the options that apply to everyone (see SQLExec::is_global_option)?
+
+    // the session's prepared statements, by name
+    std::map<std::string, PreparedStatementPtr> prepared;
+
+    // the session's options (see SQLExec::set)
+    Transaction::Isolation isolation;
+    uint32_t block_size;
+    std::string storage;
+    std::string output;
+    bool exclusive;  // has the engine to itself for this turn?
+
+    static std::shared_mutex engine;          // held (shared, mostly) by every turn
+    static thread_local Session *running;     // the session whose turn this thread has, if any
+    static thread_local Session *aside;       // the session that stepped aside from its turn, if any
+
+    void enter(bool exclusive);
+
+    void leave();
+
+    /**
+     * A turn, for as long as this object lives.
+     */
+    class Turn {
+    public:
+        explicit Turn(Session &session, bool exclusive = false) : session(session) { session.enter(exclusive); }
+
+        ~Turn() { session.leave(); }
+
+    protected:
+        Session &session;
+    };
+
+    void run(PreparedStatement &statement, const std::vector<Value> &arguments, std::ostream &out);
+
+    bool rows_only(const hsql::SQLStatement *statement) const;
+
+    void prepare(const std::string &rest, std::ostream &out);
+
+    void execute_prepared(const std::string &rest, std::ostream &out);
+
+    void deallocate(const std::string &rest, std::ostream &out);
+
+    void explain(const std::string &rest, std::ostream &out);
+
+    static bool is_transaction_control(const std::string &line, std::string &command);
+
+    static bool is_command(const std::string &line, const std::string &word, std::string &rest);
+};
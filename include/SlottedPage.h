@@ -18,20 +18,61 @@
         Modeled after slotted-page from Database Systems Concepts, 6ed, Figure 10-9.
 
         Record id are handed out sequentially starting with 1 as records are added with add().
-        Each record has a header which is a fixed offset from the beginning of the block:
-            Bytes 0x00 - Ox01: number of records
-            Bytes 0x02 - 0x03: offset to end of free space
-            Bytes 0x04 - 0x05: size of record 1
-            Bytes 0x06 - 0x07: offset to record 1
+        The block starts with a header, then each record has a header at a fixed offset from the
+        beginning of the block:
+            Bytes 0x00 - Ox03: number of records (including deleted ones)
+            Bytes 0x04 - 0x07: offset to end of free space
+            Bytes 0x08 - 0x0B: number of fragmented bytes (holes left by deleted or shrunken records)
+            Bytes 0x0C - 0x0F: id of first deleted record available for reuse (0 if none)
+            Bytes 0x10 - 0x13: number of live (non-deleted) records
+            Bytes 0x14 - 0x17: CRC-32C of the rest of the block (set by set_checksum() before a write)
+            Bytes 0x18 - 0x1B: FORMAT, so blocks laid out some other way are recognized (see format_ok)
+            Bytes 0x1C - 0x1F: reserved (zero)
+            Bytes 0x20 - 0x23: size of record 1
+            Bytes 0x24 - 0x27: offset to record 1
             etc.
+        The header fields are 32 bits so that blocks can be larger than 64kB minus the headers.
+        The size of the block is taken from the Dbt it is built on.
+
+        Deleting or shrinking a record just leaves a hole, which is only reclaimed (by compacting
+        all the records to the end of the block) when an add or put needs the space. A deleted
+        record's header is a tombstone (offset 0) whose size field links it into the list of
+        record ids that add() hands out again before growing the header area.
+
+        The top bits of a record's size field are never needed for the size, so they hold flags
+        for the users of the block (see FORWARD and MOVED).
  *
  */
 class SlottedPage : public DbBlock {
 public:
+    /**
+     * Record flags: the record is a stub pointing to where the data was moved
+     */
+    static const uint32_t FORWARD = 0x80000000U;
+
+    /**
+     * Record flags: the record was moved here and is reached through its stub
+     */
+    static const uint32_t MOVED = 0x40000000U;
+
+    /**
+     * What a block laid out as described above has in bytes 0x18 - 0x1B: "SP" and a version number, to
+     * be bumped whenever the layout changes
+     */
+    static const uint32_t FORMAT = 0x53500001U;
+
+    /**
+     * Bytes of header each record takes besides its data
+     */
+    static const uint32_t SLOT_SZ = 8;
+
     SlottedPage(Dbt &block, BlockID block_id, bool is_new = false);
 
-    // Big 5 - use the defaults
-    virtual ~SlottedPage() {}
+    // Big 5 - use the defaults (but see adopt)
+    virtual ~SlottedPage() {
+        if (this->owns_data)
+            delete[] (char *) this->block.get_data();
+    }
 
     virtual RecordID add(const Dbt *data);
 
@@ -43,29 +84,60 @@ public:
 
     virtual RecordIDs *ids(void) const;
 
+    virtual RecordID next_id(RecordID record_id = 0) const;
+
     virtual void clear();
 
     virtual u_int16_t size() const;
 
-    virtual u_int16_t unused_bytes() const;
+    virtual u_int32_t unused_bytes() const;
+
+    virtual uint32_t get_flags(RecordID record_id) const;
+
+    virtual void set_flags(RecordID record_id, uint32_t flags);
+
+    virtual void set_checksum();
+
+    virtual bool checksum_ok() const;
+
+    virtual bool format_ok() const;
+
+    /**
+     * Take over the block's memory (allocated with new[] for this block alone), so that it is freed
+     * along with the block (see HeapFile::get).
+     */
+    void adopt() { this->owns_data = true; }
 
 protected:
-    uint16_t num_records;
-    uint16_t end_free;
+    static const uint32_t FLAGS = FORWARD | MOVED;
+    static const uint32_t HEADER_SZ = 32;  // block header
+
+    uint32_t num_records;
+    uint32_t end_free;
+    uint32_t fragmented;
+    uint32_t free_slot;
+    uint32_t live_records;
+    bool owns_data;  // see adopt
+
+    void get_header(uint32_t &size, uint32_t &loc, RecordID id = 0) const;
+
+    void put_header(RecordID id = 0, uint32_t size = 0, uint32_t loc = 0);
+
+    bool has_room(uint32_t size) const;
 
-    void get_header(uint16_t &size, uint16_t &loc, RecordID id = 0) const;
+    uint32_t contiguous_bytes() const;
 
-    void put_header(RecordID id = 0, uint16_t size = 0, uint16_t loc = 0);
+    uint32_t checksum() const;
 
-    bool has_room(uint16_t size) const;
+    uint32_t place(uint32_t size);
 
-    virtual void slide(uint16_t start, uint16_t end);
+    virtual void compact();
 
-    uint16_t get_n(uint16_t offset) const;
+    uint32_t get_n(uint32_t offset) const;
 
-    void put_n(uint16_t offset, uint16_t n);
+    void put_n(uint32_t offset, uint32_t n);
 
-    void *address(uint16_t offset) const;
+    void *address(uint32_t offset) const;
 
     friend bool test_slotted_page();
 };
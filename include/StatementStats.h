@@ -0,0 +1,102 @@
+/**
+ * @file StatementStats.h - How long statements take, and which ones took too long.
+ * LatencyHistogram
+ * StatementStats
+ *
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include "SQLParser.h"
+
+/**
+ * @class LatencyHistogram - counts of latencies (in microseconds), in the manner of an HDR histogram
+ *
+ * Latencies under 128 us each get a bucket of their own. Above that, each power of two is split into 64
+ * buckets of equal width, so a percentile is never off by more than 1/64 (about 1.6%) of its value, no
+ * matter how long the tail (latencies of 2^40 us, 12 days, or more all go in the last bucket).
+ * Recording is a relaxed atomic add to the bucket, the count, and the sum, so it can be left on.
+ */
+class LatencyHistogram {
+public:
+    static const uint32_t EXACT = 128;    // latencies below this get a bucket of their own
+    static const uint32_t SUB_BUCKETS = 64;  // buckets per power of two above that
+    static const uint32_t MAX_BITS = 40;
+    static const uint32_t BUCKETS = EXACT + (MAX_BITS - 7) * SUB_BUCKETS;
+
+    LatencyHistogram();
+
+    LatencyHistogram(const LatencyHistogram &other) = delete;
+
+    LatencyHistogram &operator=(const LatencyHistogram &other) = delete;
+
+    void record(uint64_t us);
+
+    uint64_t count() const { return this->total.load(std::memory_order_relaxed); }
+
+    uint64_t mean() const;
+
+    uint64_t max() const { return this->largest.load(std::memory_order_relaxed); }
+
+    uint64_t percentile(double fraction) const;
+
+protected:
+    std::atomic<uint64_t> counts[BUCKETS];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> largest;
+
+    static uint32_t bucket_of(uint64_t us);
+
+    static uint64_t highest_in(uint32_t bucket);
+
+    friend bool test_latency_histogram();
+};
+
+
+/**
+ * @class StatementStats - a latency histogram for each kind of statement, and the slow query log
+ *
+ * SQLExec::execute times every statement it runs and records it here. A statement that takes longer
+ * than the slow query threshold (which starts out off; see SQLExec::set) is also written to the slow
+ * query log, slow_queries.log in the database environment's directory, with its plan and how many
+ * rows it looked at.
+ */
+class StatementStats {
+public:
+    enum Kind {
+        SELECT, INSERT, UPDATE, DELETE, DDL, OTHER, KINDS
+    };
+
+    static Kind kind_of(const hsql::SQLStatement *statement);
+
+    static const char *name(Kind kind);
+
+    static void record(Kind kind, uint64_t us) { histograms[kind].record(us); }
+
+    static const LatencyHistogram &histogram(Kind kind) { return histograms[kind]; }
+
+    static bool is_slow(uint64_t us) { return us >= slow_us.load(std::memory_order_relaxed); }
+
+    static bool logging_slow() { return slow_us.load(std::memory_order_relaxed) != UINT64_MAX; }
+
+    static void set_slow_threshold(uint64_t ms);
+
+    static void slow_threshold_off();
+
+    static void log_slow(const std::string &text, const std::string &plan, uint64_t rows_examined,
+                         uint64_t blocks_read, uint64_t us);
+
+protected:
+    static LatencyHistogram histograms[KINDS];
+    static std::atomic<uint64_t> slow_us;  // UINT64_MAX when the log is off
+    static std::mutex log_mutex;
+    static std::ofstream log;
+};
+
+bool test_latency_histogram();
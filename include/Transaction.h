@@ -0,0 +1,151 @@
+/**
+ * @file Transaction.h - Transactions on the Berkeley DB environment.
+ * Transaction
+ *
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include <atomic>
+#include "storage_engine.h"
+
+/**
+ * @class Transaction - BEGIN, COMMIT, and ROLLBACK
+ *
+ * Every statement runs in a Berkeley DB transaction of its own, which is _DB_TXN while the statement
+ * runs. Outside of BEGIN ... COMMIT that is a top-level transaction committed as soon as the statement
+ * succeeds. Inside, it is a child of the transaction started by BEGIN, so a statement that fails is
+ * undone without losing the rest of the transaction.
+ *
+ * Top-level commits are group commits: the commit's log records are written without waiting for the
+ * disk, and then the committer waits for the log to be synced. The first committer to get there
+ * waits commit_delay microseconds for others to line up behind it, then syncs the log once for all
+ * of them.
+ *
+ * Under snapshot isolation (the default), a transaction reads everything as it was when the
+ * transaction started, without read locks, so readers never wait for writers and writers never wait
+ * for readers. Berkeley DB does the versioning: our files are opened multiversion, and a block changed
+ * while some snapshot may still need its old contents is copied first. A snapshot transaction that
+ * tries to change a block someone else changed after it started fails (and can be retried). Under
+ * serializable isolation, transactions take read locks as well and wait for each other instead.
+ *
+ * Old versions stay in Berkeley DB's cache until the last snapshot that can see them finishes, then
+ * their space is reused. The cleaner thread (see start_cleaner) keeps trickle_percent of the cache
+ * written out in the background, so that making a new version never has to wait for a write first.
+ *
+ * Only Berkeley DB files are transactional; whatever is written to mmap and direct tables stays.
+ *
+ * Each transaction (or statement outside of BEGIN ... COMMIT) also gets a number under which it takes
+ * locks in the LockManager; they are released when it ends.
+ */
+class Transaction {
+public:
+    /**
+     * Microseconds a commit waits for others to share its sync of the log.
+     */
+    static uint32_t commit_delay;
+
+    /**
+     * How transactions see each other's changes.
+     */
+    enum Isolation {
+        SNAPSHOT,       // read from a snapshot taken when the transaction starts
+        SERIALIZABLE    // read the latest committed data, with read locks
+    };
+
+    /**
+     * Isolation for transactions started from now on.
+     */
+    static thread_local Isolation isolation;
+
+    /**
+     * Percentage of the cache the cleaner thread keeps written out (0 to leave it to Berkeley DB).
+     */
+    static std::atomic<uint32_t> trickle_percent;
+
+    /**
+     * Fail at once, rather than wait, when Berkeley DB finds a block locked by another transaction.
+     * The server sets this: the transaction holding the lock could never finish while we wait for it.
+     */
+    static bool no_wait;
+
+    /**
+     * Called, if set, before a statement waits for something that may need other sessions to run first
+     * (a lock, the log sync), and after the wait. If before_wait throws, there is no wait (see Session).
+     */
+    static void (*before_wait)();
+
+    static void (*after_wait)();
+
+    /**
+     * Is there a transaction started by BEGIN?
+     * @return  true between BEGIN and COMMIT or ROLLBACK
+     */
+    static bool in_progress() { return transaction != nullptr; }
+
+    /**
+     * Does the statement running now read from a snapshot (and so need no read locks)?
+     * @return  true under snapshot isolation, except for a statement on its own that writes
+     */
+    static bool reads_snapshot() { return (flags & DB_TXN_SNAPSHOT) != 0; }
+
+    /**
+     * Who owns the locks taken now (see LockManager)?
+     * @return  the transaction's number, or 0 if no statement is running
+     */
+    static uint64_t lock_owner() { return owner; }
+
+    /**
+     * How many transactions (started by BEGIN, or statements' outside of one) are running in all sessions?
+     * @return  the number, counting the one running now, if any
+     */
+    static uint32_t running_count() { return running; }
+
+    static void begin();
+
+    static void commit();
+
+    static void rollback();
+
+    static void begin_statement(bool writes);
+
+    static void commit_statement();
+
+    static void rollback_statement();
+
+    static bool statement_wrote();
+
+    static void start_cleaner();
+
+    static void stop_cleaner();
+
+protected:
+    static const uint32_t CLEAN_INTERVAL_MS = 1000;  // how often the cleaner thread runs
+
+    // the transaction this thread is running (put in place for each turn; see Session)
+    static thread_local DbTxn *transaction;  // started by BEGIN
+    static thread_local DbTxn *statement;    // the current statement's
+    static thread_local uint32_t flags;      // txn_begin flags of BEGIN's transaction, or else the statement's
+    static thread_local uint64_t owner;      // lock owner of the transaction running now
+    static thread_local uint64_t changes;    // HeapFile::changes() when the current statement started
+    static std::atomic<uint64_t> last_owner;
+    static std::atomic<uint32_t> running;
+
+    static uint32_t isolation_flags();
+
+    static void abort(DbTxn *txn);
+
+    static void end_statement(DbTxn *txn);
+
+    static void release_locks();
+
+    static void sync_log();
+
+    static void wait_for_log();
+
+    static void clean();
+
+    friend class Session;
+};
+
+bool test_transactions();
@@ -6,11 +6,59 @@
  */
 #pragma once
 
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include "BTreeNode.h"
+#include "LockManager.h"
 
+/**
+ * @class VersionLatch - latch for optimistic lock coupling
+ *
+ * A version number that goes up by one when a writer locks the latch and by one more when it unlocks
+ * it, so the version is odd while locked. Readers don't lock: they note the version before reading
+ * and check it is unchanged afterward (and start over if it isn't). A writer locks by upgrading from
+ * the version it read, which fails (rather than waits) if anyone else got there first.
+ */
+class VersionLatch {
+public:
+    VersionLatch() : version(0) {}
+
+    uint64_t read_lock() const;
+
+    /**
+     * Has anyone locked the latch since read_lock() returned the given version?
+     * @param version  what read_lock() returned
+     * @return         true if not (so what was read since is good)
+     */
+    bool validate(uint64_t version) const { return this->version.load() == version; }
+
+    bool try_upgrade(uint64_t version);
+
+    void unlock();
+
+protected:
+    alignas(64) std::atomic<uint64_t> version;  // a cache line each, so latches don't slow each other down
+};
+
+/**
+ * @class BTreeIndex - unique B+ tree index in a HeapFile of its own
+ *
+ * Safe for several threads at once, using optimistic lock coupling. Each block's latch is one of
+ * LATCHES VersionLatches (picked by block id), and root_latch covers the root id and height.
+ * Lookups take no locks at all: they go down the tree noting latch versions and start over if any
+ * changed. An insert goes down the same way, then locks only the nodes it changes: the leaf, plus
+ * each node above it that might have to take a new entry because the one below it splits (and the
+ * root latch if the root itself might split). If any of them changed since it was read, the insert
+ * starts over instead of waiting, so inserts can't deadlock. Each node read is a copy of its own (see
+ * HeapFile::get), so each node is read whole. The root id and height are read from the file on each
+ * trip down the tree, so each transaction goes by the tree as it sees it (and not by one an abort
+ * has taken back).
+ */
 class BTreeIndex : public DbIndex {
 public:
-    BTreeIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique);
+    BTreeIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique,
+               uint32_t block_size = DbBlock::BLOCK_SZ);
 
     virtual ~BTreeIndex();
 
@@ -34,19 +82,49 @@ public:
 
 protected:
     static const BlockID STAT = 1;
-    bool closed;
-    BTreeStat *stat;
-    BTreeNode *root;
-    HeapFile file;
+    static const uint32_t LATCHES = 1024;
+
+    /**
+     * A node on the way down from the root, and the version of its latch when it was read.
+     */
+    struct PathStep {
+        BTreeNode *node;
+        uint64_t version;
+    };
+    typedef std::vector<PathStep> Path;
+
+    std::atomic<bool> closed;
+    std::mutex open_mutex;
+    mutable HeapFile file;  // lookups read nodes, too
     KeyProfile key_profile;
+    mutable VersionLatch root_latch;
+    std::unique_ptr<VersionLatch[]> latches;
 
     void build_key_profile();
 
-    Handles *_lookup(BTreeNode *node, uint height, const KeyValue *key) const;
+    VersionLatch &latch(BlockID block_id) const { return this->latches[block_id % LATCHES]; }
+
+    bool descend(const KeyValue *key, Path &path, uint64_t &root_version) const;
+
+    static void release(Path &path);
+
+    bool try_insert(const KeyValue *key, Handle handle);
 
-    Insertion _insert(BTreeNode *node, uint height, const KeyValue *key, Handle handle);
+    bool try_del(const KeyValue *key, Handle handle);
+
+    bool lock(VersionLatch &latch, uint64_t version, std::vector<VersionLatch *> &held);
+
+    static void unlock(std::vector<VersionLatch *> &held);
+
+    void insert_key(const KeyValue *key, Handle handle);
+
+    void lock_key(const KeyValue *key, LockManager::Mode mode) const;
+
+    friend bool benchmark_btree();
 };
 
 bool test_btree();
 
+bool benchmark_btree();
+
 
@@ -0,0 +1,19 @@
+/**
+ * @file crc32c.h - CRC-32C (Castagnoli) checksums, used to catch torn or corrupted blocks.
+ *
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Compute (or continue computing) the CRC-32C of a run of bytes.
+ * Uses the SSE4.2 crc32 instruction when the processor has it, otherwise a table lookup.
+ * @param data  bytes to checksum
+ * @param n     number of bytes
+ * @param crc   result from the previous run of bytes when checksumming in pieces (0 to start)
+ * @return      checksum of everything so far
+ */
+uint32_t crc32c(const void *data, size_t n, uint32_t crc = 0);
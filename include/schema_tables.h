@@ -8,6 +8,7 @@
 #pragma once
 
 #include "heap_storage.h"
+#include "CatalogCache.h"
 
 /**
  * Initialize access to the schema tables.
@@ -22,7 +23,7 @@ class Columns; // forward declare
 /**
  * @class Tables - The singleton table that stores the metadata for all other tables.
  * For now, we are not indexing anything, so a query requires sequential scan
- * of the table.
+ * of the table. Along with the name we keep the block size each table was created with.
  */
 class Tables : public HeapTable {
 public:
@@ -60,6 +61,13 @@ public:
      */
     static DbRelation &get_table(Identifier table_name);
 
+    /**
+     * Forget all the tables instantiated so far except _tables and _columns (after a rollback,
+     * the schema may no longer say what it did when they were instantiated).
+     * Forget the indices first (see Indices::clear_cache), since they refer to their tables.
+     */
+    static void clear_cache();
+
 protected:
     // hard-coded columns for _tables table
     static ColumnNames &COLUMN_NAMES();
@@ -70,8 +78,8 @@ protected:
     static Columns *columns_table;
 
 private:
-    // keep a cache of all the tables we've instantiated so far
-    static std::map<Identifier, DbRelation *> table_cache;
+    // keep a cache of all the tables we've instantiated so far (safe to look in from any thread)
+    static CatalogCache<Identifier, DbRelation> table_cache;
 };
 
 
@@ -125,9 +133,10 @@ public:
      * @param is_hash         returned by reference: set to False if the
      *                        requested index is a btree index
      * @param is_unique       search key for this index is a key for the relation
+     * @param block_size      returned by reference: block size the index was created with
      */
     virtual void get_columns(Identifier table_name, Identifier index_name, ColumnNames &column_names, bool &is_hash,
-                             bool &is_unique);
+                             bool &is_unique, uint32_t &block_size);
 
     /**
      * Get the instantiated DbIndex for the given index.
@@ -144,6 +153,11 @@ public:
      */
     virtual IndexNames get_index_names(Identifier table_name);
 
+    /**
+     * Forget all the indices instantiated so far.
+     */
+    static void clear_cache();
+
     // overrides
     virtual Handle insert(const ValueDict *row);
 
@@ -155,7 +169,8 @@ protected:
     static ColumnAttributes &COLUMN_ATTRIBUTES();
 
 private:
-    static std::map<std::pair<Identifier, Identifier>, DbIndex *> index_cache;
+    // keep a cache of all the indices we've instantiated so far (safe to look in from any thread)
+    static CatalogCache<std::pair<Identifier, Identifier>, DbIndex> index_cache;
 };
 
 
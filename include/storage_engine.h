@@ -10,6 +10,7 @@
 #pragma once
 
 #include <exception>
+#include <functional>
 #include <map>
 #include <utility>
 #include <vector>
@@ -20,6 +21,12 @@
  */
 extern DbEnv *_DB_ENV;
 
+/**
+ * Global variable to hold the transaction the current statement runs in (nullptr if none), one for
+ * each thread.
+ */
+extern thread_local DbTxn *_DB_TXN;
+
 /*
  * Convenient aliases for types
  */
@@ -46,10 +53,16 @@ typedef std::length_error DbBlockNoRoomError;
 class DbBlock {
 public:
     /**
-     * our blocks are 4kB
+     * our blocks are 4kB unless the table or index asks for something else
      */
     static const uint BLOCK_SZ = 4096;
 
+    /**
+     * range of block sizes a table or index may choose (must be a power of two)
+     */
+    static const uint MIN_BLOCK_SZ = 512;
+    static const uint MAX_BLOCK_SZ = 65536;
+
     /**
      * ctor/dtor (subclasses should handle the big-5)
      */
@@ -108,7 +121,7 @@ public:
      * Get the number of bytes not currently used to store data or for overhead.
      * @returns  number of unused bytes
      */
-    virtual u_int16_t unused_bytes() const = 0;
+    virtual u_int32_t unused_bytes() const = 0;
 
     /**
      * Access the whole block's memory as a BerkeleyDB Dbt pointer.
@@ -128,6 +141,12 @@ public:
      */
     virtual BlockID get_block_id() { return block_id; }
 
+    /**
+     * Get the size of this block in bytes.
+     * @returns  number of bytes in the block
+     */
+    virtual u_int32_t get_block_size() const { return block.get_size(); }
+
 protected:
     Dbt block;
     BlockID block_id;
@@ -259,6 +278,7 @@ typedef std::vector<Identifier> ColumnNames;
 typedef std::vector<ColumnAttribute> ColumnAttributes;
 typedef std::pair<BlockID, RecordID> Handle;
 typedef std::vector<Handle> Handles;  // FIXME: will need to turn this into an iterator at some point
+typedef std::function<void(Handle)> HandleVisitor;  // called with each handle of a selection, in turn
 typedef std::map<Identifier, Value> ValueDict;
 typedef std::vector<ValueDict *> ValueDicts;
 
@@ -374,6 +394,29 @@ public:
      */
     virtual Handles *select(Handles *current_selection, const ValueDict *where) = 0;
 
+    /**
+     * Conceptually, execute: SELECT <handle> FROM <table_name> WHERE <where>
+     * This version hands over each qualifying row as it is found, rather than collecting them all
+     * first, so the caller can be done with one row before the next is looked for.
+     * @param where  where-clause predicates (nullptr for all rows)
+     * @param visit  called with the handle of each qualifying row
+     */
+    virtual void select(const ValueDict *where, const HandleVisitor &visit);
+
+    /**
+     * About how many rows there are (for EXPLAIN). The default counts them.
+     * @returns  the estimate
+     */
+    virtual uint64_t estimate_rows();
+
+    /**
+     * Are changes to the relation undone when their transaction rolls back? The default says they are.
+     * @returns  true if they are
+     */
+    virtual bool is_transactional() const {
+        return true;
+    }
+
     /**
      * Return a sequence of all values for handle (SELECT *).
      * @param handle  row to get values from
@@ -512,6 +555,22 @@ public:
      */
     virtual void del(Handle record) = 0;
 
+    /**
+     * Accessor for key_columns.
+     * @returns  list of the columns in the search key, in order
+     */
+    virtual const ColumnNames &get_key_columns() const {
+        return key_columns;
+    }
+
+    /**
+     * Accessor for unique.
+     * @returns  true if no two records may have the same search key
+     */
+    virtual bool is_unique() const {
+        return unique;
+    }
+
 protected:
     DbRelation &relation;
     Identifier name;
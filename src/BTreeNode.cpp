@@ -6,6 +6,7 @@
 
 #include <cstring>
 #include "BTreeNode.h"
+#include "PerfCounters.h"
 
 using namespace std;
 
@@ -22,7 +23,8 @@ BTreeNode::BTreeNode(HeapFile &file, BlockID block_id, const KeyProfile &key_pro
         this->block = file.get_new();
         this->id = this->block->get_block_id();
     } else {
-        this->block = file.get(block_id);
+        PerfCounters::mine().node_loads++;
+        this->block = file.get(block_id);  // our own copy, whoever else reads the file meanwhile
     }
 }
 
@@ -67,10 +69,7 @@ KeyValue *BTreeNode::get_key(RecordID record_id) const {
         } else if (data_type == ColumnAttribute::DataType::TEXT) {
             uint16_t size = *(uint16_t *) (bytes + offset);
             offset += sizeof(uint16_t);
-            char buffer[DbBlock::BLOCK_SZ];
-            memcpy(buffer, bytes + offset, size);
-            buffer[size] = '\0';
-            value.s = std::string(buffer);  // assume ascii for now
+            value.s = std::string(bytes + offset, size);  // assume ascii for now
             offset += size;
         } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
             value.n = *(uint8_t *) (bytes + offset);
@@ -84,6 +83,22 @@ KeyValue *BTreeNode::get_key(RecordID record_id) const {
     return key_value;
 }
 
+// Number of bytes a key takes once marshaled (see marshal_key).
+uint32_t BTreeNode::key_size(const KeyValue *key) const {
+    uint32_t size = 0;
+    uint col_num = 0;
+    for (auto const &data_type: this->key_profile) {
+        if (data_type == ColumnAttribute::DataType::INT)
+            size += sizeof(int32_t);
+        else if (data_type == ColumnAttribute::DataType::TEXT)
+            size += sizeof(uint16_t) + (uint32_t) (*key)[col_num].s.length();
+        else
+            size += sizeof(uint8_t);
+        col_num++;
+    }
+    return size;
+}
+
 // Convert block_id into bytes.
 Dbt *BTreeNode::marshal_block_id(BlockID block_id) {
     char *bytes = new char[sizeof(BlockID)];
@@ -103,14 +118,15 @@ Dbt *BTreeNode::marshal_handle(Handle handle) {
 
 // Convert KeyValue into bytes.
 Dbt *BTreeNode::marshal_key(const KeyValue *key) {
-    char *bytes = new char[DbBlock::BLOCK_SZ]; // more than we need
+    const uint block_size = this->file.get_block_size();
+    char *bytes = new char[block_size]; // more than we need
     uint offset = 0;
     uint col_num = 0;
     for (auto const &data_type: this->key_profile) {
         Value value = (*key)[col_num];
 
         if (data_type == ColumnAttribute::DataType::INT) {
-            if (offset + 4 > DbBlock::BLOCK_SZ - 4)
+            if (offset + 4 > block_size - 4)
                 throw DbRelationError("index key too big to marshal");
 
             *(int32_t *) (bytes + offset) = value.n;
@@ -120,7 +136,7 @@ Dbt *BTreeNode::marshal_key(const KeyValue *key) {
             u_long size = (uint16_t) value.s.length();
             if (size > UINT16_MAX)
                 throw DbRelationError("text field too long to marshal");
-            if (offset + 2 + size > DbBlock::BLOCK_SZ)
+            if (offset + 2 + size > block_size)
                 throw DbRelationError("index key too big to marshal");
 
             *(uint16_t *) (bytes + offset) = (uint16_t) size;
@@ -129,7 +145,7 @@ Dbt *BTreeNode::marshal_key(const KeyValue *key) {
             offset += size;
 
         } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
-            if (offset + 1 > DbBlock::BLOCK_SZ - 1)
+            if (offset + 1 > block_size - 1)
                 throw DbRelationError("index key too big to marshal");
 
             *(uint8_t *) (bytes + offset) = (uint8_t) value.n;
@@ -187,7 +203,6 @@ void BTreeStat::save() {
     BTreeNode::save();
 }
 
-
 /*****************
  * BTreeInterior *
  *****************/
@@ -221,8 +236,8 @@ BTreeInterior::~BTreeInterior() {
     this->boundaries.clear();
 }
 
-// Get next block down in tree where key must be.
-BTreeNode *BTreeInterior::find(const KeyValue *key, uint depth) const {
+// Get the id of the next block down in tree where key must be.
+BlockID BTreeInterior::find_id(const KeyValue *key) const {
     BlockID down = this->pointers.back();  // last pointer is correct if we don't find an earlier boundary
     for (uint i = 0; i < this->boundaries.size(); i++) {
         KeyValue *boundary = this->boundaries[i];
@@ -234,12 +249,31 @@ BTreeNode *BTreeInterior::find(const KeyValue *key, uint depth) const {
             break;
         }
     }
+    return down;
+}
+
+// Get next block down in tree where key must be.
+BTreeNode *BTreeInterior::find(const KeyValue *key, uint depth) const {
+    BlockID down = find_id(key);
     if (depth == 2)
         return new BTreeLeaf(this->file, down, this->key_profile, false);
     else
         return new BTreeInterior(this->file, down, this->key_profile, false);
 }
 
+// Will a boundary of up to the given size (and its pointer) fit without a split?
+bool BTreeInterior::has_room(uint32_t boundary_size) const {
+    return (uint64_t) sizeof(BlockID) + boundary_size + 2 * SlottedPage::SLOT_SZ <= this->block->unused_bytes();
+}
+
+// Size of the biggest boundary here (the most a split of this node can send up).
+uint32_t BTreeInterior::largest_key() const {
+    uint32_t largest = 0;
+    for (auto const boundary: this->boundaries)
+        largest = max(largest, key_size(boundary));
+    return largest;
+}
+
 // Save the pointers and boundaries in the correct order
 void BTreeInterior::save() {
     Dbt *dbt;
@@ -307,6 +341,7 @@ Insertion BTreeInterior::insert(const KeyValue *boundary, BlockID block_id) {
         delete dbt;
 
         // too big, so split
+        PerfCounters::mine().btree_splits++;
 
         // create the sister
         BTreeInterior *nnode = new BTreeInterior(this->file, 0, this->key_profile, true);
@@ -385,6 +420,20 @@ Handle BTreeLeaf::find_eq(const KeyValue *key) const {
     return this->key_map.at(*key);
 }
 
+// Will the key (and its handle) fit without a split?
+bool BTreeLeaf::has_room(const KeyValue *key) const {
+    return (uint64_t) sizeof(BlockID) + sizeof(RecordID) + key_size(key) + 2 * SlottedPage::SLOT_SZ <=
+           this->block->unused_bytes();
+}
+
+// Size of the biggest key here (the most a split of this leaf can send up, besides the key being inserted).
+uint32_t BTreeLeaf::largest_key() const {
+    uint32_t largest = 0;
+    for (auto const &item: this->key_map)
+        largest = max(largest, key_size(&item.first));
+    return largest;
+}
+
 // Save the key_map and next_leaf data in the correct order
 void BTreeLeaf::save() {
     Dbt *dbt;
@@ -440,6 +489,7 @@ Insertion BTreeLeaf::insert(const KeyValue *key, Handle handle) {
         delete dbt;
 
         // too big, so split
+        PerfCounters::mine().btree_splits++;
 
         // create the sister and put her to the right
         BTreeLeaf *nleaf = new BTreeLeaf(this->file, 0, this->key_profile, true);
@@ -473,4 +523,11 @@ Insertion BTreeLeaf::insert(const KeyValue *key, Handle handle) {
     }
 }
 
-
+// Remove the key from this leaf if it is there for the given handle. Sparse leaves are not merged.
+void BTreeLeaf::del(const KeyValue *key, Handle handle) {
+    auto item = this->key_map.find(*key);
+    if (item == this->key_map.end() || item->second != handle)
+        return;
+    this->key_map.erase(item);
+    save();
+}
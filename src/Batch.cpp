@@ -0,0 +1,242 @@
+/**
+ * @file Batch.cpp - implementation of Batch class
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+#include "Batch.h"
+#include "Session.h"
+#include "Transaction.h"
+
+using namespace std;
+typedef chrono::steady_clock Clock;
+
+/**
+ * Takes what a session prints and keeps only its last line, and its first error.
+ */
+class LastLine : public streambuf {
+public:
+    LastLine() : line(), last(), error() {}
+
+    // forget the previous statement's lines
+    void clear() {
+        this->line.clear();
+        this->last.clear();
+        this->error.clear();
+    }
+
+    const string &get_result() const { return this->error.empty() ? this->last : this->error; }
+
+    bool failed() const { return !this->error.empty(); }
+
+protected:
+    string line;   // so far
+    string last;   // last whole line
+    string error;  // first error message
+
+    int overflow(int c) override {
+        if (c != traits_type::eof()) {
+            char ch = (char) c;
+            xsputn(&ch, 1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    streamsize xsputn(const char *data, streamsize n) override {
+        const char *end = data + n;
+        while (data < end) {
+            const char *newline = (const char *) memchr(data, '\n', (size_t) (end - data));
+            if (newline == nullptr) {
+                this->line.append(data, (size_t) (end - data));
+                break;
+            }
+            this->line.append(data, (size_t) (newline - data));
+            end_line();
+            data = newline + 1;
+        }
+        return n;
+    }
+
+    void end_line() {
+        if (this->error.empty() &&
+            (this->line.compare(0, 7, "Error: ") == 0 || this->line.compare(0, 12, "invalid SQL:") == 0))
+            this->error = this->line;
+        if (!this->line.empty())
+            this->last.swap(this->line);
+        this->line.clear();
+    }
+};
+
+// CPU time used so far by this thread (or, with CLOCK_PROCESS_CPUTIME_ID, the whole process), in seconds
+static double cpu_seconds(clockid_t clock = CLOCK_THREAD_CPUTIME_ID) {
+    timespec now{};
+    clock_gettime(clock, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+Batch::Batch(const vector<string> &paths, ostream &out) : scripts(), out(out), out_mutex() {
+    for (const string &path: paths)
+        this->scripts.push_back(Script{path, false, 0, 0, 0.0, 0.0, 0.0, 0});
+}
+
+/**
+ * Run the scripts (at the same time, if there is more than one) and print the summary.
+ * @return  true if every script could be read and every statement in them succeeded
+ */
+bool Batch::run() {
+    // sessions waiting for each other's locks have to let each other run
+    bool together = this->scripts.size() > 1;
+    if (together) {
+        Transaction::before_wait = Session::step_aside;
+        Transaction::after_wait = Session::step_back;
+        Transaction::no_wait = true;
+    }
+    auto start = Clock::now();
+    double cpu_start = cpu_seconds(CLOCK_PROCESS_CPUTIME_ID);
+    vector<thread> threads;
+    for (Script &script: this->scripts)
+        threads.emplace_back(&Batch::run_script, this, ref(script));
+    for (thread &t: threads)
+        t.join();
+    double wall_s = chrono::duration<double>(Clock::now() - start).count();
+    double cpu_s = cpu_seconds(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+    if (together) {
+        Transaction::before_wait = nullptr;
+        Transaction::after_wait = nullptr;
+        Transaction::no_wait = false;
+    }
+
+    bool ok = true;
+    uint64_t statements = 0, errors = 0;
+    this->out << fixed << setprecision(3);
+    for (const Script &script: this->scripts) {
+        if (!script.opened) {
+            this->out << script.path << ": could not be read" << endl;
+            ok = false;
+            continue;
+        }
+        statements += script.statements;
+        errors += script.errors;
+        this->out << script.path << ": " << script.statements << " statements, " << script.errors << " errors, "
+                  << script.wall_s << " s wall, " << script.cpu_s << " s cpu, " << setprecision(0)
+                  << (script.wall_s > 0 ? (double) script.statements / script.wall_s : 0.0) << " statements/s";
+        if (script.statements > 0)
+            this->out << ", slowest line " << script.slowest_line << " (" << setprecision(3) << script.slowest_ms
+                      << " ms)";
+        this->out << setprecision(3) << endl;
+    }
+    this->out << "total: " << statements << " statements, " << errors << " errors, " << wall_s << " s wall, "
+              << cpu_s << " s cpu, " << setprecision(0) << (wall_s > 0 ? (double) statements / wall_s : 0.0)
+              << " statements/s" << endl;
+    this->out.unsetf(ios::floatfield);
+    this->out << setprecision(6);
+    return ok && errors == 0;
+}
+
+/**
+ * Run one script in a session of its own, timing each statement. A transaction the script leaves
+ * open is rolled back.
+ */
+void Batch::run_script(Script &script) {
+    ifstream in(script.path);
+    if (!in)
+        return;
+    script.opened = true;
+
+    Session session;
+    session.set_echo(false);
+    LastLine result;
+    ostream discard(&result);
+    auto start = Clock::now();
+    double cpu_start = cpu_seconds();
+
+    string line, text;
+    uint32_t line_number = 0, first_line = 0;
+    bool more = true;
+    while (more && getline(in, line)) {
+        line_number++;
+        if (text.empty()) {
+            size_t first = line.find_first_not_of(" \t\r");
+            if (first == string::npos || line.compare(first, 2, "--") == 0)
+                continue;
+            first_line = line_number;
+            text = line.substr(first);
+        } else {
+            text += " " + line;
+        }
+        while (!text.empty() && isspace((unsigned char) text.back()))
+            text.pop_back();
+        if (!is_complete(text))
+            continue;
+
+        result.clear();
+        auto statement_start = Clock::now();
+        double statement_cpu = cpu_seconds();
+        try {
+            more = session.execute(text, discard);
+        } catch (exception &e) {
+            discard << "Error: " << e.what() << endl;
+        }
+        double wall_ms = chrono::duration<double, milli>(Clock::now() - statement_start).count();
+        double cpu_ms = (cpu_seconds() - statement_cpu) * 1000.0;
+        text.clear();
+        if (!more)
+            break;  // "quit"
+
+        script.statements++;
+        if (result.failed())
+            script.errors++;
+        if (wall_ms > script.slowest_ms) {
+            script.slowest_ms = wall_ms;
+            script.slowest_line = first_line;
+        }
+        report(script, first_line, wall_ms, cpu_ms, result.get_result());
+    }
+    if (!text.empty()) {
+        script.errors++;
+        report(script, first_line, 0.0, 0.0, "Error: script ends in the middle of a statement");
+    }
+
+    result.clear();
+    session.close(discard);
+    if (result.failed())
+        report(script, line_number, 0.0, 0.0, result.get_result());
+    script.wall_s = chrono::duration<double>(Clock::now() - start).count();
+    script.cpu_s = cpu_seconds() - cpu_start;
+}
+
+// print a statement's line
+void Batch::report(const Script &script, uint32_t line, double wall_ms, double cpu_ms, const string &result) {
+    ostringstream report;
+    report << script.path << ":" << line << fixed << setprecision(3) << "  wall " << wall_ms << " ms  cpu "
+           << cpu_ms << " ms  " << result << '\n';
+    lock_guard<mutex> guard(this->out_mutex);
+    this->out << report.str();
+}
+
+/**
+ * Is this a whole statement, or is a parenthesis or quote still open (so the next line is more of it)?
+ */
+bool Batch::is_complete(const string &text) {
+    int depth = 0;
+    char quote = 0;
+    for (char c: text) {
+        if (quote != 0) {
+            if (c == quote)
+                quote = 0;
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+        } else if (c == '(') {
+            depth++;
+        } else if (c == ')') {
+            depth--;
+        }
+    }
+    return quote == 0 && depth <= 0;
+}
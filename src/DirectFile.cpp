@@ -0,0 +1,369 @@
+/**
+ * @file DirectFile.cpp
+ * @see Seattle University, CPSC5300
+ */
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "DirectFile.h"
+#include "PerfCounters.h"
+
+using namespace std;
+
+uint32_t DirectFile::cache_blocks = 1024;
+
+/**
+ * Constructor
+ * @param name
+ * @param block_size  size of the blocks if the file gets created
+ */
+DirectFile::DirectFile(string name, uint32_t block_size) : HeapFile(name, block_size), path(""), fd(-1), lru(),
+                                                           cache(), written() {
+    const char *home = nullptr;
+    _DB_ENV->get_home(&home);
+    this->path = (home == nullptr ? string("") : string(home) + "/") + this->name + ".direct";
+}
+
+DirectFile::~DirectFile() {
+    close();
+}
+
+/**
+ * Create physical file.
+ * @throws DbException if it already exists or can't be created
+ * @throws DbRelationError if the block size is too small for direct I/O
+ */
+void DirectFile::create(void) {
+    if (this->block_size < ALIGNMENT)
+        throw DbRelationError("direct storage needs blocks of at least " + to_string(ALIGNMENT) + " bytes");
+    open_fd(O_RDWR | O_CREAT | O_EXCL);
+    char *header = allocate(this->block_size);
+    memset(header, 0, this->block_size);
+    ((uint32_t *) header)[0] = MAGIC;
+    ((uint32_t *) header)[1] = this->block_size;
+    this->last = 0;
+    this->closed = false;
+    try {
+        write_block(0, header);
+    } catch (DbRelationError &e) {
+        free(header);
+        close();
+        throw;
+    }
+    free(header);
+    SlottedPage *page = get_new(); // force one page to exist
+    delete page;
+}
+
+/**
+ * Delete the physical file.
+ * @throws DbException if there is no file to remove
+ */
+void DirectFile::drop(void) {
+    discard();
+    close();
+    if (unlink(this->path.c_str()) != 0)
+        throw DbException(("cannot remove " + this->path).c_str(), errno);
+}
+
+/**
+ * Open physical file.
+ * @throws DbException if the file does not exist
+ */
+void DirectFile::open(void) {
+    if (!this->closed)
+        return;
+    open_fd(O_RDWR);
+    char *header = allocate(ALIGNMENT);  // blocks are never smaller than this
+    struct stat info;
+    bool ok = pread(this->fd, header, ALIGNMENT, 0) == ALIGNMENT && ((uint32_t *) header)[0] == MAGIC &&
+              is_valid_block_size(((uint32_t *) header)[1]) && fstat(this->fd, &info) == 0;
+    uint32_t size = ((uint32_t *) header)[1];
+    free(header);
+    if (!ok) {
+        ::close(this->fd);
+        this->fd = -1;
+        throw DbRelationError(this->path + " is not a block file");
+    }
+    this->block_size = size;  // an existing file keeps the block size it was created with
+    this->last = (uint32_t) (info.st_size / this->block_size) - 1;
+    this->closed = false;
+}
+
+/**
+ * Make sure everything written is on the disk, drop the cache, and close the file.
+ */
+void DirectFile::close(void) {
+    if (this->closed)
+        return;
+    flush();
+    fdatasync(this->fd);
+    for (auto &entry: this->cache)
+        free(entry.second.data);
+    this->cache.clear();
+    this->lru.clear();
+    ::close(this->fd);
+    this->fd = -1;
+    this->closed = true;
+    this->verified.clear();
+}
+
+/**
+ * Allocate a new block at the end of the file.
+ * @return the new empty block (freed by caller)
+ */
+SlottedPage *DirectFile::get_new(void) {
+    PerfCounters::mine().blocks_allocated++;
+    BlockID block_id = this->last + 1;
+    char *data = install(block_id);
+    memset(data, 0, this->block_size);
+    Dbt dbt(data, this->block_size);
+    SlottedPage *page = new SlottedPage(dbt, block_id, true);
+    page->set_checksum();
+    this->last = block_id;
+    this->written.insert(block_id);  // gets to the file when it is evicted or flushed
+    mark_dirty();
+    mark_verified(block_id);
+    return page;
+}
+
+/**
+ * Get a block, from the cache if it is there or else from the file.
+ * @param block_id   block to get
+ * @return           the block (freed by caller)
+ * @throws DbRelationError if the block cannot be read or does not match its checksum
+ */
+SlottedPage *DirectFile::get(BlockID block_id) {
+    PerfCounters::mine().heap_gets++;
+    char *data = cached(block_id);
+    bool from_file = data == nullptr;
+    if (from_file) {
+        PerfCounters::mine().blocks_read++;
+        data = install(block_id);
+        try {
+            read_blocks(block_id, 1, data);
+        } catch (DbRelationError &e) {
+            uncache(block_id);
+            throw;
+        }
+    } else {
+        PerfCounters::mine().block_hits++;
+    }
+    Dbt dbt(data, this->block_size);
+    SlottedPage *page = new SlottedPage(dbt, block_id, false);
+    if (from_file) {
+        try {
+            verify(page);
+        } catch (DbRelationError &e) {
+            uncache(block_id);  // don't keep a corrupt block around
+            throw;
+        }
+    }
+    return page;
+}
+
+/**
+ * Write a block back to the file. It is copied into the cache (if it isn't already a cached block)
+ * and marked dirty; it gets to the file when it is evicted or the file is flushed.
+ * @param block
+ * @throws DbRelationError if the cache had to write out a block and couldn't
+ */
+void DirectFile::put(DbBlock *block) {
+    PerfCounters::mine().heap_puts++;
+    BlockID block_id = block->get_block_id();
+    static_cast<SlottedPage *>(block)->set_checksum();  // all our blocks are SlottedPages
+    char *data = (char *) block->get_data();
+    char *frame = cached(block_id);
+    if (frame == nullptr)
+        frame = install(block_id);
+    if (data != frame)
+        memcpy(frame, data, this->block_size);
+    this->written.insert(block_id);
+    mark_dirty();
+    mark_verified(block_id);
+    if (this->written.size() > write_back)
+        flush();
+}
+
+/**
+ * Write all the dirty blocks to the file, in block order. They stay in the cache.
+ * @throws DbRelationError if a block can't be written
+ */
+void DirectFile::flush() {
+    while (!this->written.empty()) {
+        BlockID block_id = *this->written.begin();
+        write_block(block_id, this->cache.at(block_id).data);
+        this->written.erase(this->written.begin());
+    }
+    mark_clean();
+}
+
+/**
+ * Forget that any blocks are dirty (the file is about to be dropped).
+ */
+void DirectFile::discard() {
+    this->written.clear();
+    mark_clean();
+}
+
+/**
+ * Start a sequential scan of all the blocks.
+ * @return  the scan (freed by caller)
+ */
+HeapFileScan *DirectFile::scan() {
+    flush();  // the scan reads straight from the file
+    return new DirectFileScan(*this);
+}
+
+/**
+ * Open the file for direct I/O (or ordinary I/O, if the file system won't do direct I/O).
+ * @param flags  open flags other than O_DIRECT
+ * @throws DbException if the file can't be opened
+ */
+void DirectFile::open_fd(int flags) {
+    this->fd = ::open(this->path.c_str(), flags | O_DIRECT, 0644);
+    if (this->fd < 0 && errno == EINVAL)
+        this->fd = ::open(this->path.c_str(), flags, 0644);
+    if (this->fd < 0)
+        throw DbException(("cannot open " + this->path).c_str(), errno);
+}
+
+/**
+ * Look for a block in the cache, marking it as just used if it is there.
+ * @param block_id  block to look for
+ * @return          the block's buffer, or nullptr if it isn't cached
+ */
+char *DirectFile::cached(BlockID block_id) {
+    auto hit = this->cache.find(block_id);
+    if (hit == this->cache.end())
+        return nullptr;
+    this->lru.splice(this->lru.begin(), this->lru, hit->second.use);
+    return hit->second.data;
+}
+
+/**
+ * Get a cache buffer for a block that isn't cached, reusing the least recently used one if the cache is full
+ * (and writing that one out first if it is dirty).
+ * @param block_id  block the buffer is for
+ * @return          the buffer (contents are left to the caller)
+ * @throws DbRelationError if the evicted block can't be written
+ */
+char *DirectFile::install(BlockID block_id) {
+    char *data;
+    if (this->cache.size() >= max(cache_blocks, MIN_CACHE_BLOCKS)) {
+        BlockID victim = this->lru.back();
+        data = this->cache[victim].data;
+        if (this->written.erase(victim) != 0)
+            write_block(victim, data);
+        this->lru.pop_back();
+        this->cache.erase(victim);
+    } else {
+        data = allocate(this->block_size);
+    }
+    this->lru.push_front(block_id);
+    this->cache[block_id] = Frame{data, this->lru.begin()};
+    return data;
+}
+
+/**
+ * Take a block out of the cache.
+ * @param block_id  block to forget
+ */
+void DirectFile::uncache(BlockID block_id) {
+    auto hit = this->cache.find(block_id);
+    if (hit == this->cache.end())
+        return;
+    this->written.erase(block_id);
+    free(hit->second.data);
+    this->lru.erase(hit->second.use);
+    this->cache.erase(hit);
+}
+
+/**
+ * Read consecutive blocks from the file.
+ * @param block_id  first block to read
+ * @param count     number of blocks
+ * @param buffer    where to put them (aligned, with room for count blocks)
+ * @throws DbRelationError if the blocks can't all be read
+ */
+void DirectFile::read_blocks(BlockID block_id, uint32_t count, char *buffer) {
+    uint64_t size = (uint64_t) count * this->block_size;
+    ssize_t n = pread(this->fd, buffer, size, (off_t) ((uint64_t) block_id * this->block_size));
+    if (n < 0 || (uint64_t) n != size)
+        throw DbRelationError("cannot read block " + to_string(block_id) + " of " + this->path +
+                              (n < 0 ? string(": ") + strerror(errno) : string("")));
+}
+
+/**
+ * Write a block to the file.
+ * @param block_id  block to write
+ * @param buffer    its contents (aligned)
+ * @throws DbRelationError if it can't be written
+ */
+void DirectFile::write_block(BlockID block_id, const char *buffer) {
+    ssize_t n = pwrite(this->fd, buffer, this->block_size, (off_t) ((uint64_t) block_id * this->block_size));
+    if (n < 0 || (uint32_t) n != this->block_size)
+        throw DbRelationError("cannot write block " + to_string(block_id) + " of " + this->path +
+                              (n < 0 ? string(": ") + strerror(errno) : string("")));
+}
+
+/**
+ * Allocate a buffer aligned for direct I/O.
+ * @param size  bytes needed
+ * @return      the buffer (freed with free())
+ */
+char *DirectFile::allocate(uint64_t size) {
+    void *data = nullptr;
+    if (posix_memalign(&data, ALIGNMENT, size) != 0)
+        throw bad_alloc();
+    return (char *) data;
+}
+
+
+/**
+ * Set up a sequential scan (nothing is read until the first call to next()).
+ * @param file  the (open) file to scan
+ */
+DirectFileScan::DirectFileScan(DirectFile &file) : HeapFileScan(file), direct_file(file), block_id(0), first(0),
+                                                   count(0), size(RUN_BLOCKS), run(nullptr) {
+}
+
+DirectFileScan::~DirectFileScan() {
+    free(this->run);
+}
+
+/**
+ * Get the next block in the file.
+ * @return  the next block (freed by caller, and only good until the next call), or nullptr after the last one
+ * @throws DbRelationError if the block cannot be read or does not match its checksum
+ */
+SlottedPage *DirectFileScan::next() {
+    DirectFile &file = this->direct_file;
+    if (this->block_id >= file.get_last_block_id())
+        return nullptr;
+    BlockID block_id = ++this->block_id;
+    uint32_t block_size = file.get_block_size();
+    if (this->run == nullptr)
+        this->run = DirectFile::allocate((uint64_t) this->size * block_size);
+    if (block_id >= this->first + this->count) {
+        this->first = block_id;
+        this->count = min(this->size, file.get_last_block_id() + 1 - block_id);
+        file.read_blocks(this->first, this->count, this->run);
+    }
+    char *data = this->run + (uint64_t) (block_id - this->first) * block_size;
+    auto hit = file.cache.find(block_id);  // a cached block may be newer than what we just read
+    if (hit != file.cache.end()) {
+        memcpy(data, hit->second.data, block_size);
+        PerfCounters::mine().block_hits++;
+    } else {
+        PerfCounters::mine().blocks_read++;
+    }
+    Dbt dbt(data, block_size);
+    SlottedPage *page = new SlottedPage(dbt, block_id, false);
+    if (hit == file.cache.end())
+        file.verify(page);
+    return page;
+}
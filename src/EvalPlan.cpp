@@ -4,8 +4,15 @@
  * @see "Seattle University, CPSC5300, Winter 24"
  */
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
 #include "EvalPlan.h"
+#include "PerfCounters.h"
 
+typedef std::chrono::steady_clock Clock;
 
 class Dummy : public DbRelation {
 public:
@@ -43,24 +50,80 @@ public:
     virtual ValueDict *project(Handle handle, const ColumnNames *column_names) { return nullptr; }
 };
 
+/**
+ * Charges this thread's time, and the blocks it reads, to an operator of a plan being analyzed, for as
+ * long as the Charge lives; then goes back to charging the operator that was being charged before.
+ * Every operator takes one whenever it does work of its own (including when it is handed a row by the
+ * operator under it), so each one's share comes out right however their work is interleaved.
+ */
+class EvalPlan::Charge {
+public:
+    explicit Charge(EvalPlan *plan) : previous(working), active(plan->analyzing) {
+        if (this->active)
+            switch_to(plan);
+    }
+
+    ~Charge() {
+        if (this->active)
+            switch_to(this->previous);
+    }
+
+    Charge(const Charge &other) = delete;
+
+    Charge &operator=(const Charge &other) = delete;
+
+protected:
+    EvalPlan *previous;
+    bool active;
+
+    static thread_local EvalPlan *working;      // the operator being charged
+    static thread_local Clock::time_point since;  // when it started being charged
+    static thread_local PerfCounters counted;    // this thread's counters as of then
+
+    static void switch_to(EvalPlan *plan) {
+        Clock::time_point now = Clock::now();
+        PerfCounters counters = PerfCounters::mine();
+        if (working != nullptr) {
+            working->stats.time_ns += (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    now - since).count();
+            working->stats.blocks_read += counters.blocks_read - counted.blocks_read;
+            working->stats.block_hits += counters.block_hits - counted.block_hits;
+        }
+        working = plan;
+        since = now;
+        counted = counters;
+    }
+};
+
+thread_local EvalPlan *EvalPlan::Charge::working = nullptr;
+thread_local Clock::time_point EvalPlan::Charge::since;
+thread_local PerfCounters EvalPlan::Charge::counted;
+
 EvalPlan::EvalPlan(PlanType type, EvalPlan *relation) : type(type), relation(relation), projection(nullptr),
-                                                        select_conjunction(nullptr), table(Dummy::one()) {
+                                                        select_conjunction(nullptr), select_parameters(nullptr),
+                                                        table(Dummy::one()), analyzing(false), stats(),
+                                                        estimated(NOT_ESTIMATED) {
 }
 
 EvalPlan::EvalPlan(ColumnNames *projection, EvalPlan *relation) : type(Project), relation(relation),
                                                                   projection(projection), select_conjunction(nullptr),
-                                                                  table(Dummy::one()) {
+                                                                  select_parameters(nullptr), table(Dummy::one()),
+                                                                  analyzing(false), stats(), estimated(NOT_ESTIMATED) {
 }
 
-EvalPlan::EvalPlan(ValueDict *conjunction, EvalPlan *relation) : type(Select), relation(relation), projection(nullptr),
-                                                                 select_conjunction(conjunction), table(Dummy::one()) {
+EvalPlan::EvalPlan(ValueDict *conjunction, EvalPlan *relation, EvalParameters *parameters)
+        : type(Select), relation(relation), projection(nullptr), select_conjunction(conjunction),
+          select_parameters(parameters), table(Dummy::one()), analyzing(false), stats(),
+          estimated(NOT_ESTIMATED) {
 }
 
 EvalPlan::EvalPlan(DbRelation &table) : type(TableScan), relation(nullptr), projection(nullptr),
-                                        select_conjunction(nullptr), table(table) {
+                                        select_conjunction(nullptr), select_parameters(nullptr), table(table),
+                                        analyzing(false), stats(), estimated(NOT_ESTIMATED) {
 }
 
-EvalPlan::EvalPlan(const EvalPlan *other) : type(other->type), table(other->table) {
+EvalPlan::EvalPlan(const EvalPlan *other) : type(other->type), table(other->table), analyzing(false), stats(),
+                                            estimated(other->estimated) {
     if (other->relation != nullptr)
         relation = new EvalPlan(other->relation);
     else
@@ -73,12 +136,17 @@ EvalPlan::EvalPlan(const EvalPlan *other) : type(other->type), table(other->tabl
         select_conjunction = new ValueDict(*other->select_conjunction);
     else
         select_conjunction = nullptr;
+    if (other->select_parameters != nullptr)
+        select_parameters = new EvalParameters(*other->select_parameters);
+    else
+        select_parameters = nullptr;
 }
 
 EvalPlan::~EvalPlan() {
     delete relation;
     delete projection;
     delete select_conjunction;
+    delete select_parameters;
 }
 
 
@@ -86,38 +154,210 @@ EvalPlan *EvalPlan::optimize() {
     return new EvalPlan(this);  // For now, we don't know how to do anything better
 }
 
+/**
+ * Fill in the parameters of a plan made for a prepared statement. The plan itself is left as it is,
+ * so it can be bound again the next time the statement runs.
+ * @param arguments  the values of the parameters, by number
+ * @return           a copy of the plan, ready to evaluate (freed by caller)
+ * @throws DbRelationError if a parameter has no value
+ */
+EvalPlan *EvalPlan::bind(const std::vector<Value> &arguments) const {
+    EvalPlan *bound = new EvalPlan(this);
+    for (EvalPlan *plan = bound; plan != nullptr; plan = plan->relation) {
+        if (plan->select_parameters == nullptr)
+            continue;
+        for (auto const &parameter: *plan->select_parameters) {
+            if (parameter.second >= arguments.size()) {
+                delete bound;
+                throw DbRelationError("no value for parameter " + std::to_string(parameter.second + 1));
+            }
+            (*plan->select_conjunction)[parameter.first] = arguments[parameter.second];
+        }
+    }
+    return bound;
+}
+
 ValueDicts *EvalPlan::evaluate() {
-    ValueDicts *ret = nullptr;
+    RowCollector rows;
+    evaluate(rows);
+    return rows.release();
+}
+
+void EvalPlan::evaluate(RowSink &sink) {
     if (this->type != ProjectAll && this->type != Project)
         throw DbRelationError("Invalid evaluation plan--not ending with a projection");
 
-    EvalPipeline pipeline = this->relation->pipeline();
-    DbRelation *temp_table = pipeline.first;
-    Handles *handles = pipeline.second;
-    if (this->type == ProjectAll)
-        ret = temp_table->project(handles);
-    else if (this->type == Project)
-        ret = temp_table->project(handles, this->projection);
-    delete handles;
-    return ret;
+    Charge charge(this);
+    this->stats.ran = true;
+    this->relation->pipeline([this, &sink](DbRelation &temp_table, Handle handle) {
+        Charge charge(this);
+        ValueDict *row = this->type == ProjectAll ? temp_table.project(handle)
+                                                  : temp_table.project(handle, this->projection);
+        this->stats.rows++;
+        if (this->analyzing)
+            this->stats.memory = std::max(this->stats.memory, RowCollector::size_of(*row));
+        try {
+            sink.row(*row);
+        } catch (...) {
+            delete row;
+            throw;
+        }
+        delete row;
+    });
 }
 
 EvalPipeline EvalPlan::pipeline() {
+    Charge charge(this);
+    this->stats.ran = true;
+    EvalPipeline ret;
+
     // base cases
     if (this->type == TableScan)
-        return EvalPipeline(&this->table, this->table.select());
-    if (this->type == Select && this->relation->type == TableScan)
-        return EvalPipeline(&this->relation->table, this->relation->table.select(this->select_conjunction));
+        ret = EvalPipeline(&this->table, this->table.select());
+    else if (this->type == Select && this->relation->type == TableScan)
+        ret = EvalPipeline(&this->relation->table, this->relation->table.select(this->select_conjunction));
 
     // recursive case
-    if (this->type == Select) {
+    else if (this->type == Select) {
         EvalPipeline pipeline = this->relation->pipeline();
         DbRelation *temp_table = pipeline.first;
         Handles *handles = pipeline.second;
-        EvalPipeline ret(temp_table, temp_table->select(handles, this->select_conjunction));
+        ret = EvalPipeline(temp_table, temp_table->select(handles, this->select_conjunction));
         delete handles;
-        return ret;
+    } else {
+        throw DbRelationError("Not implemented: pipeline other than Select or TableScan");
+    }
+
+    this->stats.rows += ret.second->size();
+    this->stats.memory = std::max(this->stats.memory, ret.second->capacity() * sizeof(Handle));
+    return ret;
+}
+
+void EvalPlan::pipeline(const EvalVisitor &visit) {
+    // base cases: the table hands over its rows as its scan comes to them
+    if (this->type == TableScan || (this->type == Select && this->relation->type == TableScan)) {
+        Charge charge(this);
+        this->stats.ran = true;
+        DbRelation &table = this->type == TableScan ? this->table : this->relation->table;
+        table.select(this->select_conjunction, [this, &table, &visit](Handle handle) {
+            this->stats.rows++;
+            visit(table, handle);
+        });
+        return;
+    }
+
+    // recursive case (the optimizer folds these into the base case, so they're rare)
+    EvalPipeline pipeline = this->pipeline();
+    try {
+        for (Handle handle: *pipeline.second)
+            visit(*pipeline.first, handle);
+    } catch (...) {
+        delete pipeline.second;
+        throw;
+    }
+    delete pipeline.second;
+}
+
+/**
+ * Work out about how many rows each operator produces, for explain. The table is sampled (see
+ * DbRelation::estimate_rows), so this has to be done while the statement's transaction still holds
+ * what it locked. There are no statistics on the values in the columns, so each equality in a
+ * selection is taken to keep a tenth of the rows (System R's default).
+ */
+void EvalPlan::estimate() {
+    if (this->type == TableScan) {
+        this->estimated = this->table.estimate_rows();
+        return;
+    }
+    this->relation->estimate();
+    uint64_t rows = this->relation->estimated;
+    if (this->type != Select || rows == 0) {
+        this->estimated = rows;
+        return;
     }
+    double selected = (double) rows;
+    for (size_t i = 0; i < this->select_conjunction->size(); i++)
+        selected /= 10.0;
+    this->estimated = std::max((uint64_t) 1, (uint64_t) std::llround(selected));
+}
 
-    throw DbRelationError("Not implemented: pipeline other than Select or TableScan");
-}
\ No newline at end of file
+/**
+ * Have every operator of the plan count what it does from now on (see explain).
+ */
+void EvalPlan::analyze() {
+    for (EvalPlan *plan = this; plan != nullptr; plan = plan->relation)
+        plan->analyzing = true;
+}
+
+/**
+ * The plan, an operator to a line, each one indented under the one it hands its rows to, with the
+ * rows it is expected to produce (if estimate has been called; nothing is read from the tables here). If the plan was analyzed and has run, each operator also has the
+ * rows it did produce and, counting the operators under it, the time it took and the blocks it read
+ * and found in memory; then the time it took itself, and the most memory it held.
+ * @return  the plan
+ */
+std::string EvalPlan::explain() const {
+    std::string text;
+    explain(text, 0, false);
+    return text;
+}
+
+// this operator's line, then its relation's (folded if this operator does the relation's work for it)
+void EvalPlan::explain(std::string &text, int depth, bool folded) const {
+    std::ostringstream line;
+    line << std::string(2 * depth, ' ');
+    switch (this->type) {
+        case ProjectAll:
+            line << "ProjectAll";
+            break;
+        case Project:
+            line << "Project";
+            for (size_t i = 0; i < this->projection->size(); i++)
+                line << (i == 0 ? " " : ", ") << (*this->projection)[i];
+            break;
+        case Select: {
+            line << "Select";
+            const char *separator = " ";
+            for (auto const &condition: *this->select_conjunction) {
+                line << separator << condition.first << " = ";
+                if (condition.second.data_type == ColumnAttribute::TEXT)
+                    line << "\"" << condition.second.s << "\"";
+                else
+                    line << condition.second;
+                separator = " and ";
+            }
+            break;
+        }
+        case TableScan:
+            line << "TableScan " << this->table.get_table_name();
+            break;
+    }
+    if (this->estimated != NOT_ESTIMATED)
+        line << "  (estimated rows " << this->estimated << ")";
+    if (folded) {
+        line << "  (scanned by the Select above)";
+    } else if (this->analyzing && !this->stats.ran) {
+        line << "  (never ran)";
+    } else if (this->analyzing) {
+        EvalStats total = this->total();
+        line << std::fixed << std::setprecision(3) << "  (actual rows " << this->stats.rows << ", time "
+             << (double) total.time_ns / 1e6 << " ms, blocks read " << total.blocks_read << ", buffer hits "
+             << total.block_hits << "; self " << (double) this->stats.time_ns / 1e6 << " ms, memory "
+             << this->stats.memory << " bytes)";
+    }
+    text += line.str() + "\n";
+    if (this->relation != nullptr)
+        this->relation->explain(text, depth + 1, this->type == Select && this->relation->type == TableScan);
+}
+
+// what this operator and the ones under it did, all together
+EvalStats EvalPlan::total() const {
+    EvalStats ret = this->stats;
+    if (this->relation != nullptr) {
+        EvalStats under = this->relation->total();
+        ret.time_ns += under.time_ns;
+        ret.blocks_read += under.blocks_read;
+        ret.block_hits += under.block_hits;
+    }
+    return ret;
+}
@@ -4,20 +4,46 @@
  * @see Seattle University, CPSC5300
  */
 #include <cstring>
+#include <mutex>
 #include "db_cxx.h"
 #include "HeapFile.h"
+#include "PerfCounters.h"
 
 using namespace std;
 typedef uint16_t u16;
 
+HeapFile::VerifyMode HeapFile::verify_mode = HeapFile::VERIFY_ALWAYS;
+uint32_t HeapFile::write_back = 256;
+thread_local map<HeapFile *, HeapFile::Blocks> HeapFile::dirty;
+thread_local set<HeapFile *> HeapFile::dirty_files;
+set<HeapFile *> HeapFile::open_files;
+map<string, DbTxn *> HeapFile::new_files;
+mutex HeapFile::registry_mutex;
+thread_local uint64_t HeapFile::changed = 0;
+
 /**
  * Constructor
  * @param name
+ * @param block_size  size of the blocks if the file gets created
  */
-HeapFile::HeapFile(string name) : DbFile(name), dbfilename(""), last(0), closed(true), db(_DB_ENV, 0) {
+HeapFile::HeapFile(string name, uint32_t block_size) : DbFile(name), dbfilename(""), block_size(block_size), last(0),
+                                                       closed(true), db(nullptr), opened_in(nullptr),
+                                                       written_in(nullptr) {
+    if (!is_valid_block_size(block_size))
+        throw DbRelationError("invalid block size " + to_string(block_size));
     this->dbfilename = this->name + ".db";
 }
 
+HeapFile::~HeapFile() {
+    if (!this->closed)
+        flush();
+    unregister();
+    if (this->db != nullptr) {
+        this->db->close(0);
+        delete this->db;
+    }
+}
+
 /**
  * Create physical file.
  */
@@ -31,9 +57,10 @@ void HeapFile::create(void) {
  * Delete the physical file.
  */
 void HeapFile::drop(void) {
+    discard();
     close();
-    Db db(_DB_ENV, 0);
-    db.remove(this->dbfilename.c_str(), nullptr, 0);
+    changed++;
+    _DB_ENV->dbremove(_DB_TXN, this->dbfilename.c_str(), nullptr, 0);
 }
 
 /**
@@ -47,50 +74,245 @@ void HeapFile::open(void) {
  * Close the physical file.
  */
 void HeapFile::close(void) {
-    this->db.close(0);
+    lock_guard<recursive_mutex> guard(this->latch);
+    if (!this->closed)
+        flush();
+    if (this->db != nullptr) {
+        this->db->close(0);
+        delete this->db;  // Berkeley DB handles can't be opened again once closed
+        this->db = nullptr;
+    }
+    {
+        lock_guard<mutex> lock(registry_mutex);
+        open_files.erase(this);
+    }
     this->closed = true;
+    this->verified.clear();
 }
 
 /**
  * Allocate a new block for the database file.
- * @return the new empty DbBlock that is managing the records in this block and its block id.
+ * @return the new empty DbBlock that is managing the records in this block and its block id (the caller's
+ *         own copy, freed by caller)
  */
 SlottedPage *HeapFile::get_new(void) {
-    char block[DbBlock::BLOCK_SZ];
-    memset(block, 0, sizeof(block));
-    Dbt data(block, sizeof(block));
+    PerfCounters::mine().blocks_allocated++;
+    char *block = new char[this->block_size];
+    memset(block, 0, this->block_size);
+    Dbt data(block, this->block_size);
+    BlockID block_id = ++this->last;
+    SlottedPage *page = new SlottedPage(data, block_id, true);
+    page->adopt();
+    page->set_checksum();
 
-    int block_id = ++this->last;
-    Dbt key(&block_id, sizeof(block_id));
-
-    // write out an empty block and read it back in so Berkeley DB is managing the memory
-    SlottedPage *page = new SlottedPage(data, this->last, true);
-    this->db.put(nullptr, &key, &data, 0); // write it out with initialization done to it
-    delete page;
-    this->db.get(nullptr, &key, &data, 0);
-    return new SlottedPage(data, this->last);
+    // the new block starts out dirty; it gets to Berkeley DB with the next flush
+    char *written = new char[this->block_size];
+    memcpy(written, block, this->block_size);
+    dirty[this][block_id] = written;
+    this->written_in = _DB_TXN;
+    changed++;
+    mark_dirty();
+    mark_verified(block_id);
+    return page;
 }
 
 /**
- * Get a block from the database file.
+ * Get a block from the database file. A block our transaction can't see (one added by a transaction
+ * that hasn't committed, or that committed after our snapshot was taken) comes back empty.
  * @param block_id
- * @return          the given slotted page (freed by caller)
+ * @return          the given slotted page (the caller's own copy, freed by caller)
  */
 SlottedPage *HeapFile::get(BlockID block_id) {
+    PerfCounters::mine().heap_gets++;
+    char *block = new char[this->block_size];
+    auto mine = dirty.find(this);
+    if (mine != dirty.end()) {
+        auto written = mine->second.find(block_id);
+        if (written != mine->second.end()) {
+            PerfCounters::mine().block_hits++;
+            memcpy(block, written->second, this->block_size);  // newer than what Berkeley DB has
+            Dbt data(block, this->block_size);
+            SlottedPage *page = new SlottedPage(data, block_id, false);
+            page->adopt();
+            return page;
+        }
+    }
+    PerfCounters::mine().blocks_read++;
     Dbt key(&block_id, sizeof(block_id));
-    Dbt data;
-    this->db.get(nullptr, &key, &data, 0);
-    return new SlottedPage(data, block_id, false);
+    Dbt data(block, this->block_size);
+    data.set_ulen(this->block_size);
+    data.set_flags(DB_DBT_USERMEM);
+    int status;
+    try {
+        status = this->db->get(_DB_TXN, &key, &data, 0);
+    } catch (...) {
+        delete[] block;
+        throw;
+    }
+    if (status == DB_NOTFOUND || status == DB_KEYEMPTY) {
+        memset(block, 0, this->block_size);
+        Dbt empty(block, this->block_size);
+        SlottedPage *page = new SlottedPage(empty, block_id, true);
+        page->adopt();
+        return page;
+    }
+    SlottedPage *page = new SlottedPage(data, block_id, false);
+    page->adopt();
+    verify(page);
+    return page;
 }
 
 /**
- * Write a block back to the database file.
+ * Write a block back to the database file. A copy of the block is kept as one of this thread's dirty
+ * blocks until the next flush, so writing it again before then costs only a copy. The block itself is
+ * still the caller's.
  * @param block
  */
 void HeapFile::put(DbBlock *block) {
-    int block_id = block->get_block_id();
-    Dbt key(&block_id, sizeof(block_id));
-    this->db.put(nullptr, &key, block->get_block(), 0);
+    PerfCounters::mine().heap_puts++;
+    BlockID block_id = block->get_block_id();
+    static_cast<SlottedPage *>(block)->set_checksum();  // all our blocks are SlottedPages
+    Blocks &mine = dirty[this];
+    char *&data = mine[block_id];
+    if (data == nullptr)
+        data = new char[this->block_size];
+    memcpy(data, block->get_data(), this->block_size);
+    this->written_in = _DB_TXN;
+    changed++;
+    mark_dirty();
+    mark_verified(block_id);
+    if (mine.size() > write_back)
+        flush();
+}
+
+/**
+ * Write this thread's dirty blocks back to Berkeley DB, in block order.
+ * If Berkeley DB fails part-way, the blocks not yet written are still dirty (and the transaction is
+ * about to be aborted, which discards them).
+ */
+void HeapFile::flush() {
+    auto mine = dirty.find(this);
+    if (mine != dirty.end()) {
+        Blocks &blocks = mine->second;
+        for (auto written = blocks.begin(); written != blocks.end();) {
+            BlockID block_id = written->first;
+            Dbt key(&block_id, sizeof(block_id));
+            Dbt data(written->second, this->block_size);
+            this->db->put(_DB_TXN, &key, &data, 0);
+            delete[] written->second;
+            written = blocks.erase(written);
+        }
+        dirty.erase(mine);
+    }
+    mark_clean();
+}
+
+/**
+ * Write back this thread's dirty blocks of every file (done at the end of each statement).
+ */
+void HeapFile::flush_all() {
+    while (!dirty_files.empty())
+        (*dirty_files.begin())->flush();  // takes it out of dirty_files
+}
+
+/**
+ * Throw away this thread's dirty blocks of every Berkeley DB file (their transaction is being aborted).
+ */
+void HeapFile::discard_all() {
+    while (!dirty.empty())
+        dirty.begin()->first->HeapFile::discard();
+}
+
+/**
+ * A transaction has committed, so the files it created, the handles opened in it, and the blocks it
+ * wrote are its parent's now (or, for a top-level transaction, nobody's in particular).
+ * @param txn     the transaction
+ * @param parent  its parent, or nullptr
+ */
+void HeapFile::committed(DbTxn *txn, DbTxn *parent) {
+    lock_guard<mutex> lock(registry_mutex);
+    for (HeapFile *file: open_files) {
+        if (file->opened_in == txn)
+            file->opened_in = parent;
+        if (file->written_in == txn)
+            file->written_in = parent;
+    }
+    for (auto file = new_files.begin(); file != new_files.end();) {
+        if (file->second != txn) {
+            ++file;
+        } else if (parent != nullptr) {
+            file->second = parent;
+            ++file;
+        } else {
+            file = new_files.erase(file);
+        }
+    }
+}
+
+/**
+ * A transaction has been aborted (and this thread's dirty blocks discarded), so get the files it used
+ * back in step with it. Handles opened in it are no good any more (and their files may be gone), so
+ * they are closed; the file is opened again when next needed. The files it wrote to stay open, but are
+ * counted again, since the blocks it added have been taken back. Nobody else can be writing to those
+ * (see HeapTable), so the count is good for everyone.
+ * @param txn     the transaction
+ * @param parent  its parent, or nullptr (the blocks written by the parent are still there)
+ */
+void HeapFile::aborted(DbTxn *txn, DbTxn *parent) {
+    vector<HeapFile *> closing, counting;
+    {
+        lock_guard<mutex> lock(registry_mutex);
+        for (HeapFile *file: open_files) {
+            if (file->opened_in == txn)
+                closing.push_back(file);
+            else if (file->written_in == txn)
+                counting.push_back(file);
+        }
+        for (auto file = new_files.begin(); file != new_files.end();)
+            file = file->second == txn ? new_files.erase(file) : next(file);
+    }
+    for (HeapFile *file: closing)
+        file->close();
+    for (HeapFile *file: counting) {
+        file->last = file->get_block_count();
+        file->written_in = parent;
+    }
+}
+
+/**
+ * Throw away this thread's dirty blocks without writing them (the file is about to be dropped).
+ */
+void HeapFile::discard() {
+    auto mine = dirty.find(this);
+    if (mine != dirty.end()) {
+        for (auto const &written: mine->second)
+            delete[] written.second;
+        dirty.erase(mine);
+    }
+    mark_clean();
+}
+
+/**
+ * Note that this thread has blocks to write back to this file.
+ */
+void HeapFile::mark_dirty() {
+    dirty_files.insert(this);
+}
+
+/**
+ * Note that this thread has no more blocks to write back to this file.
+ */
+void HeapFile::mark_clean() {
+    dirty_files.erase(this);
+}
+
+/**
+ * Take this file out of the lists of open and dirty files (it is going away).
+ */
+void HeapFile::unregister() {
+    HeapFile::discard();
+    lock_guard<mutex> lock(registry_mutex);
+    open_files.erase(this);
 }
 
 /**
@@ -105,15 +327,37 @@ BlockIDs *HeapFile::block_ids() const {
 }
 
 /**
- * Ask BerkDb how many blocks we are currently using in the file.
+ * Start a sequential scan of all the blocks.
+ * @return  the scan (freed by caller)
+ */
+HeapFileScan *HeapFile::scan() {
+    flush();  // the scan reads straight from Berkeley DB
+    return new HeapFileScan(*this);
+}
+
+/**
+ * Ask BerkDb for the id of the last block in the file (as the current transaction sees it), which is
+ * how many blocks we are using.
  * @return number of blocks
  */
 uint32_t HeapFile::get_block_count() {
-    DB_BTREE_STAT *stat;
-    this->db.stat(nullptr, &stat, DB_FAST_STAT);
-    uint32_t bt_ndata = stat->bt_ndata;
-    free(stat);
-    return bt_ndata;
+    Dbc *cursor;
+    this->db->cursor(_DB_TXN, &cursor, 0);
+    db_recno_t block_id = 0;
+    Dbt key(&block_id, sizeof(block_id));
+    key.set_ulen(sizeof(block_id));
+    key.set_flags(DB_DBT_USERMEM);
+    Dbt data;  // we only want the key
+    data.set_flags(DB_DBT_USERMEM | DB_DBT_PARTIAL);
+    int status;
+    try {
+        status = cursor->get(&key, &data, DB_LAST);
+    } catch (...) {
+        cursor->close();
+        throw;
+    }
+    cursor->close();
+    return status == 0 ? block_id : 0;
 }
 
 /**
@@ -123,10 +367,154 @@ uint32_t HeapFile::get_block_count() {
 void HeapFile::db_open(uint flags) {
     if (!this->closed)
         return;
-    this->db.set_re_len(DbBlock::BLOCK_SZ); // record length - will be ignored if file already exists
-    this->db.open(nullptr, this->dbfilename.c_str(), nullptr, DB_RECNO, flags, 0644);
+    lock_guard<recursive_mutex> guard(this->latch);
+    if (!this->closed)
+        return;  // somebody else opened it while we waited
+
+    // a new file has to be made in the transaction that wants it, and opened in it until that commits
+    // (nobody else can see it till then); any other file is opened in a transaction of its own
+    DbTxn *txn = nullptr;
+    if (flags != 0) {
+        txn = _DB_TXN;
+    } else {
+        lock_guard<mutex> lock(registry_mutex);
+        if (new_files.find(this->dbfilename) != new_files.end())
+            txn = _DB_TXN;
+    }
+    this->db = new Db(_DB_ENV, 0);
+    try {
+        this->db->set_re_len(this->block_size); // record length - will be ignored if file already exists
+        // multiversion, so snapshot transactions can read the file without waiting for its writers, and
+        // free-threaded, so they can all read it at once
+        this->db->open(txn, this->dbfilename.c_str(), nullptr, DB_RECNO,
+                       flags | DB_MULTIVERSION | DB_THREAD | (txn == nullptr ? DB_AUTO_COMMIT : 0), 0644);
+    } catch (DbException &e) {
+        this->db->close(0);
+        delete this->db;
+        this->db = nullptr;
+        throw;
+    }
+    this->db->get_re_len(&this->block_size); // an existing file keeps the block size it was created with
 
     this->last = flags ? 0 : get_block_count();
+    this->opened_in = txn;
+    this->written_in = nullptr;
+    {
+        lock_guard<mutex> lock(registry_mutex);
+        open_files.insert(this);
+        if (flags != 0 && txn != nullptr)
+            new_files[this->dbfilename] = txn;
+    }
     this->closed = false;
 }
 
+
+/**
+ * Check a block just read against its checksum (as called for by verify_mode). Its format is always checked.
+ * @param page  the block just read (deleted here if it is corrupt)
+ * @throws DbRelationError if the block does not match its checksum, or is in some other format
+ */
+void HeapFile::verify(SlottedPage *page) {
+    BlockID block_id = page->get_block_id();
+    if (!page->format_ok()) {
+        delete page;
+        throw DbRelationError("block " + to_string(block_id) + " of " + this->dbfilename
+                              + " is in an unsupported format (the database environment was made by an older"
+                                " version; start with an empty one)");
+    }
+    if (verify_mode == VERIFY_NEVER)
+        return;
+    if (verify_mode == VERIFY_ONCE) {
+        lock_guard<recursive_mutex> guard(this->latch);
+        if (block_id < this->verified.size() && this->verified[block_id])
+            return;
+    }
+    if (!page->checksum_ok()) {
+        delete page;
+        throw DbRelationError("checksum mismatch in block " + to_string(block_id) + " of " + this->dbfilename);
+    }
+    mark_verified(block_id);
+}
+
+/**
+ * Remember that a block is known to be intact, so VERIFY_ONCE can skip checking it again.
+ * @param block_id  block just verified or written
+ */
+void HeapFile::mark_verified(BlockID block_id) {
+    if (verify_mode != VERIFY_ONCE)
+        return;  // nobody will ask
+    lock_guard<recursive_mutex> guard(this->latch);
+    if (block_id >= this->verified.size())
+        this->verified.resize(block_id + 1, false);
+    this->verified[block_id] = true;
+}
+
+/**
+ * Check that a requested block size is one we can use.
+ * @param block_size  candidate block size in bytes
+ * @return            true if it is a power of two between DbBlock::MIN_BLOCK_SZ and DbBlock::MAX_BLOCK_SZ
+ */
+bool HeapFile::is_valid_block_size(uint32_t block_size) {
+    return block_size >= DbBlock::MIN_BLOCK_SZ && block_size <= DbBlock::MAX_BLOCK_SZ &&
+           (block_size & (block_size - 1)) == 0;
+}
+
+
+/**
+ * Set up a sequential scan (nothing is read until the first call to next()).
+ * @param file  the (open) file to scan
+ */
+HeapFileScan::HeapFileScan(HeapFile &file) : file(file), cursor(nullptr), buffer(nullptr), bulk(), batch(nullptr),
+                                             done(false) {
+}
+
+HeapFileScan::~HeapFileScan() {
+    delete this->batch;
+    if (this->cursor != nullptr)
+        this->cursor->close();
+    delete[] this->buffer;
+}
+
+/**
+ * Get the next block in the file.
+ * @return  the next block (freed by caller, and only good until the next call), or nullptr after the last one
+ * @throws DbRelationError if the block does not match its checksum
+ */
+SlottedPage *HeapFileScan::next() {
+    db_recno_t block_id;
+    Dbt data;
+    while (this->batch == nullptr || !this->batch->next(block_id, data)) {
+        delete this->batch;
+        this->batch = nullptr;
+        if (this->done)
+            return nullptr;
+        if (this->cursor == nullptr)
+            start();
+        db_recno_t recno;
+        Dbt key(&recno, sizeof(recno));
+        key.set_ulen(sizeof(recno));
+        key.set_flags(DB_DBT_USERMEM);
+        if (this->cursor->get(&key, &this->bulk, DB_NEXT | DB_MULTIPLE_KEY) == DB_NOTFOUND) {
+            this->done = true;
+            return nullptr;
+        }
+        this->batch = new DbMultipleRecnoDataIterator(this->bulk);
+    }
+    PerfCounters::mine().blocks_read++;
+    SlottedPage *page = new SlottedPage(data, block_id, false);
+    this->file.verify(page);
+    return page;
+}
+
+/**
+ * Open a cursor on the file and get the bulk retrieval buffer ready.
+ */
+void HeapFileScan::start() {
+    // room for a good number of blocks at a time; Berkeley DB wants a multiple of 1kB
+    uint32_t size = max(BULK_SZ, 16 * (this->file.get_block_size() + 1024));
+    this->buffer = new char[size];
+    this->bulk.set_data(this->buffer);
+    this->bulk.set_ulen(size);
+    this->bulk.set_flags(DB_DBT_USERMEM);
+    this->file.db->cursor(_DB_TXN, &this->cursor, 0);
+}
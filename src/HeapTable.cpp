@@ -3,20 +3,60 @@
  * @author K Lundeen
  * @see Seattle University, CPSC5300
  */
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
 #include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <unordered_map>
 #include "HeapTable.h"
+#include "LockManager.h"
+#include "PerfCounters.h"
+#include "Transaction.h"
 
 using namespace std;
 typedef uint16_t u16;
 
+// every table's version, by name (see HeapTable::version); the counters stay put once made
+static mutex versions_mutex;
+static unordered_map<Identifier, atomic<uint64_t>> versions;
+
 /**
  * Constructor
  * @param table_name
  * @param column_names
  * @param column_attributes
+ * @param block_size         size of the table's blocks (only used when the table is created)
+ * @param storage            "heap" for a Berkeley DB file, "mmap" for a memory-mapped file, or "direct" for a
+ *                           file read and written with direct I/O
  */
-HeapTable::HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes) : DbRelation(
-        table_name, column_names, column_attributes), file(table_name) {
+HeapTable::HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes,
+                     uint32_t block_size, const string &storage) : DbRelation(table_name, column_names,
+                                                                              column_attributes),
+                                                                   file(nullptr), overflow(nullptr), storage(storage),
+                                                                   writes(version(table_name)) {
+    if (!is_valid_storage(storage))
+        throw DbRelationError("unknown storage " + storage);
+    // the overflow pages are kept the same way as the rows, so a rollback takes back both or neither
+    if (storage == "mmap") {
+        this->file = new MmapFile(table_name, block_size);
+        this->overflow = new MmapFile(table_name + ".overflow", block_size);
+    } else if (storage == "direct") {
+        this->file = new DirectFile(table_name, block_size);
+        this->overflow = new DirectFile(table_name + ".overflow", block_size);
+    } else {
+        this->file = new HeapFile(table_name, block_size);
+        this->overflow = new HeapFile(table_name + ".overflow", block_size);
+    }
+}
+
+HeapTable::~HeapTable() {
+    delete this->overflow;
+    delete this->file;
 }
 
 /**
@@ -24,7 +64,8 @@ HeapTable::HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttr
  * Is not responsible for metadata storage or validation.
  */
 void HeapTable::create() {
-    file.create();
+    this->writes++;
+    file->create();
 }
 
 /**
@@ -43,30 +84,66 @@ void HeapTable::create_if_not_exists() {
  * Execute: DROP TABLE <table_name>
  */
 void HeapTable::drop() {
-    file.drop();
+    this->writes++;
+    file->drop();
+    try {
+        overflow->drop();
+    } catch (DbException &e) {
+        if (e.get_errno() != ENOENT)
+            throw;
+        // never needed any overflow pages, so there is no file to remove
+    }
 }
 
 /**
  * Open existing table. Enables: insert, update, delete, select, project
  */
 void HeapTable::open() {
-    file.open();
+    file->open();
 }
 
 /**
  * Closes the table. Disables: insert, update, delete, select, project
  */
 void HeapTable::close() {
-    file.close();
+    file->close();
+}
+
+/**
+ * Locks the table for reading it, for the rest of the transaction.
+ * Memory-mapped and direct tables keep their blocks in the one place for everyone, so they are only
+ * ever used by one transaction at a time (exclusive). A Berkeley DB table is locked shared, unless we
+ * are reading from a snapshot, which nobody else's changes get into anyway.
+ * @throws DeadlockError if locking the table would deadlock
+ */
+void HeapTable::lock_to_read() {
+    if (this->storage != "heap")
+        LockManager::lock_table(this->table_name, LockManager::X);
+    else if (!Transaction::reads_snapshot())
+        LockManager::lock_table(this->table_name, LockManager::S);
+}
+
+/**
+ * Locks the table for changing it, for the rest of the transaction.
+ * Only one transaction at a time writes to a table (exclusive): the new blocks and the block count
+ * belong to that transaction until it is over (see HeapFile).
+ * @throws DeadlockError if locking the table would deadlock
+ */
+void HeapTable::lock_to_write() {
+    LockManager::lock_table(this->table_name, LockManager::X);
 }
 
 /**
  * Execute: INSERT INTO <table_name> (<row_keys>) VALUES (<row_values>)
+ * The table is locked (exclusively) for the rest of the transaction.
  * @param row a dictionary with column name keys
  * @return the handle of the inserted row
+ * @throws DeadlockError if locking the table would deadlock
  */
 Handle HeapTable::insert(const ValueDict *row) {
     open();
+    this->writes++;
+    lock_to_write();
     ValueDict *full_row = validate(row);
     Handle handle = append(full_row);
     delete full_row;
@@ -77,27 +154,146 @@ Handle HeapTable::insert(const ValueDict *row) {
  * Conceptually, execute: UPDATE INTO <table_name> SET <new_values> WHERE <handle>
  * where handle is sufficient to identify one specific record (e.g., returned from an insert
  * or select).
+ * The row is rewritten in place if it still fits in its block. If not, it is moved to the end of
+ * the file and the original record becomes a forwarding stub, so the handle stays valid. A row that
+ * has already moved is only ever one hop from its stub.
+ * The table is locked (exclusively) for the rest of the transaction, waiting for anyone else who has it.
+ * Long TEXT values that aren't changing keep the overflow chains they have; the chains of the ones
+ * that are changing are freed.
  * @param handle the row to be updated
  * @param new_values a dictionary with column name keys
+ * @throws DeadlockError if locking the table would deadlock
  */
 void HeapTable::update(const Handle handle, const ValueDict *new_values) {
-    throw DbRelationError("Not implemented");
+    open();
+    this->writes++;
+    lock_to_write();
+    ValueDict *row = project(handle);
+    OverflowChains old_chains = overflow_chains(handle), kept;
+    for (auto const &chain: old_chains) {
+        auto change = new_values->find(chain.first);
+        if (change == new_values->end() || change->second == row->at(chain.first))
+            kept.insert(chain);
+    }
+    for (auto const &column: *new_values) {
+        if (row->find(column.first) == row->end()) {
+            delete row;
+            throw DbRelationError("table does not have column named '" + column.first + "'");
+        }
+        (*row)[column.first] = column.second;
+    }
+    ValueDict *full_row = validate(row);
+    delete row;
+    Dbt *data = marshal(full_row, &kept);
+    delete full_row;
+
+    // find where the row lives now (only one block at a time, since a direct file's cache reuses its buffers)
+    SlottedPage *block = this->file->get(handle.first);
+    Handle location = handle;
+    bool forwarded = (block->get_flags(handle.second) & SlottedPage::FORWARD) != 0;
+    if (forwarded) {
+        Dbt *stub = block->get(handle.second);
+        location = unmarshal_handle(stub);
+        delete stub;
+        delete block;
+        block = this->file->get(location.first);
+    }
+
+    try {
+        block->put(location.second, *data);
+        this->file->put(block);
+        delete block;
+    } catch (DbBlockNoRoomError &e) {
+        // doesn't fit where it is, so move it
+        delete block;
+        Handle moved = append(data, SlottedPage::MOVED);
+        if (forwarded) {
+            block = this->file->get(location.first);
+            block->del(location.second);
+            this->file->put(block);
+            delete block;
+        }
+        Dbt *stub = marshal_handle(moved);
+        block = this->file->get(handle.first);
+        try {
+            block->put(handle.second, *stub);
+        } catch (DbBlockNoRoomError &e) {
+            // can only happen if the original row was smaller than a stub; undo the move
+            delete block;
+            delete[] (char *) stub->get_data();
+            delete stub;
+            block = this->file->get(moved.first);
+            block->del(moved.second);
+            this->file->put(block);
+            delete block;
+            for (auto const &chain: overflow_chains(data))
+                if (kept.find(chain.first) == kept.end())
+                    free_overflow(chain.second);  // the new values' chains
+            delete[] (char *) data->get_data();
+            delete data;
+            throw DbRelationError("no room to update row");
+        }
+        block->set_flags(handle.second, SlottedPage::FORWARD);
+        this->file->put(block);
+        delete block;
+        delete[] (char *) stub->get_data();
+        delete stub;
+    }
+    delete[] (char *) data->get_data();
+    delete data;
+    for (auto const &chain: old_chains)
+        if (kept.find(chain.first) == kept.end())
+            free_overflow(chain.second);
 }
 
 /**
  * Conceptually, execute: DELETE FROM <table_name> WHERE <handle>
  * where handle is sufficient to identify one specific record (e.g., returned from an insert
  * or select).
+ * The table is locked (exclusively) for the rest of the transaction, waiting for anyone else who has it.
+ * Any overflow chains the row refers to are freed.
  * @param handle the row to be deleted
+ * @throws DeadlockError if locking the table would deadlock
  */
 void HeapTable::del(const Handle handle) {
     open();
+    this->writes++;
+    lock_to_write();
     BlockID block_id = handle.first;
     RecordID record_id = handle.second;
-    SlottedPage *block = this->file.get(block_id);
+    SlottedPage *block = this->file->get(block_id);
+    Handle moved(0, 0);
+    OverflowChains chains;
+    Dbt *data = block->get(record_id);
+    if (block->get_flags(record_id) & SlottedPage::FORWARD)
+        moved = unmarshal_handle(data);
+    else
+        chains = overflow_chains(data);
+    delete data;
     block->del(record_id);
-    this->file.put(block);
+    this->file->put(block);
     delete block;
+    if (moved.first != 0) {
+        block = this->file->get(moved.first);
+        data = block->get(moved.second);
+        chains = overflow_chains(data);
+        delete data;
+        block->del(moved.second);
+        this->file->put(block);
+        delete block;
+    }
+    for (auto const &chain: chains)
+        free_overflow(chain.second);
+}
+
+/**
+ * Get a table's version.
+ * @param table_name  the table
+ * @return            its version counter
+ */
+atomic<uint64_t> &HeapTable::version(const Identifier &table_name) {
+    lock_guard<mutex> guard(versions_mutex);
+    return versions[table_name];
 }
 
 /**
@@ -112,24 +308,85 @@ Handles *HeapTable::select() {
  * The select command
  * @param where predicates to match
  * @return list of handles of the selected rows
+ * @throws DeadlockError if locking the table would deadlock
  */
 Handles *HeapTable::select(const ValueDict *where) {
-    open();
     Handles *handles = new Handles();
-    BlockIDs *block_ids = file.block_ids();
-    for (auto const &block_id: *block_ids) {
-        SlottedPage *block = file.get(block_id);
-        RecordIDs *record_ids = block->ids();
-        for (auto const &record_id: *record_ids) {
-            Handle handle(block_id, record_id);
-            if (selected(handle, where))
-                handles->push_back(Handle(handle));
+    try {
+        select(where, [handles](Handle handle) { handles->push_back(handle); });
+    } catch (...) {
+        delete handles;
+        throw;
+    }
+    return handles;
+}
+
+/**
+ * The select command, handing over each row as the scan comes to it.
+ * The whole table is locked for reading for the rest of the transaction (see lock_to_read), so nobody
+ * can change or add rows it would have selected.
+ * @param where predicates to match
+ * @param visit called with the handle of each selected row
+ * @throws DeadlockError if locking the table would deadlock
+ */
+void HeapTable::select(const ValueDict *where, const HandleVisitor &visit) {
+    open();
+    lock_to_read();
+    HeapFileScan *scan = file->scan();
+    SlottedPage *block = nullptr;
+    try {
+        for (block = scan->next(); block != nullptr; block = scan->next()) {
+            BlockID block_id = block->get_block_id();
+            for (RecordID record_id = block->next_id(); record_id != 0; record_id = block->next_id(record_id)) {
+                uint32_t flags = block->get_flags(record_id);
+                if (flags & SlottedPage::MOVED)
+                    continue;  // will get it through its forwarding stub
+                Handle handle(block_id, record_id);
+                bool is_selected;
+                if (flags & SlottedPage::FORWARD) {
+                    is_selected = selected(handle, where);
+                } else {
+                    Dbt *data = block->get(record_id);  // the row is right here, no need to look its block up again
+                    is_selected = selected(data, where);
+                    delete data;
+                }
+                if (is_selected)
+                    visit(handle);
+            }
+            delete block;
         }
-        delete record_ids;
+    } catch (...) {
         delete block;
+        delete scan;
+        throw;
     }
-    delete block_ids;
-    return handles;
+    delete scan;
+}
+
+/**
+ * About how many rows the table has, without reading all of it: the rows in its first and last
+ * blocks, averaged, times the number of blocks.
+ * @return the estimate
+ */
+uint64_t HeapTable::estimate_rows() {
+    open();
+    lock_to_read();
+    BlockID last = file->get_last_block_id();
+    if (last == 0)
+        return 0;
+    uint64_t rows = 0;
+    uint32_t sampled = 0;
+    for (BlockID block_id: {(BlockID) 1, last}) {
+        if (sampled > 0 && block_id == 1)
+            break;  // only one block
+        SlottedPage *block = file->get(block_id);
+        for (RecordID record_id = block->next_id(); record_id != 0; record_id = block->next_id(record_id))
+            if (!(block->get_flags(record_id) & SlottedPage::MOVED))
+                rows++;
+        delete block;
+        sampled++;
+    }
+    return rows * last / sampled;
 }
 
 /**
@@ -158,28 +415,40 @@ ValueDict *HeapTable::project(Handle handle) {
 
 /**
  * Project given columns from a given row.
+ * A memory-mapped or direct table is locked for reading (see lock_to_read); otherwise, unless we are
+ * reading from a snapshot, the row is locked (shared) for the rest of the transaction.
  * @param handle row to be projected
  * @param column_names of columns to be included in the result
  * @return a sequence of values for handle given by column_names
+ * @throws DeadlockError if locking the row would deadlock
  */
 ValueDict *HeapTable::project(Handle handle, const ColumnNames *column_names) {
+    if (this->storage != "heap")
+        lock_to_read();
+    else if (!Transaction::reads_snapshot())
+        LockManager::lock_record(this->table_name, handle, LockManager::S);
     BlockID block_id = handle.first;
     RecordID record_id = handle.second;
-    SlottedPage *block = file.get(block_id);
+    SlottedPage *block = file->get(block_id);
     Dbt *data = block->get(record_id);
-    ValueDict *row = unmarshal(data);
+    if (block->get_flags(record_id) & SlottedPage::FORWARD) {
+        Handle moved = unmarshal_handle(data);
+        delete data;
+        delete block;
+        block = file->get(moved.first);
+        data = block->get(moved.second);
+    }
+    ValueDict *row;
+    try {
+        row = unmarshal(data, column_names);
+    } catch (DbRelationError &e) {
+        delete data;
+        delete block;
+        throw;
+    }
     delete data;
     delete block;
-    if (column_names->empty())
-        return row;
-    ValueDict *result = new ValueDict();
-    for (auto const &column_name: *column_names) {
-        if (row->find(column_name) == row->end())
-            throw DbRelationError("table does not have column named '" + column_name + "'");
-        (*result)[column_name] = (*row)[column_name];
-    }
-    delete row;
-    return result;
+    return row;
 }
 
 /**
@@ -209,31 +478,75 @@ ValueDict *HeapTable::validate(const ValueDict *row) const {
  */
 Handle HeapTable::append(const ValueDict *row) {
     Dbt *data = marshal(row);
-    SlottedPage *block = this->file.get(this->file.get_last_block_id());
+    Handle handle = append(data);
+    delete[] (char *) data->get_data();
+    delete data;
+    return handle;
+}
+
+/**
+ * Appends an already marshaled record to the file.
+ * @param data   bits of the record
+ * @param flags  record flags to set on it (e.g., SlottedPage::MOVED)
+ * @return handle of the new record
+ */
+Handle HeapTable::append(const Dbt *data, uint32_t flags) {
+    SlottedPage *block = this->file->get(this->file->get_last_block_id());
     RecordID record_id;
     try {
         record_id = block->add(data);
     } catch (DbBlockNoRoomError &e) {
         // need a new block
         delete block;
-        block = this->file.get_new();
+        block = this->file->get_new();
         record_id = block->add(data);
     }
-    this->file.put(block);
+    if (flags)
+        block->set_flags(record_id, flags);
+    this->file->put(block);
     delete block;
-    delete[] (char *) data->get_data();
-    delete data;
-    return Handle(this->file.get_last_block_id(), record_id);
+    return Handle(this->file->get_last_block_id(), record_id);
 }
 
+/**
+ * @class OverflowWritten - overflow chains marshal has written for a row, freed again if the row can't
+ * be marshaled after all
+ */
+class OverflowWritten {
+public:
+    explicit OverflowWritten(HeapTable &table) : table(table), chains() {}
+
+    ~OverflowWritten() {
+        for (BlockID chain: this->chains) {
+            try {
+                this->table.free_overflow(chain);
+            } catch (...) {
+                // already failing; at worst the chain stays allocated (and the transaction is rolled back)
+            }
+        }
+    }
+
+    OverflowWritten(const OverflowWritten &other) = delete;
+
+    OverflowWritten &operator=(const OverflowWritten &other) = delete;
+
+    HeapTable &table;
+    vector<BlockID> chains;
+};
+
 /**
  * Figure out the bits to go into the file.
  * The caller is responsible for freeing the returned Dbt and its enclosed ret->get_data().
  * @param row data for the tuple
+ * @param keep overflow chains already holding some of the row's long TEXT values (which are not written again)
  * @return bits of the record as it should appear on disk
  */
-Dbt *HeapTable::marshal(const ValueDict *row) const {
-    char *bytes = new char[DbBlock::BLOCK_SZ]; // more than we need (we insist that one row fits into DbBlock::BLOCK_SZ)
+Dbt *HeapTable::marshal(const ValueDict *row, const OverflowChains *keep) {
+    PerfCounters::mine().rows_marshaled++;
+    const uint block_size = get_block_size();
+    unique_ptr<char[]> buffer(new char[block_size]); // more than we need (we insist that one row fits into a block)
+    char *bytes = buffer.get();
+    OverflowWritten written(*this);
     uint offset = 0;
     uint col_num = 0;
     for (auto const &column_name: this->column_names) {
@@ -242,22 +555,42 @@ Dbt *HeapTable::marshal(const ValueDict *row) const {
         Value value = column->second;
 
         if (ca.get_data_type() == ColumnAttribute::DataType::INT) {
-            if (offset + 4 > DbBlock::BLOCK_SZ - 4)
+            if (offset + 4 > block_size - 4)
                 throw DbRelationError("row too big to marshal");
             *(int32_t *) (bytes + offset) = value.n;
             offset += sizeof(int32_t);
         } else if (ca.get_data_type() == ColumnAttribute::DataType::TEXT) {
             u_long size = value.s.length();
-            if (size > UINT16_MAX)
-                throw DbRelationError("text field too long to marshal");
-            if (offset + 2 + size > DbBlock::BLOCK_SZ)
+            if (size > overflow_threshold()) {
+                // store it out-of-line and just keep the length and first overflow block in the row
+                if (size > UINT32_MAX)
+                    throw DbRelationError("text field too long to marshal");
+                if (offset + 2 + 4 + 4 > block_size)
+                    throw DbRelationError("row too big to marshal");
+                *(u16 *) (bytes + offset) = OVERFLOW_MARKER;
+                offset += sizeof(u16);
+                *(uint32_t *) (bytes + offset) = (uint32_t) size;
+                offset += sizeof(uint32_t);
+                BlockID chain;
+                auto kept = keep == nullptr ? OverflowChains::const_iterator() : keep->find(column_name);
+                if (keep != nullptr && kept != keep->end()) {
+                    chain = kept->second;
+                } else {
+                    chain = put_overflow(value.s);
+                    written.chains.push_back(chain);
+                }
+                *(BlockID *) (bytes + offset) = chain;
+                offset += sizeof(BlockID);
+                continue;
+            }
+            if (offset + 2 + size > block_size)
                 throw DbRelationError("row too big to marshal");
             *(u16 *) (bytes + offset) = size;
             offset += sizeof(u16);
             memcpy(bytes + offset, value.s.c_str(), size); // assume ascii for now
             offset += size;
         } else if (ca.get_data_type() == ColumnAttribute::DataType::BOOLEAN) {
-            if (offset + 1 > DbBlock::BLOCK_SZ - 1)
+            if (offset + 1 > block_size - 1)
                 throw DbRelationError("row too big to marshal");
             *(uint8_t *) (bytes + offset) = (uint8_t) value.n;
             offset += sizeof(uint8_t);
@@ -267,17 +600,27 @@ Dbt *HeapTable::marshal(const ValueDict *row) const {
     }
     char *right_size_bytes = new char[offset];
     memcpy(right_size_bytes, bytes, offset);
-    delete[] bytes;
     Dbt *data = new Dbt(right_size_bytes, offset);
+    written.chains.clear();  // the record refers to them now
     return data;
 }
 
 /**
  * Figure out the memory data structures from the given bits gotten from the file.
- * @param data file data for the tuple
+ * Only the requested columns are decoded, so overflow chains for other columns are never read.
+ * @param data          file data for the tuple
+ * @param column_names  columns to include in the result (all columns if null or empty)
  * @return row data for the tuple
+ * @throws DbRelationError if a requested column is not in this table
  */
-ValueDict *HeapTable::unmarshal(Dbt *data) const {
+ValueDict *HeapTable::unmarshal(Dbt *data, const ColumnNames *column_names) {
+    PerfCounters::mine().rows_unmarshaled++;
+    bool all = column_names == nullptr || column_names->empty();
+    if (!all) {
+        for (auto const &column_name: *column_names)
+            if (find(this->column_names.begin(), this->column_names.end(), column_name) == this->column_names.end())
+                throw DbRelationError("table does not have column named '" + column_name + "'");
+    }
     ValueDict *row = new ValueDict();
     Value value;
     char *bytes = (char *) data->get_data();
@@ -285,6 +628,7 @@ ValueDict *HeapTable::unmarshal(Dbt *data) const {
     uint col_num = 0;
     for (auto const &column_name: this->column_names) {
         ColumnAttribute ca = this->column_attributes[col_num++];
+        bool wanted = all || find(column_names->begin(), column_names->end(), column_name) != column_names->end();
         value.data_type = ca.get_data_type();
         if (ca.get_data_type() == ColumnAttribute::DataType::INT) {
             value.n = *(int32_t *) (bytes + offset);
@@ -292,22 +636,216 @@ ValueDict *HeapTable::unmarshal(Dbt *data) const {
         } else if (ca.get_data_type() == ColumnAttribute::DataType::TEXT) {
             u16 size = *(u16 *) (bytes + offset);
             offset += sizeof(u16);
-            char buffer[DbBlock::BLOCK_SZ];
-            memcpy(buffer, bytes + offset, size);
-            buffer[size] = '\0';
-            value.s = string(buffer);  // assume ascii for now
-            offset += size;
+            if (size == OVERFLOW_MARKER) {
+                uint32_t length = *(uint32_t *) (bytes + offset);
+                offset += sizeof(uint32_t);
+                BlockID first = *(BlockID *) (bytes + offset);
+                offset += sizeof(BlockID);
+                if (wanted)
+                    value.s = get_overflow(first, length);
+            } else {
+                if (wanted)
+                    value.s = string(bytes + offset, size);  // assume ascii for now
+                offset += size;
+            }
         } else if (ca.get_data_type() == ColumnAttribute::DataType::BOOLEAN) {
             value.n = *(uint8_t *) (bytes + offset);
             offset += sizeof(uint8_t);
         } else {
             throw DbRelationError("Only know how to unmarshal INT, TEXT, and BOOLEAN");
         }
-        (*row)[column_name] = value;
+        if (wanted)
+            (*row)[column_name] = value;
     }
     return row;
 }
 
+/**
+ * Open the overflow file, creating it the first time a table needs one.
+ */
+void HeapTable::open_overflow() {
+    try {
+        overflow->open();
+    } catch (DbException &e) {
+        overflow->create();
+    }
+}
+
+/**
+ * Store a long TEXT value in a chain of overflow pages.
+ * Each overflow page holds one record: the BlockID of the next page in the chain (0 at the end)
+ * followed by up to OVERFLOW_CHUNK bytes of the value. The chain is written back to front so
+ * each page already knows its successor.
+ * @param text  value to store
+ * @return      block id of the first page in the chain
+ */
+BlockID HeapTable::put_overflow(const string &text) {
+    open_overflow();
+    const size_t chunk = overflow_chunk();
+    char *bytes = new char[sizeof(BlockID) + chunk];
+    BlockID next = 0;
+    size_t chunks = (text.length() + chunk - 1) / chunk;
+    for (size_t i = chunks; i > 0; i--) {
+        size_t start = (i - 1) * chunk;
+        size_t size = min(chunk, text.length() - start);
+        *(BlockID *) bytes = next;
+        memcpy(bytes + sizeof(BlockID), text.data() + start, size);
+        Dbt data(bytes, (uint32_t) (sizeof(BlockID) + size));
+        SlottedPage *page = new_overflow_page();
+        page->add(&data);
+        this->overflow->put(page);
+        next = page->get_block_id();
+        delete page;
+    }
+    delete[] bytes;
+    return next;
+}
+
+/**
+ * Put a chain of overflow pages on the free list, so later chains can use its pages.
+ * Each freed page holds just the BlockID of the next free page (0 at the end).
+ * @param block_id  first page of the chain
+ */
+void HeapTable::free_overflow(BlockID block_id) {
+    open_overflow();
+    BlockID head = get_overflow_free_list();
+    while (block_id != 0) {
+        SlottedPage *page = this->overflow->get(block_id);
+        Dbt *data = page->get(1);
+        if (data == nullptr) {
+            delete page;
+            throw DbRelationError("overflow chain is damaged");
+        }
+        BlockID next = *(BlockID *) data->get_data();
+        delete data;
+        page->clear();
+        Dbt link(&head, sizeof(head));
+        page->add(&link);
+        this->overflow->put(page);
+        delete page;
+        head = block_id;
+        block_id = next;
+    }
+    set_overflow_free_list(head);
+}
+
+/**
+ * The first pages of the overflow chains a marshaled row refers to.
+ * @param data  the row's record (nullptr for none)
+ * @return      the chains, by column
+ */
+HeapTable::OverflowChains HeapTable::overflow_chains(const Dbt *data) const {
+    OverflowChains chains;
+    if (data == nullptr)
+        return chains;
+    char *bytes = (char *) data->get_data();
+    uint offset = 0;
+    uint col_num = 0;
+    for (auto const &column_name: this->column_names) {
+        ColumnAttribute ca = this->column_attributes[col_num++];
+        if (ca.get_data_type() == ColumnAttribute::DataType::INT) {
+            offset += sizeof(int32_t);
+        } else if (ca.get_data_type() == ColumnAttribute::DataType::TEXT) {
+            u16 size = *(u16 *) (bytes + offset);
+            offset += sizeof(u16);
+            if (size == OVERFLOW_MARKER) {
+                chains[column_name] = *(BlockID *) (bytes + offset + sizeof(uint32_t));
+                offset += sizeof(uint32_t) + sizeof(BlockID);
+            } else {
+                offset += size;
+            }
+        } else if (ca.get_data_type() == ColumnAttribute::DataType::BOOLEAN) {
+            offset += sizeof(uint8_t);
+        }
+    }
+    return chains;
+}
+
+/**
+ * The first pages of the overflow chains a stored row refers to (following it if it has moved).
+ * @param handle  the row
+ * @return        the chains, by column
+ */
+HeapTable::OverflowChains HeapTable::overflow_chains(Handle handle) {
+    SlottedPage *block = this->file->get(handle.first);
+    Dbt *data = block->get(handle.second);
+    if (block->get_flags(handle.second) & SlottedPage::FORWARD) {
+        Handle moved = unmarshal_handle(data);
+        delete data;
+        delete block;
+        block = this->file->get(moved.first);
+        data = block->get(moved.second);
+    }
+    OverflowChains chains = overflow_chains(data);
+    delete data;
+    delete block;
+    return chains;
+}
+
+/**
+ * A page for an overflow chain: one from the free list if there are any, otherwise a new one.
+ * @return  the page, empty (freed by caller)
+ */
+SlottedPage *HeapTable::new_overflow_page() {
+    BlockID head = get_overflow_free_list();
+    if (head == 0)
+        return this->overflow->get_new();
+    SlottedPage *page = this->overflow->get(head);
+    Dbt *data = page->get(1);
+    BlockID next = data == nullptr ? 0 : *(BlockID *) data->get_data();
+    delete data;
+    delete page;
+    set_overflow_free_list(next);
+    page = this->overflow->get(head);  // again, since a direct file may have reused the buffer for the list head
+    page->clear();
+    return page;
+}
+
+/**
+ * The first page on the overflow file's free list (0 if it is empty).
+ */
+BlockID HeapTable::get_overflow_free_list() {
+    SlottedPage *page = this->overflow->get(OVERFLOW_FREE_LIST);
+    Dbt *data = page->get(1);
+    BlockID head = data == nullptr ? 0 : *(BlockID *) data->get_data();
+    delete data;
+    delete page;
+    return head;
+}
+
+void HeapTable::set_overflow_free_list(BlockID head) {
+    SlottedPage *page = this->overflow->get(OVERFLOW_FREE_LIST);
+    page->clear();
+    Dbt data(&head, sizeof(head));
+    page->add(&data);
+    this->overflow->put(page);
+    delete page;
+}
+
+/**
+ * Read back a long TEXT value from its chain of overflow pages.
+ * @param block_id  first page of the chain
+ * @param length    total length of the value
+ * @return          the reassembled value
+ */
+string HeapTable::get_overflow(BlockID block_id, uint32_t length) {
+    open_overflow();
+    string text;
+    text.reserve(length);
+    while (block_id != 0 && text.length() < length) {
+        SlottedPage *page = this->overflow->get(block_id);
+        Dbt *data = page->get(1);
+        char *bytes = (char *) data->get_data();
+        block_id = *(BlockID *) bytes;
+        text.append(bytes + sizeof(BlockID), data->get_size() - sizeof(BlockID));
+        delete data;
+        delete page;
+    }
+    if (text.length() != length)
+        throw DbRelationError("overflow chain is damaged");
+    return text;
+}
+
 /**
  * See if the row at the given handle satisfies the given where clause
  * @param handle  row to check
@@ -323,6 +861,47 @@ bool HeapTable::selected(Handle handle, const ValueDict *where) {
     return is_selected;
 }
 
+/**
+ * See if the given bits of a row satisfy the given where clause
+ * @param data   marshaled row to check
+ * @param where  conditions to check
+ * @return       true if conditions met, false otherwise
+ */
+bool HeapTable::selected(Dbt *data, const ValueDict *where) {
+    if (where == nullptr)
+        return true;
+    ColumnNames column_names;
+    for (auto const &column: *where)
+        column_names.push_back(column.first);
+    ValueDict *row = unmarshal(data, &column_names);
+    bool is_selected = *row == *where;
+    delete row;
+    return is_selected;
+}
+
+/**
+ * Convert a handle into the bits of a forwarding stub.
+ * The caller is responsible for freeing the returned Dbt and its enclosed ret->get_data().
+ * @param handle  where the row has moved to
+ * @return        bits of the stub
+ */
+Dbt *HeapTable::marshal_handle(Handle handle) {
+    char *bytes = new char[sizeof(BlockID) + sizeof(RecordID)];
+    *(BlockID *) bytes = handle.first;
+    *(RecordID *) (bytes + sizeof(BlockID)) = handle.second;
+    return new Dbt(bytes, sizeof(BlockID) + sizeof(RecordID));
+}
+
+/**
+ * Get the handle back out of a forwarding stub.
+ * @param data  bits of the stub
+ * @return      where the row has moved to
+ */
+Handle HeapTable::unmarshal_handle(const Dbt *data) {
+    char *bytes = (char *) data->get_data();
+    return Handle(*(BlockID *) bytes, *(RecordID *) (bytes + sizeof(BlockID)));
+}
+
 /**
  * Test helper. Sets the row's a and b values.
  * @param row to set
@@ -431,8 +1010,361 @@ bool test_heap_storage() {
             return false;
     }
     cout << "del ok" << endl;
+    delete handles;
+
+    // same-size update stays in place; growing rows in a full block have to move
+    handles = table.select();
+    Handle first = handles->front(), second = handles->at(1);
+    delete handles;
+    ValueDict changes;
+    changes["a"] = Value(-3);
+    table.update(first, &changes);
+    if (!test_compare(table, first, -3, b))
+        return assertion_failure("update in place");
+    string longer = b + b + b;
+    changes["a"] = Value(8);
+    changes["b"] = Value(longer);
+    table.update(second, &changes);
+    if (!test_compare(table, second, 8, longer))
+        return assertion_failure("update with move");
+    changes["b"] = Value(longer + longer);
+    table.update(second, &changes);
+    if (!test_compare(table, second, 8, longer + longer))
+        return assertion_failure("update of moved row");
+    handles = table.select();
+    bool once = handles->size() == 1000 && handles->at(1) == second;
+    delete handles;
+    if (!once)
+        return assertion_failure("select after update");
+    table.del(second);
+    handles = table.select();
+    once = handles->size() == 999;
+    delete handles;
+    if (!once)
+        return assertion_failure("del of moved row");
+    cout << "update ok" << endl;
+
+    // a value several pages long goes to overflow pages and comes back intact
+    string big;
+    while (big.length() < 5 * DbBlock::BLOCK_SZ)
+        big += b;
+    test_set_row(row, 2024, big);
+    Handle big_handle = table.insert(&row);
+    if (!test_compare(table, big_handle, 2024, big))
+        return assertion_failure("overflow text round trip");
+    ColumnNames just_a = {"a"};
+    ValueDict *partial = table.project(big_handle, &just_a);
+    bool only_a = partial->size() == 1 && partial->at("a").n == 2024;
+    delete partial;
+    if (!only_a)
+        return assertion_failure("projection around overflow text");
+    BlockID overflow_end = table.overflow->get_last_block_id();
+    table.del(big_handle);
+    big_handle = table.insert(&row);  // the deleted row's chain is freed, and its pages used again
+    if (!test_compare(table, big_handle, 2024, big) || table.overflow->get_last_block_id() != overflow_end)
+        return assertion_failure("overflow pages reused after del");
+    ValueDict new_values;
+    new_values["a"] = Value(2025);
+    table.update(big_handle, &new_values);  // b isn't changing, so it keeps its chain
+    if (!test_compare(table, big_handle, 2025, big) || table.overflow->get_last_block_id() != overflow_end)
+        return assertion_failure("update around overflow text");
+    new_values["a"] = Value(2024);
+    new_values["b"] = Value(big + "!");
+    table.update(big_handle, &new_values);
+    overflow_end = table.overflow->get_last_block_id();
+    new_values["b"] = Value(big);
+    table.update(big_handle, &new_values);  // onto the pages freed when b first changed
+    if (!test_compare(table, big_handle, 2024, big) || table.overflow->get_last_block_id() != overflow_end)
+        return assertion_failure("overflow pages reused after update");
+    cout << "overflow ok" << endl;
+
+    // blocks changed since the last write-back all get to the file when it is closed
+    table.close();
+    table.open();
+    handles = table.select();
+    once = handles->size() == 1000 && test_compare(table, big_handle, 2024, big);
+    delete handles;
+    if (!once)
+        return assertion_failure("write-back on close");
+    cout << "write-back ok" << endl;
     table.drop();
+
+    // same rows in a memory-mapped table, still there after closing and reopening it
+    HeapTable mapped("_test_mmap_cpp", column_names, column_attributes, DbBlock::BLOCK_SZ, "mmap");
+    mapped.create_if_not_exists();
+    for (i = 0; i < 1000; i++) {
+        test_set_row(row, i, b);
+        last_handle = mapped.insert(&row);
+    }
+    mapped.del(last_handle);
+    changes["b"] = Value(longer);
+    mapped.update(Handle(1, 1), &changes);
+    mapped.close();
+    mapped.open();
+    handles = mapped.select();
+    once = handles->size() == 999 && test_compare(mapped, handles->at(0), 8, longer) &&
+           test_compare(mapped, handles->at(998), 998, b);
     delete handles;
+    mapped.drop();
+    if (!once)
+        return assertion_failure("mmap table");
+    cout << "mmap ok" << endl;
+
+    // and in a direct I/O table, with a cache too small to hold them all
+    uint32_t cache_blocks = DirectFile::cache_blocks;
+    DirectFile::cache_blocks = 8;
+    HeapTable direct("_test_direct_cpp", column_names, column_attributes, DbBlock::BLOCK_SZ, "direct");
+    direct.create_if_not_exists();
+    for (i = 0; i < 1000; i++) {
+        test_set_row(row, i, b);
+        last_handle = direct.insert(&row);
+    }
+    direct.del(last_handle);
+    direct.update(Handle(1, 1), &changes);
+    direct.close();
+    direct.open();
+    handles = direct.select();
+    once = handles->size() == 999 && test_compare(direct, handles->at(0), 8, longer) &&
+           test_compare(direct, handles->at(998), 998, b);
+    delete handles;
+    direct.drop();
+    DirectFile::cache_blocks = cache_blocks;
+    if (!once)
+        return assertion_failure("direct table");
+    cout << "direct ok" << endl;
     return true;
 }
 
+
+// seconds since start
+static double seconds_since(chrono::steady_clock::time_point start) {
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+/**
+ * @class Restore - puts a setting back the way it was when it goes away, even if a benchmark throws
+ */
+template<typename T>
+class Restore {
+public:
+    explicit Restore(T &setting) : setting(setting), saved(setting) {}
+
+    ~Restore() { setting = saved; }
+
+    Restore(const Restore &other) = delete;
+
+    Restore &operator=(const Restore &other) = delete;
+
+protected:
+    T &setting;
+    T saved;
+};
+
+static const int BENCHMARK_ROWS = 200 * 1000;
+static const int BENCHMARK_LOOKUPS = 100 * 1000;
+static const char *BENCHMARK_TABLE = "__benchmark_storage";
+
+// a table with an INT and a short TEXT column, for the benchmarks to fill
+static HeapTable *benchmark_table(uint32_t block_size = DbBlock::BLOCK_SZ, const string &storage = "heap") {
+    ColumnNames column_names = {"a", "b"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::TEXT)};
+    return new HeapTable(BENCHMARK_TABLE, column_names, column_attributes, block_size, storage);
+}
+
+// insert BENCHMARK_ROWS rows, keeping their handles if asked to
+static void benchmark_load(HeapTable &table, vector<Handle> *handles) {
+    for (int i = 0; i < BENCHMARK_ROWS; i++) {
+        ValueDict row = {{"a", Value(i)}, {"b", Value("row number " + to_string(i) + " of the benchmark")}};
+        Handle handle = table.insert(&row);
+        if (handles != nullptr)
+            handles->push_back(handle);
+    }
+    HeapFile::flush_all();
+}
+
+/**
+ * Time loading a new table, scanning it, and looking up its rows by handle (as an index would), and
+ * print a line with the rows per second of each (see benchmark_header).
+ * @param label       what to call the table's storage in the output
+ * @param storage     how to keep the table's blocks (see HeapTable::is_valid_storage)
+ * @param block_size  size of its blocks
+ * @return            true if the scan and the lookups found the rows they should have
+ */
+static bool benchmark_loads_scans_lookups(const string &label, const string &storage, uint32_t block_size) {
+    mt19937_64 random(5300);
+    uniform_int_distribution<size_t> pick(0, BENCHMARK_ROWS - 1);
+    unique_ptr<HeapTable> table(benchmark_table(block_size, storage));
+    table->create();
+    bool ok = true;
+    double loads, scan, lookups;
+    try {
+        vector<Handle> handles;
+        handles.reserve(BENCHMARK_ROWS);
+        auto start = chrono::steady_clock::now();
+        benchmark_load(*table, &handles);
+        loads = BENCHMARK_ROWS / seconds_since(start);
+
+        start = chrono::steady_clock::now();
+        Handles *all = table->select();
+        scan = BENCHMARK_ROWS / seconds_since(start);
+        ok = all->size() == BENCHMARK_ROWS;
+        delete all;
+
+        start = chrono::steady_clock::now();
+        for (int i = 0; i < BENCHMARK_LOOKUPS; i++) {
+            size_t n = pick(random);
+            ValueDict *row = table->project(handles[n]);
+            ok = ok && row->at("a").n == (int32_t) n;
+            delete row;
+        }
+        lookups = BENCHMARK_LOOKUPS / seconds_since(start);
+    } catch (...) {
+        table->drop();
+        throw;
+    }
+    table->drop();
+    cout << left << setw(21) << label << right << setw(10) << block_size << setw(14) << (uint64_t) loads
+         << setw(15) << (uint64_t) scan << setw(14) << (uint64_t) lookups << endl;
+    return ok;
+}
+
+// heading for the lines benchmark_loads_scans_lookups prints
+static void benchmark_header() {
+    cout << "storage              block size     loads/sec  scan rows/sec   lookups/sec" << endl;
+}
+
+/**
+ * Benchmark of table block sizes: loads, scans, and lookups in Berkeley DB tables with 4, 16, and 64 kB blocks.
+ * @return true if every scan and lookup found the rows it should have
+ */
+bool benchmark_block_size() {
+    bool ok = true;
+    benchmark_header();
+    for (uint32_t block_size: {4096U, 16384U, 65536U})
+        ok = benchmark_loads_scans_lookups("berkeley db", "heap", block_size) && ok;
+    return ok;
+}
+
+/**
+ * Benchmark of memory-mapped storage: loads, scans, and lookups in mmap tables with 4, 16, and 64 kB blocks,
+ * to compare with Berkeley DB tables (see benchmark_block_size).
+ * @return true if every scan and lookup found the rows it should have
+ */
+bool benchmark_mmap() {
+    bool ok = true;
+    benchmark_header();
+    for (uint32_t block_size: {4096U, 16384U, 65536U})
+        ok = benchmark_loads_scans_lookups("mmap", "mmap", block_size) && ok;
+    return ok;
+}
+
+/**
+ * Benchmark of direct I/O storage: loads, scans, and lookups in direct tables with 4, 16, and 64 kB blocks,
+ * with the usual cache (see DirectFile::cache_blocks) and with a 64-block cache, much smaller than the table.
+ * @return true if every scan and lookup found the rows it should have
+ */
+bool benchmark_direct() {
+    bool ok = true;
+    Restore<uint32_t> cache_blocks(DirectFile::cache_blocks);
+    benchmark_header();
+    for (uint32_t cache: {DirectFile::cache_blocks, 64U}) {
+        DirectFile::cache_blocks = cache;
+        string label = "direct, " + to_string(cache) + " blocks";
+        for (uint32_t block_size: {4096U, 16384U, 65536U})
+            ok = benchmark_loads_scans_lookups(label, "direct", block_size) && ok;
+    }
+    return ok;
+}
+
+/**
+ * Benchmark of scanning a Berkeley DB file: walks all the blocks of a table once with a cursor with
+ * bulk retrieval (see HeapFileScan), and once with one Berkeley DB get per block.
+ * @return true if both walks found all the rows
+ */
+bool benchmark_bulk_scan() {
+    unique_ptr<HeapTable> table(benchmark_table());
+    table->create();
+    uint64_t cursor_rows = 0, get_rows = 0;
+    double cursor, get;
+    BlockID blocks;
+    try {
+        benchmark_load(*table, nullptr);
+        blocks = table->file->get_last_block_id();
+        auto start = chrono::steady_clock::now();
+        unique_ptr<HeapFileScan> scan(table->file->scan());
+        for (SlottedPage *block = scan->next(); block != nullptr; block = scan->next()) {
+            cursor_rows += block->size();
+            delete block;
+        }
+        cursor = blocks / seconds_since(start);
+        start = chrono::steady_clock::now();
+        for (BlockID block_id = 1; block_id <= blocks; block_id++) {
+            SlottedPage *block = table->file->get(block_id);
+            get_rows += block->size();
+            delete block;
+        }
+        get = blocks / seconds_since(start);
+    } catch (...) {
+        table->drop();
+        throw;
+    }
+    table->drop();
+    cout << "scan of " << blocks << " blocks: cursor " << (uint64_t) cursor << " blocks/sec, get per block "
+         << (uint64_t) get << " blocks/sec (" << fixed << setprecision(2) << cursor / get << "x)"
+         << defaultfloat << endl;
+    return cursor_rows == BENCHMARK_ROWS && get_rows == BENCHMARK_ROWS;
+}
+
+/**
+ * Benchmark of write-back: loads a Berkeley DB table with the changed blocks written back in batches
+ * (see HeapFile::write_back), and again with each one written through as it is put.
+ * @return true (there is nothing to check)
+ */
+bool benchmark_write_back() {
+    Restore<uint32_t> write_back(HeapFile::write_back);
+    uint32_t batch = HeapFile::write_back == 0 ? 256 : HeapFile::write_back;
+    double batched = 0.0;
+    for (uint32_t blocks: {batch, 0U}) {
+        HeapFile::write_back = blocks;
+        unique_ptr<HeapTable> table(benchmark_table());
+        table->create();
+        auto start = chrono::steady_clock::now();
+        try {
+            benchmark_load(*table, nullptr);
+        } catch (...) {
+            table->drop();
+            throw;
+        }
+        double loads = BENCHMARK_ROWS / seconds_since(start);
+        table->drop();
+        if (blocks != 0) {
+            batched = loads;
+            cout << "load, written back every " << blocks << " blocks: " << (uint64_t) loads << " rows/sec" << endl;
+        } else {
+            cout << "load, written through on every put: " << (uint64_t) loads << " rows/sec ("
+                 << fixed << setprecision(2) << batched / loads << "x slower)" << defaultfloat << endl;
+        }
+    }
+    return true;
+}
+
+/**
+ * Benchmark of the storage layer, to go with the B-tree's (see benchmark_btree). Prints:
+ *  - load, scan, and lookup throughput for each block size (see benchmark_block_size)
+ *  - the same for memory-mapped storage (see benchmark_mmap)
+ *  - the same for direct I/O storage, including with a cache much smaller than the table (see benchmark_direct)
+ *  - a full scan through a Berkeley DB cursor with bulk retrieval against one Berkeley DB get per block
+ *    (see benchmark_bulk_scan)
+ *  - loads with changed blocks written back in batches against writing each one through on every put
+ *    (see benchmark_write_back)
+ * @return true if every scan and lookup found the rows it should have
+ */
+bool benchmark_storage() {
+    bool ok = benchmark_block_size();
+    ok = benchmark_mmap() && ok;
+    ok = benchmark_direct() && ok;
+    ok = benchmark_bulk_scan() && ok;
+    ok = benchmark_write_back() && ok;
+    return ok;
+}
@@ -0,0 +1,592 @@
+/**
+ * @file LockManager.cpp - implementation of LockManager class
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "LockManager.h"
+#include "Transaction.h"
+
+using namespace std;
+
+typedef LockManager::Mode Mode;
+
+/**
+ * A transaction's request for a lock, granted or waiting.
+ */
+struct LockManager::Request {
+    uint64_t owner;
+    Mode mode;       // held, if granted, or else wanted
+    Mode upgrade;    // wanted, while a granted request waits to be made stronger
+    bool granted;
+    bool upgrading;
+};
+
+/**
+ * One stripe of the lock table: the requests, in arrival order, for each thing locked.
+ */
+struct LockManager::Stripe {
+    mutex latch;
+    condition_variable wake;  // something in this stripe was released
+    unordered_map<LockId, list<Request>, LockIdHash> queues;
+};
+
+/**
+ * One stripe of the table of what each transaction holds (what it has to release when it ends).
+ */
+struct LockManager::Holdings {
+    mutex latch;
+    unordered_map<uint64_t, unordered_map<LockId, Mode, LockIdHash>> held;
+};
+
+// rows are what is held, columns what is asked for
+const bool LockManager::compatible[5][5] = {
+        //          IS     IX     S      SIX    X
+        /* IS  */ {true,  true,  true,  true,  false},
+        /* IX  */ {true,  true,  false, false, false},
+        /* S   */ {true,  false, true,  false, false},
+        /* SIX */ {true,  false, false, false, false},
+        /* X   */ {false, false, false, false, false}
+};
+
+// weakest mode that gives both
+const Mode LockManager::supremum[5][5] = {
+        //          IS   IX   S    SIX  X
+        /* IS  */ {IS,  IX,  S,   SIX, X},
+        /* IX  */ {IX,  IX,  SIX, SIX, X},
+        /* S   */ {S,   SIX, S,   SIX, X},
+        /* SIX */ {SIX, SIX, SIX, SIX, X},
+        /* X   */ {X,   X,   X,   X,   X}
+};
+
+atomic<uint64_t> LockManager::requests(0);
+LockManager::Stripe LockManager::stripes[LockManager::STRIPES];
+LockManager::Holdings LockManager::holdings[LockManager::STRIPES];
+
+// the waits-for graph: who each waiting transaction is waiting for
+static mutex graph_mutex;
+static unordered_map<uint64_t, vector<uint64_t>> waits_for;
+
+// waiting done, by table or index
+static mutex stats_mutex;
+static map<Identifier, LockManager::WaitStats> stats;
+
+size_t LockManager::LockId::hash() const {
+    size_t h = std::hash<string>()(this->object);
+    h = h * 31 + this->level;
+    h ^= (size_t) (this->first * 0x9e3779b97f4a7c15ULL);
+    h ^= (size_t) (this->second * 0xc2b2ae3d27d4eb4fULL);
+    return h;
+}
+
+/**
+ * Lock a whole table (or index).
+ * @param table_name  table to lock
+ * @param mode        lock mode
+ * @throws DeadlockError if waiting for the lock would deadlock
+ */
+void LockManager::lock_table(const Identifier &table_name, Mode mode) {
+    uint64_t owner = Transaction::lock_owner();
+    if (owner == 0)
+        return;
+    requests++;
+    lock(owner, LockId{table_name, TABLE, 0, 0}, mode);
+}
+
+/**
+ * Does the transaction running now have a table (or index) locked, in a mode at least as strong as the
+ * one given?
+ * @param table_name  the table
+ * @param mode        lock mode
+ * @return            true if it does
+ */
+bool LockManager::holds_table(const Identifier &table_name, Mode mode) {
+    uint64_t owner = Transaction::lock_owner();
+    return owner != 0 && holds(owner, LockId{table_name, TABLE, 0, 0}, mode);
+}
+
+/**
+ * Lock a block of a table, with an intent lock on the table.
+ * @param table_name  table the block belongs to
+ * @param block_id    block to lock
+ * @param mode        lock mode
+ * @throws DeadlockError if waiting for the lock would deadlock
+ */
+void LockManager::lock_page(const Identifier &table_name, BlockID block_id, Mode mode) {
+    uint64_t owner = Transaction::lock_owner();
+    if (owner == 0)
+        return;
+    requests++;
+    LockId table{table_name, TABLE, 0, 0};
+    if (holds(owner, table, mode))
+        return;
+    lock(owner, table, intent(mode));
+    lock(owner, LockId{table_name, PAGE, block_id, 0}, mode);
+}
+
+/**
+ * Lock a row, with intent locks on its block and table.
+ * @param table_name  table the row belongs to
+ * @param handle      the row (where it was inserted, even if it has moved since)
+ * @param mode        lock mode
+ * @throws DeadlockError if waiting for the lock would deadlock
+ */
+void LockManager::lock_record(const Identifier &table_name, Handle handle, Mode mode) {
+    uint64_t owner = Transaction::lock_owner();
+    if (owner == 0)
+        return;
+    requests++;
+    LockId table{table_name, TABLE, 0, 0};
+    if (holds(owner, table, mode))
+        return;
+    lock(owner, table, intent(mode));
+    LockId page{table_name, PAGE, handle.first, 0};
+    if (holds(owner, page, mode))
+        return;
+    lock(owner, page, intent(mode));
+    lock(owner, LockId{table_name, RECORD, handle.first, handle.second}, mode);
+}
+
+/**
+ * Lock the entries for a key value in an index, with an intent lock on the index.
+ * @param index_name  name of the index (unique among all tables' indices)
+ * @param key_hash    hash of the key value (different keys with the same hash share a lock)
+ * @param mode        lock mode
+ * @throws DeadlockError if waiting for the lock would deadlock
+ */
+void LockManager::lock_key(const Identifier &index_name, uint64_t key_hash, Mode mode) {
+    uint64_t owner = Transaction::lock_owner();
+    if (owner == 0)
+        return;
+    requests++;
+    LockId index{index_name, TABLE, 0, 0};
+    if (holds(owner, index, mode))
+        return;
+    lock(owner, index, intent(mode));
+    lock(owner, LockId{index_name, KEY, key_hash, 0}, mode);
+}
+
+/**
+ * Release every lock a transaction holds, waking up whoever is waiting for them.
+ * @param owner  the transaction (see Transaction::lock_owner)
+ */
+void LockManager::release_all(uint64_t owner) {
+    if (owner == 0)
+        return;
+    unordered_map<LockId, Mode, LockIdHash> held;
+    {
+        Holdings &mine = holdings[owner % STRIPES];
+        lock_guard<mutex> guard(mine.latch);
+        auto hit = mine.held.find(owner);
+        if (hit == mine.held.end())
+            return;
+        held.swap(hit->second);
+        mine.held.erase(hit);
+    }
+    for (auto &entry: held) {
+        Stripe &stripe = stripes[entry.first.hash() % STRIPES];
+        {
+            lock_guard<mutex> guard(stripe.latch);
+            auto queue = stripe.queues.find(entry.first);
+            if (queue != stripe.queues.end()) {
+                queue->second.remove_if([owner](const Request &request) { return request.owner == owner; });
+                if (queue->second.empty())
+                    stripe.queues.erase(queue);
+            }
+        }
+        stripe.wake.notify_all();
+    }
+}
+
+/**
+ * How much waiting there has been for the locks on each table and index (those never waited for are left out).
+ * @return  a copy of the statistics, by table or index name
+ */
+map<Identifier, LockManager::WaitStats> LockManager::wait_stats() {
+    lock_guard<mutex> guard(stats_mutex);
+    return stats;
+}
+
+/**
+ * Get a lock for a transaction (or make the one it has strong enough), waiting if need be.
+ * @param owner  the transaction
+ * @param id     what to lock
+ * @param mode   lock mode
+ * @throws DeadlockError if waiting would deadlock (the request is withdrawn)
+ */
+void LockManager::lock(uint64_t owner, const LockId &id, Mode mode) {
+    Mode current = mode;
+    bool upgrade = held(owner, id, current);
+    if (upgrade && supremum[current][mode] == current)
+        return;  // already have it
+    Mode wanted = upgrade ? supremum[current][mode] : mode;
+
+    Stripe &stripe = stripes[id.hash() % STRIPES];
+    unique_lock<mutex> guard(stripe.latch);
+    list<Request> &queue = stripe.queues[id];  // stays put while it has our request in it
+    list<Request>::iterator request;
+    if (upgrade) {
+        request = find_if(queue.begin(), queue.end(), [owner](const Request &r) { return r.owner == owner; });
+        request->upgrade = wanted;
+        request->upgrading = true;
+    } else {
+        request = queue.insert(queue.end(), Request{owner, wanted, wanted, false, false});
+    }
+
+    vector<uint64_t> blockers = blocking(queue, request);
+    bool aside = false;  // have we let other sessions run while we wait?
+    if (!blockers.empty()) {
+        auto start = chrono::steady_clock::now();
+        try {
+            while (!blockers.empty()) {
+                if (closes_cycle(owner, blockers)) {
+                    count_wait(id.object, elapsed_us(start), true);
+                    throw DeadlockError("deadlock waiting for a lock on " + id.object);
+                }
+                if (!aside && Transaction::before_wait != nullptr) {
+                    guard.unlock();
+                    Transaction::before_wait();
+                    aside = true;
+                    guard.lock();
+                } else {
+                    stripe.wake.wait(guard);
+                }
+                blockers = blocking(queue, request);
+            }
+        } catch (...) {
+            // withdraw the request
+            if (!guard.owns_lock())
+                guard.lock();
+            if (upgrade)
+                request->upgrading = false;
+            else
+                queue.erase(request);
+            if (queue.empty())
+                stripe.queues.erase(id);
+            guard.unlock();
+            stop_waiting(owner);
+            stripe.wake.notify_all();  // anyone queued behind us may be able to go now
+            if (aside)
+                Transaction::after_wait();
+            throw;
+        }
+        stop_waiting(owner);
+        count_wait(id.object, elapsed_us(start), false);
+    }
+    if (upgrade) {
+        request->mode = wanted;
+        request->upgrading = false;
+    } else {
+        request->granted = true;
+    }
+    guard.unlock();
+    {
+        Holdings &mine = holdings[owner % STRIPES];
+        lock_guard<mutex> held_guard(mine.latch);
+        mine.held[owner][id] = wanted;
+    }
+    if (aside)
+        Transaction::after_wait();
+}
+
+/**
+ * Does a transaction hold a lock that already gives it a mode (on this, or on something it contains)?
+ * @param owner  the transaction
+ * @param id     what to check
+ * @param mode   mode it needs
+ * @return       true if its lock on id is at least as strong as mode
+ */
+bool LockManager::holds(uint64_t owner, const LockId &id, Mode mode) {
+    Mode current = mode;
+    return held(owner, id, current) && supremum[current][mode] == current;
+}
+
+/**
+ * What lock does a transaction hold?
+ * @param owner  the transaction
+ * @param id     what to check
+ * @param mode   returned by reference: the mode it holds (unchanged if none)
+ * @return       true if it holds a lock on id
+ */
+bool LockManager::held(uint64_t owner, const LockId &id, Mode &mode) {
+    Holdings &mine = holdings[owner % STRIPES];
+    lock_guard<mutex> guard(mine.latch);
+    auto locks = mine.held.find(owner);
+    if (locks == mine.held.end())
+        return false;
+    auto hit = locks->second.find(id);
+    if (hit == locks->second.end())
+        return false;
+    mode = hit->second;
+    return true;
+}
+
+/**
+ * Who is a request waiting for? Everyone holding something incompatible with it, and, for a new
+ * request, everyone ahead of it wanting something incompatible (so nobody waits forever behind a
+ * stream of readers).
+ * @param queue    requests for the same thing (stripe must be locked)
+ * @param request  the request
+ * @return         the transactions it has to wait for (none if it can be granted now)
+ */
+vector<uint64_t> LockManager::blocking(const list<Request> &queue, list<Request>::const_iterator request) {
+    vector<uint64_t> blockers;
+    Mode wanted = request->upgrading ? request->upgrade : request->mode;
+    bool ahead = true;
+    for (auto other = queue.begin(); other != queue.end(); ++other) {
+        if (other == request) {
+            ahead = false;
+            continue;
+        }
+        bool conflict;
+        if (other->granted)
+            conflict = !compatible[other->mode][wanted] ||
+                       (other->upgrading && !request->granted && !compatible[other->upgrade][wanted]);
+        else
+            conflict = ahead && !request->granted && !compatible[other->mode][wanted];
+        if (conflict)
+            blockers.push_back(other->owner);
+    }
+    return blockers;
+}
+
+/**
+ * Record in the waits-for graph that a transaction is waiting, unless that would close a cycle.
+ * @param owner     the waiting transaction
+ * @param blockers  who it is waiting for
+ * @return          true if one of them is (indirectly) waiting for it, i.e., it would deadlock
+ */
+bool LockManager::closes_cycle(uint64_t owner, const vector<uint64_t> &blockers) {
+    lock_guard<mutex> guard(graph_mutex);
+    vector<uint64_t> stack(blockers);
+    unordered_map<uint64_t, bool> seen;
+    while (!stack.empty()) {
+        uint64_t waiter = stack.back();
+        stack.pop_back();
+        if (waiter == owner) {
+            waits_for.erase(owner);
+            return true;
+        }
+        if (seen[waiter])
+            continue;
+        seen[waiter] = true;
+        auto edges = waits_for.find(waiter);
+        if (edges != waits_for.end())
+            stack.insert(stack.end(), edges->second.begin(), edges->second.end());
+    }
+    waits_for[owner] = blockers;
+    return false;
+}
+
+/**
+ * Take a transaction that got its lock out of the waits-for graph.
+ * @param owner  the transaction
+ */
+void LockManager::stop_waiting(uint64_t owner) {
+    lock_guard<mutex> guard(graph_mutex);
+    waits_for.erase(owner);
+}
+
+/**
+ * Add a wait to the statistics.
+ * @param object    table or index waited for
+ * @param wait_us   how long
+ * @param deadlock  true if the wait ended in a deadlock
+ */
+void LockManager::count_wait(const Identifier &object, uint64_t wait_us, bool deadlock) {
+    lock_guard<mutex> guard(stats_mutex);
+    WaitStats &counts = stats[object];
+    counts.waits++;
+    counts.wait_us += wait_us;
+    counts.max_wait_us = max(counts.max_wait_us, wait_us);
+    if (deadlock)
+        counts.deadlocks++;
+}
+
+/**
+ * Microseconds since a time.
+ * @param start  the time
+ * @return       microseconds from then to now
+ */
+uint64_t LockManager::elapsed_us(chrono::steady_clock::time_point start) {
+    return (uint64_t) chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+}
+
+// is the transaction waiting for a lock?
+static bool test_waiting(uint64_t owner) {
+    lock_guard<mutex> guard(graph_mutex);
+    return waits_for.count(owner) != 0;
+}
+
+/**
+ * A lock request made on a thread of its own, so the test can see whether it has to wait.
+ */
+class TestRequest {
+public:
+    TestRequest(uint64_t owner, const function<void()> &request) : owner(owner), done(false), deadlock(false) {
+        this->thread = std::thread([this, request] {
+            try {
+                request();
+            } catch (DeadlockError &e) {
+                this->deadlock = true;
+            }
+            this->done = true;
+        });
+    }
+
+    ~TestRequest() {
+        if (this->thread.joinable())
+            this->thread.join();
+    }
+
+    // wait until the request is granted (true) or waiting for a lock (false)
+    bool granted() {
+        while (!this->done && !test_waiting(this->owner))
+            this_thread::yield();
+        return this->done && !this->deadlock;
+    }
+
+    // wait until it is done (granted or refused)
+    bool finished() {
+        this->thread.join();
+        this->thread = std::thread();
+        return !this->deadlock;
+    }
+
+protected:
+    uint64_t owner;
+    atomic<bool> done;
+    atomic<bool> deadlock;
+    std::thread thread;
+};
+
+/**
+ * Test which modes can be held at once, upgrades (and that one goes ahead of a request waiting behind
+ * it), and that a wait that would close a cycle, across tables or from two upgrades, is refused.
+ * @return true if the tests all succeeded
+ */
+bool test_lock_manager() {
+    const uint64_t T1 = UINT64_MAX - 1, T2 = UINT64_MAX - 2;  // no real transaction gets near these
+    const LockManager::LockId a{"_test_locks_a", LockManager::TABLE, 0, 0};
+    const LockManager::LockId b{"_test_locks_b", LockManager::TABLE, 0, 0};
+    const Mode modes[] = {LockManager::IS, LockManager::IX, LockManager::S, LockManager::SIX, LockManager::X};
+    const char *names[] = {"IS", "IX", "S", "SIX", "X"};
+    const bool expected[5][5] = {
+            //          IS     IX     S      SIX    X
+            /* IS  */ {true,  true,  true,  true,  false},
+            /* IX  */ {true,  true,  false, false, false},
+            /* S   */ {true,  false, true,  false, false},
+            /* SIX */ {true,  false, false, false, false},
+            /* X   */ {false, false, false, false, false}
+    };
+    uint64_t deadlocks = LockManager::wait_stats()[a.object].deadlocks;
+
+    // compatibility
+    for (int held = 0; held < 5; held++) {
+        for (int wanted = 0; wanted < 5; wanted++) {
+            LockManager::lock(T1, a, modes[held]);
+            bool granted;
+            {
+                TestRequest request(T2, [&] { LockManager::lock(T2, a, modes[wanted]); });
+                granted = request.granted();
+                LockManager::release_all(T1);
+            }
+            LockManager::release_all(T2);
+            if (granted != expected[held][wanted]) {
+                cout << names[wanted] << (granted ? " granted" : " not granted") << " while " << names[held]
+                     << " is held" << endl;
+                return false;
+            }
+        }
+    }
+
+    // upgrades
+    LockManager::lock(T1, a, LockManager::S);
+    LockManager::lock(T1, a, LockManager::IX);
+    bool six = LockManager::holds(T1, a, LockManager::SIX) && !LockManager::holds(T1, a, LockManager::X);
+    LockManager::release_all(T1);
+    if (!six) {
+        cout << "S and IX together should make SIX" << endl;
+        return false;
+    }
+    LockManager::lock(T1, a, LockManager::S);
+    {
+        TestRequest request(T2, [&] { LockManager::lock(T2, a, LockManager::X); });
+        if (request.granted()) {
+            LockManager::release_all(T1);
+            cout << "X granted while S is held" << endl;
+            return false;
+        }
+        try {
+            LockManager::lock(T1, a, LockManager::X);  // goes ahead of T2
+        } catch (DeadlockError &e) {
+            LockManager::release_all(T1);
+            cout << "upgrade waited behind a new request" << endl;
+            return false;
+        }
+        bool upgraded = LockManager::holds(T1, a, LockManager::X);
+        LockManager::release_all(T1);
+        if (!request.finished() || !upgraded) {
+            LockManager::release_all(T2);
+            cout << "upgrade to X" << endl;
+            return false;
+        }
+    }
+    LockManager::release_all(T2);
+
+    // two upgrades, each waiting for the other to give up S
+    LockManager::lock(T1, a, LockManager::S);
+    LockManager::lock(T2, a, LockManager::S);
+    {
+        TestRequest request(T1, [&] { LockManager::lock(T1, a, LockManager::X); });
+        request.granted();
+        bool refused = false;
+        try {
+            LockManager::lock(T2, a, LockManager::X);
+        } catch (DeadlockError &e) {
+            refused = true;
+        }
+        LockManager::release_all(T2);
+        bool finished = request.finished();
+        LockManager::release_all(T1);
+        if (!refused || !finished) {
+            cout << "deadlock between upgrades" << endl;
+            return false;
+        }
+    }
+
+    // each waiting for the other's table
+    LockManager::lock(T1, a, LockManager::X);
+    LockManager::lock(T2, b, LockManager::X);
+    {
+        TestRequest request(T1, [&] { LockManager::lock(T1, b, LockManager::X); });
+        request.granted();
+        bool refused = false;
+        try {
+            LockManager::lock(T2, a, LockManager::X);
+        } catch (DeadlockError &e) {
+            refused = true;
+        }
+        LockManager::release_all(T2);
+        bool finished = request.finished();
+        LockManager::release_all(T1);
+        if (!refused || !finished) {
+            cout << "deadlock across tables" << endl;
+            return false;
+        }
+    }
+
+    if (LockManager::wait_stats()[a.object].deadlocks != deadlocks + 2) {
+        cout << "deadlocks not counted" << endl;
+        return false;
+    }
+    return true;
+}
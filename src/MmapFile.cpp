@@ -0,0 +1,204 @@
+/**
+ * @file MmapFile.cpp
+ * @see Seattle University, CPSC5300
+ */
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "MmapFile.h"
+#include "PerfCounters.h"
+
+using namespace std;
+
+/**
+ * Constructor
+ * @param name
+ * @param block_size  size of the blocks if the file gets created
+ */
+MmapFile::MmapFile(string name, uint32_t block_size) : HeapFile(name, block_size), path(""), fd(-1), map(nullptr) {
+    const char *home = nullptr;
+    _DB_ENV->get_home(&home);
+    this->path = (home == nullptr ? string("") : string(home) + "/") + this->name + ".mmap";
+}
+
+MmapFile::~MmapFile() {
+    close();
+}
+
+/**
+ * Create physical file.
+ * @throws DbException if it already exists or can't be created
+ */
+void MmapFile::create(void) {
+    this->fd = ::open(this->path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (this->fd < 0)
+        throw DbException(("cannot create " + this->path).c_str(), errno);
+    uint32_t header[2] = {MAGIC, this->block_size};
+    if (ftruncate(this->fd, this->block_size) != 0 || pwrite(this->fd, header, sizeof(header), 0) != sizeof(header))
+        throw DbRelationError("cannot write " + this->path + ": " + strerror(errno));
+    this->last = 0;
+    map_file();
+    SlottedPage *page = get_new(); // force one page to exist
+    delete page;
+}
+
+/**
+ * Delete the physical file.
+ * @throws DbException if there is no file to remove
+ */
+void MmapFile::drop(void) {
+    close();
+    if (unlink(this->path.c_str()) != 0)
+        throw DbException(("cannot remove " + this->path).c_str(), errno);
+}
+
+/**
+ * Open physical file and map it in.
+ * @throws DbException if the file does not exist
+ */
+void MmapFile::open(void) {
+    if (!this->closed)
+        return;
+    this->fd = ::open(this->path.c_str(), O_RDWR);
+    if (this->fd < 0)
+        throw DbException(("cannot open " + this->path).c_str(), errno);
+    uint32_t header[2];
+    struct stat info;
+    if (pread(this->fd, header, sizeof(header), 0) != sizeof(header) || header[0] != MAGIC ||
+        !is_valid_block_size(header[1]) || fstat(this->fd, &info) != 0) {
+        ::close(this->fd);
+        this->fd = -1;
+        throw DbRelationError(this->path + " is not a block file");
+    }
+    this->block_size = header[1];  // an existing file keeps the block size it was created with
+    this->last = (uint32_t) (info.st_size / this->block_size) - 1;
+    map_file();
+}
+
+/**
+ * Write everything back to the file and unmap it.
+ */
+void MmapFile::close(void) {
+    if (this->closed)
+        return;
+    msync(this->map, (uint64_t) (this->last + 1) * this->block_size, MS_SYNC);
+    munmap(this->map, MAX_FILE_SZ);
+    ::close(this->fd);
+    this->map = nullptr;
+    this->fd = -1;
+    this->closed = true;
+    this->verified.clear();
+}
+
+/**
+ * Allocate a new block at the end of the file.
+ * @return the new empty block (freed by caller)
+ */
+SlottedPage *MmapFile::get_new(void) {
+    PerfCounters::mine().blocks_allocated++;
+    uint64_t size = (uint64_t) (this->last + 2) * this->block_size;
+    if (size > MAX_FILE_SZ)
+        throw DbRelationError(this->path + " is full");
+    if (ftruncate(this->fd, (off_t) size) != 0)
+        throw DbRelationError("cannot extend " + this->path + ": " + strerror(errno));
+    BlockID block_id = ++this->last;
+    Dbt data(address(block_id), this->block_size);
+    SlottedPage *page = new SlottedPage(data, block_id, true);
+    page->set_checksum();
+    mark_verified(block_id);
+    return page;
+}
+
+/**
+ * Get a block from the file. The block wraps the mapped memory, so there is no copying.
+ * @param block_id   block to get
+ * @return           the block (freed by caller)
+ */
+SlottedPage *MmapFile::get(BlockID block_id) {
+    PerfCounters::mine().heap_gets++;
+    PerfCounters::mine().blocks_read++;  // the kernel pages it in, if it isn't already
+    Dbt data(address(block_id), this->block_size);
+    SlottedPage *page = new SlottedPage(data, block_id, false);
+    verify(page);
+    return page;
+}
+
+/**
+ * Write a block back to the file. Blocks from get() are already in the file, so all
+ * that is left is to refresh the checksum.
+ * @param block
+ */
+void MmapFile::put(DbBlock *block) {
+    PerfCounters::mine().heap_puts++;
+    BlockID block_id = block->get_block_id();
+    static_cast<SlottedPage *>(block)->set_checksum();  // all our blocks are SlottedPages
+    void *data = block->get_block()->get_data();
+    if (data != address(block_id))
+        memcpy(address(block_id), data, this->block_size);
+    mark_verified(block_id);
+}
+
+/**
+ * Start a sequential scan of all the blocks.
+ * @return  the scan (freed by caller)
+ */
+HeapFileScan *MmapFile::scan() {
+    return new MmapFileScan(*this);
+}
+
+/**
+ * Map address space for the largest allowed file, so the mapping never has to move.
+ */
+void MmapFile::map_file() {
+    void *addr = mmap(nullptr, MAX_FILE_SZ, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, this->fd, 0);
+    if (addr == MAP_FAILED) {
+        ::close(this->fd);
+        this->fd = -1;
+        throw DbRelationError("cannot map " + this->path + ": " + strerror(errno));
+    }
+    this->map = (char *) addr;
+    madvise(this->map, MAX_FILE_SZ, MADV_RANDOM);  // most gets are point lookups; scans say otherwise
+    this->closed = false;
+}
+
+/**
+ * Check a block against its checksum the first time it is read after the file is opened.
+ * Blocks are changed in place in the mapping, so the checksum is only refreshed by put();
+ * checking it again on later reads could catch a block in the middle of a change.
+ * @param page  the block just read (deleted here if it is corrupt)
+ * @throws DbRelationError if the block does not match its checksum
+ */
+void MmapFile::verify(SlottedPage *page) {
+    BlockID block_id = page->get_block_id();
+    if (block_id < this->verified.size() && this->verified[block_id])
+        return;
+    HeapFile::verify(page);
+}
+
+
+/**
+ * Set up a sequential scan.
+ * @param file  the (open) file to scan
+ */
+MmapFileScan::MmapFileScan(MmapFile &file) : HeapFileScan(file), mmap_file(file), block_id(0) {
+    madvise(file.map, (uint64_t) (file.last + 1) * file.block_size, MADV_SEQUENTIAL);
+}
+
+MmapFileScan::~MmapFileScan() {
+    if (this->mmap_file.map != nullptr)
+        madvise(this->mmap_file.map, MmapFile::MAX_FILE_SZ, MADV_RANDOM);
+}
+
+/**
+ * Get the next block in the file.
+ * @return  the next block (freed by caller), or nullptr after the last one
+ * @throws DbRelationError if the block does not match its checksum
+ */
+SlottedPage *MmapFileScan::next() {
+    if (this->block_id >= this->mmap_file.get_last_block_id())
+        return nullptr;
+    return this->mmap_file.get(++this->block_id);
+}
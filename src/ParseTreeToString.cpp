@@ -136,6 +136,9 @@ string ParseTreeToString::expression(const Expr *expr) {
         case kExprLiteralInt:
             ret += to_string(expr->ival);
             break;
+        case kExprPlaceholder:
+            ret += "?";
+            break;
         case kExprFunctionRef:
             ret += string(expr->name) + "?" + expr->expr->name;
             break;
@@ -340,6 +343,21 @@ string ParseTreeToString::del(const DeleteStatement *stmt) {
     return ret;
 }
 
+string ParseTreeToString::update(const UpdateStatement *stmt) {
+    string ret("UPDATE ");
+    ret += table_ref(stmt->table) + " SET ";
+    bool doComma = false;
+    for (UpdateClause *clause : *stmt->updates) {
+        if (doComma)
+            ret += ", ";
+        ret += string(clause->column) + " = " + expression(clause->value);
+        doComma = true;
+    }
+    if (stmt->where != NULL)
+        ret += " WHERE " + expression(stmt->where);
+    return ret;
+}
+
 string ParseTreeToString::statement(const SQLStatement *stmt) {
     switch (stmt->type()) {
         case kStmtSelect:
@@ -354,10 +372,11 @@ string ParseTreeToString::statement(const SQLStatement *stmt) {
             return drop((const DropStatement *) stmt);
         case kStmtShow:
             return show((const ShowStatement *) stmt);
+        case kStmtUpdate:
+            return update((const UpdateStatement *) stmt);
 
         case kStmtError:
         case kStmtImport:
-        case kStmtUpdate:
         case kStmtPrepare:
         case kStmtExecute:
         case kStmtExport:
@@ -0,0 +1,142 @@
+/**
+ * @file PerfCounters.cpp - implementation of PerfCounters
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include <chrono>
+#include <condition_variable>
+#include <thread>
+#include "PerfCounters.h"
+
+using namespace std;
+
+thread_local PerfCounters::Registered PerfCounters::counters;
+mutex PerfCounters::registry_mutex;
+set<const PerfCounters *> PerfCounters::live;
+PerfCounters PerfCounters::retired;
+
+PerfCounters &PerfCounters::operator+=(const PerfCounters &other) {
+    this->blocks_read += other.blocks_read;
+    this->block_hits += other.block_hits;
+    this->heap_gets += other.heap_gets;
+    this->heap_puts += other.heap_puts;
+    this->blocks_allocated += other.blocks_allocated;
+    this->page_compactions += other.page_compactions;
+    this->btree_splits += other.btree_splits;
+    this->node_loads += other.node_loads;
+    this->rows_marshaled += other.rows_marshaled;
+    this->rows_unmarshaled += other.rows_unmarshaled;
+    this->catalog_lookups += other.catalog_lookups;
+    return *this;
+}
+
+/**
+ * The counters by name, in the order they are declared.
+ */
+vector<pair<string, uint64_t>> PerfCounters::list() const {
+    return {
+            {"blocks_read",      this->blocks_read},
+            {"block_hits",       this->block_hits},
+            {"heap_gets",        this->heap_gets},
+            {"heap_puts",        this->heap_puts},
+            {"blocks_allocated", this->blocks_allocated},
+            {"page_compactions", this->page_compactions},
+            {"btree_splits",     this->btree_splits},
+            {"node_loads",       this->node_loads},
+            {"rows_marshaled",   this->rows_marshaled},
+            {"rows_unmarshaled", this->rows_unmarshaled},
+            {"catalog_lookups",  this->catalog_lookups},
+    };
+}
+
+/**
+ * Every thread's counts added up, the finished threads' included. The running threads go on counting
+ * while we read, so this is a little behind by the time it is returned.
+ */
+PerfCounters PerfCounters::total() {
+    lock_guard<mutex> guard(registry_mutex);
+    PerfCounters ret = retired;
+    for (const PerfCounters *counts: live)
+        ret += *counts;
+    return ret;
+}
+
+PerfCounters::Registered::Registered() {
+    lock_guard<mutex> guard(registry_mutex);
+    live.insert(this);
+}
+
+PerfCounters::Registered::~Registered() {
+    lock_guard<mutex> guard(registry_mutex);
+    live.erase(this);
+    retired += *this;
+}
+
+
+/*
+ * The periodic dump
+ */
+
+/**
+ * @class Dumper - thread that writes what the counters did since last time, every so often
+ */
+class Dumper {
+public:
+    Dumper() : seconds(0), out(nullptr), stopping(false) {}
+
+    ~Dumper() {
+        set(0, nullptr);  // at exit
+    }
+
+    /**
+     * Start, restart with a new interval, or (with 0 seconds) stop.
+     */
+    void set(uint32_t seconds, ostream *out) {
+        {
+            lock_guard<std::mutex> guard(this->mutex);
+            this->stopping = true;
+        }
+        this->wake.notify_all();
+        if (this->worker.joinable())
+            this->worker.join();
+        this->seconds = seconds;
+        this->out = out;
+        this->stopping = false;
+        if (seconds > 0 && out != nullptr)
+            this->worker = thread(&Dumper::run, this);
+    }
+
+protected:
+    uint32_t seconds;
+    ostream *out;
+    bool stopping;
+    std::mutex mutex;
+    condition_variable wake;
+    thread worker;
+
+    void run() {
+        PerfCounters last = PerfCounters::total();
+        unique_lock<std::mutex> lock(this->mutex);
+        while (!this->wake.wait_for(lock, chrono::seconds(this->seconds), [this] { return this->stopping; })) {
+            PerfCounters now = PerfCounters::total();
+            vector<pair<string, uint64_t>> before = last.list(), after = now.list();
+            string line = "(sql5300 status, last " + to_string(this->seconds) + " s:";
+            for (size_t i = 0; i < after.size(); i++)
+                line += " " + after[i].first + " " + to_string(after[i].second - before[i].second);
+            *this->out << line << ")" << endl;
+            last = now;
+        }
+    }
+};
+
+static Dumper dumper;
+
+/**
+ * Write how much each counter has gone up, every so often.
+ * @param seconds  how often (0 to stop)
+ * @param out      where to write
+ */
+void PerfCounters::set_dump_interval(uint32_t seconds, ostream *out) {
+    static std::mutex setting;  // one change at a time
+    lock_guard<std::mutex> guard(setting);
+    dumper.set(seconds, out);
+}
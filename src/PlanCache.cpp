@@ -0,0 +1,366 @@
+/**
+ * @file PlanCache.cpp - implementation of PreparedStatement and PlanCache classes
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include <cctype>
+#include <cstdint>
+#include <iostream>
+#include "PlanCache.h"
+#include "ParseTreeToString.h"
+#include "SQLExec.h"
+
+using namespace std;
+using namespace hsql;
+
+/*
+ * PreparedStatement
+ */
+
+PreparedStatement::PreparedStatement(const string &text) : text(text), parse(nullptr), statement(nullptr),
+                                                            plan(nullptr) {
+    this->parse = SQLParser::parseSQLString(text);
+    if (!this->parse->isValid()) {
+        string message = this->parse->errorMsg() != nullptr ? this->parse->errorMsg() : "";
+        delete this->parse;
+        throw SQLExecError("invalid SQL: " + text + (message.empty() ? "" : " (" + message + ")"));
+    }
+    if (this->parse->size() != 1) {
+        delete this->parse;
+        throw SQLExecError("only one statement can be prepared at a time");
+    }
+    this->statement = this->parse->getStatement(0);
+
+    // number the placeholders in the order they appear
+    switch (this->statement->type()) {
+        case kStmtSelect: {
+            const SelectStatement *select = (const SelectStatement *) this->statement;
+            for (const Expr *expr: *select->selectList)
+                find_placeholders(expr);
+            find_placeholders(select->whereClause);
+            break;
+        }
+        case kStmtInsert: {
+            const InsertStatement *insert = (const InsertStatement *) this->statement;
+            if (insert->values != nullptr)
+                for (const Expr *expr: *insert->values)
+                    find_placeholders(expr);
+            break;
+        }
+        case kStmtUpdate: {
+            const UpdateStatement *update = (const UpdateStatement *) this->statement;
+            for (const UpdateClause *clause: *update->updates)
+                find_placeholders(clause->value);
+            find_placeholders(update->where);
+            break;
+        }
+        case kStmtDelete:
+            find_placeholders(((const DeleteStatement *) this->statement)->expr);
+            break;
+        default:
+            break;
+    }
+
+    // the echo, ready for the arguments to go in where the placeholders are
+    string echo = ParseTreeToString::statement(this->statement);
+    size_t start = 0;
+    for (size_t at = echo.find('?'); at != string::npos; at = echo.find('?', start)) {
+        this->echo_pieces.push_back(echo.substr(start, at - start));
+        start = at + 1;
+    }
+    this->echo_pieces.push_back(echo.substr(start));
+    if (this->echo_pieces.size() != this->placeholders.size() + 1)
+        this->echo_pieces = {echo};  // a "?" that isn't a placeholder: just echo it as is
+}
+
+PreparedStatement::~PreparedStatement() {
+    delete this->parse;
+}
+
+/**
+ * Which parameter is this placeholder?
+ * @param placeholder  one of the statement's placeholders
+ * @return             its number (counting from 0)
+ * @throws SQLExecError if it isn't one of ours
+ */
+size_t PreparedStatement::parameter_number(const Expr *placeholder) const {
+    for (size_t i = 0; i < this->placeholders.size(); i++)
+        if (this->placeholders[i] == placeholder)
+            return i;
+    throw SQLExecError("parameter is not part of the statement");
+}
+
+/**
+ * The statement as the parser understood it, with the arguments filled in, for the REPL to print.
+ * @param arguments  values of the parameters
+ * @return           the statement
+ */
+string PreparedStatement::echo(const vector<Value> &arguments) const {
+    if (this->echo_pieces.size() != this->placeholders.size() + 1)
+        return this->echo_pieces[0];
+    string ret = this->echo_pieces[0];
+    for (size_t i = 0; i < this->placeholders.size(); i++) {
+        if (i >= arguments.size())
+            ret += "?";
+        else if (arguments[i].data_type == ColumnAttribute::TEXT)
+            ret += "\"" + arguments[i].s + "\"";
+        else
+            ret += to_string(arguments[i].n);
+        ret += this->echo_pieces[i + 1];
+    }
+    return ret;
+}
+
+// depth-first, left to right, which is the order they appear in the statement
+void PreparedStatement::find_placeholders(const Expr *expr) {
+    if (expr == nullptr)
+        return;
+    if (expr->type == kExprPlaceholder)
+        this->placeholders.push_back(expr);
+    find_placeholders(expr->expr);
+    find_placeholders(expr->expr2);
+    if (expr->exprList != nullptr)
+        for (const Expr *item: *expr->exprList)
+            find_placeholders(item);
+}
+
+
+/*
+ * PlanCache
+ */
+
+mutex PlanCache::mutex;
+size_t PlanCache::capacity = PlanCache::DEFAULT_CAPACITY;
+PlanCache::Entries PlanCache::entries;
+unordered_map<string, PlanCache::Entries::iterator> PlanCache::by_text;
+
+/**
+ * Get the prepared statement for some SQL, parsing it if it isn't cached.
+ * @param text  the statement (see normalize)
+ * @return      the prepared statement
+ * @throws SQLExecError if it isn't valid SQL, or is more than one statement
+ */
+PreparedStatementPtr PlanCache::get(const string &text) {
+    {
+        lock_guard<std::mutex> guard(PlanCache::mutex);
+        auto hit = by_text.find(text);
+        if (hit != by_text.end()) {
+            entries.splice(entries.begin(), entries, hit->second);
+            if (hit->second->prepared == nullptr)
+                throw SQLExecError(hit->second->error);
+            return hit->second->prepared;
+        }
+    }
+
+    // parse without holding up everyone else
+    PreparedStatementPtr prepared;
+    string error;
+    try {
+        prepared = make_shared<PreparedStatement>(text);
+    } catch (SQLExecError &e) {
+        error = e.what();
+    }
+
+    lock_guard<std::mutex> guard(PlanCache::mutex);
+    auto hit = by_text.find(text);
+    if (hit == by_text.end() && capacity > 0) {
+        entries.push_front(Entry{text, prepared, error});
+        by_text[text] = entries.begin();
+        trim();
+    } else if (hit != by_text.end() && hit->second->prepared != nullptr) {
+        prepared = hit->second->prepared;  // somebody beat us to it
+    }
+    if (prepared == nullptr)
+        throw SQLExecError(error);
+    return prepared;
+}
+
+/**
+ * Is this a statement whose plan is worth keeping? Only selects, inserts, updates, and deletes have
+ * plans; anything else (DDL especially, which changes the catalog anyway) is just parsed and run.
+ * @param line  what the user typed
+ * @return      true if it starts with SELECT, INSERT, UPDATE, or DELETE
+ */
+bool PlanCache::plans(const string &line) {
+    string keyword;
+    for (size_t i = line.find_first_not_of(" \t\r\n"); i < line.size() && isalpha((unsigned char) line[i]); i++)
+        keyword += (char) tolower((unsigned char) line[i]);
+    return keyword == "select" || keyword == "insert" || keyword == "update" || keyword == "delete";
+}
+
+/**
+ * Take the literals out of a line of SQL, so that statements that differ only in their literals look
+ * the same: "select * from foo where id = 7 and name = 'x'" becomes "select * from foo where id = ? and
+ * name = ?", with arguments 7 and "x". Runs of white space become a single space.
+ * @param line       what the user typed
+ * @param text       returned by reference: the line with a "?" for each literal
+ * @param arguments  returned by reference: the literals, in order
+ * @return           false if the line can't be run that way (it has parameters of its own, or a
+ *                   literal we don't handle), in which case it should be parsed as it is
+ */
+bool PlanCache::normalize(const string &line, string &text, vector<Value> &arguments) {
+    text.clear();
+    arguments.clear();
+    size_t n = line.size();
+    bool space = false;
+    for (size_t i = 0; i < n;) {
+        unsigned char c = line[i];
+        if (isspace(c)) {
+            space = true;
+            i++;
+            continue;
+        }
+        if (space && !text.empty())
+            text += ' ';
+        space = false;
+
+        size_t end = i + 1;
+        if (c == '\'') {
+            // string literal
+            end = line.find('\'', i + 1);
+            if (end == string::npos)
+                return false;
+            arguments.push_back(Value(line.substr(i + 1, end - i - 1)));
+            text += '?';
+            end++;
+        } else if (c == '"') {
+            // quoted identifier
+            end = line.find('"', i + 1);
+            if (end == string::npos)
+                return false;
+            end++;
+            text.append(line, i, end - i);
+        } else if (isdigit(c)) {
+            // integer literal
+            while (end < n && isdigit((unsigned char) line[end]))
+                end++;
+            if (end < n && (line[end] == '.' || line[end] == '_' || isalpha((unsigned char) line[end])))
+                return false;
+            if (end - i > 10)
+                return false;
+            long long value = stoll(line.substr(i, end - i));
+            if (value > INT32_MAX)
+                return false;
+            arguments.push_back(Value((int32_t) value));
+            text += '?';
+        } else if (isalpha(c) || c == '_') {
+            // keyword or identifier (including any digits in it)
+            while (end < n && (isalnum((unsigned char) line[end]) || line[end] == '_'))
+                end++;
+            text.append(line, i, end - i);
+        } else if (c == '?') {
+            return false;
+        } else {
+            text += (char) c;
+        }
+        i = end;
+    }
+    return true;
+}
+
+/**
+ * Change how many statements are kept (0 to keep none).
+ */
+void PlanCache::set_capacity(size_t capacity) {
+    lock_guard<std::mutex> guard(PlanCache::mutex);
+    PlanCache::capacity = capacity;
+    trim();
+}
+
+size_t PlanCache::get_capacity() {
+    lock_guard<std::mutex> guard(PlanCache::mutex);
+    return PlanCache::capacity;
+}
+
+// drop the least recently used statements until there are few enough (mutex must be locked)
+void PlanCache::trim() {
+    while (entries.size() > capacity) {
+        by_text.erase(entries.back().text);
+        entries.pop_back();
+    }
+}
+
+// does the line normalize to the text and arguments given?
+static bool test_normalize(const string &line, const string &expected_text, const vector<Value> &expected_arguments) {
+    string text;
+    vector<Value> arguments;
+    if (!PlanCache::normalize(line, text, arguments) || text != expected_text || arguments != expected_arguments) {
+        cout << "normalize: " << line << " -> " << text << endl;
+        return false;
+    }
+    return true;
+}
+
+// is the line left to the parser?
+static bool test_not_normalized(const string &line) {
+    string text;
+    vector<Value> arguments;
+    if (PlanCache::normalize(line, text, arguments)) {
+        cout << "normalize should refuse: " << line << " -> " << text << endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Test taking the literals out of statements (and leaving the ones we can't to the parser), which
+ * statements are planned, and keeping, sharing, and dropping the least recently used statements.
+ * @return true if the tests all succeeded
+ */
+bool test_plan_cache() {
+    if (!test_normalize("select * from foo where id = 7 and name = 'x  y'",
+                        "select * from foo where id = ? and name = ?", {Value(7), Value("x  y")}) ||
+        !test_normalize("  select\t*  from foo\nwhere id=-12 ", "select * from foo where id=-?", {Value(12)}) ||
+        !test_normalize("insert into t2 (\"a 1\", b) values (2147483647, '')",
+                        "insert into t2 (\"a 1\", b) values (?, ?)", {Value(2147483647), Value("")}) ||
+        !test_normalize("delete from foo", "delete from foo", {}))
+        return false;
+    if (!test_not_normalized("select * from foo where x = 1.5") ||
+        !test_not_normalized("select * from foo where x = 12abc") ||
+        !test_not_normalized("select * from foo where x = 2147483648") ||
+        !test_not_normalized("select * from foo where x = ?") ||
+        !test_not_normalized("select * from foo where x = 'open") ||
+        !test_not_normalized("select * from \"open"))
+        return false;
+
+    if (!PlanCache::plans("SELECT * from foo") || !PlanCache::plans("  insert into foo values (1)") ||
+        !PlanCache::plans("update foo set a = 1") || !PlanCache::plans("Delete from foo") ||
+        PlanCache::plans("create table foo (a int)") || PlanCache::plans("show tables") ||
+        PlanCache::plans("selection")) {
+        cout << "plans" << endl;
+        return false;
+    }
+
+    size_t capacity = PlanCache::get_capacity();
+    bool ok = true;
+    try {
+        PreparedStatementPtr first = PlanCache::get("select * from _test_plan_cache where a = ?");
+        if (PlanCache::get("select * from _test_plan_cache where a = ?") != first || first->parameter_count() != 1) {
+            cout << "statement not kept" << endl;
+            ok = false;
+        }
+        for (int i = 0; ok && i < 2; i++) {
+            try {
+                PlanCache::get("select from where");
+                cout << "invalid statement prepared" << endl;
+                ok = false;
+            } catch (SQLExecError &e) {
+                // so it should be, both times (the second from the cache)
+            }
+        }
+        PlanCache::set_capacity(2);
+        PreparedStatementPtr a = PlanCache::get("select * from _test_plan_cache where a = ?");
+        PreparedStatementPtr b = PlanCache::get("select * from _test_plan_cache where b = ?");
+        PlanCache::get("select * from _test_plan_cache where a = ?");  // now the most recently used
+        PlanCache::get("select * from _test_plan_cache where c = ?");  // so b is dropped
+        if (ok && (PlanCache::get("select * from _test_plan_cache where a = ?") != a ||
+                   PlanCache::get("select * from _test_plan_cache where b = ?") == b)) {
+            cout << "least recently used not dropped" << endl;
+            ok = false;
+        }
+    } catch (SQLExecError &e) {
+        cout << e.what() << endl;
+        ok = false;
+    }
+    PlanCache::set_capacity(capacity);
+    return ok;
+}
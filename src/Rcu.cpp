@@ -0,0 +1,170 @@
+/**
+ * @file Rcu.cpp - implementation of Rcu class
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <iostream>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "Rcu.h"
+
+using namespace std;
+
+/**
+ * Each thread's announcement of when its current read section started (0 if it isn't in one).
+ * Slots are a cache line each so that readers on different cores don't slow each other down.
+ */
+struct alignas(64) ReaderSlot {
+    atomic<uint64_t> active;
+    uint32_t depth;  // how deeply nested the thread's read sections are
+
+    ReaderSlot();
+
+    ~ReaderSlot();
+};
+
+static atomic<uint64_t> epoch(1);
+static mutex rcu_mutex;  // guards the list of slots and the retired list
+static vector<pair<uint64_t, function<void()>>> retired;  // epoch retired in, and how to delete it
+static atomic<size_t> pending(0);  // size of retired, for a quick look without the lock
+static thread_local ReaderSlot slot;
+
+// every thread's slot (built on first use, so it outlives the slots that are in it)
+static set<ReaderSlot *> &slots() {
+    static set<ReaderSlot *> all;
+    return all;
+}
+
+ReaderSlot::ReaderSlot() : active(0), depth(0) {
+    lock_guard<mutex> lock(rcu_mutex);
+    slots().insert(this);
+}
+
+ReaderSlot::~ReaderSlot() {
+    lock_guard<mutex> lock(rcu_mutex);
+    slots().erase(this);
+}
+
+/**
+ * Start a read section: from here on, nothing this thread can see will be deleted.
+ */
+Rcu::ReadSection::ReadSection() {
+    if (slot.depth++ == 0)
+        slot.active.store(epoch.load());
+}
+
+/**
+ * End a read section, and delete whatever was waiting only for this thread.
+ */
+Rcu::ReadSection::~ReadSection() {
+    if (--slot.depth == 0) {
+        slot.active.store(0);
+        if (pending.load() > 0)
+            reclaim();
+    }
+}
+
+/**
+ * Retire something that has already been replaced (so new read sections can't find it).
+ * @param reclaim  deletes it; called once no read section that might have found it is left
+ */
+void Rcu::retire(function<void()> reclaim) {
+    {
+        lock_guard<mutex> lock(rcu_mutex);
+        retired.emplace_back(epoch.fetch_add(1), move(reclaim));
+        pending.store(retired.size());
+    }
+    Rcu::reclaim();
+}
+
+/**
+ * Delete everything retired before the oldest read section still going started.
+ */
+void Rcu::reclaim() {
+    vector<function<void()>> ready;
+    {
+        lock_guard<mutex> lock(rcu_mutex);
+        uint64_t oldest = UINT64_MAX;
+        for (ReaderSlot *reader: slots()) {
+            uint64_t started = reader->active.load();
+            if (started != 0 && started < oldest)
+                oldest = started;
+        }
+        auto keep = retired.begin();
+        for (auto &entry: retired) {
+            if (entry.first < oldest)
+                ready.push_back(move(entry.second));
+            else
+                *keep++ = move(entry);
+        }
+        retired.erase(keep, retired.end());
+        pending.store(retired.size());
+    }
+    for (auto &reclaim: ready)
+        reclaim();  // outside the lock, since deleting one thing may retire another
+}
+
+/**
+ * Test that retired things are deleted once, and only once, no read section that began before they
+ * were retired is left: right away with no readers, after the outermost of nested read sections, and
+ * not before another thread's read section ends (though one that began after the retirement doesn't
+ * hold it up).
+ * @return true if the tests all succeeded
+ */
+bool test_rcu() {
+    int reclaimed = 0;
+    Rcu::retire([&reclaimed] { reclaimed++; });
+    if (reclaimed != 1) {
+        cout << "not reclaimed with no readers" << endl;
+        return false;
+    }
+
+    reclaimed = 0;
+    {
+        Rcu::ReadSection outer;
+        {
+            Rcu::ReadSection inner;
+            Rcu::retire([&reclaimed] { reclaimed++; });
+        }
+        if (reclaimed != 0) {
+            cout << "reclaimed in the outer read section" << endl;
+            return false;
+        }
+    }
+    if (reclaimed != 1) {
+        cout << "not reclaimed after the read sections" << endl;
+        return false;
+    }
+
+    // another thread reads from before the retirement, we read from after it
+    reclaimed = 0;
+    atomic<int> step(0);
+    thread reader([&step] {
+        Rcu::ReadSection section;
+        step = 1;
+        while (step.load() != 2)
+            this_thread::yield();
+    });
+    while (step.load() != 1)
+        this_thread::yield();
+    Rcu::retire([&reclaimed] { reclaimed++; });
+    {
+        Rcu::ReadSection section;
+    }
+    bool held = reclaimed == 0;
+    step = 2;
+    reader.join();
+    if (!held) {
+        cout << "reclaimed during another thread's read section" << endl;
+        return false;
+    }
+    if (reclaimed != 1) {
+        cout << "not reclaimed after another thread's read section" << endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,281 @@
+/**
+ * @file ResultCache.cpp - implementation of ResultCache class
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include <iostream>
+#include "ResultCache.h"
+#include "HeapTable.h"
+#include "RowSink.h"
+#include "SQLExec.h"
+
+using namespace std;
+
+mutex ResultCache::mutex;
+size_t ResultCache::capacity = 0;
+size_t ResultCache::bytes = 0;
+uint64_t ResultCache::epoch = 0;
+ResultCache::Entries ResultCache::entries;
+unordered_map<string, ResultCache::Entries::iterator> ResultCache::by_key;
+uint64_t ResultCache::hits = 0;
+uint64_t ResultCache::misses = 0;
+uint64_t ResultCache::stale = 0;
+uint64_t ResultCache::evictions = 0;
+
+/**
+ * Is the cache turned on?
+ */
+bool ResultCache::enabled() {
+    lock_guard<std::mutex> guard(ResultCache::mutex);
+    return capacity > 0;
+}
+
+/**
+ * The key for a statement run with some arguments.
+ * @param text       the statement, with its literals taken out (see PlanCache::normalize)
+ * @param arguments  the literals
+ * @return           the key
+ */
+string ResultCache::key(const string &text, const vector<Value> &arguments) {
+    string ret = text;
+    for (const Value &argument: arguments) {
+        ret += '\0';
+        if (argument.data_type == ColumnAttribute::TEXT)
+            ret += "s" + argument.s;
+        else
+            ret += "n" + to_string(argument.n);
+    }
+    return ret;
+}
+
+/**
+ * Take this before reading a result that is to be cached, and pass it to insert.
+ */
+uint64_t ResultCache::get_epoch() {
+    lock_guard<std::mutex> guard(ResultCache::mutex);
+    return epoch;
+}
+
+/**
+ * Look for a result.
+ * @param key  see key
+ * @return     a copy of the result (freed by caller), or nullptr if there isn't one or its table
+ *             has changed since it was read
+ */
+QueryResult *ResultCache::find(const string &key) {
+    lock_guard<std::mutex> guard(ResultCache::mutex);
+    auto hit = by_key.find(key);
+    if (hit == by_key.end()) {
+        misses++;
+        return nullptr;
+    }
+    Entries::iterator entry = hit->second;
+    if (entry->epoch != epoch || entry->version != HeapTable::version(entry->table_name).load()) {
+        erase(entry);
+        stale++;
+        misses++;
+        return nullptr;
+    }
+    entries.splice(entries.begin(), entries, entry);
+    hits++;
+    return copy(*entry->result);
+}
+
+/**
+ * Keep a result. Only results that nobody else can have uncommitted changes under belong here.
+ * @param key         see key
+ * @param table_name  the table it was read from
+ * @param version     the table's version before it was read
+ * @param epoch       see get_epoch
+ * @param result      the result (copied)
+ */
+void ResultCache::insert(const string &key, const Identifier &table_name, uint64_t version, uint64_t epoch,
+                         const QueryResult &result) {
+    size_t size = size_of(key, result);
+    lock_guard<std::mutex> guard(ResultCache::mutex);
+    if (size > capacity || epoch != ResultCache::epoch)
+        return;
+    auto old = by_key.find(key);
+    if (old != by_key.end())
+        erase(old->second);
+    entries.push_front(Entry{key, table_name, version, epoch, copy(result), size});
+    by_key[key] = entries.begin();
+    bytes += size;
+    trim();
+}
+
+/**
+ * Make every result cached so far stale (after a change to the catalog is rolled back).
+ */
+void ResultCache::invalidate_all() {
+    lock_guard<std::mutex> guard(ResultCache::mutex);
+    epoch++;
+}
+
+/**
+ * Change how many bytes of results are kept (0 to turn the cache off).
+ */
+void ResultCache::set_capacity(size_t bytes) {
+    lock_guard<std::mutex> guard(ResultCache::mutex);
+    capacity = bytes;
+    trim();
+}
+
+size_t ResultCache::get_capacity() {
+    lock_guard<std::mutex> guard(ResultCache::mutex);
+    return capacity;
+}
+
+ResultCache::Stats ResultCache::stats() {
+    lock_guard<std::mutex> guard(ResultCache::mutex);
+    return Stats{capacity, bytes, entries.size(), hits, misses, stale, evictions};
+}
+
+QueryResult *ResultCache::copy(const QueryResult &result) {
+    ValueDicts *rows = new ValueDicts();
+    rows->reserve(result.get_rows()->size());
+    for (ValueDict *row: *result.get_rows())
+        rows->push_back(new ValueDict(*row));
+    return new QueryResult(new ColumnNames(*result.get_column_names()),
+                           new ColumnAttributes(*result.get_column_attributes()), rows, result.get_message());
+}
+
+// about how much memory a cached result takes
+size_t ResultCache::size_of(const string &key, const QueryResult &result) {
+    size_t size = sizeof(Entry) + key.size() + sizeof(QueryResult) + result.get_message().size();
+    for (const Identifier &column_name: *result.get_column_names())
+        size += sizeof(Identifier) + column_name.size() + sizeof(ColumnAttribute);
+    for (const ValueDict *row: *result.get_rows())
+        size += RowCollector::size_of(*row);
+    return size;
+}
+
+// mutex must be locked
+void ResultCache::erase(Entries::iterator entry) {
+    bytes -= entry->bytes;
+    delete entry->result;
+    by_key.erase(entry->key);
+    entries.erase(entry);
+}
+
+// drop the least recently used results until they fit (mutex must be locked)
+void ResultCache::trim() {
+    while (bytes > capacity && !entries.empty()) {
+        erase(prev(entries.end()));
+        evictions++;
+    }
+}
+
+// a result with a row for each of the values
+static QueryResult *test_result(const vector<int32_t> &values) {
+    ValueDicts *rows = new ValueDicts();
+    for (int32_t value: values) {
+        ValueDict *row = new ValueDict();
+        (*row)["a"] = Value(value);
+        rows->push_back(row);
+    }
+    return new QueryResult(new ColumnNames{"a"}, new ColumnAttributes{ColumnAttribute(ColumnAttribute::INT)}, rows,
+                           "successfully returned " + to_string(values.size()) + " rows");
+}
+
+// is the result for the key cached, and (if so) the one with these rows?
+static bool test_cached(const string &key, const vector<int32_t> &values) {
+    QueryResult *result = ResultCache::find(key);
+    if (result == nullptr)
+        return false;
+    bool same = result->get_rows()->size() == values.size();
+    for (size_t i = 0; same && i < values.size(); i++)
+        same = result->get_rows()->at(i)->at("a") == Value(values[i]);
+    delete result;
+    return same;
+}
+
+// cache a result for the key, as read from the table as it is now
+static void test_insert(const string &key, const Identifier &table_name, const vector<int32_t> &values) {
+    uint64_t version = HeapTable::version(table_name).load();
+    uint64_t epoch = ResultCache::get_epoch();
+    QueryResult *result = test_result(values);
+    ResultCache::insert(key, table_name, version, epoch, *result);
+    delete result;
+}
+
+/**
+ * Test that cached results are found (as copies of what was put in), that they go stale when their
+ * table changes or everything is invalidated, that a result read before an invalidation isn't kept,
+ * and that the least recently used results are dropped when the cache is full.
+ * @return true if the tests all succeeded
+ */
+bool test_result_cache() {
+    const Identifier table_name = "_test_result_cache";
+    const string key1 = ResultCache::key("select * from _test_result_cache where a = ?", {Value(1)});
+    const string key2 = ResultCache::key("select * from _test_result_cache where a = ?", {Value(2)});
+    const string key3 = ResultCache::key("select * from _test_result_cache where a = ?", {Value(3)});
+    if (key1 == key2 || key1 != ResultCache::key("select * from _test_result_cache where a = ?", {Value(1)}) ||
+        ResultCache::key("?", {Value(1)}) == ResultCache::key("?", {Value("1")})) {
+        cout << "keys" << endl;
+        return false;
+    }
+
+    size_t capacity = ResultCache::get_capacity();
+    ResultCache::set_capacity(1 << 20);
+    bool ok = true;
+
+    // found until the table changes
+    test_insert(key1, table_name, {1, 2, 3});
+    if (!test_cached(key1, {1, 2, 3}) || !test_cached(key1, {1, 2, 3})) {
+        cout << "result not kept" << endl;
+        ok = false;
+    }
+    uint64_t stale = ResultCache::stats().stale;
+    HeapTable::version(table_name)++;
+    if (ok && (test_cached(key1, {1, 2, 3}) || ResultCache::stats().stale != stale + 1)) {
+        cout << "result kept after its table changed" << endl;
+        ok = false;
+    }
+
+    // gone stale with everything else
+    test_insert(key1, table_name, {4});
+    ResultCache::invalidate_all();
+    if (ok && test_cached(key1, {4})) {
+        cout << "result kept after invalidate_all" << endl;
+        ok = false;
+    }
+
+    // read before an invalidation, so never kept
+    uint64_t version = HeapTable::version(table_name).load();
+    uint64_t epoch = ResultCache::get_epoch();
+    ResultCache::invalidate_all();
+    QueryResult *result = test_result({5});
+    ResultCache::insert(key1, table_name, version, epoch, *result);
+    delete result;
+    if (ok && test_cached(key1, {5})) {
+        cout << "result read before invalidate_all kept" << endl;
+        ok = false;
+    }
+
+    // room for two results: the least recently used goes
+    ResultCache::set_capacity(0);
+    ResultCache::set_capacity(1 << 20);
+    test_insert(key1, table_name, {1});
+    size_t size = ResultCache::stats().bytes;
+    ResultCache::set_capacity(size * 2 + size / 2);
+    test_insert(key2, table_name, {2});
+    test_cached(key1, {1});  // now the most recently used
+    uint64_t evictions = ResultCache::stats().evictions;
+    test_insert(key3, table_name, {3});
+    if (ok && (!test_cached(key1, {1}) || test_cached(key2, {2}) || !test_cached(key3, {3}) ||
+               ResultCache::stats().evictions != evictions + 1)) {
+        cout << "least recently used result not dropped" << endl;
+        ok = false;
+    }
+
+    // too big to keep at all
+    ResultCache::set_capacity(size / 2);
+    test_insert(key1, table_name, {1});
+    if (ok && (test_cached(key1, {1}) || ResultCache::stats().entries != 0)) {
+        cout << "result bigger than the cache kept" << endl;
+        ok = false;
+    }
+
+    ResultCache::set_capacity(capacity);
+    return ok;
+}
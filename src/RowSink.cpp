@@ -0,0 +1,509 @@
+/**
+ * @file RowSink.cpp - implementation of the RowSink classes, and benchmark_output
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include "RowSink.h"
+
+using namespace std;
+
+// bookkeeping per node of a std::map (color and three pointers), for guessing how big a row is
+static const size_t MAP_NODE_OVERHEAD = 32;
+
+/*
+ * RowSink
+ */
+
+/**
+ * Is this the name of an output format?
+ * @param format  text, csv, tsv, or binary
+ */
+bool RowSink::is_valid_format(const string &format) {
+    return format == "text" || format == "csv" || format == "tsv" || format == "binary";
+}
+
+/**
+ * A sink that writes rows in the given format.
+ * @param format  see is_valid_format
+ * @param out     where to write them
+ * @return        the sink (freed by caller)
+ * @throws DbRelationError if there is no such format
+ */
+RowSink *RowSink::make(const string &format, ostream &out) {
+    if (format == "text")
+        return new TextRowSink(out);
+    if (format == "csv")
+        return new CsvRowSink(out);
+    if (format == "tsv")
+        return new TsvRowSink(out);
+    if (format == "binary")
+        return new BinaryRowSink(out);
+    throw DbRelationError("unknown output format " + format);
+}
+
+
+/*
+ * TextRowSink
+ */
+
+void TextRowSink::begin(const ColumnNames &column_names, const ColumnAttributes &column_attributes) {
+    this->column_names = column_names;
+    for (const Identifier &column_name: column_names)
+        this->out << column_name << " ";
+    this->out << endl << "+";
+    for (unsigned int i = 0; i < column_names.size(); i++)
+        this->out << "----------+";
+    this->out << '\n';
+}
+
+void TextRowSink::row(const ValueDict &row) {
+    for (const Identifier &column_name: this->column_names) {
+        const Value &value = row.at(column_name);
+        switch (value.data_type) {
+            case ColumnAttribute::INT:
+                this->out << value.n;
+                break;
+            case ColumnAttribute::TEXT:
+                this->out << "\"" << value.s << "\"";
+                break;
+            case ColumnAttribute::BOOLEAN:
+                this->out << (value.n == 0 ? "false" : "true");
+                break;
+            default:
+                this->out << "???";
+        }
+        this->out << " ";
+    }
+    this->out << '\n';  // not endl: flushing every row would cost more than printing it
+}
+
+
+/*
+ * BufferedRowSink
+ */
+
+BufferedRowSink::BufferedRowSink(ostream &out) : out(out), column_names(), buffer(BUFFER_SIZE), used(0) {
+}
+
+void BufferedRowSink::begin(const ColumnNames &column_names, const ColumnAttributes &column_attributes) {
+    this->column_names = column_names;
+}
+
+void BufferedRowSink::end() {
+    flush();
+    this->out.flush();
+}
+
+// write out what's in the buffer
+void BufferedRowSink::flush() {
+    if (this->used > 0)
+        this->out.write(this->buffer.data(), (streamsize) this->used);
+    this->used = 0;
+}
+
+void BufferedRowSink::put(const char *data, size_t n) {
+    if (n > this->buffer.size() - this->used) {
+        flush();
+        if (n >= this->buffer.size()) {
+            this->out.write(data, (streamsize) n);  // too big to be worth copying
+            return;
+        }
+    }
+    memcpy(this->buffer.data() + this->used, data, n);
+    this->used += n;
+}
+
+// in decimal
+void BufferedRowSink::put_int(int32_t n) {
+    const size_t MAX_DIGITS = 11;  // "-2147483648"
+    if (this->buffer.size() - this->used < MAX_DIGITS)
+        flush();
+    char *start = this->buffer.data() + this->used;
+    this->used += (size_t) (to_chars(start, start + MAX_DIGITS, n).ptr - start);
+}
+
+// in four bytes, little-endian
+void BufferedRowSink::put_uint32(uint32_t n) {
+    if (this->buffer.size() - this->used < 4)
+        flush();
+    char *at = this->buffer.data() + this->used;
+    at[0] = (char) (n & 0xFF);
+    at[1] = (char) ((n >> 8) & 0xFF);
+    at[2] = (char) ((n >> 16) & 0xFF);
+    at[3] = (char) ((n >> 24) & 0xFF);
+    this->used += 4;
+}
+
+
+/*
+ * CsvRowSink
+ */
+
+void CsvRowSink::begin(const ColumnNames &column_names, const ColumnAttributes &column_attributes) {
+    BufferedRowSink::begin(column_names, column_attributes);
+    for (size_t i = 0; i < column_names.size(); i++) {
+        if (i > 0)
+            put(',');
+        put_text(column_names[i]);
+    }
+    put('\n');
+}
+
+void CsvRowSink::row(const ValueDict &row) {
+    for (size_t i = 0; i < this->column_names.size(); i++) {
+        if (i > 0)
+            put(',');
+        const Value &value = row.at(this->column_names[i]);
+        switch (value.data_type) {
+            case ColumnAttribute::INT:
+                put_int(value.n);
+                break;
+            case ColumnAttribute::TEXT:
+                put_text(value.s);
+                break;
+            case ColumnAttribute::BOOLEAN:
+                put(value.n == 0 ? "false" : "true");
+                break;
+        }
+    }
+    put('\n');
+}
+
+// quoted (with any quotes in it doubled) only if it has to be
+void CsvRowSink::put_text(const string &s) {
+    if (s.find_first_of(",\"\r\n") == string::npos) {
+        put(s);
+        return;
+    }
+    put('"');
+    for (char c: s) {
+        if (c == '"')
+            put('"');
+        put(c);
+    }
+    put('"');
+}
+
+
+/*
+ * TsvRowSink
+ */
+
+void TsvRowSink::begin(const ColumnNames &column_names, const ColumnAttributes &column_attributes) {
+    BufferedRowSink::begin(column_names, column_attributes);
+    for (size_t i = 0; i < column_names.size(); i++) {
+        if (i > 0)
+            put('\t');
+        put_text(column_names[i]);
+    }
+    put('\n');
+}
+
+void TsvRowSink::row(const ValueDict &row) {
+    for (size_t i = 0; i < this->column_names.size(); i++) {
+        if (i > 0)
+            put('\t');
+        const Value &value = row.at(this->column_names[i]);
+        switch (value.data_type) {
+            case ColumnAttribute::INT:
+                put_int(value.n);
+                break;
+            case ColumnAttribute::TEXT:
+                put_text(value.s);
+                break;
+            case ColumnAttribute::BOOLEAN:
+                put(value.n == 0 ? "false" : "true");
+                break;
+        }
+    }
+    put('\n');
+}
+
+// with tabs, line breaks, and backslashes escaped
+void TsvRowSink::put_text(const string &s) {
+    if (s.find_first_of("\t\r\n\\") == string::npos) {
+        put(s);
+        return;
+    }
+    for (char c: s) {
+        switch (c) {
+            case '\t':
+                put("\\t", 2);
+                break;
+            case '\r':
+                put("\\r", 2);
+                break;
+            case '\n':
+                put("\\n", 2);
+                break;
+            case '\\':
+                put("\\\\", 2);
+                break;
+            default:
+                put(c);
+        }
+    }
+}
+
+
+/*
+ * BinaryRowSink
+ */
+
+void BinaryRowSink::begin(const ColumnNames &column_names, const ColumnAttributes &column_attributes) {
+    BufferedRowSink::begin(column_names, column_attributes);
+    put_uint32((uint32_t) column_names.size());
+    for (size_t i = 0; i < column_names.size(); i++) {
+        ColumnAttribute attribute = i < column_attributes.size() ? column_attributes[i] : ColumnAttribute::TEXT;
+        put_uint32((uint32_t) column_names[i].size());
+        put(column_names[i]);
+        put((char) attribute.get_data_type());
+    }
+}
+
+void BinaryRowSink::row(const ValueDict &row) {
+    // look the values up once, to get the row's length before writing any of it
+    const size_t columns = this->column_names.size();
+    vector<const Value *> &values = this->values;
+    values.resize(columns);
+    uint32_t length = 0;
+    for (size_t i = 0; i < columns; i++) {
+        values[i] = &row.at(this->column_names[i]);
+        switch (values[i]->data_type) {
+            case ColumnAttribute::INT:
+                length += 4;
+                break;
+            case ColumnAttribute::TEXT:
+                length += 4 + (uint32_t) values[i]->s.size();
+                break;
+            case ColumnAttribute::BOOLEAN:
+                length += 1;
+                break;
+        }
+    }
+    put_uint32(length);
+    for (size_t i = 0; i < columns; i++) {
+        switch (values[i]->data_type) {
+            case ColumnAttribute::INT:
+                put_uint32((uint32_t) values[i]->n);
+                break;
+            case ColumnAttribute::TEXT:
+                put_uint32((uint32_t) values[i]->s.size());
+                put(values[i]->s);
+                break;
+            case ColumnAttribute::BOOLEAN:
+                put((char) (values[i]->n != 0));
+                break;
+        }
+    }
+}
+
+void BinaryRowSink::end() {
+    put_uint32(0xFFFFFFFF);
+    BufferedRowSink::end();
+}
+
+
+/*
+ * RowCollector
+ */
+
+/**
+ * @param next   another sink to pass the rows on to, if any
+ * @param limit  about how many bytes of rows to keep before giving up on keeping them
+ */
+RowCollector::RowCollector(RowSink *next, size_t limit) : next(next), limit(limit), bytes(0), rows_seen(0),
+                                                          rows(new ValueDicts()) {}
+
+RowCollector::~RowCollector() {
+    discard();
+}
+
+void RowCollector::begin(const ColumnNames &column_names, const ColumnAttributes &column_attributes) {
+    if (this->next != nullptr)
+        this->next->begin(column_names, column_attributes);
+}
+
+void RowCollector::row(const ValueDict &row) {
+    this->rows_seen++;
+    if (this->next != nullptr)
+        this->next->row(row);
+    if (this->rows == nullptr)
+        return;
+    this->bytes += size_of(row);
+    if (this->bytes > this->limit)
+        discard();  // too many to keep
+    else
+        this->rows->push_back(new ValueDict(row));
+}
+
+void RowCollector::end() {
+    if (this->next != nullptr)
+        this->next->end();
+}
+
+/**
+ * Take the rows kept so far.
+ * @return  the rows (caller frees the list and the rows in it), or nullptr if there were too many to keep
+ */
+ValueDicts *RowCollector::release() {
+    ValueDicts *ret = this->rows;
+    this->rows = nullptr;
+    return ret;
+}
+
+// stop keeping rows, and free the ones kept so far
+void RowCollector::discard() {
+    if (this->rows == nullptr)
+        return;
+    for (ValueDict *row: *this->rows)
+        delete row;
+    delete this->rows;
+    this->rows = nullptr;
+}
+
+/**
+ * About how much memory a copy of a row takes.
+ */
+size_t RowCollector::size_of(const ValueDict &row) {
+    size_t size = sizeof(ValueDict *) + sizeof(ValueDict);
+    for (auto const &field: row)
+        size += MAP_NODE_OVERHEAD + sizeof(field) + field.first.size() + field.second.s.size();
+    return size;
+}
+
+
+/*
+ * benchmark_output
+ */
+
+/**
+ * Takes what's written to it and throws it away, counting the bytes and the writes.
+ */
+class DiscardingBuffer : public streambuf {
+public:
+    DiscardingBuffer() : bytes(0), writes(0), buffer(64 * 1024) {
+        setp(this->buffer.data(), this->buffer.data() + this->buffer.size());
+    }
+
+    uint64_t bytes, writes;
+
+protected:
+    vector<char> buffer;
+
+    int overflow(int c) override {
+        sync();
+        if (c != traits_type::eof()) {
+            *pptr() = (char) c;
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    streamsize xsputn(const char *data, streamsize n) override {
+        if ((size_t) n < this->buffer.size())
+            return streambuf::xsputn(data, n);
+        sync();
+        this->bytes += (uint64_t) n;
+        this->writes++;
+        return n;
+    }
+
+    int sync() override {
+        if (pptr() > pbase()) {
+            this->bytes += (uint64_t) (pptr() - pbase());
+            this->writes++;
+        }
+        setp(this->buffer.data(), this->buffer.data() + this->buffer.size());
+        return 0;
+    }
+};
+
+// what the formats make of a few awkward rows
+static bool check_formats() {
+    ColumnNames column_names = {"id", "name", "score"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::TEXT),
+                                          ColumnAttribute(ColumnAttribute::INT)};
+    ValueDicts rows;
+    rows.push_back(new ValueDict{{"id", Value(1)}, {"name", Value("a,b")}, {"score", Value(-5)}});
+    rows.push_back(new ValueDict{{"id", Value(2)}, {"name", Value("say \"hi\"")}, {"score", Value(0)}});
+    rows.push_back(new ValueDict{{"id", Value(3)}, {"name", Value("tab\there")}, {"score", Value(INT32_MIN)}});
+    const string expected[] = {
+            "id,name,score\n1,\"a,b\",-5\n2,\"say \"\"hi\"\"\",0\n3,tab\there,-2147483648\n",
+            "id\tname\tscore\n1\ta,b\t-5\n2\tsay \"hi\"\t0\n3\ttab\\there\t-2147483648\n"};
+    const char *formats[] = {"csv", "tsv", "binary"};
+    bool ok = true;
+    for (int f = 0; f < 3; f++) {
+        ostringstream out;
+        RowSink *sink = RowSink::make(formats[f], out);
+        sink->begin(column_names, column_attributes);
+        for (ValueDict *row: rows)
+            sink->row(*row);
+        sink->end();
+        delete sink;
+        string written = out.str();
+        if (f < 2 && written != expected[f]) {
+            cout << formats[f] << " output is wrong:" << endl << written;
+            ok = false;
+        }
+        // header: 4 + (4 + 2 + 1) + (4 + 4 + 1) + (4 + 5 + 1); rows: 4 + 4 + 4 + n + 4 each; end: 4
+        if (f == 2 && (written.size() != 30 + (16 + 3) + (16 + 8) + (16 + 8) + 4 ||
+                       written.compare(written.size() - 4, 4, "\xFF\xFF\xFF\xFF") != 0)) {
+            cout << "binary output is " << written.size() << " bytes" << endl;
+            ok = false;
+        }
+    }
+    for (ValueDict *row: rows)
+        delete row;
+    return ok;
+}
+
+/**
+ * Check that CSV, TSV, and binary output come out as they should, then time writing ROWS rows of
+ * an (int, text, int) table in each format, including the REPL's text format, to a stream that
+ * throws them away. Prints each format's throughput in MB/s and how many writes it took.
+ * @return true if the formats came out right
+ */
+bool benchmark_output() {
+    const int ROWS = 500 * 1000;
+    bool ok = check_formats();
+
+    ColumnNames column_names = {"id", "name", "score"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::TEXT),
+                                          ColumnAttribute(ColumnAttribute::INT)};
+    ValueDicts rows;
+    rows.reserve(ROWS);
+    for (int i = 0; i < ROWS; i++)
+        rows.push_back(new ValueDict{{"id", Value(i)}, {"name", Value("customer number " + to_string(i))},
+                                     {"score", Value(i * 37 - 1000000)}});
+
+    cout << "format        MB      seconds      MB/s    writes" << endl;
+    for (const char *format: {"text", "csv", "tsv", "binary"}) {
+        DiscardingBuffer discard;
+        ostream out(&discard);
+        auto start = chrono::steady_clock::now();
+        RowSink *sink = RowSink::make(format, out);
+        sink->begin(column_names, column_attributes);
+        for (ValueDict *row: rows)
+            sink->row(*row);
+        sink->end();
+        delete sink;
+        out.flush();
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+        double mb = (double) discard.bytes / (1024.0 * 1024.0);
+        cout << left << setw(8) << format << right << fixed << setprecision(1) << setw(8) << mb
+             << setprecision(3) << setw(13) << elapsed.count() << setprecision(1) << setw(10)
+             << mb / elapsed.count() << setw(10) << discard.writes << endl;
+    }
+    cout.unsetf(ios::floatfield);
+    cout << setprecision(6);
+
+    for (ValueDict *row: rows)
+        delete row;
+    return ok;
+}
@@ -3,7 +3,18 @@
  * @authors Kevin Lundeen, Dnyandeep, Samuel
  * @see "Seattle University, CPSC5300, Winter 2024"
  */
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <set>
+#include <sstream>
 #include "SQLExec.h"
+#include "LockManager.h"
+#include "PerfCounters.h"
+#include "ParseTreeToString.h"
+#include "Rcu.h"
+#include "ResultCache.h"
+#include "Transaction.h"
 #include <sql/DropStatement.h>
 
 using namespace std;
@@ -12,36 +23,24 @@ using namespace hsql;
 // define static data
 Tables* SQLExec::tables = nullptr;
 Indices* SQLExec::indices = nullptr;
+once_flag SQLExec::schema_opened;
+thread_local uint32_t SQLExec::block_size = DbBlock::BLOCK_SZ;
+thread_local string SQLExec::storage = "heap";
+thread_local string SQLExec::output = "text";
+atomic<uint64_t> SQLExec::catalog_version(0);
+thread_local PreparedStatement* SQLExec::prepared = nullptr;
+thread_local const vector<Value>* SQLExec::arguments = nullptr;
+thread_local SQLExec::Explain SQLExec::explaining = SQLExec::NO_EXPLAIN;
+thread_local string SQLExec::explained;
 
 // make query result be printable
 ostream& operator<<(ostream& out, const QueryResult& qres) {
     if (qres.column_names != nullptr) {
-        for (Identifier& column_name: *qres.column_names)
-            out << column_name << " ";
-        out << endl << "+";
-        for (unsigned int i = 0; i < qres.column_names->size(); i++)
-            out << "----------+";
-        out << endl;
-        for (ValueDict* row: *qres.rows) {
-            for (Identifier& column_name: *qres.column_names) {
-                Value value = row->at(column_name);
-                switch (value.data_type) {
-                    case ColumnAttribute::INT:
-                        out << value.n;
-                        break;
-                    case ColumnAttribute::TEXT:
-                        out << "\"" << value.s << "\"";
-                        break;
-                    case ColumnAttribute::BOOLEAN:
-                        out << (value.n == 0 ? "false" : "true");
-                        break;
-                    default:
-                        out << "???";
-                }
-                out << " ";
-            }
-            out << endl;
-        }
+        TextRowSink sink(out);
+        sink.begin(*qres.column_names, *qres.column_attributes);
+        for (ValueDict* row: *qres.rows)
+            sink.row(*row);
+        sink.end();
     }
     out << qres.message;
     return out;
@@ -62,86 +61,575 @@ QueryResult::~QueryResult() {
 /**
  * Executes a given SQL statement and returns the result as a QueryResult object.
  * It also initializes the schema tables if they haven't been initialized yet.
+ * The statement runs in a transaction of its own (see Transaction), so if it fails, none of it is kept.
+ * If it would deadlock waiting for a lock, the whole transaction is rolled back.
+ * Every statement holds a lock on the catalog (the _tables table) until its transaction ends: a shared
+ * one to read it, or an exclusive one for CREATE and DROP, so nobody goes by what the catalog says
+ * while a change to it might still be rolled back.
+ * How long it took is recorded by kind of statement, and it goes in the slow query log if it took too long
+ * (see StatementStats).
  *
  * @param statement Pointer to a SQLStatement object representing the SQL statement to execute.
+ * @param sink Where a SELECT's rows go as they are found, or nullptr to have them in the result.
  * @return Pointer to a QueryResult object containing the outcome of the executed statement.
  * @throws SQLExecError if an error occurs during statement execution.
  */
 
-QueryResult* SQLExec::execute(const SQLStatement* statement) {
-    if (!SQLExec::tables)
+QueryResult* SQLExec::execute(const SQLStatement* statement, RowSink* sink) {
+    call_once(SQLExec::schema_opened, [] {
         SQLExec::tables = new Tables();
-    if (!SQLExec::indices)
         SQLExec::indices = new Indices();
-
+    });
+
+    QueryResult* result = nullptr;
+    PerfCounters before = PerfCounters::mine();
+    auto start = chrono::steady_clock::now();
+    SQLExec::explained.clear();
+    bool changes_catalog = statement->type() == kStmtCreate || statement->type() == kStmtDrop;
+    Transaction::begin_statement(statement->type() != kStmtSelect && statement->type() != kStmtShow);
     try {
+        LockManager::lock_table(Tables::TABLE_NAME, changes_catalog ? LockManager::X : LockManager::IS);
         switch (statement->type()) {
             case kStmtCreate:
-                return create((const CreateStatement*) statement);
+                result = create((const CreateStatement*) statement);
+                catalog_changed();
+                break;
             case kStmtDrop:
-                return drop((const DropStatement*) statement);
+                result = drop((const DropStatement*) statement);
+                catalog_changed();
+                break;
             case kStmtShow:
-                return show((const ShowStatement*) statement);
+                result = show((const ShowStatement*) statement);
+                break;
             case kStmtInsert:
-                return insert((const InsertStatement*) statement);
+                result = insert((const InsertStatement*) statement);
+                break;
             case kStmtDelete:
-                return del((const DeleteStatement*) statement);
+                result = del((const DeleteStatement*) statement);
+                break;
+            case kStmtUpdate:
+                result = update((const UpdateStatement*) statement);
+                break;
             case kStmtSelect:
-                return select((const SelectStatement*) statement);
+                result = select((const SelectStatement*) statement, sink);
+                break;
             default:
-                return new QueryResult("not implemented");
+                result = new QueryResult("not implemented");
         }
+
+        // the statement is done, so write back the blocks it changed and commit
+        HeapFile::flush_all();
+        Transaction::commit_statement();
+    } catch (DeadlockError& e) {
+        // waiting would never end, so give up the whole transaction (and its locks)
+        delete result;
+        undo_statement(changes_catalog);
+        if (Transaction::in_progress()) {
+            try {
+                rollback_transaction();
+            } catch (...) {
+            }
+            throw SQLExecError("DeadlockError: " + string(e.what()) + " (transaction rolled back)");
+        }
+        throw SQLExecError("DeadlockError: " + string(e.what()));
     } catch (DbRelationError& e) {
+        delete result;
+        undo_statement(changes_catalog);
         throw SQLExecError("DbRelationError: " + string(e.what()));
+    } catch (DbException& e) {
+        delete result;
+        undo_statement(changes_catalog);
+        throw SQLExecError("DbException: " + string(e.what()));
+    } catch (...) {
+        delete result;
+        undo_statement(changes_catalog);
+        throw;
+    }
+
+    if (SQLExec::explaining == NO_EXPLAIN) {
+        uint64_t us = (uint64_t) chrono::duration_cast<chrono::microseconds>(
+                chrono::steady_clock::now() - start).count();
+        StatementStats::record(StatementStats::kind_of(statement), us);
+        if (StatementStats::is_slow(us)) {
+            try {
+                log_slow(statement, before, us);
+            } catch (...) {
+                // the statement is done; not getting it into the log doesn't change that
+            }
+        }
+    }
+    SQLExec::explained.clear();
+    return result;
+}
+
+/**
+ * Executes a prepared statement, reusing the plan it made last time if the catalog hasn't changed since.
+ *
+ * @param prepared The statement.
+ * @param arguments Values for its parameters, in order.
+ * @param sink Where a SELECT's rows go as they are found, or nullptr to have them in the result.
+ * @return Pointer to a QueryResult object containing the outcome of the executed statement.
+ * @throws SQLExecError if the number of arguments is wrong, or as for execute.
+ */
+
+QueryResult* SQLExec::execute(PreparedStatement& prepared, const vector<Value>& arguments, RowSink* sink) {
+    if (arguments.size() != prepared.parameter_count())
+        throw SQLExecError("statement takes " + to_string(prepared.parameter_count()) + " parameters, not " +
+                           to_string(arguments.size()));
+    SQLExec::prepared = &prepared;
+    SQLExec::arguments = &arguments;
+    try {
+        QueryResult* result = execute(prepared.get_statement(), sink);
+        SQLExec::prepared = nullptr;
+        SQLExec::arguments = nullptr;
+        return result;
+    } catch (...) {
+        SQLExec::prepared = nullptr;
+        SQLExec::arguments = nullptr;
+        throw;
+    }
+}
+
+/**
+ * Explains how a SELECT statement is run (EXPLAIN), and runs it to see (EXPLAIN ANALYZE).
+ *
+ * @param statement The statement.
+ * @param analyze True to run it as well.
+ * @return Pointer to a QueryResult object with the plan.
+ * @throws SQLExecError if it isn't a SELECT, or as for execute.
+ */
+
+QueryResult* SQLExec::explain(const SQLStatement* statement, bool analyze) {
+    if (statement->type() != kStmtSelect)
+        throw SQLExecError("only SELECT statements can be explained");
+    SQLExec::explaining = analyze ? EXPLAIN_ANALYZE : EXPLAIN;
+    try {
+        QueryResult* result = execute(statement);
+        SQLExec::explaining = NO_EXPLAIN;
+        return result;
+    } catch (...) {
+        SQLExec::explaining = NO_EXPLAIN;
+        throw;
     }
 }
 
+/**
+ * Starts a transaction (BEGIN).
+ *
+ * @return Pointer to a QueryResult object.
+ * @throws SQLExecError if a transaction is already in progress.
+ */
+
+QueryResult* SQLExec::begin() {
+    try {
+        Transaction::begin();
+    } catch (DbRelationError& e) {
+        throw SQLExecError(e.what());
+    }
+    return new QueryResult("transaction started");
+}
+
+/**
+ * Commits the transaction in progress (COMMIT).
+ *
+ * @return Pointer to a QueryResult object.
+ * @throws SQLExecError if there is no transaction in progress or it cannot be committed.
+ */
+
+QueryResult* SQLExec::commit() {
+    Rcu::ReadSection reading;  // a failed commit closes the files it created; see undo_statement
+    bool changed_catalog = LockManager::holds_table(Tables::TABLE_NAME, LockManager::X);
+    try {
+        Transaction::commit();
+    } catch (DbRelationError& e) {
+        throw SQLExecError(e.what());
+    } catch (DbException& e) {
+        // it has been rolled back instead, and with it any change it made to the catalog
+        if (changed_catalog)
+            forget_relations();
+        throw SQLExecError("DbException: " + string(e.what()));
+    }
+    return new QueryResult("transaction committed");
+}
+
+/**
+ * Undoes the transaction in progress (ROLLBACK).
+ *
+ * @return Pointer to a QueryResult object.
+ * @throws SQLExecError if there is no transaction in progress.
+ */
+
+QueryResult* SQLExec::rollback() {
+    try {
+        rollback_transaction();
+    } catch (DbRelationError& e) {
+        throw SQLExecError(e.what());
+    }
+    return new QueryResult("transaction rolled back");
+}
+
+/**
+ * Undoes a failed statement (just the statement, if it is part of a bigger transaction).
+ * The tables and indices we know of are only forgotten if it wrote to the catalog; what other statements
+ * wrote can't be in them, since they hold on to the catalog while they may yet be rolled back.
+ *
+ * @param changes_catalog True for CREATE and DROP.
+ */
+
+void SQLExec::undo_statement(bool changes_catalog) {
+    Rcu::ReadSection reading;  // what is forgotten is kept until the rollback has closed what it must
+    if (changes_catalog && Transaction::statement_wrote())
+        forget_relations();
+    try {
+        Transaction::rollback_statement();
+    } catch (...) {
+        // nothing more we can do; the original error is the one to report
+    }
+}
+
+/**
+ * Rolls back the transaction in progress, forgetting the tables and indices we know of if it changed
+ * the catalog (it has the catalog to itself if so).
+ *
+ * @throws DbRelationError if there is no transaction in progress.
+ */
+
+void SQLExec::rollback_transaction() {
+    Rcu::ReadSection reading;  // as for undo_statement
+    if (LockManager::holds_table(Tables::TABLE_NAME, LockManager::X))
+        forget_relations();
+    Transaction::rollback();
+}
+
+/**
+ * Forgets the tables and indices instantiated so far, since what the schema tables say about them
+ * is being rolled back. They are looked up again the next time they are used.
+ */
+
+void SQLExec::forget_relations() {
+    Indices::clear_cache();
+    Tables::clear_cache();
+    catalog_changed();
+    ResultCache::invalidate_all();  // and what was read from them, to be on the safe side
+}
+
+/**
+ * Notes that the catalog (may have) changed, so the plans made before now are no good any more.
+ */
+
+void SQLExec::catalog_changed() {
+    SQLExec::catalog_version++;
+}
+
+/**
+ * The plan kept with the prepared statement being executed, if there is one and it is still good.
+ *
+ * @return The plan, or nullptr if one has to be made.
+ */
+
+shared_ptr<StatementPlan> SQLExec::cached_plan() {
+    if (SQLExec::prepared == nullptr)
+        return nullptr;
+    shared_ptr<StatementPlan> plan = atomic_load(&SQLExec::prepared->plan);  // other sessions may be replacing it
+    if (plan != nullptr && plan->catalog_version == SQLExec::catalog_version)
+        return plan;
+    return nullptr;
+}
+
+/**
+ * Keeps a newly made plan with the prepared statement being executed (if there is one) for next time.
+ *
+ * @param plan The plan.
+ */
+
+void SQLExec::keep_plan(const shared_ptr<StatementPlan>& plan) {
+    if (SQLExec::prepared != nullptr)
+        atomic_store(&SQLExec::prepared->plan, plan);
+}
+
+/**
+ * Fills in the arguments of the plan of the statement being executed. If there is a slow query log,
+ * the plan is also estimated and explained now, while the statement's transaction still has what it
+ * locked, in case the statement turns out to be slow.
+ *
+ * @param plan The statement's plan.
+ * @return The plan with its arguments (freed by caller).
+ */
+
+EvalPlan* SQLExec::bind_plan(const StatementPlan& plan) {
+    EvalPlan* bound = plan.plan->bind(get_arguments());
+    if (StatementStats::logging_slow()) {
+        try {
+            bound->estimate();
+            SQLExec::explained = bound->explain();
+        } catch (...) {
+            delete bound;
+            throw;
+        }
+    }
+    return bound;
+}
+
+/**
+ * Writes a statement that took too long to the slow query log, with its plan (as bind_plan explained it)
+ * and how many rows it looked at.
+ *
+ * @param statement The statement.
+ * @param before This thread's counters from before it ran.
+ * @param us How long it took, in microseconds.
+ */
+
+void SQLExec::log_slow(const SQLStatement* statement, const PerfCounters& before, uint64_t us) {
+    string text = SQLExec::prepared != nullptr ? SQLExec::prepared->echo(get_arguments())
+                                               : ParseTreeToString::statement(statement);
+    const PerfCounters& after = PerfCounters::mine();
+    StatementStats::log_slow(text, SQLExec::explained, after.rows_unmarshaled - before.rows_unmarshaled,
+                             after.blocks_read - before.blocks_read, us);
+}
+
+/**
+ * Gets the value of a literal, or of a parameter of the prepared statement being executed.
+ *
+ * @param expr The expression.
+ * @param value Returned by reference: its value.
+ * @return false if the expression is neither.
+ * @throws SQLExecError if it's a parameter without a value.
+ */
+
+bool SQLExec::literal(const Expr* expr, Value& value) {
+    switch (expr->type) {
+        case kExprLiteralInt:
+            value = Value(expr->ival);
+            return true;
+        case kExprLiteralString:
+            value = Value(expr->name);
+            return true;
+        case kExprPlaceholder: {
+            size_t i = parameter_number(expr);
+            if (SQLExec::arguments == nullptr || i >= SQLExec::arguments->size())
+                throw SQLExecError("no value for parameter " + to_string(i + 1));
+            value = (*SQLExec::arguments)[i];
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+/**
+ * Which parameter of the prepared statement being executed is this?
+ *
+ * @param placeholder A "?" in the statement.
+ * @return Its number (counting from 0).
+ * @throws SQLExecError if there's no prepared statement being executed.
+ */
+
+size_t SQLExec::parameter_number(const Expr* placeholder) {
+    if (SQLExec::prepared == nullptr)
+        throw SQLExecError("parameters can only be used in prepared statements");
+    return SQLExec::prepared->parameter_number(placeholder);
+}
+
+/**
+ * The arguments of the prepared statement being executed (none if it isn't one).
+ */
+
+const vector<Value>& SQLExec::get_arguments() {
+    static const vector<Value> none;
+    return SQLExec::arguments != nullptr ? *SQLExec::arguments : none;
+}
+
+/**
+ * Changes an option, either one of the session's own or one for everyone (see is_global_option).
+ *
+ * @param option Name of the option to change.
+ * @param value New value for the option.
+ * @return Pointer to a QueryResult object describing the new setting.
+ * @throws SQLExecError if the option is unknown or the value is not acceptable.
+ */
+
+QueryResult* SQLExec::set(const string& option, const string& value) {
+    if (option == "block_size") {
+        uint32_t n;
+        try {
+            n = (uint32_t) stoul(value);
+        } catch (exception& e) {
+            throw SQLExecError("block_size must be a number");
+        }
+        if (!HeapFile::is_valid_block_size(n))
+            throw SQLExecError("block_size must be a power of two from " + to_string(DbBlock::MIN_BLOCK_SZ) + " to " +
+                               to_string(DbBlock::MAX_BLOCK_SZ));
+        SQLExec::block_size = n;
+        return new QueryResult("block_size set to " + value);
+    }
+    if (option == "storage") {
+        if (!HeapTable::is_valid_storage(value))
+            throw SQLExecError("storage must be heap, mmap, or direct");
+        SQLExec::storage = value;
+        return new QueryResult("storage set to " + value);
+    }
+    if (option == "output") {
+        if (!RowSink::is_valid_format(value))
+            throw SQLExecError("output must be text, csv, tsv, or binary");
+        SQLExec::output = value;
+        return new QueryResult("output set to " + value);
+    }
+    if (option == "direct_cache") {
+        try {
+            DirectFile::cache_blocks = (uint32_t) stoul(value);
+        } catch (exception& e) {
+            throw SQLExecError("direct_cache must be a number of blocks");
+        }
+        return new QueryResult("direct_cache set to " + value);
+    }
+    if (option == "commit_delay") {
+        try {
+            Transaction::commit_delay = (uint32_t) stoul(value);
+        } catch (exception& e) {
+            throw SQLExecError("commit_delay must be a number of microseconds");
+        }
+        return new QueryResult("commit_delay set to " + value);
+    }
+    if (option == "write_back") {
+        try {
+            HeapFile::write_back = (uint32_t) stoul(value);
+        } catch (exception& e) {
+            throw SQLExecError("write_back must be a number of blocks");
+        }
+        return new QueryResult("write_back set to " + value);
+    }
+    if (option == "isolation") {
+        if (value == "snapshot")
+            Transaction::isolation = Transaction::SNAPSHOT;
+        else if (value == "serializable")
+            Transaction::isolation = Transaction::SERIALIZABLE;
+        else
+            throw SQLExecError("isolation must be snapshot or serializable");
+        return new QueryResult("isolation set to " + value);
+    }
+    if (option == "trickle") {
+        uint32_t percent = 101;
+        try {
+            percent = (uint32_t) stoul(value);
+        } catch (exception& e) {
+        }
+        if (percent > 100)
+            throw SQLExecError("trickle must be a percentage from 0 to 100");
+        Transaction::trickle_percent = percent;
+        return new QueryResult("trickle set to " + value);
+    }
+    if (option == "verify_checksums") {
+        if (value == "never")
+            HeapFile::verify_mode = HeapFile::VERIFY_NEVER;
+        else if (value == "always")
+            HeapFile::verify_mode = HeapFile::VERIFY_ALWAYS;
+        else if (value == "once")
+            HeapFile::verify_mode = HeapFile::VERIFY_ONCE;
+        else
+            throw SQLExecError("verify_checksums must be never, always, or once");
+        return new QueryResult("verify_checksums set to " + value);
+    }
+    if (option == "status_interval") {
+        try {
+            PerfCounters::set_dump_interval((uint32_t) stoul(value), &cerr);
+        } catch (exception& e) {
+            throw SQLExecError("status_interval must be a number of seconds");
+        }
+        return new QueryResult("status_interval set to " + value);
+    }
+    if (option == "slow_query_ms") {
+        if (value == "off") {
+            StatementStats::slow_threshold_off();
+        } else {
+            try {
+                StatementStats::set_slow_threshold(stoul(value));
+            } catch (exception& e) {
+                throw SQLExecError("slow_query_ms must be a number of milliseconds or off");
+            }
+        }
+        return new QueryResult("slow_query_ms set to " + value);
+    }
+    if (option == "plan_cache") {
+        try {
+            PlanCache::set_capacity(stoul(value));
+        } catch (exception& e) {
+            throw SQLExecError("plan_cache must be a number of statements");
+        }
+        return new QueryResult("plan_cache set to " + value);
+    }
+    if (option == "result_cache") {
+        try {
+            ResultCache::set_capacity(stoul(value));
+        } catch (exception& e) {
+            throw SQLExecError("result_cache must be a number of bytes");
+        }
+        return new QueryResult("result_cache set to " + value);
+    }
+    throw SQLExecError("unknown option " + option);
+}
+
+bool SQLExec::is_global_option(const string& option) {
+    static const std::set<string> global = {"direct_cache", "commit_delay", "write_back", "trickle", "verify_checksums",
+                                            "status_interval", "slow_query_ms", "plan_cache", "result_cache"};
+    return global.count(option) != 0;
+}
+
 QueryResult* SQLExec::insert(const InsertStatement* statement) {
     Identifier table_name = statement->tableName;
+    LockManager::lock_table(table_name, LockManager::X);  // see HeapTable::lock_to_write
+
+    shared_ptr<StatementPlan> plan = cached_plan();
+    if (plan == nullptr) {
+        plan = make_shared<StatementPlan>(SQLExec::catalog_version);
+
+        // check table exists
+        ValueDict where = {{"table_name", Value(table_name)}};
+        Handles* tabMeta = SQLExec::tables->select(&where);
+        bool tableExists = !tabMeta->empty();
+        delete tabMeta;
+        if (!tableExists)
+            throw SQLExecError("attempting to insert into non-existent table " + table_name);
+        plan->table = &SQLExec::tables->get_table(table_name);
+        for (const Identifier& idx : SQLExec::indices->get_index_names(table_name))
+            plan->indices.push_back(&SQLExec::indices->get_index(table_name, idx));
+        keep_plan(plan);
+    }
+    DbRelation& table = *plan->table;
 
-    // check table exists
-    ValueDict where = {{"table_name", Value(table_name)}};
-    Handles* tabMeta = SQLExec::tables->select(&where);
-    bool tableExists = !tabMeta->empty();
-    delete tabMeta;
-    if (!tableExists)
-        throw SQLExecError("attempting to insert into non-existent table " + table_name);
-    DbRelation& table = SQLExec::tables->get_table(table_name);
-    
     // create row
     ValueDict row;
     const ColumnNames& cn = table.get_column_names();
     size_t values_n = statement->values->size();
     for (size_t i = 0; i < values_n; i++) {
-        Identifier column = cn[i];
-        Expr* value = (*statement->values)[i];
-        switch (value->type) {
-            case kExprLiteralInt:
-                row[column] = Value(value->ival);
-                break;
-            case kExprLiteralString:
-                row[column] = Value(value->name);
-                break;
-            default:
-                throw SQLExecError("column attribute unrecognized");
-        }
+        Value value;
+        if (!literal((*statement->values)[i], value))
+            throw SQLExecError("column attribute unrecognized");
+        row[cn[i]] = value;
     }
 
     // insert into table and existing indices
     Handle insertion = table.insert(&row);
-    IndexNames indices = SQLExec::indices->get_index_names(table_name);
-    for (const Identifier& idx : indices) {
-        DbIndex &index = SQLExec::indices->get_index(table_name, idx);
-        index.insert(insertion);
-    }
-    string suffix = indices.size() ? " and into " + to_string(indices.size()) + " indices" : "";
+    for (DbIndex* index : plan->indices)
+        index->insert(insertion);
+    size_t indices_n = plan->indices.size();
+    string suffix = indices_n ? " and into " + to_string(indices_n) + " indices" : "";
     return new QueryResult("successfully inserted 1 row into " + table_name + suffix);
 }
 
-void get_where_conjunction(const Expr* where, ValueDict* conjunction) {
+/**
+ * Pulls the column = value comparisons out of a WHERE clause (the only kind we handle).
+ *
+ * @param where The WHERE clause.
+ * @param conjunction Returned by reference: the values the columns have to have.
+ * @param parameters Returned by reference: the columns whose values are parameters of the prepared
+ *                   statement being executed (their values in conjunction are filled in by EvalPlan::bind).
+ * @throws SQLExecError if a column is compared with something other than a literal or parameter.
+ */
+
+void SQLExec::get_where_conjunction(const Expr* where, ValueDict* conjunction, EvalParameters* parameters) {
     if (where->opType == Expr::OperatorType::AND) {
-        get_where_conjunction(where->expr, conjunction);
-        get_where_conjunction(where->expr2, conjunction);
+        get_where_conjunction(where->expr, conjunction, parameters);
+        get_where_conjunction(where->expr2, conjunction, parameters);
     } else if (where->opType == Expr::OperatorType::SIMPLE_OP && where->opChar == '=') {
         switch (where->expr2->type) {
             case kExprLiteralInt:
@@ -150,90 +638,362 @@ void get_where_conjunction(const Expr* where, ValueDict* conjunction) {
             case kExprLiteralString:
                 (*conjunction)[where->expr->name] = Value(where->expr2->name);
                 break;
+            case kExprPlaceholder:
+                (*conjunction)[where->expr->name] = Value();
+                (*parameters)[where->expr->name] = parameter_number(where->expr2);
+                break;
             default:
                 throw SQLExecError("unrecognized expression");
         }
     }
 }
 
-ValueDict* get_where_conjunction(const Expr* where) {
+/**
+ * Puts a selection for a WHERE clause (if there is one) on top of a plan.
+ *
+ * @param where The WHERE clause, or nullptr.
+ * @param plan The plan to select from.
+ * @return The new plan.
+ */
+
+EvalPlan* SQLExec::where_plan(const Expr* where, EvalPlan* plan) {
+    if (where == nullptr)
+        return plan;
     ValueDict* conjunction = new ValueDict();
-    get_where_conjunction(where, conjunction);
-    return conjunction;
+    EvalParameters* parameters = new EvalParameters();
+    try {
+        get_where_conjunction(where, conjunction, parameters);
+    } catch (...) {
+        delete conjunction;
+        delete parameters;
+        delete plan;
+        throw;
+    }
+    if (parameters->empty()) {
+        delete parameters;
+        parameters = nullptr;
+    }
+    return new EvalPlan(conjunction, plan, parameters);
 }
 
 
 QueryResult* SQLExec::del(const DeleteStatement* statement) {
     Identifier table_name = statement->tableName;
-
-    // check table exists
-    ValueDict where = {{"table_name", Value(table_name)}};
-    Handles* tabMeta = SQLExec::tables->select(&where);
-    bool tableExists = !tabMeta->empty();
-    delete tabMeta;
-    if (!tableExists)
-        throw SQLExecError("attempting to delete from non-existent table " + table_name);
-    DbRelation& table = SQLExec::tables->get_table(table_name);
-    
-    // evaluation plan
-    EvalPlan* plan = new EvalPlan(table);
-    if (statement->expr)
-        plan = new EvalPlan(get_where_conjunction(statement->expr), plan);
-    plan = plan->optimize();
+    LockManager::lock_table(table_name, LockManager::X);  // before reading it, so we read what the last writer wrote
+
+    shared_ptr<StatementPlan> plan = cached_plan();
+    if (plan == nullptr) {
+        plan = make_shared<StatementPlan>(SQLExec::catalog_version);
+
+        // check table exists
+        ValueDict where = {{"table_name", Value(table_name)}};
+        Handles* tabMeta = SQLExec::tables->select(&where);
+        bool tableExists = !tabMeta->empty();
+        delete tabMeta;
+        if (!tableExists)
+            throw SQLExecError("attempting to delete from non-existent table " + table_name);
+        plan->table = &SQLExec::tables->get_table(table_name);
+        for (const Identifier& index : SQLExec::indices->get_index_names(table_name))
+            plan->indices.push_back(&SQLExec::indices->get_index(table_name, index));
+
+        // evaluation plan
+        EvalPlan* unoptimized = where_plan(statement->expr, new EvalPlan(*plan->table));
+        plan->plan = unoptimized->optimize();
+        delete unoptimized;
+        keep_plan(plan);
+    }
+    DbRelation& table = *plan->table;
 
     // get handles to remove tuples from table and indices
-    Handles* handles = plan->pipeline().second;
-    IndexNames indices = SQLExec::indices->get_index_names(table_name);
+    EvalPlan* bound = bind_plan(*plan);
+    Handles* handles;
+    try {
+        handles = bound->pipeline().second;
+    } catch (...) {
+        delete bound;
+        throw;
+    }
+    delete bound;
     for (const Handle& handle : *handles) {
-        // FIXME: Implement index row del
-        // for (const Identifier& index : indices)
-        //     SQLExec::indices->get_index(table_name, index).del(handle);
+        // index entries first, while the row is still there to project the keys from;
+        // the table's slot may be reused by the next insert
+        for (DbIndex* index : plan->indices)
+            index->del(handle);
         table.del(handle);
     }
 
     size_t rows_n = handles->size();
-    size_t indices_n = indices.size();
-    string suffix = indices_n ? " FIXME: and from " + to_string(indices_n) + " indices" : "";
-    delete plan;
+    size_t indices_n = plan->indices.size();
+    string suffix = indices_n ? " and from " + to_string(indices_n) + " indices" : "";
     delete handles;
     return new QueryResult("successfully deleted " + to_string(rows_n) + " rows" + suffix);
 }
 
-QueryResult* SQLExec::select(const SelectStatement* statement) {
+/**
+ * Handles UPDATE <table> SET <column> = <literal>, ... [WHERE ...].
+ * Rows keep their handles across an update, so only the indices with a changed key column
+ * have their entries removed and put back. The new keys are checked against the unique indices before
+ * any row is changed, since a table stored with mmap or direct has no transaction to take back the rows
+ * updated before one of them turned out to be a duplicate.
+ *
+ * @param statement Pointer to an UpdateStatement object.
+ * @return Pointer to a QueryResult object with the number of rows updated.
+ * @throws SQLExecError if the table does not exist or a new value is not a literal.
+ */
+
+QueryResult* SQLExec::update(const UpdateStatement* statement) {
+    Identifier table_name = statement->table->getName();
+    LockManager::lock_table(table_name, LockManager::X);  // as for del
+
+    shared_ptr<StatementPlan> plan = cached_plan();
+    if (plan == nullptr) {
+        plan = make_shared<StatementPlan>(SQLExec::catalog_version);
+
+        // check table exists
+        ValueDict where = {{"table_name", Value(table_name)}};
+        Handles* tabMeta = SQLExec::tables->select(&where);
+        bool tableExists = !tabMeta->empty();
+        delete tabMeta;
+        if (!tableExists)
+            throw SQLExecError("attempting to update non-existent table " + table_name);
+        plan->table = &SQLExec::tables->get_table(table_name);
+
+        // only the indices on a changed column need maintenance
+        for (const Identifier& index_name : SQLExec::indices->get_index_names(table_name)) {
+            DbIndex& index = SQLExec::indices->get_index(table_name, index_name);
+            for (const Identifier& column : index.get_key_columns()) {
+                bool changed = false;
+                for (const UpdateClause* clause : *statement->updates)
+                    changed = changed || column == clause->column;
+                if (changed) {
+                    plan->indices.push_back(&index);
+                    break;
+                }
+            }
+        }
+
+        // evaluation plan
+        EvalPlan* unoptimized = where_plan(statement->where, new EvalPlan(*plan->table));
+        plan->plan = unoptimized->optimize();
+        delete unoptimized;
+        keep_plan(plan);
+    }
+    DbRelation& table = *plan->table;
+
+    // new values
+    ValueDict new_values;
+    for (const UpdateClause* clause : *statement->updates) {
+        Value value;
+        if (!literal(clause->value, value))
+            throw SQLExecError("only literal values are supported in SET");
+        new_values[clause->column] = value;
+    }
+
+    EvalPlan* bound = bind_plan(*plan);
+    Handles* handles;
+    try {
+        handles = bound->pipeline().second;
+    } catch (...) {
+        delete bound;
+        throw;
+    }
+    delete bound;
+    try {
+        check_unique(plan->indices, table, *handles, new_values);
+    } catch (...) {
+        delete handles;
+        throw;
+    }
+    for (const Handle& handle : *handles) {
+        for (DbIndex* index : plan->indices)
+            index->del(handle);
+        table.update(handle, &new_values);
+        for (DbIndex* index : plan->indices)
+            index->insert(handle);
+    }
+
+    size_t rows_n = handles->size();
+    size_t indices_n = plan->indices.size();
+    string suffix = indices_n ? " and " + to_string(indices_n) + " indices" : "";
+    delete handles;
+    return new QueryResult("successfully updated " + to_string(rows_n) + " rows" + suffix);
+}
+
+/**
+ * Checks that updating the given rows won't give any of them the same key as another row, in any of
+ * the unique indices, either one of the other rows being updated or one that isn't.
+ *
+ * @param indices The indices on the columns being changed.
+ * @param table The table being updated.
+ * @param handles The rows to be updated.
+ * @param new_values The columns being changed, and their new values.
+ * @throws DbRelationError if there would be a duplicate key.
+ */
+
+void SQLExec::check_unique(const vector<DbIndex*>& indices, DbRelation& table, const Handles& handles,
+                           const ValueDict& new_values) {
+    std::set<Handle> updating(handles.begin(), handles.end());
+    for (DbIndex* index : indices) {
+        if (!index->is_unique())
+            continue;
+        std::set<ValueDict> keys;
+        for (const Handle& handle : handles) {
+            ValueDict* key = table.project(handle, &index->get_key_columns());
+            for (const Identifier& column : index->get_key_columns()) {
+                auto value = new_values.find(column);
+                if (value != new_values.end())
+                    (*key)[column] = value->second;
+            }
+            bool duplicate = !keys.insert(*key).second;
+            if (!duplicate) {
+                // another row has it now, and is not getting a new one
+                Handles* found = index->lookup(key);
+                for (const Handle& other : *found)
+                    duplicate = duplicate || updating.find(other) == updating.end();
+                delete found;
+            }
+            delete key;
+            if (duplicate)
+                throw DbRelationError("Duplicate keys are not allowed in unique index");
+        }
+    }
+}
+
+/**
+ * Handles the SELECT statement.
+ *
+ * @param statement Pointer to a SelectStatement object.
+ * @param sink Where the rows go as they are found; if nullptr, they are collected into the result.
+ * @return Pointer to a QueryResult object with the number of rows (and the rows, if there's no sink).
+ */
+
+QueryResult* SQLExec::select(const SelectStatement* statement, RowSink* sink) {
     Identifier table_name = statement->fromTable->getName();
 
-    // check table exists
-    ValueDict where = {{"table_name", Value(table_name)}};
-    Handles* tabMeta = SQLExec::tables->select(&where);
-    bool tableExists = !tabMeta->empty();
-    delete tabMeta;
-    if (!tableExists)
-        throw SQLExecError("attempting to select from non-existent table " + table_name);
-    DbRelation& table = SQLExec::tables->get_table(table_name);
-    ColumnNames* cn = new ColumnNames();
-    for (const Expr* expr : *statement->selectList) {
-        if (expr->type == kExprStar)
-            for (const Identifier& col : table.get_column_names())
-                cn->push_back(col);
-        else
-            cn->push_back(expr->name);
+    shared_ptr<StatementPlan> plan = cached_plan();
+    if (plan == nullptr) {
+        plan = make_shared<StatementPlan>(SQLExec::catalog_version);
+
+        // check table exists
+        ValueDict where = {{"table_name", Value(table_name)}};
+        Handles* tabMeta = SQLExec::tables->select(&where);
+        bool tableExists = !tabMeta->empty();
+        delete tabMeta;
+        if (!tableExists)
+            throw SQLExecError("attempting to select from non-existent table " + table_name);
+        DbRelation& table = SQLExec::tables->get_table(table_name);
+        plan->table = &table;
+        ColumnNames* cn = new ColumnNames();
+        for (const Expr* expr : *statement->selectList) {
+            if (expr->type == kExprStar)
+                for (const Identifier& col : table.get_column_names())
+                    cn->push_back(col);
+            else
+                cn->push_back(expr->name);
+        }
+        plan->column_names = cn;
+        plan->column_attributes = table.get_column_attributes(*cn);
+
+        // start base of plan at a TableScan, enclose in selection if where clause exists, and wrap in project
+        EvalPlan* unoptimized = where_plan(statement->whereClause, new EvalPlan(table));
+        unoptimized = new EvalPlan(new ColumnNames(*cn), unoptimized);
+
+        // optimize
+        plan->plan = unoptimized->optimize();
+        delete unoptimized;
+        keep_plan(plan);
     }
 
-    // start base of plan at a TableScan
-    EvalPlan* plan = new EvalPlan(table);
+    if (SQLExec::explaining != NO_EXPLAIN)
+        return explain_select(*plan);
+
+    // the same query (and arguments) since the table last changed gets the same rows, but only for a
+    // statement on its own: one in a transaction has to see the table as of its snapshot (or lock what
+    // it reads, if serializable), not as it is now
+    string cache_key;
+    uint64_t version = 0, epoch = 0;
+    bool cacheable = SQLExec::prepared != nullptr && !Transaction::in_progress() && Transaction::reads_snapshot() &&
+                     ResultCache::enabled();
+    if (cacheable) {
+        cache_key = ResultCache::key(SQLExec::prepared->get_text(), get_arguments());
+        QueryResult* cached = ResultCache::find(cache_key);
+        if (cached != nullptr && sink == nullptr)
+            return cached;
+        if (cached != nullptr) {
+            sink->begin(*cached->get_column_names(), *cached->get_column_attributes());
+            for (ValueDict* row : *cached->get_rows())
+                sink->row(*row);
+            sink->end();
+            QueryResult* result = new QueryResult(cached->get_message());
+            delete cached;
+            return result;
+        }
+        version = HeapTable::version(table_name).load();
+        epoch = ResultCache::get_epoch();
+    }
 
-    // enclose in selection if where clause exists
-    if (statement->whereClause)
-        plan = new EvalPlan(get_where_conjunction(statement->whereClause), plan);
-    
-    // wrap in project
-    plan = new EvalPlan(cn, plan);
+    // evaluate, passing the rows on to the sink as they come; we only keep them if there's no sink,
+    // or to cache them (while there are few enough)
+    size_t keep = sink == nullptr ? SIZE_MAX : cacheable ? ResultCache::get_capacity() : 0;
+    RowCollector rows(sink, keep);
+    EvalPlan* bound = bind_plan(*plan);
+    try {
+        rows.begin(*plan->column_names, *plan->column_attributes);
+        bound->evaluate(rows);
+        rows.end();
+    } catch (...) {
+        delete bound;
+        throw;
+    }
+    delete bound;
+    string message = "successfully return " + to_string(rows.count()) + " rows";
+    QueryResult* result = new QueryResult(new ColumnNames(*plan->column_names),
+                                          new ColumnAttributes(*plan->column_attributes), rows.release(), message);
+
+    // what we read can be shared if nobody else has a transaction going (which might have changes to
+    // the table that aren't committed yet, and so aren't in our snapshot)
+    if (cacheable && result->get_rows() != nullptr && Transaction::running_count() == 1)
+        ResultCache::insert(cache_key, table_name, version, epoch, *result);
+    if (sink == nullptr)
+        return result;
+    delete result;  // the rows have already gone to the sink
+    return new QueryResult(message);
+}
+
+/**
+ * Explains a SELECT's plan, running it first (and throwing away its rows) for EXPLAIN ANALYZE.
+ *
+ * @param plan The statement's plan.
+ * @return Pointer to a QueryResult object with the plan, an operator to a line.
+ */
 
-    // optimize and evaluate
-    plan = plan->optimize();
-    ValueDicts* rows = plan->evaluate();
-    delete plan;
-    return new QueryResult(cn, table.get_column_attributes(*cn), rows, "successfully return " + to_string(rows->size()) + " rows");
+QueryResult* SQLExec::explain_select(const StatementPlan& plan) {
+    EvalPlan* bound = plan.plan->bind(get_arguments());
+    string text;
+    try {
+        bound->estimate();
+        if (SQLExec::explaining == EXPLAIN_ANALYZE) {
+            RowCollector rows(nullptr, 0);  // counts them, keeps none
+            bound->analyze();
+            auto start = chrono::steady_clock::now();
+            rows.begin(*plan.column_names, *plan.column_attributes);
+            bound->evaluate(rows);
+            rows.end();
+            chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+            ostringstream summary;
+            summary << fixed << setprecision(3) << "execution time " << elapsed.count() << " ms, "
+                    << rows.count() << " rows";
+            text = bound->explain() + summary.str();
+        } else {
+            text = bound->explain();
+            text.pop_back();  // the newline after the last operator
+        }
+    } catch (...) {
+        delete bound;
+        throw;
+    }
+    delete bound;
+    return new QueryResult(text);
 }
 
 /**
@@ -287,8 +1047,14 @@ QueryResult* SQLExec::create(const CreateStatement* statement) {
  */
 
 QueryResult* SQLExec::create_table(const CreateStatement* statement) {
+    LockManager::lock_table(statement->tableName, LockManager::X);
+
     // update _tables schema
-    ValueDict row = {{"table_name", Value(statement->tableName)}};
+    ValueDict row = {
+        {"table_name", Value(statement->tableName)},
+        {"block_size", Value((int32_t) SQLExec::block_size)},
+        {"storage", Value(SQLExec::storage)}
+    };
     Handle tableHandle = SQLExec::tables->insert(&row);
     try {
         // update _columns schema
@@ -342,8 +1108,14 @@ QueryResult* SQLExec::create_table(const CreateStatement* statement) {
  */
 
 QueryResult* SQLExec::create_index(const CreateStatement* statement) {
+    LockManager::lock_table(statement->tableName, LockManager::S);  // no changes to the table while we index it
     DbRelation& table = SQLExec::tables->get_table(statement->tableName);
 
+    // an index is in Berkeley DB, so a rollback would take back its entries but not the table's rows
+    if (!table.is_transactional())
+        throw SQLExecError("cannot index " + string(statement->tableName) +
+                           ": only tables stored in Berkeley DB (storage heap) can have indices");
+
     // check that all the index columns exist in the table
     const ColumnNames& cn = table.get_column_names();
     for (char* column_name : *statement->indexColumns)
@@ -357,7 +1129,8 @@ QueryResult* SQLExec::create_index(const CreateStatement* statement) {
         {"column_name", Value("")},
         {"seq_in_index", Value()},
         {"index_type", Value(statement->indexType)},
-        {"is_unique", Value(string(statement->indexType) == "BTREE")}
+        {"is_unique", Value(string(statement->indexType) == "BTREE")},
+        {"block_size", Value((int32_t) SQLExec::block_size)}
     };
     for (char* column_name : *statement->indexColumns) {
         row["column_name"] = Value(column_name);
@@ -418,6 +1191,7 @@ QueryResult* SQLExec::drop_table(const DropStatement* statement) {
     delete tabMeta;
     if (!tableExists)
         throw SQLExecError("attempting to drop non-existent table " + table_name);
+    LockManager::lock_table(table_name, LockManager::X);
 
     // before dropping the table, drop each index on the table
     Handles* selected = SQLExec::indices->select(&where);
@@ -453,6 +1227,7 @@ QueryResult* SQLExec::drop_index(const DropStatement* statement) {
     // call get_index to get a reference to the index and then invoke the drop method on it
     Identifier table_name = statement->name; 
     Identifier index_name = statement->indexName; 
+    LockManager::lock_table(table_name, LockManager::X);  // nobody may be using the index
     DbIndex& index = SQLExec::indices->get_index(table_name, index_name);
     index.drop();
 
@@ -598,3 +1373,138 @@ QueryResult *SQLExec::show_index(const ShowStatement *statement)
     delete index_handles;
     return new QueryResult(column_names, column_attributes, rows, message);
 }
+
+/**
+ * Shows how much transactions have waited for locks on each table and index, longest total wait first,
+ * so that hot spots stand out.
+ *
+ * @return Pointer to a QueryResult object with a row for each table or index that has been waited for.
+ */
+
+QueryResult* SQLExec::show_locks() {
+    ColumnNames* column_names = new ColumnNames({"object", "waits", "wait_ms", "max_wait_ms", "deadlocks"});
+    ColumnAttributes* column_attributes = new ColumnAttributes({ColumnAttribute(ColumnAttribute::DataType::TEXT),
+                                                                ColumnAttribute(ColumnAttribute::DataType::INT),
+                                                                ColumnAttribute(ColumnAttribute::DataType::INT),
+                                                                ColumnAttribute(ColumnAttribute::DataType::INT),
+                                                                ColumnAttribute(ColumnAttribute::DataType::INT)});
+    map<Identifier, LockManager::WaitStats> stats = LockManager::wait_stats();
+    vector<pair<Identifier, LockManager::WaitStats>> hot(stats.begin(), stats.end());
+    sort(hot.begin(), hot.end(), [](const pair<Identifier, LockManager::WaitStats>& a,
+                                    const pair<Identifier, LockManager::WaitStats>& b) {
+        return a.second.wait_us > b.second.wait_us;
+    });
+
+    ValueDicts* rows = new ValueDicts();
+    uint64_t waits = 0, wait_us = 0, deadlocks = 0;
+    for (auto& entry : hot) {
+        const LockManager::WaitStats& counts = entry.second;
+        ValueDict* row = new ValueDict();
+        (*row)["object"] = Value(entry.first);
+        (*row)["waits"] = Value((int32_t) counts.waits);
+        (*row)["wait_ms"] = Value((int32_t) (counts.wait_us / 1000));
+        (*row)["max_wait_ms"] = Value((int32_t) (counts.max_wait_us / 1000));
+        (*row)["deadlocks"] = Value((int32_t) counts.deadlocks);
+        rows->push_back(row);
+        waits += counts.waits;
+        wait_us += counts.wait_us;
+        deadlocks += counts.deadlocks;
+    }
+    return new QueryResult(column_names, column_attributes, rows,
+                           to_string(LockManager::requests.load()) + " lock requests, " + to_string(waits) +
+                           " waited (" + to_string(wait_us / 1000) + " ms in all), " + to_string(deadlocks) +
+                           " deadlocks");
+}
+
+/**
+ * Shows how well the result cache is doing.
+ *
+ * @return Pointer to a QueryResult object with one row of counts.
+ */
+
+QueryResult* SQLExec::show_result_cache() {
+    ColumnNames* column_names = new ColumnNames({"capacity", "bytes", "entries", "hits", "misses", "stale",
+                                                 "evictions", "hit_rate"});
+    ColumnAttributes* column_attributes = new ColumnAttributes();
+    for (size_t i = 0; i < column_names->size() - 1; i++)
+        column_attributes->push_back(ColumnAttribute(ColumnAttribute::DataType::INT));
+    column_attributes->push_back(ColumnAttribute(ColumnAttribute::DataType::TEXT));
+
+    ResultCache::Stats stats = ResultCache::stats();
+    auto clamp = [](uint64_t n) { return Value((int32_t) min<uint64_t>(n, INT32_MAX)); };
+    uint64_t lookups = stats.hits + stats.misses;
+    double hit_rate = lookups == 0 ? 0.0 : 100.0 * (double) stats.hits / (double) lookups;
+    char percent[16];
+    snprintf(percent, sizeof(percent), "%.1f%%", hit_rate);
+    ValueDict* row = new ValueDict();
+    (*row)["capacity"] = clamp(stats.capacity);
+    (*row)["bytes"] = clamp(stats.bytes);
+    (*row)["entries"] = clamp(stats.entries);
+    (*row)["hits"] = clamp(stats.hits);
+    (*row)["misses"] = clamp(stats.misses);
+    (*row)["stale"] = clamp(stats.stale);
+    (*row)["evictions"] = clamp(stats.evictions);
+    (*row)["hit_rate"] = Value(string(percent));
+    ValueDicts* rows = new ValueDicts({row});
+    return new QueryResult(column_names, column_attributes, rows,
+                           stats.capacity == 0 ? "result cache is off (set result_cache <bytes> to turn it on)"
+                                               : "successfully returned 1 row");
+}
+
+/**
+ * Shows what the storage layer has done since the program started, over all the threads, so that
+ * hot spots (and regressions, from one run to the next) stand out without a profiler.
+ *
+ * @return Pointer to a QueryResult object with a row for each counter (the values are text, since
+ *         the counts soon outgrow an INT).
+ */
+
+QueryResult* SQLExec::show_status() {
+    ColumnNames* column_names = new ColumnNames({"counter", "value"});
+    ColumnAttributes* column_attributes = new ColumnAttributes({ColumnAttribute(ColumnAttribute::DataType::TEXT),
+                                                                ColumnAttribute(ColumnAttribute::DataType::TEXT)});
+    ValueDicts* rows = new ValueDicts();
+    for (auto& counter : PerfCounters::total().list()) {
+        ValueDict* row = new ValueDict();
+        (*row)["counter"] = Value(counter.first);
+        (*row)["value"] = Value(to_string(counter.second));
+        rows->push_back(row);
+    }
+    return new QueryResult(column_names, column_attributes, rows,
+                           "successfully returned " + to_string(rows->size()) + " rows");
+}
+
+/**
+ * Shows how long each kind of statement has taken, since the program started: how many have run, and the
+ * latency (in microseconds) that half, 90%, 99%, and 99.9% of them came in under, the mean, and the longest.
+ *
+ * @return Pointer to a QueryResult object with a row for each kind of statement that has run.
+ */
+
+QueryResult* SQLExec::show_latency() {
+    ColumnNames* column_names = new ColumnNames({"statement", "count", "p50_us", "p90_us", "p99_us", "p999_us",
+                                                 "mean_us", "max_us"});
+    ColumnAttributes* column_attributes = new ColumnAttributes({ColumnAttribute(ColumnAttribute::DataType::TEXT)});
+    for (size_t i = 1; i < column_names->size(); i++)
+        column_attributes->push_back(ColumnAttribute(ColumnAttribute::DataType::INT));
+
+    auto clamp = [](uint64_t n) { return Value((int32_t) min<uint64_t>(n, INT32_MAX)); };
+    ValueDicts* rows = new ValueDicts();
+    for (int kind = 0; kind < StatementStats::KINDS; kind++) {
+        const LatencyHistogram& latencies = StatementStats::histogram((StatementStats::Kind) kind);
+        if (latencies.count() == 0)
+            continue;
+        ValueDict* row = new ValueDict();
+        (*row)["statement"] = Value(string(StatementStats::name((StatementStats::Kind) kind)));
+        (*row)["count"] = clamp(latencies.count());
+        (*row)["p50_us"] = clamp(latencies.percentile(0.50));
+        (*row)["p90_us"] = clamp(latencies.percentile(0.90));
+        (*row)["p99_us"] = clamp(latencies.percentile(0.99));
+        (*row)["p999_us"] = clamp(latencies.percentile(0.999));
+        (*row)["mean_us"] = clamp(latencies.mean());
+        (*row)["max_us"] = clamp(latencies.max());
+        rows->push_back(row);
+    }
+    return new QueryResult(column_names, column_attributes, rows,
+                           "successfully returned " + to_string(rows->size()) + " rows");
+}
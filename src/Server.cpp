@@ -0,0 +1,604 @@
+/**
+ * @file Server.cpp - implementation of Server class
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "Server.h"
+#include "Session.h"
+#include "Transaction.h"
+
+using namespace std;
+
+Server *Server::instance = nullptr;
+
+// set by stop(), which may be called from a signal handler
+static volatile sig_atomic_t stop_requested = 0;
+static int stop_fd = -1;
+
+/**
+ * A client's connection and its session.
+ */
+struct Server::Connection {
+    int fd;
+    Session session;
+    string input;          // received, but not yet a whole line (event loop only)
+    mutex latch;           // guards the rest
+    deque<string> lines;   // whole lines waiting to be run
+    string output;         // response the socket hasn't taken yet
+    condition_variable taken;  // the socket took some of the output, or the client hung up
+    bool scheduled;        // ready to run, or being run by a worker
+    bool ended;            // the session is over
+    bool hung_up;          // the client is gone, so there is nobody to write to
+
+    explicit Connection(int fd) : fd(fd), session(), input(), latch(), lines(), output(), taken(), scheduled(false),
+                                  ended(false), hung_up(false) {
+        session.set_admin(false);  // options for everyone are set when the server starts (see sql5300.cpp)
+    }
+};
+
+/**
+ * The response to one line, framed (see respond) and handed over to the connection a chunk at a time
+ * as the session writes it, so that even a big result is never held whole. If the client falls too
+ * far behind, the writer waits for it to catch up, stepping aside from its turn (see wait_for_client).
+ */
+class Server::Response : public streambuf {
+public:
+    Response(Server &server, const ConnectionPtr &connection) : server(server), connection(connection),
+                                                                 buffer(CHUNK_SIZE), line_start(true) {
+        setp(this->buffer.data(), this->buffer.data() + this->buffer.size());
+    }
+
+    void finish(bool more);
+
+protected:
+    int overflow(int c) override;
+
+    int sync() override { return 0; }  // not for every endl: a chunk at a time is plenty
+
+private:
+    Server &server;
+    ConnectionPtr connection;
+    vector<char> buffer;
+    bool line_start;  // is the next character the start of a line?
+
+    string frame();
+
+    void hand_over(const string &framed, bool last, bool more);
+
+    void wait_for_client();
+};
+
+/**
+ * Start listening (clients are served once run is called).
+ * @param address  path of a Unix domain socket, or a port number for TCP on the loopback interface
+ * @param workers  size of the worker pool
+ * @throws runtime_error if the address can't be listened on
+ */
+Server::Server(const string &address, uint32_t workers) : address(address), listener(-1), epoll(-1), wake{-1, -1},
+                                                          connections(), pool_mutex(), work(), idle(), ready(),
+                                                          finished(), size(max(workers, 1U)), workers(0),
+                                                          waiting(0), stopping(false) {
+    this->listener = listen_on(address);
+    this->epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (this->epoll < 0 || pipe2(this->wake, O_NONBLOCK | O_CLOEXEC) != 0) {
+        ::close(this->listener);
+        throw runtime_error(string("cannot set up event loop: ") + strerror(errno));
+    }
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = this->listener;
+    epoll_ctl(this->epoll, EPOLL_CTL_ADD, this->listener, &event);
+    event.data.fd = this->wake[0];
+    epoll_ctl(this->epoll, EPOLL_CTL_ADD, this->wake[0], &event);
+}
+
+Server::~Server() {
+    if (this->listener >= 0)
+        ::close(this->listener);
+    ::close(this->epoll);
+    ::close(this->wake[0]);
+    ::close(this->wake[1]);
+    bool is_port = this->address.find_first_not_of("0123456789") == string::npos;
+    if (!is_port)
+        unlink(this->address.c_str());
+}
+
+/**
+ * Serve clients until stop is called, then end every session (rolling back unfinished transactions)
+ * and wait for the workers to finish.
+ */
+void Server::run() {
+    instance = this;
+    stop_fd = this->wake[1];
+    Transaction::no_wait = true;
+    Transaction::before_wait = before_wait;
+    Transaction::after_wait = after_wait;
+    {
+        lock_guard<mutex> lock(this->pool_mutex);
+        while (this->workers < this->size)
+            add_worker();
+    }
+
+    const int MAX_EVENTS = 64;
+    epoll_event events[MAX_EVENTS];
+    bool draining = false;  // stopping: no more clients, and waiting for the sessions to end
+    while (!draining || !this->connections.empty()) {
+        if (!draining && stop_requested) {
+            draining = true;
+            epoll_ctl(this->epoll, EPOLL_CTL_DEL, this->listener, nullptr);
+            ::close(this->listener);
+            this->listener = -1;
+            for (auto &entry: this->connections) {
+                ConnectionPtr connection = entry.second;
+                lock_guard<mutex> lock(connection->latch);
+                connection->hung_up = true;
+                connection->taken.notify_all();
+                connection->lines.clear();
+                connection->lines.push_back("quit");
+                if (!connection->scheduled && !connection->ended) {
+                    connection->scheduled = true;
+                    schedule(connection);
+                }
+                lock_guard<mutex> pool_lock(this->pool_mutex);
+                this->finished.push_back(entry.first);  // closed now if it has already ended
+            }
+            close_finished();
+            continue;
+        }
+        int n = epoll_wait(this->epoll, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            throw runtime_error(string("epoll_wait: ") + strerror(errno));
+        }
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == this->listener) {
+                accept_all();
+            } else if (fd == this->wake[0]) {
+                char buffer[256];
+                while (read(this->wake[0], buffer, sizeof(buffer)) > 0) {}
+                close_finished();
+            } else {
+                auto hit = this->connections.find(fd);
+                if (hit == this->connections.end())
+                    continue;
+                ConnectionPtr connection = hit->second;
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                    receive(connection);
+                if (events[i].events & EPOLLOUT)
+                    send(connection);
+            }
+        }
+    }
+
+    unique_lock<mutex> lock(this->pool_mutex);
+    this->stopping = true;
+    this->work.notify_all();
+    this->idle.wait(lock, [this] { return this->workers == 0; });
+    lock.unlock();
+    Transaction::before_wait = nullptr;
+    Transaction::after_wait = nullptr;
+    Transaction::no_wait = false;
+    stop_fd = -1;
+    instance = nullptr;
+}
+
+/**
+ * Ask the running server to stop (safe to call from a signal handler).
+ */
+void Server::stop() {
+    stop_requested = 1;
+    if (stop_fd >= 0) {
+        ssize_t ignored = write(stop_fd, "", 1);
+        (void) ignored;
+    }
+}
+
+/**
+ * Accept every connection that is waiting.
+ */
+void Server::accept_all() {
+    while (true) {
+        int fd = accept4(this->listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            return;  // EAGAIN: that's all of them (or we're out of descriptors, and they'll wait)
+        }
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));  // fails harmlessly for Unix sockets
+        this->connections[fd] = make_shared<Connection>(fd);
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(this->epoll, EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+/**
+ * Read whatever a client has sent, and queue the whole lines for its session.
+ * Blank lines are ignored, as they are by the REPL.
+ * @param connection  the client
+ */
+void Server::receive(const ConnectionPtr &connection) {
+    char buffer[READ_SIZE];
+    bool gone = false;
+    while (true) {
+        ssize_t n = read(connection->fd, buffer, sizeof(buffer));
+        if (n > 0) {
+            connection->input.append(buffer, (size_t) n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        gone = n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+        break;
+    }
+
+    vector<string> lines;
+    size_t start = 0;
+    for (size_t end = connection->input.find('\n'); end != string::npos;
+         end = connection->input.find('\n', start)) {
+        string line = connection->input.substr(start, end - start);
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (!line.empty())
+            lines.push_back(line);
+        start = end + 1;
+    }
+    connection->input.erase(0, start);
+
+    if (gone)
+        epoll_ctl(this->epoll, EPOLL_CTL_DEL, connection->fd, nullptr);  // nothing more to read
+    lock_guard<mutex> lock(connection->latch);
+    if (connection->ended)
+        return;
+    for (string &line: lines)
+        connection->lines.push_back(line);
+    if (gone) {
+        connection->hung_up = true;
+        connection->lines.push_back("quit");
+        connection->taken.notify_all();
+    }
+    if (!connection->scheduled && !connection->lines.empty()) {
+        connection->scheduled = true;
+        schedule(connection);
+    }
+}
+
+/**
+ * Write as much of a client's pending response as its socket will take, watching for room for the
+ * rest if there is any.
+ * @param connection  the client
+ */
+void Server::send(const ConnectionPtr &connection) {
+    lock_guard<mutex> lock(connection->latch);
+    if (connection->fd < 0)
+        return;
+    size_t sent = 0;
+    string &output = connection->output;
+    while (sent < output.size() && !connection->hung_up) {
+        ssize_t n = ::send(connection->fd, output.data() + sent, output.size() - sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += (size_t) n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            connection->hung_up = true;  // and the session ends once it has run what it has
+        }
+    }
+    if (connection->hung_up)
+        output.clear();
+    else
+        output.erase(0, sent);
+    connection->taken.notify_all();
+    if (!connection->hung_up)
+        watch(connection->fd, !output.empty());
+    if (connection->ended && output.empty() && !connection->scheduled) {
+        lock_guard<mutex> pool_lock(this->pool_mutex);
+        this->finished.push_back(connection->fd);
+        poke();
+    }
+}
+
+/**
+ * Close the connections whose sessions have ended and whose responses have all been written.
+ */
+void Server::close_finished() {
+    deque<int> fds;
+    {
+        lock_guard<mutex> lock(this->pool_mutex);
+        fds.swap(this->finished);
+    }
+    for (int fd: fds) {
+        auto hit = this->connections.find(fd);
+        if (hit == this->connections.end())
+            continue;
+        ConnectionPtr connection = hit->second;
+        {
+            lock_guard<mutex> lock(connection->latch);
+            if (!connection->ended || connection->scheduled || (!connection->output.empty() && !connection->hung_up))
+                continue;
+            epoll_ctl(this->epoll, EPOLL_CTL_DEL, fd, nullptr);
+            ::close(fd);
+            connection->fd = -1;
+        }
+        this->connections.erase(hit);
+    }
+}
+
+/**
+ * Hand a connection with lines to run to the workers (its latch must be locked).
+ * @param connection  the client
+ */
+void Server::schedule(const ConnectionPtr &connection) {
+    lock_guard<mutex> lock(this->pool_mutex);
+    this->ready.push_back(connection);
+    this->work.notify_one();
+}
+
+/**
+ * Start another worker (pool_mutex must be locked).
+ */
+void Server::add_worker() {
+    this->workers++;
+    thread(&Server::worker, this).detach();
+}
+
+/**
+ * Body of a worker: run a line for whichever session is next, until the pool is stopping or there
+ * are more workers than we need.
+ */
+void Server::worker() {
+    unique_lock<mutex> lock(this->pool_mutex);
+    while (true) {
+        this->work.wait(lock, [this] {
+            return this->stopping || !this->ready.empty() || this->workers > this->size + this->waiting;
+        });
+        if (this->workers > this->size + this->waiting || (this->stopping && this->ready.empty()))
+            break;
+        ConnectionPtr connection = this->ready.front();
+        this->ready.pop_front();
+        lock.unlock();
+
+        string line;
+        {
+            lock_guard<mutex> connection_lock(connection->latch);
+            line = connection->lines.front();
+            connection->lines.pop_front();
+        }
+        respond(connection, line);
+        bool again;
+        {
+            lock_guard<mutex> connection_lock(connection->latch);
+            again = !connection->ended && !connection->lines.empty();
+            connection->scheduled = again;
+            if (connection->ended && (connection->output.empty() || connection->hung_up)) {
+                lock_guard<mutex> pool_lock(this->pool_mutex);
+                this->finished.push_back(connection->fd);
+                poke();
+            }
+        }
+
+        lock.lock();
+        if (again)
+            this->ready.push_back(connection);  // to the back of the line
+    }
+    this->workers--;
+    this->idle.notify_all();
+}
+
+/**
+ * Run a line for a session and send back what it printed, followed by a line with just "." on it.
+ * @param connection  the client
+ * @param line        what it sent
+ */
+void Server::respond(const ConnectionPtr &connection, const string &line) {
+    Response response(*this, connection);
+    ostream out(&response);
+    bool more;
+    try {
+        more = connection->session.execute(line, out);
+    } catch (exception &e) {
+        out << "Error: " << e.what() << endl;
+        more = true;
+    }
+    if (!more)
+        connection->session.close(out);
+    response.finish(more);
+}
+
+/**
+ * The buffer is full: hand it over and start on the next chunk.
+ */
+int Server::Response::overflow(int c) {
+    hand_over(frame(), false, true);
+    if (c != traits_type::eof()) {
+        *pptr() = (char) c;
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+/**
+ * Hand over the rest of the response and the line with the "." that ends it.
+ * @param more  false if that's the end of the session, too
+ */
+void Server::Response::finish(bool more) {
+    string framed = frame();
+    if (!this->line_start)
+        framed += '\n';
+    framed += ".\n";
+    hand_over(framed, true, more);
+}
+
+// the buffer so far, with a "." put in front of each line that starts with one (and the buffer emptied)
+string Server::Response::frame() {
+    string framed;
+    framed.reserve((size_t) (pptr() - pbase()) + 64);
+    for (const char *p = pbase(); p < pptr(); p++) {
+        if (this->line_start && *p == '.')
+            framed += '.';
+        framed += *p;
+        this->line_start = *p == '\n';
+    }
+    setp(this->buffer.data(), this->buffer.data() + this->buffer.size());
+    return framed;
+}
+
+// queue some of the response on the connection and send what the socket will take
+void Server::Response::hand_over(const string &framed, bool last, bool more) {
+    {
+        lock_guard<mutex> lock(this->connection->latch);
+        if (last && !more)
+            this->connection->ended = true;
+        if (this->connection->hung_up)
+            return;
+        this->connection->output += framed;
+    }
+    this->server.send(this->connection);
+    if (!last)
+        wait_for_client();
+}
+
+// if the client has too much of the response still to take, wait until it has taken half of it
+//
+// The statement is still going, and its scan may have a cursor open on a file, but nobody can pull the
+// file out from under it: its table and the catalog stay locked, and whatever is retired meanwhile is
+// kept until its read section ends (see Session). So the session steps aside while we wait, just as
+// for a lock (see before_wait), and others run meanwhile. A client that hasn't caught up within
+// CLIENT_TIMEOUT is cut off; the rest of its response is dropped and its session ends.
+void Server::Response::wait_for_client() {
+    {
+        lock_guard<mutex> lock(this->connection->latch);
+        if (this->connection->output.size() < MAX_BACKLOG || this->connection->hung_up)
+            return;
+    }
+    before_wait();
+    {
+        unique_lock<mutex> lock(this->connection->latch);
+        bool caught_up = this->connection->taken.wait_for(lock, chrono::seconds(CLIENT_TIMEOUT), [this] {
+            return this->connection->output.size() < MAX_BACKLOG / 2 || this->connection->hung_up;
+        });
+        if (!caught_up) {
+            this->connection->hung_up = true;
+            this->connection->output.clear();
+            this->connection->lines.clear();
+            this->connection->lines.push_back("quit");
+            if (this->connection->fd >= 0)
+                shutdown(this->connection->fd, SHUT_RDWR);  // the event loop sees it go and cleans up
+        }
+    }
+    after_wait();
+}
+
+/**
+ * Watch a connection for input (and, if we have a response waiting for room, for room to write).
+ * @param fd       the connection's socket
+ * @param writing  true to watch for room to write as well
+ */
+void Server::watch(int fd, bool writing) {
+    epoll_event event{};
+    event.events = (uint32_t) EPOLLIN | (writing ? (uint32_t) EPOLLOUT : (uint32_t) 0);
+    event.data.fd = fd;
+    epoll_ctl(this->epoll, EPOLL_CTL_MOD, fd, &event);
+}
+
+/**
+ * Wake up the event loop (to close finished connections).
+ */
+void Server::poke() {
+    ssize_t ignored = write(this->wake[1], "", 1);
+    (void) ignored;
+}
+
+/**
+ * A session is about to wait for a lock or the log (Transaction::before_wait), or for its client to catch
+ * up (see Response::wait_for_client): let other sessions run, and make up for the worker with another
+ * one while it waits.
+ */
+void Server::before_wait() {
+    Session::step_aside();
+    Server *server = instance;
+    if (server == nullptr)
+        return;
+    lock_guard<mutex> lock(server->pool_mutex);
+    server->waiting++;
+    if (server->workers < server->size + server->waiting)
+        server->add_worker();
+}
+
+/**
+ * The wait is over (Transaction::after_wait): the extra worker can go once it is idle, and the session
+ * takes its next turn.
+ */
+void Server::after_wait() {
+    Server *server = instance;
+    if (server != nullptr) {
+        lock_guard<mutex> lock(server->pool_mutex);
+        server->waiting--;
+        server->work.notify_all();
+    }
+    Session::step_back();
+}
+
+/**
+ * Open a listening socket.
+ * @param address  path of a Unix domain socket, or a port number for TCP on the loopback interface
+ * @return         the socket (non-blocking)
+ * @throws runtime_error if it can't be opened
+ */
+int Server::listen_on(const string &address) {
+    bool is_port = !address.empty() && address.find_first_not_of("0123456789") == string::npos;
+    int fd;
+    int result;
+    if (is_port) {
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            throw runtime_error(string("cannot open socket: ") + strerror(errno));
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        sockaddr_in inet{};
+        inet.sin_family = AF_INET;
+        inet.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        inet.sin_port = htons((uint16_t) stoul(address));
+        result = bind(fd, (sockaddr *) &inet, sizeof(inet));
+    } else {
+        sockaddr_un local{};
+        if (address.size() >= sizeof(local.sun_path))
+            throw runtime_error("socket path too long: " + address);
+        struct stat info;
+        if (stat(address.c_str(), &info) == 0 && S_ISSOCK(info.st_mode))
+            unlink(address.c_str());  // left over from a server that didn't get to clean up
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            throw runtime_error(string("cannot open socket: ") + strerror(errno));
+        local.sun_family = AF_UNIX;
+        strncpy(local.sun_path, address.c_str(), sizeof(local.sun_path) - 1);
+        result = bind(fd, (sockaddr *) &local, sizeof(local));
+    }
+    if (result != 0 || listen(fd, SOMAXCONN) != 0) {
+        string error = strerror(errno);
+        ::close(fd);
+        throw runtime_error("cannot listen on " + address + ": " + error);
+    }
+    return fd;
+}
@@ -0,0 +1,439 @@
+/**
+ * @file Session.cpp - implementation of Session class
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include <algorithm>
+#include <cctype>
+#include <memory>
+#include <sstream>
+#include "Session.h"
+#include "SQLParser.h"
+#include "ParseTreeToString.h"
+#include "SQLExec.h"
+#include "Rcu.h"
+
+using namespace std;
+using namespace hsql;
+
+shared_mutex Session::engine;
+thread_local Session *Session::running = nullptr;
+thread_local Session *Session::aside = nullptr;
+
+/**
+ * A new session, with no transaction and the default options.
+ */
+Session::Session() : transaction(nullptr), statement(nullptr), flags(0), owner(0), echo(true), admin(true),
+                     isolation(Transaction::SNAPSHOT), block_size(DbBlock::BLOCK_SZ), storage("heap"), output("text"),
+                     exclusive(false) {
+}
+
+/**
+ * An unfinished transaction is rolled back, as if the user had crashed.
+ */
+Session::~Session() {
+    if (this->transaction != nullptr) {
+        ostream nowhere(nullptr);
+        try {
+            close(nowhere);
+        } catch (...) {
+            // nobody left to tell
+        }
+    }
+}
+
+/**
+ * Run one line of input: transaction control, a "set" option, "show locks" (and the other shows our
+ * parser doesn't know), or SQL statements.
+ * @param line  what the user typed
+ * @param out   where to print the results (and the statements, as our parser understood them)
+ * @return      false if the user wants to quit
+ */
+bool Session::execute(const string &line, ostream &out) {
+    if (line == "quit")
+        return false;
+
+    string command;
+    if (is_transaction_control(line, command)) {
+        try {
+            QueryResult *result;
+            {
+                Turn turn(*this);
+                result = command == "begin" ? SQLExec::begin()
+                       : command == "commit" ? SQLExec::commit()
+                       : SQLExec::rollback();
+            }
+            out << *result << endl;
+            delete result;
+        } catch (SQLExecError &e) {
+            out << "Error: " << e.what() << endl;
+        }
+        return true;
+    }
+
+    if (line == "show locks" || line == "show result cache" || line == "show status" || line == "show latency") {
+        QueryResult *result;
+        {
+            Turn turn(*this);
+            result = line == "show locks" ? SQLExec::show_locks()
+                   : line == "show result cache" ? SQLExec::show_result_cache()
+                   : line == "show status" ? SQLExec::show_status()
+                   : SQLExec::show_latency();
+        }
+        out << *result << endl;
+        delete result;
+        return true;
+    }
+
+    if (line.compare(0, 4, "set ") == 0) {
+        // session options, e.g., "set block_size 32768"
+        istringstream words(line.substr(4));
+        string option, value;
+        words >> option >> value;
+        if (!this->admin && SQLExec::is_global_option(option)) {
+            out << "Error: " << option << " applies to everyone, so it can only be set when the server starts" << endl;
+            return true;
+        }
+        try {
+            QueryResult *result;
+            {
+                Turn turn(*this, SQLExec::is_global_option(option));  // nobody may be going by the old value
+                result = SQLExec::set(option, value);
+            }
+            out << *result << endl;
+            delete result;
+        } catch (SQLExecError &e) {
+            out << "Error: " << e.what() << endl;
+        }
+        return true;
+    }
+
+    string rest;
+    if (is_command(line, "prepare", rest)) {
+        prepare(rest, out);
+        return true;
+    }
+    if (is_command(line, "execute", rest)) {
+        execute_prepared(rest, out);
+        return true;
+    }
+    if (is_command(line, "deallocate", rest)) {
+        deallocate(rest, out);
+        return true;
+    }
+    if (is_command(line, "explain", rest)) {
+        explain(rest, out);
+        return true;
+    }
+
+    // a statement we have seen before, but for its literals, skips the parse and the planning
+    string text;
+    vector<Value> arguments;
+    if (PlanCache::plans(line) && PlanCache::normalize(line, text, arguments)) {
+        PreparedStatementPtr cached;
+        try {
+            cached = PlanCache::get(text);
+        } catch (SQLExecError &e) {
+            // can't be run that way (the parser will say what's wrong with it, if anything)
+        }
+        if (cached != nullptr && cached->parameter_count() == arguments.size()) {
+            run(*cached, arguments, out);
+            return true;
+        }
+    }
+
+    // use the Hyrise sql parser to get us our AST
+    SQLParserResult *parse = SQLParser::parseSQLString(line);
+    if (!parse->isValid()) {
+        out << "invalid SQL: " << line << endl;
+        out << parse->errorMsg() << endl;
+        delete parse;
+        return true;
+    }
+    // execute the statements
+    for (uint i = 0; i < parse->size(); ++i) {
+        const SQLStatement *statement = parse->getStatement(i);
+        try {
+            bool quiet = rows_only(statement);
+            if (!quiet && this->echo)
+                out << ParseTreeToString::statement(statement) << endl;
+            QueryResult *result;
+            {
+                Turn turn(*this);
+                Rcu::ReadSection section;  // whatever another session retires while we wait stays until we're done
+                unique_ptr<RowSink> rows(RowSink::make(SQLExec::output, out));  // printed as they're found
+                result = SQLExec::execute(statement, rows.get());
+            }
+            if (!quiet)
+                out << *result << endl;
+            delete result;
+        } catch (SQLExecError &e) {
+            out << "Error: " << e.what() << endl;
+        }
+    }
+    delete parse;
+    return true;
+}
+
+/**
+ * Run a prepared statement, echoing it (with its arguments) and printing the results.
+ * @param statement  the statement
+ * @param arguments  values for its parameters
+ * @param out        where to print
+ */
+void Session::run(PreparedStatement &statement, const vector<Value> &arguments, ostream &out) {
+    try {
+        bool quiet = rows_only(statement.get_statement());
+        if (!quiet && this->echo)
+            out << statement.echo(arguments) << endl;
+        QueryResult *result;
+        {
+            Turn turn(*this);
+            Rcu::ReadSection section;
+            unique_ptr<RowSink> rows(RowSink::make(SQLExec::output, out));
+            result = SQLExec::execute(statement, arguments, rows.get());
+        }
+        if (!quiet)
+            out << *result << endl;
+        delete result;
+    } catch (SQLExecError &e) {
+        out << "Error: " << e.what() << endl;
+    }
+}
+
+/**
+ * Is the output of this statement to be just its rows? It is for a select, when the session writes
+ * rows in one of the machine-readable formats (see SQLExec::set): the echo and the row count would
+ * only get in the way of whatever is reading them.
+ * @param statement  the statement
+ * @return           true to print nothing but the rows
+ */
+bool Session::rows_only(const SQLStatement *statement) const {
+    return this->output != "text" && statement->type() == kStmtSelect;
+}
+
+/**
+ * PREPARE <name> AS <statement>
+ * @param rest  what follows "prepare"
+ * @param out   where to print
+ */
+void Session::prepare(const string &rest, ostream &out) {
+    istringstream words(rest);
+    string name, as, text;
+    words >> name >> as;
+    getline(words, text);
+    transform(as.begin(), as.end(), as.begin(), [](unsigned char c) { return tolower(c); });
+    if (name.empty() || as != "as" || text.find_first_not_of(" \t") == string::npos) {
+        out << "Error: prepare <name> as <statement>" << endl;
+        return;
+    }
+    try {
+        PreparedStatementPtr statement = PlanCache::get(text.substr(text.find_first_not_of(" \t")));
+        this->prepared[name] = statement;
+        size_t n = statement->parameter_count();
+        out << statement->echo(vector<Value>()) << endl;
+        out << "prepared " << name << " with " << n << (n == 1 ? " parameter" : " parameters") << endl;
+    } catch (SQLExecError &e) {
+        out << "Error: " << e.what() << endl;
+    }
+}
+
+/**
+ * EXECUTE <name> [(<literal>, ...)]
+ * @param rest  what follows "execute"
+ * @param out   where to print
+ */
+void Session::execute_prepared(const string &rest, ostream &out) {
+    size_t paren = rest.find('(');
+    string name = rest.substr(0, paren);
+    while (!name.empty() && isspace((unsigned char) name.back()))
+        name.pop_back();
+    auto found = this->prepared.find(name);
+    if (found == this->prepared.end()) {
+        out << "Error: no prepared statement " << name << endl;
+        return;
+    }
+
+    // the arguments have to be literals: "(?, ?, ...)" once they're taken out
+    string pattern;
+    vector<Value> arguments;
+    bool literals = PlanCache::normalize(paren == string::npos ? "" : rest.substr(paren), pattern, arguments);
+    pattern.erase(remove(pattern.begin(), pattern.end(), ' '), pattern.end());
+    string expected;
+    for (size_t i = 0; i < arguments.size(); i++)
+        expected += i == 0 ? "?" : ",?";
+    if (!literals || (pattern != "" && pattern != "(" + expected + ")")) {
+        out << "Error: execute <name> [(<literal>, ...)]" << endl;
+        return;
+    }
+    run(*found->second, arguments, out);
+}
+
+/**
+ * DEALLOCATE <name>
+ * @param rest  what follows "deallocate"
+ * @param out   where to print
+ */
+void Session::deallocate(const string &rest, ostream &out) {
+    if (this->prepared.erase(rest) == 0)
+        out << "Error: no prepared statement " << rest << endl;
+    else
+        out << "deallocated " << rest << endl;
+}
+
+/**
+ * EXPLAIN [ANALYZE] <select statement>
+ * @param rest  what follows "explain"
+ * @param out   where to print
+ */
+void Session::explain(const string &rest, ostream &out) {
+    string text;
+    bool analyze = is_command(rest, "analyze", text);
+    if (!analyze)
+        text = rest;
+    SQLParserResult *parse = SQLParser::parseSQLString(text);
+    if (!parse->isValid() || parse->size() != 1) {
+        out << "Error: explain [analyze] <select statement>" << endl;
+        delete parse;
+        return;
+    }
+    try {
+        QueryResult *result;
+        {
+            Turn turn(*this);
+            Rcu::ReadSection section;
+            result = SQLExec::explain(parse->getStatement(0), analyze);
+        }
+        out << *result << endl;
+        delete result;
+    } catch (SQLExecError &e) {
+        out << "Error: " << e.what() << endl;
+    }
+    delete parse;
+}
+
+/**
+ * End the session, rolling back its transaction if it has one.
+ * @param out  where to say so
+ */
+void Session::close(ostream &out) {
+    if (this->transaction == nullptr)
+        return;
+    try {
+        QueryResult *result;
+        {
+            Turn turn(*this);
+            result = SQLExec::rollback();
+        }
+        out << *result << endl;
+        delete result;
+    } catch (SQLExecError &e) {
+        out << "Error: " << e.what() << endl;
+    }
+}
+
+/**
+ * Give up the turn while the statement this thread is running waits (for Transaction::before_wait), so
+ * that a session waiting for the engine to itself doesn't hold up the one we are waiting for. Does
+ * nothing if it isn't our turn.
+ */
+void Session::step_aside() {
+    if (running == nullptr)
+        return;
+    Session *session = running;
+    session->leave();
+    aside = session;
+}
+
+/**
+ * The wait is over, so take another turn (for Transaction::after_wait), if we stepped aside for it.
+ */
+void Session::step_back() {
+    if (aside == nullptr)
+        return;
+    Session *session = aside;
+    aside = nullptr;
+    session->enter(session->exclusive);
+}
+
+/**
+ * Start a turn: wait for the engine and put our transaction and options in place.
+ * @param exclusive  true to have the engine to ourselves, with no other turn going on meanwhile
+ */
+void Session::enter(bool exclusive) {
+    if (exclusive)
+        engine.lock();
+    else
+        engine.lock_shared();
+    this->exclusive = exclusive;
+    running = this;
+    Transaction::transaction = this->transaction;
+    Transaction::statement = this->statement;
+    Transaction::flags = this->flags;
+    Transaction::owner = this->owner;
+    Transaction::isolation = this->isolation;
+    _DB_TXN = this->statement != nullptr ? this->statement : this->transaction;
+    SQLExec::block_size = this->block_size;
+    SQLExec::storage = this->storage;
+    SQLExec::output = this->output;
+}
+
+/**
+ * End a turn: put our transaction and options away and let go of the engine.
+ */
+void Session::leave() {
+    this->transaction = Transaction::transaction;
+    this->statement = Transaction::statement;
+    this->flags = Transaction::flags;
+    this->owner = Transaction::owner;
+    this->isolation = Transaction::isolation;
+    this->block_size = SQLExec::block_size;
+    this->storage = SQLExec::storage;
+    this->output = SQLExec::output;
+    running = nullptr;
+    if (this->exclusive)
+        engine.unlock();
+    else
+        engine.unlock_shared();
+}
+
+/**
+ * Is this input one of the transaction control statements (which our parser doesn't know)?
+ * @param line     the input line
+ * @param command  returned by reference: "begin", "commit", or "rollback"
+ * @returns        true if it is
+ */
+bool Session::is_transaction_control(const string &line, string &command) {
+    string words = line;
+    transform(words.begin(), words.end(), words.begin(), [](unsigned char c) { return tolower(c); });
+    while (!words.empty() && (isspace((unsigned char) words.back()) || words.back() == ';'))
+        words.pop_back();
+    if (words == "begin" || words == "begin transaction" || words == "start transaction")
+        command = "begin";
+    else if (words == "commit" || words == "commit transaction" || words == "end")
+        command = "commit";
+    else if (words == "rollback" || words == "rollback transaction" || words == "abort")
+        command = "rollback";
+    else
+        return false;
+    return true;
+}
+
+/**
+ * Does this input start with the given command word (in any case)?
+ * @param line  the input line
+ * @param word  the command, in lower case
+ * @param rest  returned by reference: the rest of the line, without the white space around it
+ * @returns     true if it does
+ */
+bool Session::is_command(const string &line, const string &word, string &rest) {
+    size_t n = word.size();
+    if (line.size() < n || (line.size() > n && !isspace((unsigned char) line[n])))
+        return false;
+    for (size_t i = 0; i < n; i++)
+        if (tolower((unsigned char) line[i]) != word[i])
+            return false;
+    size_t start = line.find_first_not_of(" \t", n);
+    size_t end = line.find_last_not_of(" \t;");
+    rest = start == string::npos || end < start ? "" : line.substr(start, end - start + 1);
+    return true;
+}
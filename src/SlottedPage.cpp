@@ -4,10 +4,16 @@
  * @see Seattle University, CPSC5300
  */
 #include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "SlottedPage.h"
+#include "crc32c.h"
+#include "PerfCounters.h"
 
 using namespace std;
 typedef uint16_t u16;
+typedef uint32_t u32;
 
 /**
  * SlottedPage constructor
@@ -15,28 +21,52 @@ typedef uint16_t u16;
  * @param block_id
  * @param is_new
  */
-SlottedPage::SlottedPage(Dbt &block, BlockID block_id, bool is_new) : DbBlock(block, block_id, is_new) {
+SlottedPage::SlottedPage(Dbt &block, BlockID block_id, bool is_new) : DbBlock(block, block_id, is_new),
+                                                                      owns_data(false) {
     if (is_new) {
         this->num_records = 0;
-        this->end_free = DbBlock::BLOCK_SZ - 1;
+        this->end_free = get_block_size() - 1;
+        this->fragmented = 0;
+        this->free_slot = 0;
+        this->live_records = 0;
+        memset(this->address(0), 0, HEADER_SZ);
+        put_n(24, FORMAT);
         put_header();
     } else {
         get_header(this->num_records, this->end_free);
+        this->fragmented = get_n(8);
+        this->free_slot = get_n(12);
+        this->live_records = get_n(16);
     }
 }
 
 /**
- * Add a new record to the block.
+ * Add a new record to the block. Reuses a deleted record's id if there is one.
  * @param data
  * @return the new block's id
  */
 RecordID SlottedPage::add(const Dbt *data) {
-    if (!has_room((u16) data->get_size()))
+    u32 size = data->get_size();
+    bool reuse = this->free_slot != 0;
+    if (!reuse && this->num_records == UINT16_MAX)
+        throw DbBlockNoRoomError("no more record ids in block");
+    if ((uint64_t) size + (reuse ? 0 : SLOT_SZ) > this->unused_bytes())
         throw DbBlockNoRoomError("not enough room for new record");
-    u16 id = ++this->num_records;
-    u16 size = (u16) data->get_size();
-    this->end_free -= size;
-    u16 loc = this->end_free + 1U;
+
+    RecordID id;
+    if (reuse) {
+        id = (RecordID) this->free_slot;
+        u32 next, loc;
+        get_header(next, loc, id);
+        this->free_slot = next;
+    } else {
+        if (contiguous_bytes() < SLOT_SZ)
+            compact();  // the new header would overwrite a record otherwise
+        id = (RecordID) ++this->num_records;
+        put_header(id, 0, 0);  // claim the header space before making room
+    }
+    u32 loc = place(size);
+    this->live_records++;
     put_header();
     put_header(id, size, loc);
     memcpy(this->address(loc), data->get_data(), size);
@@ -49,7 +79,7 @@ RecordID SlottedPage::add(const Dbt *data) {
  * @return the bits of the record as stored in the block, or nullptr if it has been deleted (freed by caller)
  */
 Dbt *SlottedPage::get(RecordID record_id) const {
-    u16 size, loc;
+    u32 size, loc;
     get_header(size, loc, record_id);
     if (loc == 0)
         return nullptr;  // this is just a tombstone, record has been deleted
@@ -58,41 +88,57 @@ Dbt *SlottedPage::get(RecordID record_id) const {
 
 /**
  * Replace the record with the given data.
+ * A smaller record is rewritten where it is. A bigger one is written into free space and its old
+ * bytes become a hole.
  * @param record_id   record to replace
  * @param data        new contents of record_id
  * @throws DbBlockNoRoomError if it won't fit
+ * @throws DbRelationError if record_id has been deleted
  */
 void SlottedPage::put(RecordID record_id, const Dbt &data) {
-    u16 size, loc;
+    u32 size, loc;
     get_header(size, loc, record_id);
-    u16 new_size = (u16) data.get_size();
-    if (new_size > size) {
-        u16 extra = new_size - size;
-        if (!has_room(extra))
-            throw DbBlockNoRoomError("not enough room for enlarged record");
-        slide(loc, loc - extra);
-        memcpy(this->address(loc - extra), data.get_data(), new_size);
+    if (loc == 0)  // a tombstone, whose size is really the next id on the free list
+        throw DbRelationError("record " + to_string(record_id) + " of block " + to_string(get_block_id())
+                              + " has been deleted");
+    u32 flags = get_flags(record_id);
+    u32 new_size = data.get_size();
+    if (new_size <= size) {
+        memcpy(this->address(loc), data.get_data(), new_size);
+        this->fragmented += size - new_size;
     } else {
+        if ((uint64_t) new_size > (uint64_t) this->unused_bytes() + size)
+            throw DbBlockNoRoomError("not enough room for enlarged record");
+        put_header(record_id, flags, 0);  // old bytes are now free (and won't be kept by a compaction)
+        this->fragmented += size;
+        loc = place(new_size);
         memcpy(this->address(loc), data.get_data(), new_size);
-        slide(loc + new_size, loc + size);
     }
-    get_header(size, loc, record_id);
-    put_header(record_id, new_size, loc);
+    put_header();
+    put_header(record_id, new_size | flags, loc);
 }
 
 /**
  * Delete a record from the page.
  *
- * Mark the given id as deleted by changing its size to zero and its location to 0.
- * Compact the rest of the data in the block. But keep the record ids the same for everyone.
+ * Mark the given id as deleted by changing its location to 0 and put it on the list of ids to
+ * reuse. The space it used is not reclaimed until some add or put needs it.
  *
  * @param record_id  record to delete
  */
 void SlottedPage::del(RecordID record_id) {
-    u16 size, loc;
+    u32 size, loc;
     get_header(size, loc, record_id);
-    put_header(record_id, 0, 0);  // 0 is the tombstone sentinel
-    slide(loc, loc + size);
+    if (loc == 0)
+        return;  // already deleted
+    if (loc == this->end_free + 1)
+        this->end_free += size;  // it was right next to the free space, so just give it back
+    else
+        this->fragmented += size;
+    put_header(record_id, this->free_slot, 0);  // 0 is the tombstone sentinel
+    this->free_slot = record_id;
+    this->live_records--;
+    put_header();
 }
 
 /**
@@ -101,21 +147,51 @@ void SlottedPage::del(RecordID record_id) {
  */
 RecordIDs *SlottedPage::ids(void) const {
     RecordIDs *vec = new RecordIDs();
-    u16 size, loc;
-    for (RecordID record_id = 1; record_id <= this->num_records; record_id++) {
-        get_header(size, loc, record_id);
-        if (loc != 0)
-            vec->push_back(record_id);
-    }
+    vec->reserve(this->live_records);
+    for (RecordID record_id = next_id(); record_id != 0; record_id = next_id(record_id))
+        vec->push_back(record_id);
     return vec;
 }
 
+/**
+ * Step through the non-deleted record IDs without allocating anything:
+ *     for (RecordID id = page->next_id(); id != 0; id = page->next_id(id)) ...
+ * @param record_id  the previous id returned (or 0 to start at the beginning)
+ * @return           next non-deleted id after record_id, or 0 if there are no more
+ */
+RecordID SlottedPage::next_id(RecordID record_id) const {
+    if (this->live_records == 0)
+        return 0;
+    u32 id = record_id + 1U;
+#ifdef __SSE2__
+    // check the offsets of four record headers at a time: a tombstone's offset is zero
+    const __m128i zero = _mm_setzero_si128();
+    for (; id + 3 <= this->num_records; id += 4) {
+        const char *slots = (const char *) this->address(HEADER_SZ + SLOT_SZ * (id - 1U));
+        __m128i first = _mm_loadu_si128((const __m128i *) slots);
+        __m128i second = _mm_loadu_si128((const __m128i *) (slots + 16));
+        // 32-bit lanes are {size, loc, size, loc}, so mask bits 1 and 3 are set for zero locs
+        int first_zero = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(first, zero)));
+        int second_zero = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(second, zero)));
+        if ((first_zero & second_zero & 0xA) != 0xA)
+            break;  // at least one of these is live; the loop below finds which
+    }
+#endif
+    for (; id <= this->num_records; id++)
+        if (get_n(HEADER_SZ + SLOT_SZ * (id - 1U) + 4) != 0)
+            return (RecordID) id;
+    return 0;
+}
+
 /**
  * Erase all the records
  */
 void SlottedPage::clear() {
     this->num_records = 0;
-    this->end_free = DbBlock::BLOCK_SZ - 1;
+    this->end_free = get_block_size() - 1;
+    this->fragmented = 0;
+    this->free_slot = 0;
+    this->live_records = 0;
     put_header();
 }
 
@@ -124,25 +200,21 @@ void SlottedPage::clear() {
  * @return number of current records
  */
 u16 SlottedPage::size() const {
-    u16 size, loc;
-    u16 count = 0;
-    for (RecordID record_id = 1; record_id <= this->num_records; record_id++) {
-        get_header(size, loc, record_id);
-        if (loc != 0)
-            count++;
-    }
-    return count;
+    return (u16) this->live_records;
 }
 
 /**
  * Get the size and offset for given id. For id of zero, it is the block header.
- * @param size  set to the size from given header
+ * @param size  set to the size from given header (without any record flags)
  * @param loc   set to the byte offset from given header
  * @param id    the id of the header to fetch
  */
-void SlottedPage::get_header(u_int16_t &size, u_int16_t &loc, RecordID id) const {
-    size = get_n((u16) 4 * id);
-    loc = get_n((u16) (4 * id + 2));
+void SlottedPage::get_header(u32 &size, u32 &loc, RecordID id) const {
+    u32 offset = id == 0 ? 0 : HEADER_SZ + SLOT_SZ * (id - 1U);
+    size = get_n(offset);
+    if (id != 0)
+        size &= ~FLAGS;
+    loc = get_n(offset + 4);
 }
 
 /**
@@ -151,91 +223,154 @@ void SlottedPage::get_header(u_int16_t &size, u_int16_t &loc, RecordID id) const
  * @param size
  * @param loc
  */
-void SlottedPage::put_header(RecordID id, u16 size, u16 loc) {
+void SlottedPage::put_header(RecordID id, u32 size, u32 loc) {
     if (id == 0) { // called the put_header() version and using the default params
-        size = this->num_records;
-        loc = this->end_free;
+        put_n(0, this->num_records);
+        put_n(4, this->end_free);
+        put_n(8, this->fragmented);
+        put_n(12, this->free_slot);
+        put_n(16, this->live_records);
+        return;
     }
-    put_n((u16) 4 * id, size);
-    put_n((u16) (4 * id + 2), loc);
+    u32 offset = HEADER_SZ + SLOT_SZ * (id - 1U);
+    put_n(offset, size);
+    put_n(offset + 4, loc);
+}
+
+/**
+ * Get the flags (FORWARD, MOVED) set on a record.
+ * @param record_id  record to check
+ * @return           flag bits, 0 if none are set
+ */
+u32 SlottedPage::get_flags(RecordID record_id) const {
+    return get_n(HEADER_SZ + SLOT_SZ * (record_id - 1U)) & FLAGS;
+}
+
+/**
+ * Set the flags (FORWARD, MOVED) on a record, replacing any it had.
+ * @param record_id  record to mark
+ * @param flags      flag bits to set
+ */
+void SlottedPage::set_flags(RecordID record_id, u32 flags) {
+    u32 size, loc;
+    get_header(size, loc, record_id);
+    put_header(record_id, size | (flags & FLAGS), loc);
+}
+
+/**
+ * Store the block's checksum in its header. Call this just before writing the block out.
+ */
+void SlottedPage::set_checksum() {
+    put_n(20, checksum());
+}
+
+/**
+ * Check the block against the checksum in its header.
+ * @return  true if the block is intact
+ */
+bool SlottedPage::checksum_ok() const {
+    return get_n(20) == checksum();
+}
+
+/**
+ * Check that the block is laid out the way this version of SlottedPage expects.
+ * @return  false if it was written by an older (or newer) version
+ */
+bool SlottedPage::format_ok() const {
+    return get_n(24) == FORMAT;
+}
+
+/**
+ * Compute the CRC-32C of the whole block except the checksum field itself.
+ * @return  checksum
+ */
+u32 SlottedPage::checksum() const {
+    u32 crc = crc32c(this->address(0), 20);
+    return crc32c(this->address(24), get_block_size() - 24, crc);
 }
 
 /**
- * Calculate if we have room to store a record with given size. The size should include the 4 bytes
+ * Calculate if we have room to store a record with given size. The size should include the 8 bytes
  * for the header, too, if this is an add.
  * @param size   size of the new record (not including the header space needed)
  * @return       true if there is enough room, false otherwise
  */
-bool SlottedPage::has_room(u16 size) const {
-    return size + (u16)4 <= this->unused_bytes();
+bool SlottedPage::has_room(u32 size) const {
+    return (uint64_t) size + SLOT_SZ <= this->unused_bytes();
 }
 
 /**
  * Get the number of bytes not currently used to store data or for overhead.
+ * This includes the holes that a compaction would reclaim.
  * @return number of bytes
  */
-u16 SlottedPage::unused_bytes() const {
-     u16 headers = (u16) (4 * (this->num_records + 1));
-     u16 unused;
-     if (this->end_free <= headers)
-         unused = 0;
-     else
-         unused = this->end_free - headers;
-    return unused;
- }
+u32 SlottedPage::unused_bytes() const {
+    return contiguous_bytes() + this->fragmented;
+}
 
 /**
- * Slide the contents to compensate for a smaller/larger record.
- *
- * If start < end, then remove data from offset start up to but not including offset end by sliding data
- * that is to the left of start to the right. If start > end, then make room for extra data from end to start
- * by sliding data that is to the left of start to the left.
- * Also fix up any record headers whose data has slid. Assumes there is enough room if it is a left
- * shift (end < start).
- *
- * @param start  beginning of slide
- * @param end    end of slide
+ * Get the number of free bytes between the headers and the data.
+ * @return number of bytes
  */
-void SlottedPage::slide(u_int16_t start, u_int16_t end) {
-    int shift = end - start;
-    if (shift == 0)
-        return;
+u32 SlottedPage::contiguous_bytes() const {
+    u32 headers = HEADER_SZ + SLOT_SZ * this->num_records;
+    if (this->end_free <= headers)
+        return 0;
+    return this->end_free - headers;
+}
 
-    // slide data
-    void *to = this->address((u16) (this->end_free + 1 + shift));
-    void *from = this->address((u16) (this->end_free + 1));
-    int bytes = start - (this->end_free + 1U);
-    memmove(to, from, bytes);
+/**
+ * Take size bytes from the front of the free space, compacting first if the holes are needed.
+ * Assumes the caller has checked that there is enough room.
+ * @param size  number of bytes needed
+ * @return      offset of the new space
+ */
+u32 SlottedPage::place(u32 size) {
+    if (size > contiguous_bytes())
+        compact();
+    this->end_free -= size;
+    return this->end_free + 1U;
+}
 
-    // fix up headers to the right
-    RecordIDs *record_ids = ids();
-    for (auto const &record_id : *record_ids) {
-        u16 size, loc;
+/**
+ * Squeeze out the holes by moving all the records to the end of the block (keeping their ids),
+ * so all the free space is in one piece again.
+ */
+void SlottedPage::compact() {
+    PerfCounters::mine().page_compactions++;
+    u32 block_size = get_block_size();
+    char *packed = new char[block_size];
+    u32 end = block_size;
+    for (RecordID record_id = 1; record_id <= this->num_records; record_id++) {
+        u32 size, loc;
         get_header(size, loc, record_id);
-        if (loc <= start) {
-            loc += shift;
-            put_header(record_id, size, loc);
-        }
+        if (loc == 0)
+            continue;
+        end -= size;
+        memcpy(packed + end, this->address(loc), size);
+        put_header(record_id, size | get_flags(record_id), end);
     }
-    delete record_ids;
-    this->end_free += shift;
+    memcpy(this->address(end), packed + end, block_size - end);
+    delete[] packed;
+    this->end_free = end - 1;
+    this->fragmented = 0;
     put_header();
 }
 
 /**
- * Get 2-byte integer at given offset in block.
+ * Get 4-byte integer at given offset in block.
  */
-u16 SlottedPage::get_n(u16 offset) const {
-    return *(u16 *) this->address(offset);
+u32 SlottedPage::get_n(u32 offset) const {
+    return *(u32 *) this->address(offset);
 }
 
 /**
- * Put a 2-byte integer at given offset in block.
+ * Put a 4-byte integer at given offset in block.
  * @param offset number of bytes into the page
  * @param n
  */
-void SlottedPage::put_n(u16 offset, u16 n) {
-    *(u16 *) this->address(offset) = n;
+void SlottedPage::put_n(u32 offset, u32 n) {
+    *(u32 *) this->address(offset) = n;
 }
 
 /**
@@ -243,7 +378,7 @@ void SlottedPage::put_n(u16 offset, u16 n) {
  * @param offset
  * @return
  */
-void *SlottedPage::address(u16 offset) const {
+void *SlottedPage::address(u32 offset) const {
     return (void *) ((char *) this->block.get_data() + offset);
 }
 
@@ -302,7 +437,7 @@ bool test_slotted_page() {
     if (expected != actual)
         return assertion_failure("get 2 back " + actual);
 
-    // test put with expansion (and slide and ids)
+    // test put with expansion (and ids)
     char rec1_rev[] = "something much bigger";
     rec1_dbt = Dbt(rec1_rev, sizeof(rec1_rev));
     slot.put(1, rec1_dbt);
@@ -320,7 +455,7 @@ bool test_slotted_page() {
     if (expected != actual)
         return assertion_failure("get 1 back after expanding put of 1 " + actual);
 
-    // test put with contraction (and slide and ids)
+    // test put with contraction (and ids)
     rec1_dbt = Dbt(rec1, sizeof(rec1));
     slot.put(1, rec1_dbt);
     // check both rec2 and rec1 after contracting put
@@ -363,6 +498,92 @@ bool test_slotted_page() {
         return assertion_failure("wrong type thrown when add too big");
     }
 
+    // deleted ids are handed out again
+    id = slot.add(&rec1_dbt);
+    if (id != 1)
+        return assertion_failure("add reuses deleted id 1");
+    slot.del(1);
+
+    // holes left by deletes are reclaimed when an add needs them
+    char hole_space[DbBlock::BLOCK_SZ];
+    Dbt hole_dbt(hole_space, sizeof(hole_space));
+    SlottedPage holes(hole_dbt, 1, true);
+    char filler[100];
+    Dbt filler_dbt(filler, sizeof(filler));
+    uint16_t n_fill = 0;
+    try {
+        for (;;) {
+            memset(filler, 'a' + n_fill % 26, sizeof(filler));
+            holes.add(&filler_dbt);
+            n_fill++;
+        }
+    } catch (const DbBlockNoRoomError &exc) {
+        // page is full
+    }
+    for (RecordID fill_id = 1; fill_id <= n_fill; fill_id += 2)
+        holes.del(fill_id);
+    char wide[300];
+    memset(wide, 'z', sizeof(wide));
+    Dbt wide_dbt(wide, sizeof(wide));
+    id = holes.add(&wide_dbt);  // bigger than any one hole
+    if (id % 2 != 1 || id > n_fill)
+        return assertion_failure("add after deletes did not reuse an id");
+    get_dbt = holes.get(id);
+    bool holes_ok = get_dbt->get_size() == sizeof(wide) && memcmp(get_dbt->get_data(), wide, sizeof(wide)) == 0;
+    delete get_dbt;
+    for (RecordID fill_id = 2; fill_id <= n_fill && holes_ok; fill_id += 2) {
+        get_dbt = holes.get(fill_id);
+        holes_ok = get_dbt->get_size() == sizeof(filler) &&
+                   ((char *) get_dbt->get_data())[0] == 'a' + (fill_id - 1) % 26;
+        delete get_dbt;
+    }
+    if (!holes_ok)
+        return assertion_failure("records after compaction");
+
+    // stepping through the ids skips the deleted ones and agrees with size()
+    u16 live = 0;
+    RecordID prev_id = 0;
+    for (RecordID live_id = holes.next_id(); live_id != 0; live_id = holes.next_id(live_id)) {
+        get_dbt = holes.get(live_id);
+        bool found = get_dbt != nullptr;
+        delete get_dbt;
+        if (live_id <= prev_id || !found)
+            return assertion_failure("next_id order", prev_id, live_id);
+        prev_id = live_id;
+        live++;
+    }
+    if (live != holes.size() || live != n_fill / 2 + 1)
+        return assertion_failure("next_id count", live, holes.size());
+
+    // a deleted record can't be replaced (its header isn't pointing at any bytes)
+    RecordID deleted_id = holes.free_slot;
+    try {
+        holes.put(deleted_id, filler_dbt);
+        return assertion_failure("failed to throw when put deleted record");
+    } catch (const DbRelationError &exc) {
+        // test succeeded - this is the expected path
+    }
+    if (holes.free_slot != deleted_id || holes.get(deleted_id) != nullptr || holes.size() != live)
+        return assertion_failure("put of deleted record changed the block");
+
+    // a block laid out some other way is recognized
+    if (!holes.format_ok())
+        return assertion_failure("format of new block");
+    char old_space[DbBlock::BLOCK_SZ];
+    memset(old_space, 0, sizeof(old_space));  // as an older version would have left the reserved bytes
+    Dbt old_dbt(old_space, sizeof(old_space));
+    SlottedPage old_block(old_dbt, 1);
+    if (old_block.format_ok())
+        return assertion_failure("format of old block");
+
+    // checksum catches a changed byte
+    holes.set_checksum();
+    if (!holes.checksum_ok())
+        return assertion_failure("checksum of intact block");
+    ((char *) holes.address(holes.end_free + 1))[0] ^= 0x01;
+    if (holes.checksum_ok())
+        return assertion_failure("checksum of corrupted block");
+
     // more volume
     string gettysburg = "Four score and seven years ago our fathers brought forth on this continent, a new nation, conceived in Liberty, and dedicated to the proposition that all men are created equal.";
     int32_t n = -1;
@@ -403,5 +624,32 @@ bool test_slotted_page() {
         delete[] (char *) slot.block.get_data();  // this is why we need to be a friend--just convenient
     }
     delete[] data;
+
+    // a big block holds records that would never fit in the default block size
+    char *big_space = new char[DbBlock::MAX_BLOCK_SZ];
+    Dbt big_dbt(big_space, DbBlock::MAX_BLOCK_SZ);
+    SlottedPage big_page(big_dbt, 1, true);
+    string big_record(DbBlock::MAX_BLOCK_SZ - 100, 'x');
+    Dbt big_record_dbt((void *) big_record.data(), big_record.size());
+    id = big_page.add(&big_record_dbt);
+    get_dbt = big_page.get(id);
+    actual = string((char *) get_dbt->get_data(), get_dbt->get_size());
+    delete get_dbt;
+    if (actual != big_record) {
+        delete[] big_space;
+        return assertion_failure("get back record from big block");
+    }
+
+    // flags survive changes to the record and to its neighbors
+    big_page.set_flags(id, SlottedPage::MOVED);
+    id = big_page.add(&rec1_dbt);
+    big_page.put(1, rec1_dbt);
+    bool flags_ok = big_page.get_flags(1) == SlottedPage::MOVED && big_page.get_flags(id) == 0;
+    get_dbt = big_page.get(1);
+    flags_ok = flags_ok && get_dbt->get_size() == rec1_dbt.get_size();
+    delete get_dbt;
+    delete[] big_space;
+    if (!flags_ok)
+        return assertion_failure("record flags");
     return true;
 }
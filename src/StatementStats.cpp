@@ -0,0 +1,207 @@
+/**
+ * @file StatementStats.cpp - implementation of LatencyHistogram and StatementStats
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include "StatementStats.h"
+#include "storage_engine.h"
+
+using namespace std;
+using namespace hsql;
+
+/*
+ * LatencyHistogram
+ */
+
+LatencyHistogram::LatencyHistogram() : total(0), sum(0), largest(0) {
+    for (auto &count: this->counts)
+        count.store(0, memory_order_relaxed);
+}
+
+/**
+ * Count one latency.
+ * @param us  how long it took, in microseconds
+ */
+void LatencyHistogram::record(uint64_t us) {
+    this->counts[bucket_of(us)].fetch_add(1, memory_order_relaxed);
+    this->total.fetch_add(1, memory_order_relaxed);
+    this->sum.fetch_add(us, memory_order_relaxed);
+    uint64_t seen = this->largest.load(memory_order_relaxed);
+    while (us > seen && !this->largest.compare_exchange_weak(seen, us, memory_order_relaxed));
+}
+
+uint64_t LatencyHistogram::mean() const {
+    uint64_t n = count();
+    return n == 0 ? 0 : this->sum.load(memory_order_relaxed) / n;
+}
+
+/**
+ * The latency that the given fraction of those counted came in at or under (to within a bucket).
+ * @param fraction  e.g., 0.99 for the 99th percentile
+ * @return          the latency in microseconds, or 0 if nothing has been counted
+ */
+uint64_t LatencyHistogram::percentile(double fraction) const {
+    uint64_t n = count();
+    if (n == 0)
+        return 0;
+    uint64_t rank = std::max<uint64_t>(1, (uint64_t) ceil(fraction * (double) n));
+    uint64_t seen = 0;
+    for (uint32_t bucket = 0; bucket < BUCKETS; bucket++) {
+        seen += this->counts[bucket].load(memory_order_relaxed);
+        if (seen >= rank)
+            return min(highest_in(bucket), max());
+    }
+    return max();  // counted while we were reading
+}
+
+uint32_t LatencyHistogram::bucket_of(uint64_t us) {
+    if (us < EXACT)
+        return (uint32_t) us;
+    us = min<uint64_t>(us, (1ULL << MAX_BITS) - 1);
+    uint32_t bits = 63 - (uint32_t) __builtin_clzll(us);  // at least 7
+    uint32_t shift = bits - 6;
+    return EXACT + (bits - 7) * SUB_BUCKETS + (uint32_t) (us >> shift) - SUB_BUCKETS;
+}
+
+// the longest latency that goes in the bucket
+uint64_t LatencyHistogram::highest_in(uint32_t bucket) {
+    if (bucket < EXACT)
+        return bucket;
+    uint32_t bits = (bucket - EXACT) / SUB_BUCKETS + 7;
+    uint32_t shift = bits - 6;
+    uint64_t lowest = (uint64_t) (SUB_BUCKETS + (bucket - EXACT) % SUB_BUCKETS) << shift;
+    return lowest + (1ULL << shift) - 1;
+}
+
+
+/*
+ * StatementStats
+ */
+
+LatencyHistogram StatementStats::histograms[StatementStats::KINDS];
+atomic<uint64_t> StatementStats::slow_us(UINT64_MAX);
+mutex StatementStats::log_mutex;
+ofstream StatementStats::log;
+
+StatementStats::Kind StatementStats::kind_of(const SQLStatement *statement) {
+    switch (statement->type()) {
+        case kStmtSelect:
+            return SELECT;
+        case kStmtInsert:
+            return INSERT;
+        case kStmtUpdate:
+            return UPDATE;
+        case kStmtDelete:
+            return DELETE;
+        case kStmtCreate:
+        case kStmtDrop:
+            return DDL;
+        default:
+            return OTHER;
+    }
+}
+
+const char *StatementStats::name(Kind kind) {
+    static const char *const names[KINDS] = {"SELECT", "INSERT", "UPDATE", "DELETE", "DDL", "OTHER"};
+    return names[kind];
+}
+
+/**
+ * Log statements that take at least this long.
+ * @param ms  the threshold, in milliseconds (0 logs every statement)
+ */
+void StatementStats::set_slow_threshold(uint64_t ms) {
+    slow_us.store(ms * 1000, memory_order_relaxed);
+}
+
+void StatementStats::slow_threshold_off() {
+    slow_us.store(UINT64_MAX, memory_order_relaxed);
+}
+
+/**
+ * Write a slow statement to the slow query log.
+ * @param text           the statement
+ * @param plan           its evaluation plan (see EvalPlan::explain), or "" if it doesn't have one
+ * @param rows_examined  rows it read from its tables
+ * @param blocks_read    blocks it had to read (see PerfCounters)
+ * @param us             how long it took, in microseconds
+ */
+void StatementStats::log_slow(const string &text, const string &plan, uint64_t rows_examined,
+                              uint64_t blocks_read, uint64_t us) {
+    time_t now = chrono::system_clock::to_time_t(chrono::system_clock::now());
+    tm local{};
+    localtime_r(&now, &local);
+
+    lock_guard<mutex> guard(log_mutex);
+    if (!log.is_open()) {
+        const char *home = nullptr;
+        _DB_ENV->get_home(&home);
+        log.open((home == nullptr ? string("") : string(home) + "/") + "slow_queries.log", ios::app);
+    }
+    log << "# " << put_time(&local, "%Y-%m-%d %H:%M:%S") << fixed << setprecision(3) << "  time "
+        << (double) us / 1000.0 << " ms, rows examined " << rows_examined << ", blocks read " << blocks_read
+        << "\n" << text << "\n" << plan << flush;
+}
+
+
+/**
+ * Test which bucket each latency goes in (every bucket is used, in order, and none is wider than 1/64
+ * of the latencies in it), and the count, mean, maximum, and percentiles of a few sets of latencies.
+ * @return true if the tests all succeeded
+ */
+bool test_latency_histogram() {
+    typedef LatencyHistogram H;
+    for (uint64_t us = 0; us < H::EXACT; us++) {
+        if (H::bucket_of(us) != us || H::highest_in(H::bucket_of(us)) != us) {
+            cout << "exact bucket for " << us << endl;
+            return false;
+        }
+    }
+    for (uint32_t bucket = H::EXACT; bucket < H::BUCKETS - 1; bucket++) {
+        uint64_t lowest = H::highest_in(bucket - 1) + 1, highest = H::highest_in(bucket);
+        if (H::bucket_of(lowest) != bucket || H::bucket_of(highest) != bucket ||
+            (highest - lowest + 1) * H::SUB_BUCKETS > lowest) {
+            cout << "bucket " << bucket << " (" << lowest << " to " << highest << ")" << endl;
+            return false;
+        }
+    }
+    if (H::bucket_of(H::highest_in(H::BUCKETS - 2) + 1) != H::BUCKETS - 1 ||
+        H::bucket_of(UINT64_MAX) != H::BUCKETS - 1) {
+        cout << "last bucket" << endl;
+        return false;
+    }
+
+    LatencyHistogram empty;
+    if (empty.count() != 0 || empty.mean() != 0 || empty.max() != 0 || empty.percentile(0.5) != 0) {
+        cout << "empty histogram" << endl;
+        return false;
+    }
+
+    LatencyHistogram one_to_hundred;
+    for (uint64_t us = 100; us > 0; us--)
+        one_to_hundred.record(us);
+    if (one_to_hundred.count() != 100 || one_to_hundred.mean() != 50 || one_to_hundred.max() != 100 ||
+        one_to_hundred.percentile(0.0) != 1 || one_to_hundred.percentile(0.5) != 50 ||
+        one_to_hundred.percentile(0.99) != 99 || one_to_hundred.percentile(1.0) != 100) {
+        cout << "percentiles of 1 to 100" << endl;
+        return false;
+    }
+
+    // a long tail: the percentiles are within a bucket, but never more than the maximum
+    LatencyHistogram tail;
+    for (int i = 0; i < 98; i++)
+        tail.record(1000);
+    tail.record(5000);
+    tail.record(3600ULL * 1000 * 1000);
+    uint64_t p50 = tail.percentile(0.5), p99 = tail.percentile(0.99);
+    if (p50 < 1000 || p50 > 1000 + 1000 / H::SUB_BUCKETS || p99 < 5000 || p99 > 5000 + 5000 / H::SUB_BUCKETS ||
+        tail.percentile(1.0) != 3600ULL * 1000 * 1000) {
+        cout << "percentiles of a long tail: " << p50 << " " << p99 << endl;
+        return false;
+    }
+    return true;
+}
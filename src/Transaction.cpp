@@ -0,0 +1,395 @@
+/**
+ * @file Transaction.cpp - implementation of Transaction class
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "Transaction.h"
+#include "HeapFile.h"
+#include "HeapTable.h"
+#include "LockManager.h"
+
+using namespace std;
+
+uint32_t Transaction::commit_delay = 0;
+thread_local Transaction::Isolation Transaction::isolation = Transaction::SNAPSHOT;
+atomic<uint32_t> Transaction::trickle_percent(10);
+bool Transaction::no_wait = false;
+void (*Transaction::before_wait)() = nullptr;
+void (*Transaction::after_wait)() = nullptr;
+thread_local DbTxn *Transaction::transaction = nullptr;
+thread_local DbTxn *Transaction::statement = nullptr;
+thread_local uint32_t Transaction::flags = 0;
+thread_local uint64_t Transaction::owner = 0;
+thread_local uint64_t Transaction::changes = 0;
+atomic<uint64_t> Transaction::last_owner(0);
+atomic<uint32_t> Transaction::running(0);
+
+// group commit bookkeeping: commits are numbered as they ask for a sync, and synced counts how many are done
+static mutex sync_mutex;
+static condition_variable sync_done;
+static uint64_t sync_requested = 0;
+static uint64_t sync_completed = 0;
+static bool syncing = false;
+
+// the cleaner thread and what it needs to be told to stop
+static thread cleaner;
+static mutex cleaner_mutex;
+static condition_variable cleaner_wake;
+static bool cleaner_stopping = false;
+
+/**
+ * Execute: BEGIN
+ * @throws DbRelationError if there is already a transaction in progress
+ */
+void Transaction::begin() {
+    if (in_progress())
+        throw DbRelationError("a transaction is already in progress");
+    flags = isolation_flags();
+    _DB_ENV->txn_begin(nullptr, &transaction, flags);
+    _DB_TXN = transaction;
+    owner = ++last_owner;
+    running++;
+}
+
+/**
+ * Execute: COMMIT
+ * @throws DbRelationError if there is no transaction in progress
+ */
+void Transaction::commit() {
+    if (!in_progress())
+        throw DbRelationError("no transaction in progress");
+    DbTxn *txn = transaction;
+    transaction = nullptr;
+    _DB_TXN = nullptr;
+    try {
+        txn->commit(DB_TXN_NOSYNC);
+    } catch (...) {
+        HeapFile::aborted(txn, transaction);  // Berkeley DB aborts a transaction it can't commit
+        release_locks();  // the transaction is gone either way
+        throw;
+    }
+    HeapFile::committed(txn, nullptr);
+    release_locks();  // the commit is decided, so nobody has to wait for the sync as well
+    wait_for_log();
+}
+
+/**
+ * Execute: ROLLBACK
+ * @throws DbRelationError if there is no transaction in progress
+ */
+void Transaction::rollback() {
+    if (!in_progress())
+        throw DbRelationError("no transaction in progress");
+    DbTxn *txn = transaction;
+    transaction = nullptr;
+    _DB_TXN = nullptr;
+    try {
+        abort(txn);
+    } catch (...) {
+        release_locks();
+        throw;
+    }
+    release_locks();
+}
+
+/**
+ * Start the transaction for a statement (a child of BEGIN's transaction, if there is one, in which
+ * case it sees the same snapshot). A statement on its own that writes doesn't read from a snapshot: it
+ * may have to wait for another writer of the same table (see HeapTable), and then has to see what that
+ * one wrote.
+ * @param writes  true if the statement may write
+ */
+void Transaction::begin_statement(bool writes) {
+    if (!in_progress()) {
+        flags = isolation_flags();
+        if (writes)
+            flags &= ~DB_TXN_SNAPSHOT;
+    }
+    _DB_ENV->txn_begin(transaction, &statement, flags);
+    _DB_TXN = statement;
+    changes = HeapFile::changes();
+    if (!in_progress()) {
+        owner = ++last_owner;
+        running++;
+    }
+}
+
+/**
+ * The statement succeeded (and its changes have been written back), so commit its transaction.
+ * Inside BEGIN ... COMMIT, that just makes its changes part of the enclosing transaction.
+ */
+void Transaction::commit_statement() {
+    DbTxn *txn = statement;
+    statement = nullptr;
+    _DB_TXN = transaction;
+    end_statement(txn);
+    if (!in_progress())
+        wait_for_log();
+}
+
+/**
+ * The statement failed, so undo it. Inside BEGIN ... COMMIT, the locks it took are kept until the
+ * transaction ends. If it failed before writing anything, there is nothing to undo, so its transaction
+ * is committed rather than aborted (which costs the open files nothing).
+ */
+void Transaction::rollback_statement() {
+    DbTxn *txn = statement;
+    statement = nullptr;
+    _DB_TXN = transaction;
+    try {
+        if (txn != nullptr && HeapFile::changes() == changes)
+            end_statement(txn);
+        else if (txn != nullptr)
+            abort(txn);
+    } catch (...) {
+        if (!in_progress())
+            release_locks();
+        throw;
+    }
+    if (!in_progress())
+        release_locks();
+}
+
+/**
+ * Has the statement running now written anything to a Berkeley DB file (that a rollback would undo)?
+ * @return  true if it has
+ */
+bool Transaction::statement_wrote() {
+    return statement != nullptr && HeapFile::changes() != changes;
+}
+
+/**
+ * Start the cleaner thread, which keeps trickle_percent of Berkeley DB's cache written out.
+ */
+void Transaction::start_cleaner() {
+    lock_guard<mutex> lock(cleaner_mutex);
+    if (cleaner.joinable())
+        return;
+    cleaner_stopping = false;
+    cleaner = thread(clean);
+}
+
+/**
+ * Stop the cleaner thread and wait for it to finish.
+ */
+void Transaction::stop_cleaner() {
+    {
+        lock_guard<mutex> lock(cleaner_mutex);
+        cleaner_stopping = true;
+    }
+    cleaner_wake.notify_all();
+    if (cleaner.joinable())
+        cleaner.join();
+}
+
+/**
+ * Flags for starting a transaction with the current isolation.
+ * @return  flags for txn_begin
+ */
+uint32_t Transaction::isolation_flags() {
+    return (isolation == SNAPSHOT ? DB_TXN_SNAPSHOT : 0) | (no_wait ? DB_TXN_NOWAIT : 0);
+}
+
+/**
+ * Abort a transaction and get the open files back in step with it (see HeapFile::aborted).
+ * Changes not yet written back are thrown away; those for mmap and direct files are written anyway,
+ * since they were never part of the transaction.
+ * @param txn  transaction to abort
+ */
+void Transaction::abort(DbTxn *txn) {
+    HeapFile::discard_all();
+    txn->abort();
+    HeapFile::aborted(txn, transaction);
+    HeapFile::flush_all();
+}
+
+/**
+ * Commit a statement's transaction: into the transaction started by BEGIN, if there is one, or on its
+ * own, releasing its locks (without waiting for the log).
+ * @param txn  the statement's transaction
+ */
+void Transaction::end_statement(DbTxn *txn) {
+    try {
+        txn->commit(in_progress() ? 0 : DB_TXN_NOSYNC);
+    } catch (...) {
+        HeapFile::aborted(txn, transaction);  // Berkeley DB aborts a transaction it can't commit
+        throw;
+    }
+    HeapFile::committed(txn, transaction);
+    if (!in_progress())
+        release_locks();
+}
+
+/**
+ * Release the locks of the transaction that just ended.
+ */
+void Transaction::release_locks() {
+    uint64_t ended = owner;
+    owner = 0;
+    if (ended != 0)
+        running--;
+    LockManager::release_all(ended);
+}
+
+/**
+ * Wait for our commit to be synced, letting other sessions run meanwhile (so they can join the sync).
+ */
+void Transaction::wait_for_log() {
+    if (before_wait != nullptr)
+        before_wait();
+    try {
+        sync_log();
+    } catch (...) {
+        if (after_wait != nullptr)
+            after_wait();
+        throw;
+    }
+    if (after_wait != nullptr)
+        after_wait();
+}
+
+/**
+ * Wait until the log is on the disk, syncing it if nobody else is already doing so.
+ * A committer who finds a sync under way waits for it and then for the next one (which will cover its
+ * commit), so any number of commits that arrive together share one sync.
+ */
+void Transaction::sync_log() {
+    unique_lock<mutex> lock(sync_mutex);
+    uint64_t ticket = ++sync_requested;
+    while (sync_completed < ticket) {
+        if (syncing) {
+            sync_done.wait(lock);
+            continue;
+        }
+        syncing = true;
+        lock.unlock();
+        if (commit_delay > 0)
+            this_thread::sleep_for(chrono::microseconds(commit_delay));  // let others line up
+        lock.lock();
+        uint64_t covered = sync_requested;  // everybody who has committed by now
+        lock.unlock();
+        try {
+            _DB_ENV->log_flush(nullptr);
+        } catch (...) {
+            lock.lock();
+            syncing = false;
+            sync_done.notify_all();
+            throw;
+        }
+        lock.lock();
+        sync_completed = covered;
+        syncing = false;
+        sync_done.notify_all();
+    }
+}
+
+/**
+ * Body of the cleaner thread: every CLEAN_INTERVAL_MS, write out dirty pages until trickle_percent
+ * of the cache is clean. Clean pages can be reused right away, for new versions as much as anything.
+ */
+void Transaction::clean() {
+    unique_lock<mutex> lock(cleaner_mutex);
+    while (!cleaner_stopping) {
+        cleaner_wake.wait_for(lock, chrono::milliseconds(CLEAN_INTERVAL_MS));
+        uint32_t percent = trickle_percent;
+        if (cleaner_stopping || percent == 0)
+            continue;
+        lock.unlock();
+        try {
+            int written = 0;
+            _DB_ENV->memp_trickle((int) percent, &written);
+        } catch (DbException &e) {
+            // nothing to do about it here; the next statement to need the cache will find out
+        }
+        lock.lock();
+    }
+}
+
+// the values of column "a" in the rows of the table, in order
+static vector<int32_t> test_column_a(HeapTable &table) {
+    vector<int32_t> values;
+    Handles *handles = table.select();
+    for (Handle &handle: *handles) {
+        ValueDict *row = table.project(handle);
+        values.push_back(row->at("a").n);
+        delete row;
+    }
+    delete handles;
+    return values;
+}
+
+// insert a row in a statement of its own, and commit the statement or roll it back
+static void test_statement(HeapTable &table, int32_t a, bool commit) {
+    Transaction::begin_statement(true);
+    ValueDict row;
+    row["a"] = Value(a);
+    table.insert(&row);
+    HeapFile::flush_all();  // so that a rollback has to take it back from Berkeley DB
+    if (commit)
+        Transaction::commit_statement();
+    else
+        Transaction::rollback_statement();
+}
+
+/**
+ * Test statements on their own and inside BEGIN ... COMMIT and BEGIN ... ROLLBACK, including a
+ * statement that fails (is rolled back) in the middle of a transaction that then commits.
+ * @return true if the tests all succeeded
+ */
+bool test_transactions() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("_test_transactions_cpp", column_names, column_attributes);
+    table.create();
+
+    bool ok = true;
+    try {
+        test_statement(table, 1, true);
+        test_statement(table, 2, false);
+        if (test_column_a(table) != vector<int32_t>{1})
+            ok = assertion_failure("statement commit and rollback");
+
+        Transaction::begin_statement(false);
+        bool wrote = Transaction::statement_wrote();
+        Transaction::rollback_statement();
+        if (ok && wrote)
+            ok = assertion_failure("statement that wrote nothing");
+
+        Transaction::begin();
+        test_statement(table, 3, true);
+        if (ok && test_column_a(table) != vector<int32_t>{1, 3})
+            ok = assertion_failure("transaction sees its own statement");
+        Transaction::rollback();
+        if (ok && (Transaction::in_progress() || test_column_a(table) != vector<int32_t>{1}))
+            ok = assertion_failure("rollback");
+
+        Transaction::begin();
+        test_statement(table, 4, true);
+        test_statement(table, 5, false);
+        test_statement(table, 6, true);
+        Transaction::commit();
+        if (ok && (Transaction::in_progress() || test_column_a(table) != vector<int32_t>{1, 4, 6}))
+            ok = assertion_failure("commit with a statement rolled back");
+
+        bool threw = false;
+        try {
+            Transaction::commit();
+        } catch (DbRelationError &e) {
+            threw = true;
+        }
+        if (ok && !threw)
+            ok = assertion_failure("commit without a transaction");
+    } catch (...) {
+        if (Transaction::in_progress())
+            Transaction::rollback();
+        table.drop();
+        throw;
+    }
+    table.drop();
+    return ok;
+}
@@ -3,33 +3,65 @@
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Winter Quarter 2024"
  */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <random>
+#include <thread>
 #include "btree.h"
+#include "Transaction.h"
 
-BTreeIndex::BTreeIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique) : DbIndex(relation,
-                                                                                                              name,
-                                                                                                              key_columns,
-                                                                                                              unique),
-                                                                                                      closed(true),
-                                                                                                      stat(nullptr),
-                                                                                                      root(nullptr),
-                                                                                                      file(relation.get_table_name() +
-                                                                                                           "-" + name),
-                                                                                                      key_profile() {
+/****************
+ * VersionLatch *
+ ****************/
+
+// Wait until the latch isn't locked and return its version.
+uint64_t VersionLatch::read_lock() const {
+    uint64_t version = this->version.load();
+    while (version & 1) {
+        std::this_thread::yield();
+        version = this->version.load();
+    }
+    return version;
+}
+
+// Lock the latch if it is still at the given (unlocked) version. Never waits.
+bool VersionLatch::try_upgrade(uint64_t version) {
+    return this->version.compare_exchange_strong(version, version + 1);
+}
+
+// Unlock the latch, moving it on to the next version.
+void VersionLatch::unlock() {
+    this->version.fetch_add(1);
+}
+
+
+/**************
+ * BTreeIndex *
+ **************/
+
+BTreeIndex::BTreeIndex(DbRelation &relation, Identifier name, ColumnNames key_columns, bool unique,
+                       uint32_t block_size) : DbIndex(relation, name, key_columns, unique),
+                                              closed(true),
+                                              open_mutex(),
+                                              file(relation.get_table_name() + "-" + name, block_size),
+                                              key_profile(),
+                                              root_latch(),
+                                              latches(new VersionLatch[LATCHES]) {
     if (!unique)
         throw DbRelationError("BTree index must have unique key");
     build_key_profile();
 }
 
 BTreeIndex::~BTreeIndex() {
-    delete stat;
-    delete root;
 }
 
 // Create the index.
 void BTreeIndex::create() {
     file.create();
-    stat = new BTreeStat(file, STAT, STAT + 1, key_profile);
-    root = new BTreeLeaf(file, stat->get_root_id(), key_profile, true);
+    BTreeStat stat(file, STAT, STAT + 1, key_profile);
+    BTreeLeaf root(file, stat.get_root_id(), key_profile, true);
     closed = false;
     Handles *table_rows = relation.select();
     for (auto const &row: *table_rows)
@@ -44,25 +76,20 @@ void BTreeIndex::drop() {
 
 // Open existing index. Enables: lookup, range, insert, delete, update.
 void BTreeIndex::open() {
+    if (!closed)
+        return;
+    std::lock_guard<std::mutex> lock(open_mutex);
     if (closed) {
         file.open();
-        stat = new BTreeStat(file, STAT, key_profile);
-        if (stat->get_height() == 1)
-            root = new BTreeLeaf(file, stat->get_root_id(), key_profile, false);
-        else
-            root = new BTreeInterior(file, stat->get_root_id(), key_profile, false);
-        closed = true;
+        closed = false;
     }
 }
 
 // Closes the index. Disables: lookup, range, insert, delete, update.
 void BTreeIndex::close() {
+    std::lock_guard<std::mutex> lock(open_mutex);
     if (!closed) {
         file.close();
-        delete stat;
-        stat = nullptr;
-        delete root;
-        root = nullptr;
         closed = true;
     }
 }
@@ -71,27 +98,89 @@ void BTreeIndex::close() {
 // names in the index. Returns a list of row handles.
 Handles *BTreeIndex::lookup(ValueDict *key_dict) const {
     KeyValue *key = tkey(key_dict);
-    Handles *handles = _lookup(root, stat->get_height(), key);
+    Handles *handles = nullptr;
+    Path path;
+    uint64_t root_version;
+    try {
+        if (!Transaction::reads_snapshot())
+            lock_key(key, LockManager::S);  // nobody may add or remove this key until we're done
+        while (handles == nullptr) {
+            if (descend(key, path, root_version)) {
+                auto *leaf = dynamic_cast<BTreeLeaf *>(path.back().node);
+                try {
+                    handles = new Handles{leaf->find_eq(key)};
+                } catch (std::out_of_range &e) {
+                    handles = new Handles();
+                }
+            }
+            release(path);  // and start over if somebody changed a node on our way down
+        }
+    } catch (...) {
+        release(path);
+        delete key;
+        throw;
+    }
     delete key;
     return handles;
 }
 
-Handles *BTreeIndex::_lookup(BTreeNode *node, uint height, const KeyValue *key) const {
-    // Base case: node is a leaf
-    if (height == 1) {
-        BTreeLeaf *leaf = dynamic_cast<BTreeLeaf *>(node);
-        try {
-            return new Handles{leaf->find_eq(key)};
-        } catch (std::out_of_range &e) {
-            return new Handles();
-        }
+// Go down the tree to the leaf where key must be, noting each node and its latch version in path.
+// Returns false (with what we have read so far in path) if somebody changed a node on the way, in which
+// case the caller has to start over.
+bool BTreeIndex::descend(const KeyValue *key, Path &path, uint64_t &root_version) const {
+    root_version = this->root_latch.read_lock();
+    BTreeStat stat(this->file, STAT, this->key_profile);  // as this transaction sees it
+    BlockID block_id = stat.get_root_id();
+    uint height = stat.get_height();
+    uint64_t version = latch(block_id).read_lock();
+    if (!this->root_latch.validate(root_version))
+        return false;
+    for (;;) {
+        BTreeNode *node;
+        if (height == 1)
+            node = new BTreeLeaf(this->file, block_id, this->key_profile, false);
+        else
+            node = new BTreeInterior(this->file, block_id, this->key_profile, false);
+        path.push_back(PathStep{node, version});
+        if (!latch(block_id).validate(version))
+            return false;
+        if (height == 1)
+            return true;
+
+        // note the child's version before making sure the parent (and so the pointer to the child) is still good
+        BlockID child_id = dynamic_cast<BTreeInterior *>(node)->find_id(key);
+        uint64_t child_version = latch(child_id).read_lock();
+        if (!latch(block_id).validate(version))
+            return false;
+        block_id = child_id;
+        version = child_version;
+        height--;
     }
-    // Recursive case: node is an interior node
-    BTreeInterior *interior = dynamic_cast<BTreeInterior *>(node);
-    BTreeNode *next_node = interior->find(key, height);
-    Handles *result = _lookup(next_node, height - 1, key);
-    delete next_node;
-    return result;
+}
+
+// Free the nodes read on the way down.
+void BTreeIndex::release(Path &path) {
+    for (auto &step: path)
+        delete step.node;
+    path.clear();
+}
+
+// Lock a latch, as long as it is still at the version we read. A latch we hold already (for another block)
+// is fine if we locked it at that same version.
+bool BTreeIndex::lock(VersionLatch &latch, uint64_t version, std::vector<VersionLatch *> &held) {
+    if (std::find(held.begin(), held.end(), &latch) != held.end())
+        return latch.validate(version + 1);
+    if (!latch.try_upgrade(version))
+        return false;
+    held.push_back(&latch);
+    return true;
+}
+
+// Unlock the latches we hold.
+void BTreeIndex::unlock(std::vector<VersionLatch *> &held) {
+    for (auto latch: held)
+        latch->unlock();
+    held.clear();
 }
 
 Handles *BTreeIndex::range(ValueDict *min_key, ValueDict *max_key) const {
@@ -104,40 +193,135 @@ void BTreeIndex::insert(Handle handle) {
     open();
     ValueDict *key = relation.project(handle);
     KeyValue *tkey = this->tkey(key);
-    Insertion insertion = _insert(root, stat->get_height(), tkey, handle);
-    if (!BTreeNode::insertion_is_none(insertion)) {
-        auto *new_root = new BTreeInterior(file, 0, key_profile, true);
-        new_root->set_first(root->get_id());
-        new_root->insert(&insertion.second, insertion.first);
-        new_root->save();
-        stat->set_root_id(new_root->get_id());
-        stat->set_height(stat->get_height() + 1);
-        stat->save();
-        delete root;
-        root = new_root;
-        std::cout << "new root: " << *new_root << std::endl;
-    }
     delete key;
+    try {
+        lock_key(tkey, LockManager::X);
+        insert_key(tkey, handle);
+    } catch (...) {
+        delete tkey;
+        throw;
+    }
     delete tkey;
 }
 
-// Recursive insert. If a split happens at this level, return the (new node, boundary) of the split.
-Insertion BTreeIndex::_insert(BTreeNode *node, uint height, const KeyValue *key, Handle handle) {
-    if (height == 1) {
-        auto *leaf = dynamic_cast<BTreeLeaf *>(node);
-        return leaf->insert(key, handle);
-    } else {
-        auto *interior = dynamic_cast<BTreeInterior *>(node);
-        Insertion insertion = _insert(interior->find(key, height), height - 1, key, handle);
-        if (!BTreeNode::insertion_is_none(insertion))
+// Insert a key, starting over as often as other threads get in the way.
+void BTreeIndex::insert_key(const KeyValue *key, Handle handle) {
+    while (!try_insert(key, handle))
+        std::this_thread::yield();
+}
+
+// One try at an insert. Returns false if somebody else changed one of the nodes we need, so we have to start over.
+bool BTreeIndex::try_insert(const KeyValue *key, Handle handle) {
+    Path path;
+    uint64_t root_version;
+    std::vector<VersionLatch *> held;
+    try {
+        if (!descend(key, path, root_version)) {
+            release(path);
+            return false;
+        }
+
+        // find the highest node that may change: each one up from the leaf does if the one below it splits,
+        // and what a split sends up is at most the biggest key in the nodes below
+        size_t top = path.size() - 1;
+        auto *leaf = dynamic_cast<BTreeLeaf *>(path[top].node);
+        bool room = leaf->has_room(key);
+        uint32_t boundary_size = std::max(leaf->key_size(key), leaf->largest_key());
+        while (!room && top > 0) {
+            top--;
+            auto *interior = dynamic_cast<BTreeInterior *>(path[top].node);
+            room = interior->has_room(boundary_size);
+            boundary_size = std::max(boundary_size, interior->largest_key());
+        }
+
+        // lock them (and the root latch, if the root may split), as long as nobody has changed them since we read them
+        bool locked = room || lock(this->root_latch, root_version, held);
+        for (size_t i = top; locked && i < path.size(); i++)
+            locked = lock(latch(path[i].node->get_id()), path[i].version, held);
+        if (!locked) {
+            unlock(held);
+            release(path);
+            return false;
+        }
+
+        // insert into the leaf, then each split into the node above it
+        Insertion insertion = leaf->insert(key, handle);
+        for (size_t i = path.size() - 1; i > top && !BTreeNode::insertion_is_none(insertion); i--) {
+            auto *interior = dynamic_cast<BTreeInterior *>(path[i - 1].node);
             insertion = interior->insert(&insertion.second, insertion.first);
-        return insertion;
+        }
+        if (!BTreeNode::insertion_is_none(insertion)) {
+            // the root split, so it gets a new root above it
+            auto *new_root = new BTreeInterior(file, 0, key_profile, true);
+            new_root->set_first(path.front().node->get_id());
+            new_root->insert(&insertion.second, insertion.first);
+            new_root->save();
+            BTreeStat stat(file, STAT, key_profile);
+            stat.set_root_id(new_root->get_id());
+            stat.set_height(stat.get_height() + 1);
+            stat.save();
+            std::cout << "new root: " << *new_root << std::endl;
+            delete new_root;
+        }
+    } catch (...) {
+        unlock(held);
+        release(path);
+        throw;
     }
+    unlock(held);
+    release(path);
+    return true;
 }
 
+// Delete the entry for the row with the given handle. Row must still be in the relation.
+// Leaves are left sparse rather than merged (see BTreeLeaf::del), so a tree that loses most of its entries
+// keeps its height until the index is dropped and created again.
 void BTreeIndex::del(Handle handle) {
-    throw DbRelationError("Don't know how to delete from a BTree index yet");
-    // FIXME
+    open();
+    ValueDict *key = relation.project(handle, &key_columns);
+    KeyValue *tkey = this->tkey(key);
+    delete key;
+    try {
+        lock_key(tkey, LockManager::X);
+        while (!try_del(tkey, handle))
+            std::this_thread::yield();
+    } catch (...) {
+        delete tkey;
+        throw;
+    }
+    delete tkey;
+}
+
+// One try at a delete, which only has to lock the leaf. Returns false if we have to start over.
+bool BTreeIndex::try_del(const KeyValue *key, Handle handle) {
+    Path path;
+    uint64_t root_version;
+    std::vector<VersionLatch *> held;
+    bool done;
+    try {
+        done = descend(key, path, root_version) && lock(latch(path.back().node->get_id()), path.back().version, held);
+        if (done)
+            dynamic_cast<BTreeLeaf *>(path.back().node)->del(key, handle);
+    } catch (...) {
+        unlock(held);
+        release(path);
+        throw;
+    }
+    unlock(held);
+    release(path);
+    return done;
+}
+
+// Lock a key's entries for the rest of the transaction (see LockManager). Keys are locked by a hash of
+// their values, not by the leaf they are in, so splits and merges never have to move anyone's locks.
+void BTreeIndex::lock_key(const KeyValue *key, LockManager::Mode mode) const {
+    uint64_t hash = 14695981039346656037ULL;  // FNV-1a over the hashes of the key's values
+    for (const Value &value: *key) {
+        size_t h = value.data_type == ColumnAttribute::TEXT ? std::hash<std::string>()(value.s)
+                                                            : std::hash<int32_t>()(value.n);
+        hash = (hash ^ h) * 1099511628211ULL;
+    }
+    LockManager::lock_key(relation.get_table_name() + "-" + name, hash, mode);
 }
 
 KeyValue *BTreeIndex::tkey(const ValueDict *key) const {
@@ -304,3 +488,158 @@ bool test_btree() {
     table.drop();
     return true;
 }
+
+/**
+ * Zipfian choice of 0..n-1, with low numbers the most popular, as YCSB does it (from Gray et al.,
+ * "Quickly Generating Billion-Record Synthetic Databases"). YCSB then scatters the popular items
+ * across the key space by hashing them (see scramble below), so they don't all land in one leaf.
+ */
+class Zipfian {
+public:
+    explicit Zipfian(uint64_t n, double theta = 0.99) : n(n), theta(theta), alpha(1.0 / (1.0 - theta)),
+                                                       zetan(zeta(n, theta)), eta(0.0) {
+        this->eta = (1.0 - std::pow(2.0 / (double) n, 1.0 - theta)) / (1.0 - zeta(2, theta) / this->zetan);
+    }
+
+    uint64_t next(std::mt19937_64 &random) const {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(random);
+        double uz = u * this->zetan;
+        if (uz < 1.0)
+            return 0;
+        if (uz < 1.0 + std::pow(0.5, this->theta))
+            return 1;
+        uint64_t item = (uint64_t) ((double) this->n * std::pow(this->eta * u - this->eta + 1.0, this->alpha));
+        return std::min(item, this->n - 1);
+    }
+
+    // spread item i over 0..n-1 with the 64-bit FNV-1a hash
+    uint64_t scramble(uint64_t i) const {
+        uint64_t hash = 0xCBF29CE484222325ULL;
+        for (int byte = 0; byte < 8; byte++) {
+            hash ^= (i >> (byte * 8)) & 0xFF;
+            hash *= 0x100000001B3ULL;
+        }
+        return hash % this->n;
+    }
+
+private:
+    uint64_t n;
+    double theta, alpha, zetan, eta;
+
+    static double zeta(uint64_t n, double theta) {
+        double sum = 0.0;
+        for (uint64_t i = 1; i <= n; i++)
+            sum += 1.0 / std::pow((double) i, theta);
+        return sum;
+    }
+};
+
+/**
+ * YCSB-style benchmark of the B-tree index with 1, 2, 4, ... threads (up to the number of cores).
+ * Loads RECORDS rows and indexes them, then for each workload and number of threads, has every thread do
+ * OPERATIONS operations: lookups of existing keys chosen with a Zipfian distribution, or inserts of new
+ * keys (whose rows were added to the table beforehand). Prints each run's throughput and its speedup over
+ * one thread, then checks that every key inserted can be found.
+ * @return true if all the lookups and inserts gave the right answers
+ */
+bool benchmark_btree() {
+    const int RECORDS = 100 * 1000;
+    const int OPERATIONS = 10 * 1000;  // per thread, per run
+    struct Workload {
+        const char *name;
+        double inserts;  // fraction of operations that are inserts
+    };
+    const std::vector<Workload> workloads = {{"read only (YCSB C)",       0.0},
+                                             {"read mostly (YCSB B)",     0.05},
+                                             {"half inserts (YCSB A-ish)", 0.5}};
+    std::vector<uint> thread_counts;
+    uint cores = std::max(1U, std::min(16U, std::thread::hardware_concurrency()));
+    for (uint threads = 1; threads < cores; threads *= 2)
+        thread_counts.push_back(threads);
+    thread_counts.push_back(cores);
+
+    // load the table and index it
+    ColumnNames column_names = {"a", "b"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::INT)};
+    HeapTable table("__benchmark_btree", column_names, column_attributes);
+    table.create();
+    for (int i = 0; i < RECORDS; i++) {
+        ValueDict row = {{"a", Value(i)}, {"b", Value(-i)}};
+        table.insert(&row);
+    }
+    BTreeIndex index(table, "benchindex", ColumnNames{"a"}, true);
+    index.create();
+
+    // rows for the inserts to index (just added to the table, not the index)
+    size_t insert_count = 0;
+    for (auto const &workload: workloads)
+        for (uint threads: thread_counts)
+            insert_count += (size_t) std::ceil(threads * OPERATIONS * workload.inserts);
+    std::vector<Handle> new_rows;
+    for (size_t i = 0; i < insert_count; i++) {
+        ValueDict row = {{"a", Value((int32_t) (RECORDS + i))}, {"b", Value((int32_t) -(RECORDS + i))}};
+        new_rows.push_back(table.insert(&row));
+    }
+
+    Zipfian zipfian(RECORDS);
+    std::atomic<size_t> next_row(0);
+    std::atomic<uint64_t> wrong(0);
+    std::cout << "workload                   threads       ops/sec   speedup" << std::endl;
+    for (auto const &workload: workloads) {
+        double one_thread = 0.0;
+        for (uint threads: thread_counts) {
+            std::atomic<bool> go(false);
+            std::vector<std::thread> workers;
+            for (uint t = 0; t < threads; t++) {
+                workers.emplace_back([&, t]() {
+                    std::mt19937_64 random(t * 7919 + threads);
+                    std::uniform_real_distribution<double> coin(0.0, 1.0);
+                    while (!go)
+                        std::this_thread::yield();
+                    for (int op = 0; op < OPERATIONS; op++) {
+                        size_t row = insert_count;
+                        if (coin(random) < workload.inserts)
+                            row = next_row++;
+                        if (row < insert_count) {
+                            KeyValue key = {Value((int32_t) (RECORDS + row))};
+                            index.insert_key(&key, new_rows[row]);
+                        } else {
+                            int32_t a = (int32_t) zipfian.scramble(zipfian.next(random));
+                            ValueDict lookup = {{"a", Value(a)}};
+                            Handles *handles = index.lookup(&lookup);
+                            if (handles->size() != 1)
+                                wrong++;
+                            delete handles;
+                        }
+                    }
+                });
+            }
+            auto start = std::chrono::steady_clock::now();
+            go = true;
+            for (auto &worker: workers)
+                worker.join();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            double throughput = threads * OPERATIONS / elapsed.count();
+            if (threads == 1)
+                one_thread = throughput;
+            std::cout << std::left << std::setw(27) << workload.name << std::right << std::setw(7) << threads
+                      << std::setw(14) << (uint64_t) throughput << std::setw(9) << std::fixed << std::setprecision(2)
+                      << throughput / one_thread << "x" << std::defaultfloat << std::endl;
+        }
+    }
+
+    // every key inserted has to be there, pointing at its row
+    size_t inserted = std::min((size_t) next_row, insert_count);
+    for (size_t row = 0; row < inserted; row++) {
+        ValueDict lookup = {{"a", Value((int32_t) (RECORDS + row))}};
+        Handles *handles = index.lookup(&lookup);
+        if (handles->size() != 1 || handles->front() != new_rows[row])
+            wrong++;
+        delete handles;
+    }
+    if (wrong != 0)
+        std::cout << wrong << " lookups or inserts went wrong" << std::endl;
+    index.drop();
+    table.drop();
+    return wrong == 0;
+}
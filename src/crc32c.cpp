@@ -0,0 +1,76 @@
+/**
+ * @file crc32c.cpp - CRC-32C checksums
+ * @see Seattle University, CPSC5300
+ */
+#include "crc32c.h"
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_SSE42_CRC
+#include <nmmintrin.h>
+#endif
+
+static const uint32_t POLY = 0x82F63B78U;  // Castagnoli polynomial, bit-reversed
+
+/**
+ * Lookup table for the portable version, built once on first use.
+ */
+struct Crc32cTable {
+    uint32_t entries[256];
+
+    Crc32cTable() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t entry = i;
+            for (int bit = 0; bit < 8; bit++)
+                entry = entry & 1 ? (entry >> 1) ^ POLY : entry >> 1;
+            entries[i] = entry;
+        }
+    }
+};
+
+/**
+ * Portable version: one table lookup per byte.
+ */
+static uint32_t crc32c_table(const unsigned char *p, size_t n, uint32_t crc) {
+    static const Crc32cTable table;
+    while (n--)
+        crc = table.entries[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+#ifdef HAVE_SSE42_CRC
+/**
+ * SSE4.2 version: eight bytes per instruction.
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(const unsigned char *p, size_t n, uint32_t crc) {
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    for (; n >= 8; n -= 8, p += 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t) crc64;
+#endif
+    for (; n >= 4; n -= 4, p += 4) {
+        uint32_t word;
+        memcpy(&word, p, sizeof(word));
+        crc = _mm_crc32_u32(crc, word);
+    }
+    while (n--)
+        crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+#endif
+
+uint32_t crc32c(const void *data, size_t n, uint32_t crc) {
+    const unsigned char *p = (const unsigned char *) data;
+    crc = ~crc;
+#ifdef HAVE_SSE42_CRC
+    static const bool has_sse42 = __builtin_cpu_supports("sse4.2");
+    if (has_sse42)
+        return ~crc32c_sse42(p, n, crc);
+#endif
+    return ~crc32c_table(p, n, crc);
+}
@@ -5,6 +5,7 @@
  */
 #include "schema_tables.h"
 #include "ParseTreeToString.h"
+#include "PerfCounters.h"
 #include "btree.h"
 
 
@@ -49,13 +50,16 @@ bool is_acceptable_data_type(std::string dt) {
  */
 const Identifier Tables::TABLE_NAME = "_tables";
 Columns *Tables::columns_table = nullptr;
-std::map<Identifier, DbRelation *> Tables::table_cache;
+CatalogCache<Identifier, DbRelation> Tables::table_cache;
 
 // get the column name for _tables column
 ColumnNames &Tables::COLUMN_NAMES() {
     static ColumnNames cn;
-    if (cn.empty())
+    if (cn.empty()) {
         cn.push_back("table_name");
+        cn.push_back("block_size");
+        cn.push_back("storage");
+    }
     return cn;
 }
 
@@ -64,23 +68,29 @@ ColumnAttributes &Tables::COLUMN_ATTRIBUTES() {
     static ColumnAttributes cas;
     if (cas.empty()) {
         ColumnAttribute ca(ColumnAttribute::TEXT);
-        cas.push_back(ca);
+        cas.push_back(ca);  // table_name
+        ca.set_data_type(ColumnAttribute::INT);
+        cas.push_back(ca);  // block_size
+        ca.set_data_type(ColumnAttribute::TEXT);
+        cas.push_back(ca);  // storage
     }
     return cas;
 }
 
-// ctor - we have a fixed table structure of just one column: table_name
+// ctor - we have a fixed table structure: table_name, block_size, storage
 Tables::Tables() : HeapTable(TABLE_NAME, COLUMN_NAMES(), COLUMN_ATTRIBUTES()) {
-    Tables::table_cache[TABLE_NAME] = this;
+    Tables::table_cache.replace(TABLE_NAME, this);
     if (Tables::columns_table == nullptr)
         columns_table = new Columns();
-    Tables::table_cache[columns_table->TABLE_NAME] = columns_table;
+    Tables::table_cache.replace(columns_table->TABLE_NAME, columns_table);
 }
 
 // Create the file and also, manually add schema tables.
 void Tables::create() {
     HeapTable::create();
     ValueDict row;
+    row["block_size"] = Value((int32_t) DbBlock::BLOCK_SZ);
+    row["storage"] = Value("heap");
     row["table_name"] = Value("_tables");
     insert(&row);
     row["table_name"] = Value("_columns");
@@ -92,7 +102,9 @@ void Tables::create() {
 // Manually check that table_name is unique.
 Handle Tables::insert(const ValueDict *row) {
     // Try SELECT * FROM _tables WHERE table_name = row["table_name"] and it should return nothing
-    Handles *handles = select(row);
+    ValueDict where;
+    where["table_name"] = row->at("table_name");
+    Handles *handles = select(&where);
     bool unique = handles->empty();
     delete handles;
     if (!unique)
@@ -107,15 +119,18 @@ void Tables::del(Handle handle) {
     ValueDict *row = project(handle);
     Identifier table_name = row->at("table_name").s;
     delete row;
-    if (Tables::table_cache.find(table_name) != Tables::table_cache.end()) {
-        DbRelation *table = Tables::table_cache.at(table_name);
-        Tables::table_cache.erase(table_name);
-        delete table;
-    }
+    Tables::table_cache.erase(table_name);
 
     HeapTable::del(handle);
 }
 
+// Forget all the tables we've instantiated, except for _tables and _columns themselves.
+void Tables::clear_cache() {
+    Tables::table_cache.erase_if([](const Identifier &table_name) {
+        return table_name != TABLE_NAME && table_name != Columns::TABLE_NAME;
+    });
+}
+
 // Return a list of column names and column attributes for given table.
 void Tables::get_columns(Identifier table_name, ColumnNames &column_names, ColumnAttributes &column_attributes) {
     // SELECT * FROM _columns WHERE table_name = <table_name>
@@ -151,17 +166,33 @@ void Tables::get_columns(Identifier table_name, ColumnNames &column_names, Colum
 
 // Return a table for given table_name.
 DbRelation &Tables::get_table(Identifier table_name) {
+    PerfCounters::mine().catalog_lookups++;
     // if they are asking about a table we've once constructed, then just return that one
-    if (Tables::table_cache.find(table_name) != Tables::table_cache.end())
-        return *Tables::table_cache[table_name];
+    DbRelation *cached = Tables::table_cache.find(table_name);
+    if (cached != nullptr)
+        return *cached;
+
+    // look up the block size and storage it was created with
+    uint32_t block_size = DbBlock::BLOCK_SZ;
+    std::string storage = "heap";
+    DbRelation *tables = Tables::table_cache.find(TABLE_NAME);
+    ValueDict where;
+    where["table_name"] = Value(table_name);
+    Handles *handles = tables->select(&where);
+    if (!handles->empty()) {
+        ValueDict *row = tables->project(handles->front());
+        block_size = (uint32_t) row->at("block_size").n;
+        storage = row->at("storage").s;
+        delete row;
+    }
+    delete handles;
 
     // otherwise assume it is a HeapTable (for now)
     ColumnNames column_names;
     ColumnAttributes column_attributes;
     get_columns(table_name, column_names, column_attributes);
-    DbRelation *table = new HeapTable(table_name, column_names, column_attributes);
-    Tables::table_cache[table_name] = table;
-    return *table;
+    DbRelation *table = new HeapTable(table_name, column_names, column_attributes, block_size, storage);
+    return *Tables::table_cache.insert(table_name, table);  // another thread may have beaten us to it
 }
 
 
@@ -207,6 +238,12 @@ void Columns::create() {
     row["table_name"] = Value("_tables");
     row["column_name"] = Value("table_name");
     insert(&row);
+    row["column_name"] = Value("block_size");
+    row["data_type"] = Value("INT");
+    insert(&row);
+    row["column_name"] = Value("storage");
+    row["data_type"] = Value("TEXT");
+    insert(&row);
     row["table_name"] = Value("_columns");
     row["column_name"] = Value("table_name");
     insert(&row);
@@ -230,6 +267,9 @@ void Columns::create() {
     row["column_name"] = Value("is_unique");
     row["data_type"] = Value("BOOLEAN");
     insert(&row);
+    row["column_name"] = Value("block_size");
+    row["data_type"] = Value("INT");
+    insert(&row);
 }
 
 // Manually check that (table_name, column_name) is unique.
@@ -263,7 +303,7 @@ Handle Columns::insert(const ValueDict *row) {
  * ****************************
  */
 const Identifier Indices::TABLE_NAME = "_indices";
-std::map<std::pair<Identifier, Identifier>, DbIndex *> Indices::index_cache;
+CatalogCache<std::pair<Identifier, Identifier>, DbIndex> Indices::index_cache;
 
 // get the column name for _indices column
 ColumnNames &Indices::COLUMN_NAMES() {
@@ -275,6 +315,7 @@ ColumnNames &Indices::COLUMN_NAMES() {
         cn.push_back("column_name");
         cn.push_back("index_type");
         cn.push_back("is_unique");
+        cn.push_back("block_size");
     }
     return cn;
 }
@@ -293,6 +334,8 @@ ColumnAttributes &Indices::COLUMN_ATTRIBUTES() {
         cas.push_back(ca);  // index_type
         ca.set_data_type(ColumnAttribute::BOOLEAN);
         cas.push_back(ca);  // is_unique
+        ca.set_data_type(ColumnAttribute::INT);
+        cas.push_back(ca);  // block_size
     }
     return cas;
 }
@@ -330,18 +373,18 @@ void Indices::del(Handle handle) {
     ValueDict *row = project(handle);
     Identifier table_name = row->at("table_name").s;
     Identifier index_name = row->at("index_name").s;
-    std::pair<Identifier, Identifier> cache_key(table_name, index_name);
-    if (Indices::index_cache.find(cache_key) != Indices::index_cache.end()) {
-        DbIndex *index = Indices::index_cache.at(cache_key);
-        Indices::index_cache.erase(cache_key);
-        delete index;
-    }
+    Indices::index_cache.erase(std::pair<Identifier, Identifier>(table_name, index_name));
     HeapTable::del(handle);
 }
 
+// Forget all the indices we've instantiated.
+void Indices::clear_cache() {
+    Indices::index_cache.erase_if([](const std::pair<Identifier, Identifier> &) { return true; });
+}
+
 // Return a list of column names and column attributes for given table.
 void Indices::get_columns(Identifier table_name, Identifier index_name, ColumnNames &column_names, bool &is_hash,
-                          bool &is_unique) {
+                          bool &is_unique, uint32_t &block_size) {
     // SELECT * FROM _indices WHERE table_name = <table_name> AND index_name = <index_name>
     ValueDict where;
     where["table_name"] = table_name;
@@ -360,6 +403,7 @@ void Indices::get_columns(Identifier table_name, Identifier index_name, ColumnNa
             size = which;
         is_unique = (*row)["is_unique"].n != 0;
         is_hash = (*row)["index_type"].s == "HASH";
+        block_size = (uint32_t) (*row)["block_size"].n;
         delete row;
     }
     for (uint i = 0; i < size; i++)
@@ -390,24 +434,26 @@ public:
 
 // Return a table for given table_name.
 DbIndex &Indices::get_index(Identifier table_name, Identifier index_name) {
+    PerfCounters::mine().catalog_lookups++;
     // if they are asking about an index we've once constructed, then just return that one
     std::pair<Identifier, Identifier> cache_key(table_name, index_name);
-    if (Indices::index_cache.find(cache_key) != Indices::index_cache.end())
-        return *Indices::index_cache[cache_key];
+    DbIndex *cached = Indices::index_cache.find(cache_key);
+    if (cached != nullptr)
+        return *cached;
 
     // otherwise assume it is a DummyIndex (for now)
     ColumnNames column_names;
     bool is_hash, is_unique;
-    get_columns(table_name, index_name, column_names, is_hash, is_unique);
+    uint32_t block_size = DbBlock::BLOCK_SZ;
+    get_columns(table_name, index_name, column_names, is_hash, is_unique, block_size);
     DbRelation &table = Tables::get_table(table_name);
     DbIndex *index;
     if (is_hash) {
         index = new DummyIndex(table, index_name, column_names, is_unique);  // FIXME - change to HashIndex
     } else {
-        index = new BTreeIndex(table, index_name, column_names, is_unique);
+        index = new BTreeIndex(table, index_name, column_names, is_unique, block_size);
     }
-    Indices::index_cache[cache_key] = index;
-    return *index;
+    return *Indices::index_cache.insert(cache_key, index);  // another thread may have beaten us to it
 }
 
 IndexNames Indices::get_index_names(Identifier table_name) {
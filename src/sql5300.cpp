@@ -6,15 +6,30 @@
     Initializes Berkeley DB environment, takes user input for SQL statements, 
     parses and prints the statements using the SQLprinting class. Allows the user 
     to interactively input SQL statements until the user enters "quit". Allows to test 
-    functionality of heap storage if user enters "test".
+    functionality of heap storage if user enters "test". With --server, serves any number of
+    clients over a Unix domain socket or loopback TCP instead (see Server). With --batch, runs
+    SQL script files and times their statements instead (see Batch).
 */
+#include <algorithm>
+#include <csignal>
 #include <cstdlib>
 #include <iostream>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <vector>
 #include "db_cxx.h"
 #include "SQLParser.h"
-#include "ParseTreeToString.h"
 #include "SQLExec.h"
+#include "Batch.h"
+#include "LockManager.h"
+#include "Rcu.h"
+#include "ResultCache.h"
+#include "RowSink.h"
+#include "Server.h"
+#include "Session.h"
+#include "StatementStats.h"
+#include "Transaction.h"
 #include "btree.h"
 
 using namespace std;
@@ -24,16 +39,48 @@ using namespace hsql;
  * we allocate and initialize the _DB_ENV global
  */
 DbEnv *_DB_ENV;
+thread_local DbTxn *_DB_TXN = nullptr;
+
+// stop the server on SIGINT and SIGTERM
+static void stop_server(int signum) {
+    Server::stop();
+}
 
 /**
  * Main entry point of the sql5300 program
  * @args dbenvpath  the path to the BerkeleyDB database environment
+ * @args --server <socket path or port> [--workers <n>] [--set <option>=<value>]...  serve clients instead of
+ *       reading from stdin, with the options that apply to every client (see SQLExec::set)
+ * @args --batch <script>...  run SQL scripts (each on a thread of its own) and time their statements
  */
 int main(int argc, char *argv[]) {
 
     // Open/create the db enviroment
-    if (argc != 2) {
-        cerr << "Usage: cpsc5300: dbenvpath" << endl; // /home/st/llomidze/cpsc5300/data
+    string server_address;
+    uint32_t workers = max(thread::hardware_concurrency(), 2U);
+    vector<string> scripts;
+    vector<pair<string, string>> options;
+    bool batch = argc > 2 && string(argv[2]) == "--batch";
+    if (batch)
+        scripts.assign(argv + 3, argv + argc);
+    bool usage_ok = batch ? !scripts.empty() : argc % 2 == 0;
+    for (int i = 2; usage_ok && !batch && i + 1 < argc; i += 2) {
+        string flag = argv[i];
+        if (flag == "--server")
+            server_address = argv[i + 1];
+        else if (flag == "--workers" && atoi(argv[i + 1]) > 0)
+            workers = (uint32_t) atoi(argv[i + 1]);
+        else if (flag == "--set" && string(argv[i + 1]).find('=') != string::npos) {
+            string option = argv[i + 1];
+            options.emplace_back(option.substr(0, option.find('=')), option.substr(option.find('=') + 1));
+        }
+        else
+            usage_ok = false;
+    }
+    if (!usage_ok || (argc > 2 && !batch && server_address.empty())) {
+        cerr << "Usage: cpsc5300: dbenvpath [--server <socket path or port> [--workers <n>] [--set <option>=<value>]..."
+                " | --batch <script>...]"
+             << endl; // /home/st/llomidze/cpsc5300/data
         return 1;
     }
 
@@ -44,57 +91,98 @@ int main(int argc, char *argv[]) {
     env.set_error_stream(&cerr);
 
     try {
-        env.open(envHome, DB_CREATE | DB_INIT_MPOOL, 0);
+        env.set_flags(DB_AUTO_COMMIT, 1);  // anything done outside of a transaction gets one of its own
+        env.set_lk_detect(DB_LOCK_DEFAULT);
+        env.set_cachesize(0, 64 * 1024 * 1024, 1);  // room for the old versions snapshots still need
+        env.log_set_config(DB_LOG_AUTO_REMOVE, 1);  // don't keep log files once they're checkpointed
+        env.open(envHome, DB_CREATE | DB_INIT_MPOOL | DB_INIT_TXN | DB_INIT_LOG | DB_INIT_LOCK | DB_RECOVER |
+                          DB_THREAD, 0);  // the cleaner thread shares the environment
     } catch (DbException &exc) {
         cerr << "(sql5300: " << exc.what() << ")";
         exit(1);
     }
 
     _DB_ENV = &env;
+    Transaction::start_cleaner();
 
     initialize_schema_tables();
-    
-    while (true) 
-    {
-        cout << "SQL> ";
-        string query;
-        getline(cin, query);
-
-        if (query.length() == 0)
-            continue;  // blank line -- just skip
-
-        if (query == "quit")
-            break;  // only way to get out
-
-        if (query == "test") {
-            cout << "test_heap_storage: " << (test_heap_storage() ? "ok" : "failed") << endl;
-            cout << "test_btree: " << (test_btree() ? "ok" : "failed") << endl;
-            continue;
-        }
 
-        // use the Hyrise sql parser to get us our AST
-        SQLParserResult *parse = SQLParser::parseSQLString(query);
-        if (!parse->isValid()) {
-            cout << "invalid SQL: " << query << endl;
-            cout << parse->errorMsg() << endl;
-            delete parse;
-            continue;
-        }
-        // execute the statement
-        for (uint i = 0; i < parse->size(); ++i) {
-            const SQLStatement *statement = parse->getStatement(i);
-            try {
-                cout << ParseTreeToString::statement(statement) << endl;
-                QueryResult *result = SQLExec::execute(statement);
-                cout << *result << endl;
+    int status = EXIT_SUCCESS;
+    if (batch) {
+        Batch runner(scripts, cout);
+        if (!runner.run())
+            status = EXIT_FAILURE;
+    } else if (!server_address.empty()) {
+        try {
+            for (auto const &option: options) {
+                QueryResult *result = SQLExec::set(option.first, option.second);
+                cout << "(sql5300: " << result->get_message() << ")" << endl;
                 delete result;
-            } catch (SQLExecError &e) {
-                cout << "Error: " << e.what() << endl;
             }
+            Server server(server_address, workers);
+            signal(SIGPIPE, SIG_IGN);
+            signal(SIGINT, stop_server);
+            signal(SIGTERM, stop_server);
+            cout << "(sql5300: serving " << server_address << " with " << workers << " workers)" << endl;
+            server.run();
+        } catch (runtime_error &e) {
+            cerr << "(sql5300: " << e.what() << ")" << endl;
         }
-        delete parse;
+    } else {
+        Session session;
+        while (true) {
+            cout << "SQL> ";
+            string query;
+            if (!getline(cin, query))
+                break;
 
+            if (query.length() == 0)
+                continue;  // blank line -- just skip
+
+            if (query == "quit")
+                break;  // only way to get out
+
+            if (query == "test") {
+                cout << "test_heap_storage: " << (test_heap_storage() ? "ok" : "failed") << endl;
+                cout << "test_btree: " << (test_btree() ? "ok" : "failed") << endl;
+                cout << "test_transactions: " << (test_transactions() ? "ok" : "failed") << endl;
+                cout << "test_rcu: " << (test_rcu() ? "ok" : "failed") << endl;
+                cout << "test_lock_manager: " << (test_lock_manager() ? "ok" : "failed") << endl;
+                cout << "test_plan_cache: " << (test_plan_cache() ? "ok" : "failed") << endl;
+                cout << "test_result_cache: " << (test_result_cache() ? "ok" : "failed") << endl;
+                cout << "test_latency_histogram: " << (test_latency_histogram() ? "ok" : "failed") << endl;
+                continue;
+            }
+
+            if (query == "benchmark" || query == "benchmark btree") {
+                cout << "benchmark_btree: " << (benchmark_btree() ? "ok" : "failed") << endl;
+                if (query == "benchmark btree")
+                    continue;
+            }
+
+            if (query == "benchmark" || query == "benchmark storage") {
+                cout << "benchmark_storage: " << (benchmark_storage() ? "ok" : "failed") << endl;
+                if (query == "benchmark storage")
+                    continue;
+            }
+
+            if (query == "benchmark" || query == "benchmark output") {
+                cout << "benchmark_output: " << (benchmark_output() ? "ok" : "failed") << endl;
+                continue;
+            }
+
+            session.execute(query, cout);
+        }
+
+        // an unfinished transaction is rolled back, as if we had crashed
+        session.close(cout);
+    }
+    Transaction::stop_cleaner();
+    try {
+        env.txn_checkpoint(0, 0, 0);
+    } catch (DbException &exc) {
+        cerr << "(sql5300: " << exc.what() << ")" << endl;
     }
 
-    return EXIT_SUCCESS;
+    return status;
 }
@@ -71,6 +71,27 @@ ValueDict *DbRelation::project(Handle handle, const ValueDict *where) {
     return this->project(handle, &t);
 }
 
+// Visit each of the handles of a selection (relations that can find them one at a time override this)
+void DbRelation::select(const ValueDict *where, const HandleVisitor &visit) {
+    Handles *handles = where == nullptr ? select() : select(where);
+    try {
+        for (auto const &handle: *handles)
+            visit(handle);
+    } catch (...) {
+        delete handles;
+        throw;
+    }
+    delete handles;
+}
+
+// Count the rows (relations that can tell without looking at every row override this)
+uint64_t DbRelation::estimate_rows() {
+    Handles *handles = select();
+    uint64_t ret = handles->size();
+    delete handles;
+    return ret;
+}
+
 // Do a projection for each of a list of handles
 ValueDicts *DbRelation::project(Handles *handles) {
     ValueDicts *ret = new ValueDicts();
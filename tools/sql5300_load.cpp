@@ -0,0 +1,285 @@
+/**
+ * @file sql5300_load.cpp - load generator for sql5300 --server
+ *
+ * Opens many connections to a running server and has each of them send statements as fast as the
+ * server answers them, then reports queries per second and latency percentiles.
+ *
+ *   sql5300_load <socket path or port> [-c connections] [-t threads] [-d seconds] [-r range]
+ *                [-s setup statement]... statement...
+ *
+ * Each connection first sends the setup statements (once, not timed), then the statements in turn,
+ * over and over, until the time is up. "$r" in a statement is replaced by a random number from 0 to
+ * range - 1 each time it is sent. Connections are divided among the threads, each of which drives its
+ * share with non-blocking sockets and epoll.
+ *
+ * @see "Seattle University, CPSC5300, Winter Quarter 2024"
+ */
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <random>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+typedef chrono::steady_clock Clock;
+
+/**
+ * What to run, and the totals from all the threads.
+ */
+struct Load {
+    string address;
+    vector<string> setup;
+    vector<string> statements;
+    uint32_t range = 1000;
+    Clock::time_point end;
+
+    mutex totals_mutex;
+    vector<uint32_t> latencies_us;  // one per timed statement
+    uint64_t errors = 0;
+    uint64_t lost = 0;              // connections that failed or were closed on us
+};
+
+/**
+ * One connection and where it is in its statements.
+ */
+struct Client {
+    int fd = -1;
+    size_t next = 0;     // next statement to send (the setup ones are first)
+    bool timed = false;  // is the statement in flight a timed one?
+    string input;        // response so far
+    Clock::time_point sent;
+};
+
+/**
+ * Connect to the server.
+ * @param address  path of its Unix domain socket, or its port on the loopback interface
+ * @return         the socket (non-blocking), or -1 if the connection failed
+ */
+static int connect_to(const string &address) {
+    bool is_port = !address.empty() && address.find_first_not_of("0123456789") == string::npos;
+    int fd;
+    int result;
+    if (is_port) {
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            return -1;
+        sockaddr_in inet{};
+        inet.sin_family = AF_INET;
+        inet.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        inet.sin_port = htons((uint16_t) stoul(address));
+        result = connect(fd, (sockaddr *) &inet, sizeof(inet));
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    } else {
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            return -1;
+        sockaddr_un local{};
+        local.sun_family = AF_UNIX;
+        strncpy(local.sun_path, address.c_str(), sizeof(local.sun_path) - 1);
+        result = connect(fd, (sockaddr *) &local, sizeof(local));
+    }
+    if (result != 0 || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Send the client's next statement. Statements are short, so the socket always takes them whole.
+ * @return  false if the connection is gone
+ */
+static bool send_next(Load &load, Client &client, mt19937 &random) {
+    string statement;
+    if (client.next < load.setup.size()) {
+        statement = load.setup[client.next];
+        client.timed = false;
+    } else {
+        statement = load.statements[(client.next - load.setup.size()) % load.statements.size()];
+        client.timed = true;
+    }
+    client.next++;
+    for (size_t at = statement.find("$r"); at != string::npos; at = statement.find("$r", at))
+        statement.replace(at, 2, to_string(random() % load.range));
+    statement += '\n';
+    client.sent = Clock::now();
+    ssize_t n = ::send(client.fd, statement.data(), statement.size(), MSG_NOSIGNAL);
+    return n == (ssize_t) statement.size();
+}
+
+/**
+ * Has the whole response arrived (it ends with a line that is just ".")?
+ */
+static bool complete(const string &input) {
+    size_t n = input.size();
+    return (n == 2 && input == ".\n") || (n > 2 && input.compare(n - 3, 3, "\n.\n") == 0);
+}
+
+/**
+ * Is the response an error message?
+ */
+static bool is_error(const string &input) {
+    return input.compare(0, 7, "Error: ") == 0 || input.compare(0, 12, "invalid SQL:") == 0 ||
+           input.find("\nError: ") != string::npos;
+}
+
+/**
+ * Drive some of the connections until the time is up, then add what they saw to the totals.
+ */
+static void drive(Load &load, uint32_t connections, uint32_t seed) {
+    mt19937 random(seed);
+    vector<uint32_t> latencies_us;
+    uint64_t errors = 0, lost = 0;
+    vector<Client> clients(connections);
+
+    int epoll = epoll_create1(EPOLL_CLOEXEC);
+    for (uint32_t i = 0; i < connections; i++) {
+        Client &client = clients[i];
+        client.fd = connect_to(load.address);
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u32 = i;
+        if (client.fd < 0 || epoll_ctl(epoll, EPOLL_CTL_ADD, client.fd, &event) != 0 ||
+            !send_next(load, client, random)) {
+            lost++;
+            if (client.fd >= 0)
+                close(client.fd);
+            client.fd = -1;
+        }
+    }
+
+    const int MAX_EVENTS = 256;
+    epoll_event events[MAX_EVENTS];
+    char buffer[64 * 1024];
+    uint32_t open = connections - (uint32_t) lost;
+    while (open > 0 && Clock::now() < load.end) {
+        int n = epoll_wait(epoll, events, MAX_EVENTS, 100);
+        if (n < 0 && errno != EINTR)
+            break;
+        for (int e = 0; e < n; e++) {
+            Client &client = clients[events[e].data.u32];
+            ssize_t got;
+            while ((got = recv(client.fd, buffer, sizeof(buffer), 0)) > 0)
+                client.input.append(buffer, (size_t) got);
+            bool gone = got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+            if (!gone && complete(client.input)) {
+                if (client.timed) {
+                    auto us = chrono::duration_cast<chrono::microseconds>(Clock::now() - client.sent).count();
+                    latencies_us.push_back((uint32_t) us);
+                    if (is_error(client.input))
+                        errors++;
+                }
+                client.input.clear();
+                gone = !send_next(load, client, random);
+            }
+            if (gone) {
+                lost++;
+                open--;
+                close(client.fd);
+                client.fd = -1;
+            }
+        }
+    }
+    for (Client &client : clients)
+        if (client.fd >= 0)
+            close(client.fd);
+    close(epoll);
+
+    lock_guard<mutex> guard(load.totals_mutex);
+    load.latencies_us.insert(load.latencies_us.end(), latencies_us.begin(), latencies_us.end());
+    load.errors += errors;
+    load.lost += lost;
+}
+
+/**
+ * The latency that the given fraction of requests came in under.
+ */
+static uint32_t percentile(const vector<uint32_t> &sorted, double fraction) {
+    if (sorted.empty())
+        return 0;
+    size_t i = (size_t) (fraction * (double) sorted.size());
+    return sorted[min(i, sorted.size() - 1)];
+}
+
+static int usage() {
+    cerr << "usage: sql5300_load <socket path or port> [-c connections] [-t threads] [-d seconds] [-r range]"
+         << " [-s setup statement]... statement..." << endl;
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    Load load;
+    uint32_t connections = 100, threads = 1, seconds = 10;
+    if (argc < 3)
+        return usage();
+    load.address = argv[1];
+    try {
+        for (int i = 2; i < argc; i++) {
+            string arg = argv[i];
+            if (arg.size() == 2 && arg[0] == '-' && i + 1 < argc) {
+                string value = argv[++i];
+                switch (arg[1]) {
+                    case 'c':
+                        connections = (uint32_t) stoul(value);
+                        break;
+                    case 't':
+                        threads = (uint32_t) stoul(value);
+                        break;
+                    case 'd':
+                        seconds = (uint32_t) stoul(value);
+                        break;
+                    case 'r':
+                        load.range = (uint32_t) stoul(value);
+                        break;
+                    case 's':
+                        load.setup.push_back(value);
+                        break;
+                    default:
+                        return usage();
+                }
+            } else {
+                load.statements.push_back(arg);
+            }
+        }
+    } catch (logic_error &) {
+        return usage();
+    }
+    if (load.statements.empty() || connections == 0 || load.range == 0)
+        return usage();
+    threads = max(1u, min(threads, connections));
+
+    auto start = Clock::now();
+    load.end = start + chrono::seconds(seconds);
+    vector<thread> drivers;
+    for (uint32_t t = 0; t < threads; t++)
+        drivers.emplace_back(drive, ref(load), connections / threads + (t < connections % threads ? 1 : 0), t + 1);
+    for (thread &driver : drivers)
+        driver.join();
+    double elapsed = chrono::duration<double>(Clock::now() - start).count();
+
+    vector<uint32_t> &sorted = load.latencies_us;
+    sort(sorted.begin(), sorted.end());
+    cout << connections << " connections, " << threads << " threads, " << fixed << setprecision(1) << elapsed
+         << " s" << endl;
+    cout << sorted.size() << " statements, " << load.errors << " errors, " << load.lost << " connections lost"
+         << endl;
+    cout << setprecision(0) << (double) sorted.size() / elapsed << " statements/s" << endl;
+    cout << "latency (us): p50 " << percentile(sorted, 0.50) << ", p90 " << percentile(sorted, 0.90)
+         << ", p99 " << percentile(sorted, 0.99) << ", p99.9 " << percentile(sorted, 0.999)
+         << ", max " << (sorted.empty() ? 0 : sorted.back()) << endl;
+    return 0;
+}